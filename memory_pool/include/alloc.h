@@ -1,37 +1,159 @@
 #pragma once
 
 #include "thread_cache.h"
+#include "cpu_cache.h"
+#include "central_cache.h"
 #include "page_cache.h"
+#include "scavenger.h"
+#include "malloc_stats.h"
+#include "heap_profiler.h"
+#include "hardened.h"
+#include "alloc_tracer.h"
 
-#include "hnc_log.h"
+#include "mp_log.h"
 
 #include <assert.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
 
 namespace hnc::core::mem_pool {
 
+namespace details {
+/**
+ * 获取当前线程的线程局部缓存， 第一次使用时初始化
+ * 没有申请过内存的线程也可能释放内存(由其他线程申请)， 因此申请和释放都要经过这里
+ * @return 创建tc时向OS申请内存失败返回nullptr， 下次调用时重试
+ */
+inline ThreadCache* get_thread_cache() {
+    if (tls_thread_cache_ptr_ == nullptr) [[unlikely]] {
+        // 初始化线程局部缓存, 使用定长内存池，线程退出时归还
+        tls_thread_cache_ptr_ = ThreadCache::create();
+    }
+    return tls_thread_cache_ptr_;
+}
+
+/**
+ * 小块内存的前端: 编译时定义 HNC_MALLOC_PER_CPU 并且 rseq 可用时使用per-cpu缓存， 否则使用线程局部缓存
+ * 两个前端的内存块都来自cc， 可以互相释放
+ * 前端和后端都不抛出异常， 向OS申请内存失败时返回nullptr， 由调用方在不持有任何锁时报告
+ */
+inline void* front_allocate(const size_t size) {
+#ifdef HNC_MALLOC_PER_CPU
+    if (const int cpu = CpuCache::current_cpu(); cpu >= 0) [[likely]] {
+        return CpuCache::GetInstance().allocate(cpu, size);
+    }
+#endif
+    ThreadCache* tc = get_thread_cache();
+    return tc != nullptr ? tc->allocate(size) : nullptr;
+}
+
+/**
+ * @param owner 内存块所在span的所属线程的远程释放队列编号， 不是本线程时送回所属线程， 0表示直接放入本线程的缓存，
+ *              ThreadCache::UNKNOWN_OWNER 表示还没有查找span
+ */
+inline void front_deallocate(void* obj, const size_t align_size, const uint16_t owner = 0) {
+#ifdef HNC_MALLOC_PER_CPU
+    if (const int cpu = CpuCache::current_cpu(); cpu >= 0) [[likely]] {
+        CpuCache::GetInstance().deallocate(cpu, obj, align_size, owner);
+        return;
+    }
+#endif
+    ThreadCache* tc = get_thread_cache();
+    if (tc == nullptr) [[unlikely]] {
+        ThreadCache::release_to_central(obj, align_size);
+        return;
+    }
+    if (tc->deallocate_remote(obj, align_size, owner)) {
+        return;
+    }
+    tc->deallocate(obj, align_size);
+}
+
+// @return 写入out的块数， 只有向OS申请内存失败时少于count
+inline size_t front_allocate_batch(const size_t size, const size_t count, void** out) {
+#ifdef HNC_MALLOC_PER_CPU
+    if (const int cpu = CpuCache::current_cpu(); cpu >= 0) [[likely]] {
+        return CpuCache::GetInstance().allocate_batch(cpu, size, count, out);
+    }
+#endif
+    ThreadCache* tc = get_thread_cache();
+    return tc != nullptr ? tc->allocate_batch(size, count, out) : 0;
+}
+
+inline void front_deallocate_batch(void** objs, const size_t count, const size_t align_size) {
+#ifdef HNC_MALLOC_PER_CPU
+    if (const int cpu = CpuCache::current_cpu(); cpu >= 0) [[likely]] {
+        CpuCache::GetInstance().deallocate_batch(cpu, objs, count, align_size);
+        return;
+    }
+#endif
+    ThreadCache* tc = get_thread_cache();
+    if (tc == nullptr) [[unlikely]] {
+        for (size_t i = 0; i < count; ++i) {
+            ThreadCache::release_to_central(objs[i], align_size);
+        }
+        return;
+    }
+    tc->deallocate_batch(objs, count, align_size);
+}
+
+/**
+ * 小块内存申请
+ * @param request 向前端申请的字节数， 加固模式下包括尾部金丝雀
+ * @param size 用户申请的字节数， 用于采样
+ */
+inline void* malloc_small(const size_t request, const size_t size) {
+    void* ptr = front_allocate(request);
+    // 此时不持有任何锁， 抛出异常时申请异常对象是安全的
+    if (ptr == nullptr) [[unlikely]] {
+        throw std::bad_alloc();
+    }
+    if constexpr (constant::HARDENED) {
+        hardened_on_alloc(ptr, RoundUp(request));
+    }
+    sample_allocation(ptr, size);
+    trace_allocation(TraceOp::malloc, ptr, size);
+    return ptr;
+}
+}
+
 /**
  *  全局申请内存接口
  */
 inline void* tnc_malloc(const size_t size) {
     // 少于MAX_ALLOC_BYTES的字节申请向线程局部缓存申请
-    if (size <= details::constant::MAX_ALLOC_BYTES) { // 256KB
-        if (details::tls_thread_cache_ptr_ == nullptr) {
-            // 初始化线程局部缓存, 使用定长线程池，内部使用brk系统调用
-            static details::FixedMemPool<details::ThreadCache> tc_pool;
-            // // 这里不把锁的逻辑放在New里面是因为， span也会需要加锁，这就邮箱效率了，而span的New 已经保证了线程安全
-            tc_pool.lock();
-            details::tls_thread_cache_ptr_ = tc_pool.New();
-            tc_pool.unlock();
-        }
-        logger::log_debug("alloc from thread cache, size=" + std::to_string(size));
-        return details::tls_thread_cache_ptr_->allocate(size);
+    if (size <= details::constant::MAX_ALLOC_BYTES - details::constant::CANARY_BYTES) { // 256KB
+        MP_LOG(debug, "alloc from thread cache, size=" + std::to_string(size));
+        return details::malloc_small(size + details::constant::CANARY_BYTES, size);
+    }
+    // 超过 PTRDIFF_MAX 时向上取整到页数会回绕
+    if (size > PTRDIFF_MAX) [[unlikely]] {
+        throw std::bad_alloc();
+    }
+    // 大于MAX_ALLOC_BYTES 直接找当前线程的pc分片要， 加固模式多申请一页作为保护页
+    details::PageCache& page_cache = details::PageCache::GetInstance();
+    page_cache.lock();
+    details::Span* span = page_cache.create_pc_span((details::RoundUp(size) >> details::constant::PAGE_SHIFT) + details::constant::HARDENED);
+    // mmap失败， 先解锁再报告
+    if (span == nullptr) [[unlikely]] {
+        page_cache.unlock();
+        throw std::bad_alloc();
+    }
+    // 标记为使用中， 避免被pc中相邻的空闲span合并; 标记为直接分配， 释放时据此区分大块内存和tc的小块内存
+    span->_is_use = true;
+    span->_is_direct = true;
+    span->_block_size = span->_page_size << details::constant::PAGE_SHIFT;
+    page_cache.unlock();
+    if constexpr (details::constant::HARDENED) {
+        details::hardened_guard_direct(span);
     }
-    // 大于MAX_ALLOC_BYTES 直接找pc要
-    details::PageCache::GetInstance().lock();
-    const details::Span* span = details::PageCache::GetInstance().create_pc_span(details::RoundUp(size) >> details::constant::PAGE_SHIFT);
-    details::PageCache::GetInstance().unlock();
-    logger::log_debug("alloc from page cache, size=" + std::to_string(size));
-    return reinterpret_cast<void*>(span->_page_id << details::constant::PAGE_SHIFT);
+    MP_LOG(debug, "alloc from page cache, size=" + std::to_string(size));
+    void* ptr = reinterpret_cast<void*>(span->_page_id << details::constant::PAGE_SHIFT);
+    details::sample_allocation(ptr, size);
+    details::trace_allocation(details::TraceOp::malloc, ptr, size);
+    return ptr;
 }
 
 /**
@@ -39,23 +161,430 @@ inline void* tnc_malloc(const size_t size) {
  */
 inline void tnc_free(void* obj) {
     assert(obj);
+    // 在归还之前记录， 其他线程随后申请到同一个地址时时间一定更晚
+    details::trace_allocation(details::TraceOp::free, obj, 0);
 
     // 通过地址查找到对应的span，内部存储了该span所属的内存块大小
-    const auto span = details::PageCache::GetInstance().find_span_by_address(obj);
-    // 这里没有去记录block_size, 所以使用page_size
-    // const size_t size = span->_block_size;
+    // 加固模式下非法地址和重复释放的大块内存找不到span， 由检查函数报告
+    const auto span = details::constant::HARDENED ? details::PageCache::lookup_span(obj) : details::PageCache::find_span_by_address(obj);
+    if constexpr (details::constant::HARDENED) {
+        if (span != nullptr && !span->_is_direct) {
+            details::hardened_on_free(obj, span);
+        } else {
+            details::hardened_on_free_direct(obj, span);
+        }
+    }
+    // span中有被采样的内存块时先从采样表中删除
+    if (span->_sampled_count.load(std::memory_order_relaxed) != 0) [[unlikely]] {
+        details::HeapProfiler::GetInstance().erase(obj, span);
+    }
+
+    // 大内存和超过一页的对齐内存直接通过pc释放
+    if (span->_is_direct) {
+        // 归还到span所属的pc分片
+        details::PageCache& page_cache = details::PageCache::OwnerOf(span);
+        page_cache.lock();
+        page_cache.recover_span_to_page_cache(span);
+        page_cache.unlock();
+        MP_LOG(debug, "free to page cache, page_size=" + std::to_string(span->_page_size));
+        return;
+    }
+    // 其他线程申请的内存块送回所属线程
+    details::front_deallocate(obj, span->_block_size, span->owner());
+    MP_LOG(debug, "free to thread cache, block_size=" + std::to_string(span->_block_size));
+}
+
+/**
+ *  已知内存块大小时的释放接口， 直接由大小算出对应的自由链表， 通常不需要通过页号查找span
+ *  其他线程的远程释放队列打开时才查找span得到所属线程， 其他线程申请的内存块与 tnc_free 一样送回所属线程
+ *  @param size 申请时传给 tnc_malloc 的字节数
+ */
+inline void tnc_free_sized(void* obj, const size_t size) {
+    assert(obj);
+    // 大块内存仍然需要span才能归还pc
+    if (size > details::constant::MAX_ALLOC_BYTES - details::constant::CANARY_BYTES) [[unlikely]] {
+        tnc_free(obj);
+        return;
+    }
+    // 加固模式需要span检查释放位， 同时检查传入的大小
+    if constexpr (details::constant::HARDENED) {
+        const details::Span* span = details::PageCache::lookup_span(obj);
+        if (span != nullptr && !span->_is_direct && span->_block_size != details::RoundUp(size + details::constant::CANARY_BYTES)) [[unlikely]] {
+            details::SystemAbort("sized free with a size different from the allocation of", obj);
+        }
+        tnc_free(obj);
+        return;
+    }
+    if (details::HeapProfiler::GetInstance().has_samples()) [[unlikely]] {
+        details::HeapProfiler::GetInstance().erase(obj, details::PageCache::find_span_by_address(obj));
+    }
+    details::trace_allocation(details::TraceOp::free, obj, 0);
+    const size_t align_size = details::RoundUp(size);
+    // 调用方传入的大小必须和申请时一致
+    assert(details::PageCache::find_span_by_address(obj)->_block_size == align_size);
+    details::front_deallocate(obj, align_size, details::ThreadCache::UNKNOWN_OWNER);
+    MP_LOG(debug, "free sized to thread cache, block_size=" + std::to_string(align_size));
+}
+
+namespace details {
+// 对齐数 <= 一页时对齐申请实际使用的大小: 向上取整到对齐数的倍数
+inline size_t aligned_size(const size_t size, const size_t align) noexcept {
+    return _RoundUp(size == 0 ? 1 : size, align);
+}
+}
+
+/**
+ *  批量申请count个size大小的内存块写入out， 适合一次申请大量同样大小的对象
+ *  整批只计算一次自由链表下标， 自由链表中的内存块整段取出， 不足的部分直接向cc申请
+ *  内存不足时抛出 std::bad_alloc， 已经申请到的内存块全部归还
+ */
+inline void tnc_malloc_batch(const size_t size, const size_t count, void** out) {
+    if (count == 0) {
+        return;
+    }
+    // 加固模式每个内存块都要单独检查， 逐个申请
+    if (size > details::constant::MAX_ALLOC_BYTES || details::constant::HARDENED) [[unlikely]] {
+        for (size_t i = 0; i < count; ++i) {
+            try {
+                out[i] = tnc_malloc(size);
+            } catch (...) {
+                for (size_t j = 0; j < i; ++j) {
+                    tnc_free(out[j]);
+                }
+                throw;
+            }
+        }
+        return;
+    }
+    // 向OS申请内存失败时先归还已经申请到的内存块， 整批要么全部成功要么全部失败
+    if (const size_t filled = details::front_allocate_batch(size, count, out); filled < count) [[unlikely]] {
+        if (filled > 0) {
+            details::front_deallocate_batch(out, filled, details::RoundUp(size));
+        }
+        throw std::bad_alloc();
+    }
+    // 整批都没有到达采样点时只需要一次减法
+    if (details::tls_bytes_until_sample_ > size * count) [[likely]] {
+        details::tls_bytes_until_sample_ -= size * count;
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            details::sample_allocation(out[i], size);
+        }
+    }
+    if (details::AllocTracer::enabled()) [[unlikely]] {
+        for (size_t i = 0; i < count; ++i) {
+            details::AllocTracer::GetInstance().record(details::TraceOp::malloc, out[i], size);
+        }
+    }
+    MP_LOG(debug, "alloc batch, size=" + std::to_string(size) + ", count=" + std::to_string(count));
+}
 
-    // 大内存直接通过pc释放
-    if (span->_page_size > 64) {
-        details::PageCache::GetInstance().lock();
-        details::PageCache::GetInstance().recover_span_to_page_cache(span);
-        details::PageCache::GetInstance().unlock();
-        logger::log_debug("free to page cache, page_size=" + std::to_string(span->_page_size));
+/**
+ *  批量释放 tnc_malloc_batch 申请的内存块(或者同样大小的 tnc_malloc 申请的内存块)
+ *  其他线程申请的内存块逐个送回所属线程， 其余的整段挂入本线程的自由链表
+ *  @param size 申请时的字节数
+ */
+inline void tnc_free_batch(void** objs, const size_t count, const size_t size) {
+    if (count == 0) {
         return;
     }
-    details::tls_thread_cache_ptr_->deallocate(obj, span->_block_size);
-    logger::log_debug("free to thread cache, block_size=" + std::to_string(span->_block_size));
+    if (size > details::constant::MAX_ALLOC_BYTES || details::constant::HARDENED || details::HeapProfiler::GetInstance().has_samples()) [[unlikely]] {
+        for (size_t i = 0; i < count; ++i) {
+            tnc_free_sized(objs[i], size);
+        }
+        return;
+    }
+    if (details::AllocTracer::enabled()) [[unlikely]] {
+        for (size_t i = 0; i < count; ++i) {
+            details::AllocTracer::GetInstance().record(details::TraceOp::free, objs[i], 0);
+        }
+    }
+    details::front_deallocate_batch(objs, count, details::RoundUp(size));
+    MP_LOG(debug, "free batch, size=" + std::to_string(size) + ", count=" + std::to_string(count));
 }
 
+/**
+ *  按对齐申请内存
+ *  1. 对齐数 <= 一页: span的起始地址是页对齐的， 大小向上取整到对齐数的倍数后，
+ *     对应size class的块大小也是对齐数的倍数(各区间的对齐都是2的幂)， span内每个块天然对齐， 仍然走tc
+ *  2. 对齐数 > 一页: 由pc切出一个起始地址对齐的span直接分配
+ *  @param align 2的幂
+ */
+inline void* tnc_aligned_alloc(const size_t size, const size_t align) {
+    assert(align > 0 && (align & (align - 1)) == 0);
+    if (size > SIZE_MAX - align) [[unlikely]] {
+        throw std::bad_alloc();
+    }
+    if (align <= details::constant::PAGE_BYTES) {
+        // 加固模式金丝雀也计入对齐后的大小， 块大小仍然是对齐数的倍数
+        const size_t request = details::aligned_size(size + details::constant::CANARY_BYTES, align);
+        if (request <= details::constant::MAX_ALLOC_BYTES) {
+            return details::malloc_small(request, size);
+        }
+        return tnc_malloc(request);
+    }
+    const size_t page_count = (details::aligned_size(size, details::constant::PAGE_BYTES) >> details::constant::PAGE_SHIFT) + details::constant::HARDENED;
+    details::PageCache& page_cache = details::PageCache::GetInstance();
+    page_cache.lock();
+    details::Span* span = page_cache.create_aligned_span(page_count, align >> details::constant::PAGE_SHIFT);
+    if (span == nullptr) [[unlikely]] {
+        page_cache.unlock();
+        throw std::bad_alloc();
+    }
+    span->_is_direct = true;
+    span->_block_size = span->_page_size << details::constant::PAGE_SHIFT;
+    page_cache.unlock();
+    if constexpr (details::constant::HARDENED) {
+        details::hardened_guard_direct(span);
+    }
+    MP_LOG(debug, "alloc aligned span from page cache, size=" + std::to_string(size) + ", align=" + std::to_string(align));
+    void* ptr = reinterpret_cast<void*>(span->_page_id << details::constant::PAGE_SHIFT);
+    details::sample_allocation(ptr, size);
+    details::trace_allocation(details::TraceOp::malloc, ptr, size);
+    return ptr;
+}
 
-}
\ No newline at end of file
+// 与 memalign 参数顺序一致的对齐申请接口
+inline void* tnc_memalign(const size_t align, const size_t size) {
+    return tnc_aligned_alloc(size, align);
+}
+
+/**
+ *  已知大小和对齐数时的释放接口
+ *  @param size/align 申请时传给 tnc_aligned_alloc 的参数
+ */
+inline void tnc_free_aligned_sized(void* obj, const size_t size, const size_t align) {
+    if (align > details::constant::PAGE_BYTES || details::constant::HARDENED) {
+        tnc_free(obj);
+        return;
+    }
+    tnc_free_sized(obj, details::aligned_size(size, align));
+}
+
+/**
+ *  调整内存块大小， 尽量不复制数据
+ *  1. 小块内存: 新的大小对齐后仍然是同一个块大小， 直接返回原地址
+ *  2. 直接由pc分配的大块内存: 在pc中原地缩小或者吞并右侧相邻的空闲span扩大， 单独mmap的span使用mremap
+ *  3. 否则重新申请、复制、释放原内存块
+ *  @return obj 为nullptr时等同于 tnc_malloc， size 为0时释放并返回nullptr
+ */
+inline void* tnc_realloc(void* obj, const size_t size) {
+    if (obj == nullptr) {
+        return tnc_malloc(size);
+    }
+    if (size == 0) {
+        tnc_free(obj);
+        return nullptr;
+    }
+    const auto span = details::PageCache::find_span_by_address(obj);
+    const size_t old_size = span->_is_direct ? span->_block_size : span->_block_size - details::constant::CANARY_BYTES;
+    if (!span->_is_direct) {
+        if (size <= details::constant::MAX_ALLOC_BYTES - details::constant::CANARY_BYTES
+            && details::RoundUp(size + details::constant::CANARY_BYTES) == span->_block_size) {
+            return obj;
+        }
+    } else if (size > details::constant::MAX_ALLOC_BYTES && !details::constant::HARDENED) {
+        // 加固模式的大块内存尾部有保护页， 不原地调整
+        const size_t page_count = details::_RoundUp(size, details::constant::PAGE_BYTES) >> details::constant::PAGE_SHIFT;
+        if (page_count == span->_page_size) {
+            return obj;
+        }
+        // mremap 可能移动地址， 先删除原来的采样， 调整成功后按新的大小重新采样
+        if (span->_sampled_count.load(std::memory_order_relaxed) != 0) [[unlikely]] {
+            details::HeapProfiler::GetInstance().erase(obj, span);
+        }
+        details::PageCache& page_cache = details::PageCache::OwnerOf(span);
+        page_cache.lock();
+        const bool resized = page_cache.resize_span(span, page_count);
+        if (resized) {
+            span->_block_size = span->_page_size << details::constant::PAGE_SHIFT;
+        }
+        page_cache.unlock();
+        if (resized) {
+            MP_LOG(debug, "realloc in place, page_count=" + std::to_string(page_count));
+            void* new_obj = reinterpret_cast<void*>(span->_page_id << details::constant::PAGE_SHIFT);
+            // mremap 移动了地址时记录为一次释放和一次申请， 回放时不会引用已经失效的地址
+            if (new_obj != obj) {
+                details::trace_allocation(details::TraceOp::free, obj, 0);
+                details::trace_allocation(details::TraceOp::malloc, new_obj, size);
+            }
+            details::sample_allocation(new_obj, size);
+            return new_obj;
+        }
+    }
+    void* new_obj = tnc_malloc(size);
+    memcpy(new_obj, obj, std::min(size, old_size));
+    tnc_free(obj);
+    return new_obj;
+}
+
+/**
+ *  获取一块内存实际可用的字节数(对齐后的内存块大小)
+ */
+inline size_t tnc_usable_size(void* obj) noexcept {
+    assert(obj);
+    const auto span = details::PageCache::find_span_by_address(obj);
+    return span->_is_direct ? span->_block_size : span->_block_size - details::constant::CANARY_BYTES;
+}
+
+/**
+ *  汇总内存池的统计: 每个块大小在tc/cc/用户手中的块数、pc中各页数的空闲span、OS映射字节数、碎片率、span对象池和tc的累计计数
+ */
+inline MallocStats tnc_get_stats() noexcept {
+    return details::collect_stats();
+}
+
+/**
+ *  以JSON格式输出统计， 便于采集到监控系统
+ */
+inline void tnc_print_stats(FILE* out = stderr) noexcept {
+    details::print_stats(details::collect_stats(), out);
+}
+
+/**
+ *  开启采样堆分析: 平均每申请 sample_period 字节采样一次并记录调用栈， 0 表示关闭
+ */
+inline void tnc_set_heap_profile_period(const size_t sample_period) noexcept {
+    details::HeapProfiler::GetInstance().set_sample_period(sample_period);
+}
+
+/**
+ *  以 pprof 兼容的格式输出所有存活的采样: pprof <程序> <文件>
+ */
+inline bool tnc_dump_heap_profile(const int fd) noexcept {
+    return details::HeapProfiler::GetInstance().dump(fd);
+}
+
+/**
+ *  收到信号 signo 时输出到 path_prefix.<pid>.<序号>.heap
+ */
+inline bool tnc_dump_heap_profile_on_signal(const int signo, const char* path_prefix) noexcept {
+    return details::HeapProfiler::GetInstance().dump_on_signal(signo, path_prefix);
+}
+
+/**
+ *  开始跟踪所有的申请和释放， 写入 path， 之后可以用 mp_replay 回放并统计各层的命中率和碎片率
+ *  原地完成的 tnc_realloc 不记录， mremap 移动了地址时记录为一次释放和一次申请
+ *  @return 已经在跟踪或者打开文件失败返回false
+ */
+inline bool tnc_start_trace(const char* path) {
+    return details::AllocTracer::GetInstance().start(path);
+}
+
+// 停止跟踪， 写完所有线程缓冲区中的记录后返回
+inline void tnc_stop_trace() noexcept {
+    details::AllocTracer::GetInstance().stop();
+}
+
+/**
+ *  设置pc中空闲span归还OS的策略: 空闲时间、保留预算、归还速率
+ */
+inline void tnc_set_release_config(const ReleaseConfig& config) noexcept {
+    for (size_t i = 0; i < details::PageCache::ARENA_COUNT; ++i) {
+        details::PageCache& page_cache = details::PageCache::Arena(i);
+        page_cache.lock();
+        page_cache.set_release_config(config);
+        page_cache.unlock();
+    }
+}
+
+inline ReleaseConfig tnc_get_release_config() noexcept {
+    details::PageCache& page_cache = details::PageCache::Arena(0);
+    page_cache.lock();
+    const ReleaseConfig config = page_cache.release_config();
+    page_cache.unlock();
+    return config;
+}
+
+/**
+ *  立即将pc中所有空闲span归还OS， 忽略空闲时间和保留预算
+ *  @return 本次归还的字节数
+ */
+inline size_t tnc_release_memory() noexcept {
+    // 传输缓存中的内存块会让所属span无法回到pc， 先归还给spans
+    details::CentralCache::drain_transfer_caches();
+    size_t pages = 0;
+    for (size_t i = 0; i < details::PageCache::ARENA_COUNT; ++i) {
+        details::PageCache& page_cache = details::PageCache::Arena(i);
+        page_cache.lock();
+        pages += page_cache.release_idle_spans(SIZE_MAX, true);
+        page_cache.unlock();
+    }
+    return pages << details::constant::PAGE_SHIFT;
+}
+
+/**
+ *  获取pc与OS之间的内存统计: 映射字节数、驻留/已归还的空闲字节数、累计归还次数
+ */
+inline ReleaseStats tnc_get_release_stats() noexcept {
+    ReleaseStats stats{};
+    for (size_t i = 0; i < details::PageCache::ARENA_COUNT; ++i) {
+        details::PageCache& page_cache = details::PageCache::Arena(i);
+        page_cache.lock();
+        const ReleaseStats arena_stats = page_cache.release_stats();
+        page_cache.unlock();
+        stats.system_bytes += arena_stats.system_bytes;
+        stats.free_bytes += arena_stats.free_bytes;
+        stats.released_bytes += arena_stats.released_bytes;
+        stats.release_count += arena_stats.release_count;
+        stats.total_released_bytes += arena_stats.total_released_bytes;
+    }
+    return stats;
+}
+
+/**
+ *  启动/停止后台回收线程， 按照 ReleaseConfig 周期性地归还空闲过久的span
+ */
+inline void tnc_start_scavenger() {
+    details::Scavenger::GetInstance().start();
+}
+
+inline void tnc_stop_scavenger() noexcept {
+    details::Scavenger::GetInstance().stop();
+}
+
+/**
+ *  设置pc的大页模式， 只影响之后新映射的区域
+ */
+inline void tnc_set_huge_page_mode(const HugePageMode mode) noexcept {
+    for (size_t i = 0; i < details::PageCache::ARENA_COUNT; ++i) {
+        details::PageCache& page_cache = details::PageCache::Arena(i);
+        page_cache.lock();
+        page_cache.set_huge_page_mode(mode);
+        page_cache.unlock();
+    }
+}
+
+/**
+ *  获取大页覆盖统计: 大页区域映射的字节数/其中正在使用的字节数/区域个数等
+ */
+inline HugePageStats tnc_get_huge_page_stats() noexcept {
+    HugePageStats stats{};
+    for (size_t i = 0; i < details::PageCache::ARENA_COUNT; ++i) {
+        details::PageCache& page_cache = details::PageCache::Arena(i);
+        page_cache.lock();
+        const HugePageStats arena_stats = page_cache.huge_page_stats();
+        page_cache.unlock();
+        stats.system_bytes += arena_stats.system_bytes;
+        stats.hugepage_bytes += arena_stats.hugepage_bytes;
+        stats.hugepage_used_bytes += arena_stats.hugepage_used_bytes;
+        stats.hugepage_regions += arena_stats.hugepage_regions;
+        stats.hugetlb_regions += arena_stats.hugetlb_regions;
+        stats.region_release_count += arena_stats.region_release_count;
+    }
+    return stats;
+}
+
+/**
+ *  设置/获取所有线程的tc缓存内存的总预算(字节)
+ *  超过预算时空闲线程的缓存上限会被活跃线程窃取， 空闲线程下一次释放内存时收缩自己的缓存
+ */
+inline void tnc_set_thread_cache_budget(const size_t bytes) noexcept {
+    details::ThreadCache::set_overall_budget(bytes);
+}
+
+inline size_t tnc_get_thread_cache_budget() noexcept {
+    return details::ThreadCache::overall_budget();
+}
+
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+namespace hnc::core::mem_pool::details {
+
+enum class TraceOp : uint8_t {
+    malloc = 0,
+    free = 1,
+};
+
+// 跟踪文件头， 之后是连续的 TraceRecord
+struct TraceFileHeader {
+    char _magic[8]; // "HNCTRACE"
+    uint32_t _version;
+    uint32_t _record_size; // sizeof(TraceRecord)， 读取时校验
+};
+
+// 一次申请或释放， 定长24字节
+struct TraceRecord {
+    uint64_t _time_ns; // 距离开始跟踪的纳秒数
+    uint64_t _ptr; // 内存块地址， 回放时用来匹配申请和释放
+    uint32_t _size; // 申请的字节数， 超过4GB时饱和， 释放为0
+    uint16_t _thread; // 线程编号， 从1开始， 按线程第一次记录的顺序分配
+    uint8_t _op; // TraceOp
+    uint8_t _reserved;
+};
+static_assert(sizeof(TraceRecord) == 24);
+
+inline constexpr char TRACE_MAGIC[8] = {'H', 'N', 'C', 'T', 'R', 'A', 'C', 'E'};
+inline constexpr uint32_t TRACE_VERSION = 1;
+
+/**
+ * 申请/释放跟踪， 默认关闭， 记录的文件由 mp_replay 按原来的线程交错顺序回放
+ *
+ * 1. 每个线程一个单生产者单消费者的环形缓冲区， 记录时只写本线程的缓冲区， 不加锁
+ * 2. 后台线程周期性地把所有缓冲区写入文件， 缓冲区满时记录的线程等待后台线程
+ * 3. 缓冲区由 SystemAlloc 申请， 挂在只增不减的全局链表上， 线程退出后由新线程复用， 整个过程不经过 malloc
+ * 4. 申请在得到地址之后记录， 释放在归还之前记录， 同一个地址的释放时间一定早于下一次申请
+ * 5. 后台线程的运行方式与 Scavenger 相同: detach， 进程退出时由 atexit 停止， 子进程中不继续跟踪
+ */
+class AllocTracer {
+public:
+    static constexpr size_t BUFFER_RECORDS = 8192; // 每个线程缓冲区的记录数
+    static constexpr int FLUSH_INTERVAL_MS = 10; // 后台线程写文件的间隔
+
+    static AllocTracer& GetInstance() noexcept {
+        alignas(AllocTracer) static char storage[sizeof(AllocTracer)];
+        static AllocTracer* tracer = new (storage) AllocTracer();
+        return *tracer;
+    }
+
+    /**
+     * 开始跟踪， 写入 path (截断)
+     * @return 已经在跟踪或者打开文件失败返回false
+     */
+    bool start(const char* path);
+
+    // 停止跟踪， 写完所有缓冲区后关闭文件
+    void stop() noexcept;
+
+    static bool enabled() noexcept {
+        return _m_enabled.load(std::memory_order_relaxed);
+    }
+
+    void record(TraceOp op, const void* ptr, size_t size) noexcept;
+
+    // 累计写入文件的记录数
+    size_t written_count() const noexcept {
+        return _m_written.load(std::memory_order_relaxed);
+    }
+
+private:
+    AllocTracer() = default;
+    ~AllocTracer() = default;
+
+    AllocTracer(const AllocTracer&) = delete;
+    AllocTracer(AllocTracer&&) = delete;
+    AllocTracer& operator=(const AllocTracer&) = delete;
+    AllocTracer& operator=(AllocTracer&&) = delete;
+
+    // 一个线程的环形缓冲区， 记录的线程写 _head， 后台线程写 _tail
+    struct ThreadBuffer {
+        alignas(64) std::atomic<size_t> _head{0};
+        alignas(64) std::atomic<size_t> _tail{0};
+        std::atomic<bool> _in_use{false};
+        uint16_t _thread{0};
+        ThreadBuffer* _next{nullptr};
+        TraceRecord _records[BUFFER_RECORDS];
+    };
+
+    // 取得当前线程的缓冲区， 优先复用已经退出的线程的缓冲区
+    ThreadBuffer* _m_acquire_buffer() noexcept;
+    static void _m_release_buffer(void* ptr) noexcept;
+
+    // 把所有缓冲区中的记录写入文件， 需要持有 _m_mtx
+    void _m_flush() noexcept;
+
+    // 后台线程函数
+    void _m_run() noexcept;
+
+    static void _m_prepare_fork() noexcept;
+    static void _m_parent_fork() noexcept;
+    static void _m_child_fork() noexcept;
+
+private:
+    // 申请路径每次都要读取， 不经过单例的初始化检查
+    static std::atomic<bool> _m_enabled;
+    // 当前线程的缓冲区
+    static thread_local ThreadBuffer* _m_tls_buffer HNC_TLS_INITIAL_EXEC;
+    // 正在取得缓冲区(可能会申请内存)或者是后台线程， 这期间的申请释放不记录
+    static thread_local bool _m_tls_busy HNC_TLS_INITIAL_EXEC;
+
+    std::atomic<ThreadBuffer*> _m_buffers{nullptr};
+    std::atomic<uint16_t> _m_next_thread{0};
+    std::atomic<size_t> _m_written{0};
+    std::atomic<uint64_t> _m_start_ns{0};
+
+    std::mutex _m_mtx; // 保护以下成员， 记录的线程不会获取
+    std::condition_variable _m_cond;
+    int _m_fd{-1};
+    bool _m_running{false};
+    bool _m_exited{true};
+    bool _m_registered{false};
+};
+
+/**
+ * 申请/释放路径的跟踪检查， 关闭时只有一次relaxed读取
+ */
+inline void trace_allocation(const TraceOp op, const void* ptr, const size_t size) noexcept {
+    if (AllocTracer::enabled()) [[unlikely]] {
+        AllocTracer::GetInstance().record(op, ptr, size);
+    }
+}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "common.h"
+#include "span.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace hnc::core::mem_pool {
+/**
+ * 单调递增的内存区域(bump arena)， 用于生命周期与请求相同的一批对象(如每个请求的解析树)
+ *
+ * 1. 直接向pc申请多页的span， 在span内移动指针分配， 没有自由链表， 单个对象的释放没有任何开销
+ * 2. reset() 时持有一次pc锁将所有span整批归还pc， 之后可以继续用于下一个请求
+ * 3. 每次申请的span页数翻倍直到128页， reset后保留增长后的页数， 相似的请求只需要很少几次pc锁
+ * 4. 不是线程安全的， 每个线程(或每个请求)使用自己的arena
+ */
+class TncArena {
+public:
+    static constexpr size_t DEFAULT_CHUNK_PAGES = 16; // 第一个span的页数, 64KB
+
+    explicit TncArena(const size_t chunk_pages = DEFAULT_CHUNK_PAGES) noexcept
+        : _m_chunk_pages(std::clamp<size_t>(chunk_pages, 1, details::constant::MAX_PAGE_COUNT)) {}
+
+    ~TncArena() {
+        reset();
+    }
+
+    TncArena(const TncArena&) = delete;
+    TncArena(TncArena&&) = delete;
+    TncArena& operator=(const TncArena&) = delete;
+    TncArena& operator=(TncArena&&) = delete;
+
+    /**
+     * 申请size字节的内存， 在 reset() 或者arena析构之前一直有效
+     * @param align 2的幂
+     */
+    void* allocate(size_t size, const size_t align = alignof(std::max_align_t)) {
+        assert((align & (align - 1)) == 0);
+        size = std::max<size_t>(size, 1);
+        const uintptr_t ptr = (reinterpret_cast<uintptr_t>(_m_cur) + align - 1) & ~(align - 1);
+        if (ptr + size <= reinterpret_cast<uintptr_t>(_m_end)) [[likely]] {
+            _m_cur = reinterpret_cast<char*>(ptr + size);
+            _m_allocated_bytes += size;
+            return reinterpret_cast<void*>(ptr);
+        }
+        return _m_allocate_slow(size, align);
+    }
+
+    // 在arena中构造对象， reset时不会调用析构， 只能用于平凡析构的类型
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // 将所有span整批归还pc， 之前申请的内存全部失效
+    void reset() noexcept;
+
+    // 用户申请的字节数
+    size_t allocated_bytes() const noexcept { return _m_allocated_bytes; }
+    // 从pc申请的字节数
+    size_t reserved_bytes() const noexcept { return _m_reserved_bytes; }
+
+private:
+    // 当前span剩余空间不够， 向pc申请新的span
+    void* _m_allocate_slow(size_t size, size_t align);
+
+    // 向pc申请page_count页的span， 挂入span链表
+    char* _m_new_span(size_t page_count);
+
+private:
+    char* _m_cur{nullptr}; // 当前span中下一个可分配的地址
+    char* _m_end{nullptr}; // 当前span的结束地址
+    details::Span* _m_spans{nullptr}; // 从pc申请的所有span， 通过 _next 串成单链表
+    size_t _m_chunk_pages; // 下一次申请的span页数
+    size_t _m_allocated_bytes{0};
+    size_t _m_reserved_bytes{0};
+};
+}
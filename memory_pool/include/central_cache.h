@@ -2,21 +2,46 @@
 
 #include "common.h"
 #include "span.h"
+#include "transfer_cache.h"
+#include "page_cache.h"
 
 namespace hnc::core::mem_pool::details {
+/**
+ * 每个NUMA节点一个cc(未开启 HNC_MALLOC_NUMA 时只有一个)， 节点的cc只管理该节点pc分片切出的span
+ * 线程从自己节点的cc申请内存块， 归还时按内存块所属span的节点分拣， 远端的内存块回到它自己节点的cc
+ */
 class CentralCache {
 public:
-    // 全局cc单例接口
-    static CentralCache& GetInstance() noexcept {
-        return _m_central_cache;
-    }
+    // 当前线程所在节点的cc
+    static CentralCache& GetInstance() noexcept;
+
+    // node节点的cc
+    static CentralCache& Node(size_t node) noexcept;
 
     // 尝试从对应块大小的span_list中 的一些span 中分配block_count数量的align_size的块给thread cache
-    // 有可能span_list中的span内的块数量 < block_count, 但是一定会至少分配出一个内存块给tc
-    size_t alloc_to_thread(void*& start, void*& end, size_t block_count, size_t align_size) noexcept;
+    // 有可能span_list中的span内的块数量 < block_count, 但是一定会至少分配出一个内存块给tc， 只有向OS申请内存失败时返回0
+    // owner 为申请线程的远程释放队列编号， 记录在切分的span中
+    size_t alloc_to_thread(void*& start, void*& end, size_t block_count, size_t align_size, uint16_t owner = 0) noexcept;
+
+    // tc释放的一系列内存块返还给spans (可能是从属于多个span、多个节点的)
+    static void recover_blocks_to_spans(void* start, size_t align_size) noexcept;
+
+    // tc整批归还的内存块 [start -> ... -> end]， 优先放入所属节点的传输缓存， 缓存满了再归还给spans
+    static void recover_from_thread(void* start, void* end, size_t block_count, size_t align_size) noexcept;
 
-    // tc释放的一系列内存块返还给spans (可能是从属于多个span的)
-    void recover_blocks_to_spans(void* start, size_t align_size) noexcept;
+    // 将所有节点的传输缓存中的内存块归还给spans， 使完全空闲的span可以回到pc
+    static void drain_transfer_caches() noexcept;
+
+    /**
+     * 统计所有节点每个块大小的span个数、空闲块数， 逐个桶加锁
+     * @param stats 填充 size_classes 中的 span_count/central_cache_blocks， in_use_blocks 暂存分配出去(不在span中)的块数
+     * @return cc中所有span的页数
+     */
+    static size_t collect_stats(MallocStats& stats) noexcept;
+
+    // fork前锁住所有节点的所有桶， 避免子进程继承到其他线程持有的桶锁后死锁
+    static void lock_all() noexcept;
+    static void unlock_all() noexcept;
 
 private:
     CentralCache() = default;
@@ -27,13 +52,53 @@ private:
     CentralCache& operator=(const CentralCache&) = delete;
     CentralCache& operator=(CentralCache&&) = delete;
 
-    // 返回一个内部freelist至少包含一个内存块的span
+    // 返回一个内部freelist至少包含一个内存块的span， O(1)
     Span* _m_get_span(SpanList &span_list, size_t align_size) noexcept;
 
+    // 本节点的内存块归还给spans / 整批放入传输缓存
+    void _m_recover_blocks(void* start, size_t align_size) noexcept;
+    void _m_recover_batch(void* start, void* end, size_t block_count, size_t align_size) noexcept;
+
+    // 将本节点各块大小的span数、cc中的块数和已分配的块数累加到stats， 返回span占用的页数
+    size_t _m_collect_stats(MallocStats& stats) noexcept;
+
+    /**
+     * 将内存块链表按所属节点拆成多条链表， 只在多个节点时使用
+     * @param heads/tails/counts 输出每个节点的链表头/尾/块数， 没有内存块的节点 heads 为nullptr
+     */
+    static void _m_split_by_node(void* start, void** heads, void** tails, size_t* counts) noexcept;
+
 private:
-    // 组织span的208个不同块大小的span的双向链表，每个span内部又有一个freelist，
+    // 组织span的FREE_LIST_SIZE个不同块大小的span的双向链表，每个span内部又有一个freelist，
+    // 这里只存放freelist中还有内存块的span， 链表头部的span即可分配
     SpanList _m_span_lists[constant::FREE_LIST_SIZE];
+    // 内存块已经全部分配出去的span， 同样由 _m_span_lists 中同一下标的桶锁保护
+    SpanList _m_full_span_lists[constant::FREE_LIST_SIZE];
+    // 每个块大小的传输缓存， 使用自己的锁
+    TransferCache _m_transfer_caches[constant::FREE_LIST_SIZE];
+    // 各层命中次数， 只用于统计， 使用relaxed即可
+    std::atomic<size_t> _m_transfer_hits{0};
+    std::atomic<size_t> _m_span_fetches{0};
+    std::atomic<size_t> _m_page_fetches{0};
     // 必须在cpp中初始化，否则每个翻译单元包含一个static，违背ODR原则，重复定义编译报错
-    static CentralCache _m_central_cache;
+    // 与pc分片相同， 数组包在结构体中避免 gcc 12 常量初始化时丢掉 SpanList 头节点的自引用指针
+    struct Nodes;
+    static Nodes _m_central_caches;
+};
+
+struct CentralCache::Nodes {
+    CentralCache _nodes[constant::MAX_NUMA_NODES];
 };
+
+inline CentralCache& CentralCache::Node(const size_t node) noexcept {
+    return _m_central_caches._nodes[node];
+}
+
+inline CentralCache& CentralCache::GetInstance() noexcept {
+    if constexpr (constant::MAX_NUMA_NODES == 1) {
+        return _m_central_caches._nodes[0];
+    } else {
+        return _m_central_caches._nodes[PageCache::GetInstance().node()];
+    }
+}
 }
@@ -1,6 +1,10 @@
 #pragma once
+#include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <new>
 
 #ifdef _WIN32
@@ -8,11 +12,23 @@
 #else
 #include <unistd.h>
 #include <stdio.h>
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#if __has_include(<linux/mempolicy.h>)
+#include <linux/mempolicy.h>
 #endif
 
 #include <cstdlib>
 
+#if defined(__GNUC__) || defined(__clang__)
+#define HNC_TLS_INITIAL_EXEC __attribute__((tls_model("initial-exec")))
+#else
+#define HNC_TLS_INITIAL_EXEC
+#endif
+
 
 namespace hnc::core::mem_pool {
 
@@ -21,24 +37,250 @@ namespace details::constant {
 /**
  * 默认按照一个页面4K 256 * 4K = 1M， 默认一个块256KB， 即最大span已经 = 4个块了，足矣
  */
-inline constexpr int FREE_LIST_SIZE = 208; // 一共可以对应208个自由链表
 inline constexpr int MAX_ALLOC_BYTES = 256 * 1024; // 一次可分配最大内存块 256KB
 inline constexpr int MAX_PAGE_COUNT = 128; // PageCache中的一个span最多可以包含的页面数
 inline constexpr int PAGE_SHIFT = 12; // 2^12 = 4096, 一页4KB
+inline constexpr size_t PAGE_BYTES = size_t{1} << PAGE_SHIFT; // 一页的字节数
+inline constexpr int ADDRESS_BITS = 48; // 用户态虚拟地址有效位数， 决定基数树的层数和大小
+
+inline constexpr size_t OVERALL_THREAD_CACHE_BYTES = 32 * 1024 * 1024; // 所有tc缓存内存的默认总预算 32MB
+inline constexpr size_t MIN_THREAD_CACHE_BYTES = 2 * MAX_ALLOC_BYTES; // 单个tc的最小缓存上限， 至少能缓存两个最大的内存块
+inline constexpr size_t STEAL_THREAD_CACHE_BYTES = 64 * 1024; // tc每次增加上限时获取的额度 64KB
+inline constexpr size_t MAX_REMOTE_HEAPS = 128; // 拥有远程释放队列的线程数上限， 超过的线程释放和取回都走普通路径
+
+inline constexpr int HUGE_PAGE_SHIFT = 21; // 2^21 = 2MB， 大页模式下pc每次向OS申请一个2MB对齐的区域
+inline constexpr size_t HUGE_PAGE_PAGE_COUNT = size_t{1} << (HUGE_PAGE_SHIFT - PAGE_SHIFT); // 一个大页包含的页数 512
+
+// pc分片个数， 编译时定义 HNC_MALLOC_PAGE_ARENAS 修改
+#ifdef HNC_MALLOC_PAGE_ARENAS
+inline constexpr size_t PAGE_ARENA_COUNT = HNC_MALLOC_PAGE_ARENAS;
+#else
+inline constexpr size_t PAGE_ARENA_COUNT = 8;
+#endif
+static_assert(PAGE_ARENA_COUNT >= 1 && PAGE_ARENA_COUNT <= 255, "HNC_MALLOC_PAGE_ARENAS must be in [1, 255]");
+
+/**
+ * 加固模式(编译时定义 HNC_MALLOC_HARDENED)， 用于在灰度机器上发现内存越界和释放后使用:
+ * 自由链表指针加密、小块内存尾部金丝雀、span位图检测重复释放、释放隔离区、大块内存尾部保护页
+ */
+#ifdef HNC_MALLOC_HARDENED
+inline constexpr bool HARDENED = true;
+#else
+inline constexpr bool HARDENED = false;
+#endif
+// 小块内存尾部金丝雀占用的字节数， 16字节保证申请大小是16的倍数时块大小仍然是16的倍数
+// 金丝雀使每次申请都多写一个缓存行， 编译时定义 HNC_MALLOC_HARDENED_CANARY=0 关闭
+#if defined(HNC_MALLOC_HARDENED_CANARY) && HNC_MALLOC_HARDENED_CANARY == 0
+inline constexpr size_t CANARY_BYTES = 0;
+#else
+inline constexpr size_t CANARY_BYTES = HARDENED ? 16 : 0;
+#endif
+
+// 最多区分的NUMA节点数， 编译时定义 HNC_MALLOC_NUMA 开启， 关闭时所有内存都属于节点0
+#ifdef HNC_MALLOC_NUMA
+inline constexpr size_t MAX_NUMA_NODES = 4;
+#else
+inline constexpr size_t MAX_NUMA_NODES = 1;
+#endif
+
+/**
+ * 每个2的幂区间 (2^k, 2^(k+1)] 均分为 CLASS_SPLITS 个块大小， 内部碎片不超过 1/CLASS_SPLITS
+ * 编译时定义 HNC_MALLOC_CLASS_SPLITS 修改， 默认16(碎片 <= 6.25%)， 8 即 <= 12.5%， 越大自由链表越多
+ */
+#ifdef HNC_MALLOC_CLASS_SPLITS
+inline constexpr size_t CLASS_SPLITS = HNC_MALLOC_CLASS_SPLITS;
+#else
+inline constexpr size_t CLASS_SPLITS = 16;
+#endif
+inline constexpr size_t MIN_CLASS_ALIGN = 8; // 最小的块大小和步长
+inline constexpr size_t SMALL_LOOKUP_BYTES = 1024; // 不超过该值的申请直接查表得到自由链表序号
+// 实际使用的最小块大小: 加固模式释放后前两个字是链表指针和记录， 不能与尾部金丝雀重叠
+inline constexpr size_t MIN_BLOCK_BYTES = HARDENED ? 2 * sizeof(void*) + CANARY_BYTES : MIN_CLASS_ALIGN;
+static_assert(std::has_single_bit(CLASS_SPLITS) && CLASS_SPLITS >= 2 && CLASS_SPLITS * MIN_CLASS_ALIGN <= SMALL_LOOKUP_BYTES,
+    "HNC_MALLOC_CLASS_SPLITS must be a power of two in [2, 128]");
+inline constexpr int CLASS_SPLITS_SHIFT = std::countr_zero(CLASS_SPLITS);
+inline constexpr int MAX_ALLOC_SHIFT = std::countr_zero(static_cast<size_t>(MAX_ALLOC_BYTES));
+}
+
+namespace details {
+// 块大小的步长: 在 2^k 之后以 max(8, 2^k / CLASS_SPLITS) 递增
+constexpr size_t SizeClassStep(const size_t size) noexcept {
+    return std::max(constant::MIN_CLASS_ALIGN, std::bit_floor(size) / constant::CLASS_SPLITS);
+}
+
+// 块大小的个数
+// 计数和填表分成两个函数: 在常量表达式中比较成员数组的地址和nullptr， GCC 开启 -fsanitize=undefined 时不是常量表达式
+constexpr size_t CountSizeClasses() noexcept {
+    size_t count = 0;
+    for (size_t size = constant::MIN_CLASS_ALIGN; size <= constant::MAX_ALLOC_BYTES; size += SizeClassStep(size)) {
+        ++count;
+    }
+    return count;
+}
+
+// 按从小到大的顺序写入所有块大小， sizes 至少有 CountSizeClasses() 个元素
+constexpr void FillSizeClasses(size_t* sizes) noexcept {
+    size_t count = 0;
+    for (size_t size = constant::MIN_CLASS_ALIGN; size <= constant::MAX_ALLOC_BYTES; size += SizeClassStep(size)) {
+        sizes[count++] = size;
+    }
+}
+
+/**
+ * 编译期生成的块大小表
+ * 步长是2的幂且整除区间起点， 因此申请大小是对齐数(<= 一页)的倍数时选中的块大小也一定是对齐数的倍数， span内的块天然对齐
+ */
+struct SizeClassTable {
+    static constexpr size_t COUNT = CountSizeClasses();
+
+    size_t sizes[COUNT]{}; // 自由链表序号 -> 块大小
+    uint16_t small_index[constant::SMALL_LOOKUP_BYTES / constant::MIN_CLASS_ALIGN + 1]{}; // (size + 7) / 8 -> 自由链表序号, 不小于 MIN_BLOCK_BYTES
+    uint16_t band_base[constant::MAX_ALLOC_SHIFT]{}; // 区间 (2^k, 2^(k+1)] 的第一个块大小的序号
+
+    constexpr SizeClassTable() noexcept {
+        FillSizeClasses(sizes);
+        size_t index = 0;
+        for (size_t i = 0; i < std::size(small_index); ++i) {
+            while (sizes[index] < std::max(i * constant::MIN_CLASS_ALIGN, constant::MIN_BLOCK_BYTES)) {
+                ++index;
+            }
+            small_index[i] = static_cast<uint16_t>(index);
+        }
+        index = 0;
+        for (int k = 0; k < constant::MAX_ALLOC_SHIFT; ++k) {
+            while (sizes[index] <= (size_t{1} << k)) {
+                ++index;
+            }
+            band_base[k] = static_cast<uint16_t>(index);
+        }
+    }
+};
+
+inline constexpr SizeClassTable SIZE_CLASS_TABLE{};
+}
 
+namespace details::constant {
+inline constexpr int FREE_LIST_SIZE = SizeClassTable::COUNT; // 自由链表个数， 默认192个
 }
 
+/**
+ * pc中空闲span归还OS的配置， 由后台回收线程(Scavenger)或者 tnc_release_memory 使用
+ */
+struct ReleaseConfig {
+    size_t release_age_ms{5000}; // span在pc中空闲超过该时间才会被归还
+    size_t retain_bytes{32 << 20}; // 预算: pc中最多保留的驻留空闲字节数， 不超过预算时不归还
+    size_t release_rate{2560}; // 后台线程每秒最多归还的页数， 默认10MB/s
+    size_t interval_ms{1000}; // 后台线程扫描间隔
+    bool lazy{false}; // 使用 MADV_FREE 代替 MADV_DONTNEED
+};
+
+/**
+ * pc 的大页模式， 只影响之后新映射的区域
+ */
+enum class HugePageMode {
+    none, // 每次映射128页(512KB)
+    transparent, // 映射2MB对齐的区域并 madvise(MADV_HUGEPAGE)， 由内核使用透明大页
+    hugetlb, // 优先使用 MAP_HUGETLB 预留的大页， 没有可用的大页时退回透明大页
+};
+
+/**
+ * pc 的大页覆盖统计
+ */
+struct HugePageStats {
+    size_t system_bytes; // 当前pc从OS映射的字节数
+    size_t hugepage_bytes; // 其中以2MB大页区域映射的字节数
+    size_t hugepage_used_bytes; // 大页区域中正在使用(分配给cc或者用户)的字节数
+    size_t hugepage_regions; // 大页区域个数
+    size_t hugetlb_regions; // 其中通过 MAP_HUGETLB 映射的个数
+    size_t region_release_count; // 大页区域整体归还OS的累计次数
+};
+
+/**
+ * pc 与OS之间的内存统计
+ */
+struct ReleaseStats {
+    size_t system_bytes; // 当前span从OS映射的字节数
+    size_t free_bytes; // pc中空闲且仍然驻留内存的字节数
+    size_t released_bytes; // pc中空闲且已经归还OS的字节数
+    size_t release_count; // 累计归还次数(madvise调用次数)
+    size_t total_released_bytes; // 累计归还OS的字节数
+};
+
+/**
+ * 一个块大小(size class)的内存块统计
+ */
+struct SizeClassStats {
+    size_t block_size; // 内存块大小
+    size_t span_count; // cc中该块大小的span个数
+    size_t thread_cache_blocks; // 缓存在tc(包括per-cpu缓存)自由链表中的块数
+    size_t central_cache_blocks; // cc中空闲的块数(span中和传输缓存中)
+    size_t in_use_blocks; // 正在被用户使用的块数
+};
+
+/**
+ * tc的累计计数， 每个tc只由自己的线程递增， 统计时汇总所有tc(包括已经退出的线程)
+ */
+struct ThreadCacheCounters {
+    size_t alloc_count; // 小块内存申请次数
+    size_t free_count; // 小块内存释放次数
+    size_t central_fetch_count; // 自由链表为空时向cc批量申请的次数
+    size_t central_release_count; // 向cc批量归还的次数
+    size_t scavenge_count; // 缓存超过上限触发收缩的次数
+    size_t remote_free_count; // 释放到其他线程远程释放队列的内存块数
+    size_t remote_collect_count; // 从本线程远程释放队列整批取回的次数
+};
+
+/**
+ * 内存池的整体统计， 由 tnc_get_stats 按需汇总
+ * 各层分别在自己的锁内统计， 整体不是一个原子的快照， 同时有线程在申请释放时各项之间可能有少量偏差
+ */
+struct MallocStats {
+    SizeClassStats size_classes[details::constant::FREE_LIST_SIZE];
+    size_t page_cache_free_spans[details::constant::MAX_PAGE_COUNT]; // pc中的空闲span个数， 下标i对应i+1页
+
+    size_t system_bytes; // span从OS映射的字节数
+    size_t mmap_bytes; // 其中通过mmap映射的字节数
+    size_t brk_bytes; // 其中通过brk申请的字节数， 全部使用mmap， 恒为0
+    size_t page_cache_free_bytes; // pc中空闲且驻留内存的字节数
+    size_t page_cache_released_bytes; // pc中空闲且已经归还OS的字节数
+    size_t central_cache_bytes; // cc中空闲内存块的字节数
+    size_t thread_cache_bytes; // tc中缓存的字节数
+    size_t small_in_use_bytes; // 用户正在使用的小块内存字节数
+    size_t large_in_use_bytes; // 用户正在使用的直接由pc分配的字节数(大块内存和大对齐内存)
+    double fragmentation; // 驻留内存中没有被用户使用的比例 1 - in_use / (system - released)
+
+    size_t span_pool_in_use; // 正在使用的span对象个数
+    size_t span_pool_bytes; // span定长内存池向OS申请的字节数
+
+    size_t thread_cache_count; // 存活的tc个数(包括per-cpu缓存)
+    ThreadCacheCounters thread_cache_counters;
+
+    // 各层的命中情况， tc向cc批量申请时依次尝试 传输缓存 -> cc的span -> pc
+    size_t transfer_cache_hits; // 直接从传输缓存整批取到内存块的次数
+    size_t central_span_fetches; // 从cc的span中切分内存块的次数
+    size_t page_cache_span_fetches; // cc向pc申请新span的次数
+    size_t page_cache_system_allocs; // pc向OS映射内存的次数
+};
+
 namespace details {
 /**
  * 超过128个page的内存块， 直接由MMAP系统调用去映射，  使用匿名 anonymous   文件描述符设为-1即不映射文件
 */
-inline void* SystemAllocMMap(const size_t page_count) {
+inline void* SystemAllocMMapNoThrow(const size_t page_count) noexcept {
 #ifdef _WIN32
     void* mem_ptr = VirtualAlloc(0, page_count << PAGE_SHIFT, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 #else
     // 由OS决定从哪里分配， 读写， 不影响其他进程， 不与文件关联
     void* mem_ptr = mmap(nullptr, page_count << constant::PAGE_SHIFT, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem_ptr == MAP_FAILED) {
+        mem_ptr = nullptr;
+    }
 #endif
+    return mem_ptr;
+}
+
+inline void* SystemAllocMMap(const size_t page_count) {
+    void* mem_ptr = SystemAllocMMapNoThrow(page_count);
     if (mem_ptr == nullptr) {
         throw std::bad_alloc();
     }
@@ -52,78 +294,195 @@ inline void SystemFreeMMap(void* ptr, const size_t page_count) {
 }
 
 
+/**
+ * 映射一个2MB对齐的大页区域， 失败时返回nullptr， 由调用方退回普通映射
+ * @param hugetlb 优先使用 MAP_HUGETLB(需要系统预留大页)
+ * @param is_hugetlb 返回是否通过 MAP_HUGETLB 映射
+ */
+inline void* SystemAllocHugeRegion(const bool hugetlb, bool& is_hugetlb) noexcept {
+    is_hugetlb = false;
+#ifdef _WIN32
+    return nullptr;
+#else
+    constexpr size_t bytes = size_t{1} << constant::HUGE_PAGE_SHIFT;
+#ifdef MAP_HUGETLB
+    if (hugetlb) {
+        void* mem_ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem_ptr != MAP_FAILED) {
+            is_hugetlb = true;
+            return mem_ptr;
+        }
+    }
+#endif
+    // 多映射一个大页的长度， 再裁掉两端， 得到2MB对齐的区域
+    void* mem_ptr = mmap(nullptr, bytes * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem_ptr == MAP_FAILED) {
+        return nullptr;
+    }
+    const auto start = reinterpret_cast<size_t>(mem_ptr);
+    const size_t aligned = (start + bytes - 1) & ~(bytes - 1);
+    if (aligned > start) {
+        munmap(mem_ptr, aligned - start);
+    }
+    munmap(reinterpret_cast<void*>(aligned + bytes), start + bytes - aligned);
+#ifdef MADV_HUGEPAGE
+    madvise(reinterpret_cast<void*>(aligned), bytes, MADV_HUGEPAGE);
+#endif
+    return reinterpret_cast<void*>(aligned);
+#endif
+}
+
+/**
+ * 调整一段mmap映射的大小， 必要时移动到新的地址， 页面内容由内核通过修改页表保留， 不复制数据
+ * @return 失败时返回nullptr
+ */
+inline void* SystemRemap(void* ptr, const size_t old_page_count, const size_t new_page_count) noexcept {
+#if defined(_WIN32) || !defined(MREMAP_MAYMOVE)
+    return nullptr;
+#else
+    void* mem_ptr = mremap(ptr, old_page_count << constant::PAGE_SHIFT, new_page_count << constant::PAGE_SHIFT, MREMAP_MAYMOVE);
+    return mem_ptr == MAP_FAILED ? nullptr : mem_ptr;
+#endif
+}
+
+/**
+ * 将一段页面的物理内存归还OS， 虚拟地址仍然保留， 之后再访问时由缺页中断重新分配(全0页)
+ * @param lazy 使用 MADV_FREE， 内核在内存紧张时才真正回收， 之前再次写入则不会产生缺页， 但RSS不会立即下降
+ */
+inline bool SystemRelease(void* ptr, const size_t page_count, const bool lazy) noexcept {
+#ifdef _WIN32
+    return VirtualAlloc(ptr, page_count << constant::PAGE_SHIFT, MEM_RESET, PAGE_READWRITE) != nullptr;
+#else
+#ifdef MADV_FREE
+    if (lazy) {
+        return madvise(ptr, page_count << constant::PAGE_SHIFT, MADV_FREE) == 0;
+    }
+#endif
+    return madvise(ptr, page_count << constant::PAGE_SHIFT, MADV_DONTNEED) == 0;
+#endif
+}
+
+/**
+ * 向OS申请页面， 全部使用mmap:
+ * brk申请的堆内存只能从堆顶收缩， 空闲的span无法归还OS， 并且与 glibc 的 malloc 并发调整堆尾是不安全的
+ */
 inline void* SystemAlloc(const size_t page_count)
 {
-    if (page_count > constant::MAX_PAGE_COUNT) {
-        return SystemAllocMMap(page_count);
+    return SystemAllocMMap(page_count);
+}
+
+/**
+ * 检测到内存破坏时输出错误和地址后终止进程， 不申请堆内存
+ */
+[[noreturn]] inline void SystemAbort(const char* what, const void* ptr) noexcept {
+#ifndef _WIN32
+    char buf[128];
+    size_t len = 0;
+    for (const char* p = "hnc_malloc: "; *p != '\0'; ++p) buf[len++] = *p;
+    for (const char* p = what; *p != '\0' && len < 96; ++p) buf[len++] = *p;
+    buf[len++] = ' ';
+    buf[len++] = '0';
+    buf[len++] = 'x';
+    const auto value = reinterpret_cast<uintptr_t>(ptr);
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        buf[len++] = "0123456789abcdef"[(value >> shift) & 0xf];
     }
+    buf[len++] = '\n';
+    [[maybe_unused]] const ssize_t ret = write(STDERR_FILENO, buf, len);
+#endif
+    abort();
+}
+
+/**
+ * 系统的NUMA节点数， 读取 /sys/devices/system/node/possible ("0" 或者 "0-1")， 不申请堆内存
+ * @return 读取失败时返回1
+ */
+inline size_t SystemNumaNodeCount() noexcept {
 #ifdef _WIN32
-    void* ptr = VirtualAlloc(0, page_count << constant::PAGE_SHIFT, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    return 1;
 #else
-    // 使用brk系统调用调整进程堆尾指针来扩展堆内存
-    void *ptr = sbrk(0);
-    if (brk((sbrk(0) + (page_count << constant::PAGE_SHIFT))) == -1) {
-        perror("brk failed");
-        ptr = nullptr;
+    const int fd = open("/sys/devices/system/node/possible", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 1;
+    }
+    char buf[64];
+    const ssize_t len = read(fd, buf, sizeof(buf));
+    close(fd);
+    // 最后一个数字是最大的节点号
+    size_t max_node = 0, value = 0;
+    for (ssize_t i = 0; i < len; ++i) {
+        if (buf[i] >= '0' && buf[i] <= '9') {
+            value = value * 10 + (buf[i] - '0');
+        } else if (i > 0 && buf[i - 1] >= '0' && buf[i - 1] <= '9') {
+            max_node = value;
+            value = 0;
+        }
     }
+    if (len > 0 && buf[len - 1] >= '0' && buf[len - 1] <= '9') {
+        max_node = value;
+    }
+    return max_node + 1;
 #endif
-    if (ptr == nullptr)
-        throw std::bad_alloc();
-    return ptr;
 }
 
-inline size_t _RoundUp(const size_t size, const size_t alignment) noexcept {
-    return (size + alignment - 1) & ~ (alignment - 1);
+// 当前线程所在cpu的NUMA节点号， 只在线程第一次访问pc时调用
+inline size_t SystemCurrentNode() noexcept {
+#if defined(_WIN32) || !defined(SYS_getcpu)
+    return 0;
+#else
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return node;
+#endif
 }
 
-// 将申请字节对齐
-inline size_t RoundUp(const size_t size) noexcept {
-    if (size >= 1 && size <= 128)
-        return _RoundUp(size, 8);
-    if (size <= 1024)
-        return _RoundUp(size, 16);
-    if (size <= 8 * 1024)
-        return _RoundUp(size, 128);
-    if (size <= 64 * 1024)
-        return _RoundUp(size, 1024);
-    if (size <= 256 * 1024)
-        return _RoundUp(size, 8 * 1024);
-    // 超出256KB的大量 直接对齐到一个Page
-    return _RoundUp(size, 1 << constant::PAGE_SHIFT);
+/**
+ * 将一段刚映射(还没有访问)的页面优先分配在node节点上， 缺页时内核从该节点分配物理页
+ * 使用 MPOL_PREFERRED 而不是 MPOL_BIND: 节点内存不足时退回其他节点， 不会因此OOM
+ */
+inline void SystemBindNode(void* ptr, const size_t page_count, const size_t node) noexcept {
+#if defined(_WIN32) || !defined(SYS_mbind) || !defined(MPOL_PREFERRED)
+    (void)ptr, (void)page_count, (void)node;
+#else
+    const unsigned long node_mask = 1UL << node;
+    // maxnode 按照内核的约定比掩码位数多1
+    syscall(SYS_mbind, ptr, page_count << constant::PAGE_SHIFT, MPOL_PREFERRED, &node_mask, sizeof(node_mask) * 8 + 1, 0);
+#endif
 }
-// 获取对应字节数所属的自由链表序号
-inline size_t _Index(const size_t size, const size_t align_shift) noexcept
-{							/*这里align_shift是指对齐数的二进制位数。比如size为2的时候对齐数
-                            为8，8就是2^3，所以此时align_shift就是3*/
-    return ((size + (1 << align_shift) - 1) >> align_shift) - 1;
-    //这里_Index计算的是当前size所在区域的第几个下标，所以Index的返回值需要加上前面所有区域的哈希桶的个数
+
+inline size_t _RoundUp(const size_t size, const size_t alignment) noexcept {
+    return (size + alignment - 1) & ~ (alignment - 1);
 }
 
 // 计算映射的哪一个自由链表桶
 inline size_t Index(const size_t size) noexcept
 {
     assert(size <= constant::MAX_ALLOC_BYTES);
+    // 小块内存直接查表
+    if (size <= constant::SMALL_LOOKUP_BYTES) {
+        return SIZE_CLASS_TABLE.small_index[(size + constant::MIN_CLASS_ALIGN - 1) / constant::MIN_CLASS_ALIGN];
+    }
+    // size 位于 (2^k, 2^(k+1)]， 区间内步长为 2^(k - CLASS_SPLITS_SHIFT)
+    const int k = std::bit_width(size - 1) - 1;
+    const size_t offset = size - (size_t{1} << k) - 1;
+    return SIZE_CLASS_TABLE.band_base[k] + (offset >> (k - constant::CLASS_SPLITS_SHIFT));
+}
 
-    // 每个区间有多少个链
-    static int group_array[4] = { 16, 56, 56, 56 };
-    if (size <= 128)
-        // [1,128] 8B -->8B就是2^3B，对应二进制位为3位
-            return _Index(size, 3); // 3是指对齐数的二进制位位数，这里8B就是2^3B，所以就是3
-    if (size <= 1024)
-        // [128+1,1024] 16B -->4位
-            return _Index(size - 128, 4) + group_array[0];
-    if (size <= 8 * 1024)
-        // [1024+1,8*1024] 128B -->7位
-            return _Index(size - 1024, 7) + group_array[1] + group_array[0];
-    if (size <= 64 * 1024)
-        // [8*1024+1,64*1024] 1024B -->10位
-            return _Index(size - 8 * 1024, 10) + group_array[2] + group_array[1] + group_array[0];
-    if (size <= 256 * 1024)
-        // [64*1024+1,256*1024] 8 * 1024B  -->13位
-            return _Index(size - 64 * 1024, 13) + group_array[3] + group_array[2] + group_array[1] + group_array[0];
-
-    assert(false);
-    return -1;
+// 自由链表序号对应的内存块大小， Index 的逆运算
+inline size_t IndexToSize(const size_t index) noexcept {
+    assert(index < constant::FREE_LIST_SIZE);
+    return SIZE_CLASS_TABLE.sizes[index];
+}
+
+// 将申请字节对齐到所属的块大小
+inline size_t RoundUp(const size_t size) noexcept {
+    if (size <= constant::MAX_ALLOC_BYTES) {
+        return IndexToSize(Index(size));
+    }
+    // 超出256KB的大量 直接对齐到一个Page
+    return _RoundUp(size, 1 << constant::PAGE_SHIFT);
 }
 
 // 获取不同块大小的内存块最高可申请内存块数的上限阈值
@@ -141,110 +500,6 @@ inline size_t BlockThreshHold(const size_t align_size) noexcept {
     return max_block_count;
 }
 
-// Three-level radix tree for 64-bit address space
-template <int BITS>
-class TCMalloc_PageMap3 {
-private:
-    static const int ROOT_BITS = 8;  // 根节点：64位下，前8位表示根节点
-    static const int ROOT_LENGTH = 1 << ROOT_BITS;  // 根节点的长度
-
-    static const int MID_BITS = 8;  // 中间节点：64位下，中间8位表示中间节点
-    static const int MID_LENGTH = 1 << MID_BITS;  // 中间节点的长度
-
-    static const int LEAF_BITS = BITS - ROOT_BITS - MID_BITS;  // 剩余的BITS用于叶子节点
-    static const int LEAF_LENGTH = 1 << LEAF_BITS;  // 叶子节点的长度
-
-    // Leaf node
-    struct Leaf {
-        void* values[LEAF_LENGTH];
-    };
-
-    // 中间节点
-    struct Mid {
-        Leaf* leafs[MID_LENGTH];
-    };
-
-    // 根节点
-    struct Root {
-        Mid* mids[ROOT_LENGTH];
-    };
-
-    Root* root_;  // 整个树的根
-
-public:
-    typedef size_t Number;  // 64位系统下的地址类型
-
-    explicit TCMalloc_PageMap3() {
-        root_ = new Root();
-        memset(root_, 0, sizeof(*root_));  // 初始化根节点
-        PreallocateMoreMemory();  // 预分配内存，确保能存储2^64大小的数据
-    }
-
-    void* get(Number k) const {
-        const Number i1 = k >> (MID_BITS + LEAF_BITS);  // 根节点索引
-        const Number i2 = (k >> LEAF_BITS) & (MID_LENGTH - 1);  // 中间节点索引
-        const Number i3 = k & (LEAF_LENGTH - 1);  // 叶子节点索引
-
-        if ((k >> BITS) > 0 || root_->mids[i1] == NULL || root_->mids[i1]->leafs[i2] == NULL) {
-            return NULL;  // 如果超出范围或者对应节点为空，返回NULL
-        }
-        return root_->mids[i1]->leafs[i2]->values[i3];  // 返回对应叶子节点的值
-    }
-
-    void set(Number k, void* v) {
-        const Number i1 = k >> (MID_BITS + LEAF_BITS);  // 根节点索引
-        const Number i2 = (k >> LEAF_BITS) & (MID_LENGTH - 1);  // 中间节点索引
-        const Number i3 = k & (LEAF_LENGTH - 1);  // 叶子节点索引
-
-        assert(i1 < ROOT_LENGTH);
-        if (root_->mids[i1] == NULL) {
-            root_->mids[i1] = new Mid();  // 如果没有中间节点，创建一个新的中间节点
-            memset(root_->mids[i1], 0, sizeof(Mid));  // 初始化中间节点
-        }
-        if (root_->mids[i1]->leafs[i2] == NULL) {
-            root_->mids[i1]->leafs[i2] = new Leaf();  // 如果没有叶子节点，创建一个新的叶子节点
-            memset(root_->mids[i1]->leafs[i2], 0, sizeof(Leaf));  // 初始化叶子节点
-        }
-
-        root_->mids[i1]->leafs[i2]->values[i3] = v;  // 设置值
-    }
-
-    // 确保从start开始的n页内存空间已经被开辟
-    bool Ensure(Number start, size_t n) {
-        for (Number key = start; key <= start + n - 1;) {
-            const Number i1 = key >> (MID_BITS + LEAF_BITS);  // 根节点索引
-            const Number i2 = (key >> LEAF_BITS) & (MID_LENGTH - 1);  // 中间节点索引
-
-            // 检查溢出
-            if (i1 >= ROOT_LENGTH)
-                return false;
-
-            // 如果根节点没有中间节点，分配一个
-            if (root_->mids[i1] == NULL) {
-                root_->mids[i1] = new Mid();
-                memset(root_->mids[i1], 0, sizeof(Mid));
-            }
-
-            // 如果中间节点没有叶子节点，分配一个
-            if (root_->mids[i1]->leafs[i2] == NULL) {
-                root_->mids[i1]->leafs[i2] = new Leaf();
-                memset(root_->mids[i1]->leafs[i2], 0, sizeof(Leaf));
-            }
-
-            // 递增key，跳过当前叶子节点覆盖的区域
-            key = ((key >> (MID_BITS + LEAF_BITS)) + 1) << (MID_BITS + LEAF_BITS);
-        }
-        return true;
-    }
-
-    // 预分配足够的内存空间
-    void PreallocateMoreMemory() {
-        // 分配足够的内存来跟踪所有可能的页面
-        Ensure(0, 1 << BITS);
-    }
-};
-
-
 }
 
 }
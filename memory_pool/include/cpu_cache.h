@@ -0,0 +1,96 @@
+#pragma once
+
+#include "common.h"
+#include "thread_cache.h"
+
+#include <atomic>
+
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define HNC_HAS_RSEQ 1
+#endif
+
+namespace hnc::core::mem_pool::details {
+/**
+ * per-cpu 缓存， 线程局部缓存之外的可选前端(编译时定义 HNC_MALLOC_PER_CPU)
+ *
+ * 1. 每个cpu一个缓存(不属于任何线程的ThreadCache)， 内存占用与核数成正比而不是线程数，
+ *    几百个大部分时间空闲的线程共享所在cpu的缓存， 命中率也更高
+ * 2. 当前cpu号从 rseq 区域读取(glibc 2.35+ 为每个线程注册)， 只是一次TLS内存读取， 没有系统调用
+ * 3. 读到cpu号之后线程仍然可能被迁移， 每个cpu的缓存由一个自旋锁保护:
+ *    只有线程在临界区内被抢占或迁移时才会竞争， 正常情况下只是一次无竞争的原子交换
+ *    临界区只有自由链表的弹出/压入， 向cc申请和归还内存块、调整缓存上限都在释放锁之后进行，
+ *    缓存本身也在加锁之前创建， 持有锁的线程不会阻塞在任何互斥锁或者 mmap 上， 等待它的线程自旋的时间也很短
+ * 4. rseq 不可用(内核不支持或者 GLIBC_TUNABLES=glibc.pthread.rseq=0)时退回到线程局部缓存
+ */
+class CpuCache {
+public:
+    static constexpr int MAX_CPU_COUNT = 1024; // 超过的cpu号同样退回到线程局部缓存
+
+    // 全局per-cpu缓存单例接口
+    static CpuCache& GetInstance() noexcept {
+        return _m_cpu_cache;
+    }
+
+    /**
+     * 当前线程所在的cpu号
+     * @return rseq 不可用时返回 -1
+     */
+    static int current_cpu() noexcept {
+#ifdef HNC_HAS_RSEQ
+        if (__rseq_size == 0) [[unlikely]] {
+            return -1;
+        }
+        const auto rs = reinterpret_cast<const volatile struct rseq*>(
+            static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+        // 未注册时为 RSEQ_CPU_ID_UNINITIALIZED(-1) 或 RSEQ_CPU_ID_REGISTRATION_FAILED(-2)
+        const auto cpu = static_cast<int>(rs->cpu_id);
+        return cpu < MAX_CPU_COUNT ? cpu : -1;
+#else
+        return -1;
+#endif
+    }
+
+    // 从cpu对应的缓存中分配size大小的内存块， 向OS申请内存失败时返回nullptr
+    void* allocate(int cpu, size_t size) noexcept;
+
+    // 将对齐后大小为align_size的内存块释放到cpu对应的缓存， owner 不为0时先尝试送回所属线程的远程释放队列
+    void deallocate(int cpu, void* obj, size_t align_size, uint16_t owner = 0) noexcept;
+
+    // 批量申请/释放， 整批只加一次锁， 申请返回写入out的块数
+    size_t allocate_batch(int cpu, size_t size, size_t count, void** out) noexcept;
+    void deallocate_batch(int cpu, void** objs, size_t count, size_t align_size) noexcept;
+
+    // fork前锁住所有cpu的缓存， 避免子进程继承到其他线程持有的锁
+    void lock_all() noexcept;
+    void unlock_all() noexcept;
+
+private:
+    CpuCache() = default;
+    ~CpuCache() = default;
+
+    CpuCache(const CpuCache&) = delete;
+    CpuCache(CpuCache&&) = delete;
+    CpuCache& operator=(const CpuCache&) = delete;
+    CpuCache& operator=(CpuCache&&) = delete;
+
+    // 每个cpu的缓存独占缓存行， 避免不同cpu之间的伪共享
+    struct alignas(64) Slab {
+        std::atomic<bool> _locked{false};
+        std::atomic<ThreadCache*> _cache{nullptr}; // 第一次使用时在锁外创建， CAS发布
+
+        void lock() noexcept;
+        void unlock() noexcept {
+            _locked.store(false, std::memory_order_release);
+        }
+    };
+
+    // 锁住cpu对应的缓存并返回， 缓存不存在时先在锁外创建， 创建失败时不加锁并返回nullptr
+    ThreadCache* _m_lock_cache(int cpu) noexcept;
+
+private:
+    Slab _m_slabs[MAX_CPU_COUNT];
+    // 必须在cpp中初始化，否则每个翻译单元包含一个static，违背ODR原则，重复定义编译报错
+    static CpuCache _m_cpu_cache;
+};
+}
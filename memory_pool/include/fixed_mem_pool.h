@@ -3,13 +3,19 @@
 #include "common.h"
 #include <freelist.h>
 
+#include <mutex>
+
 namespace hnc::core::mem_pool::details {
 
 // 内存池， 对象size固定
 template<class T>
 class FixedMemPool {
 public:
-    T* New() {
+    /**
+     * 调用方通常持有pc等内部锁， 不能抛出异常(作为替换库时异常对象由 malloc 申请， 会等待同一把锁)
+     * @return 向OS申请内存失败时返回nullptr， 由调用方解锁后再报告失败
+     */
+    T* New() noexcept {
         // ① 自由链表不为nullptr，即有内存块，直接分配出去, 优先使用归还的内存块分配
         if (_m_free_list){
             // 获取下一个内存块地址
@@ -18,6 +24,7 @@ public:
             auto p = _m_free_list;
             // 更新自由链表
             _m_free_list = next;
+            ++_m_in_use_count;
             // 显式对第一个节点内存块调用T构造方法
             new(p)T;
             return static_cast<T*>(p);
@@ -26,11 +33,16 @@ public:
         // 内存区域中剩余字节数少于 T 或者 初次开辟内存
         if (_m_remain_bytes < sizeof(T))
         {
-            // 更新剩余字节数 ，申请128KB
-            _m_remain_bytes = 128 * 1024;
-
-            // 使用brk()系统调用调整进程堆区指针来获得堆内存
-            _m_mem = static_cast<char*>(SystemAlloc(_m_remain_bytes >> constant::PAGE_SHIFT));
+            // 直接向OS申请(mmap) 128KB
+            constexpr size_t CHUNK_BYTES = 128 * 1024;
+            void* mem = SystemAllocMMapNoThrow(CHUNK_BYTES >> constant::PAGE_SHIFT);
+            if (mem == nullptr) [[unlikely]] {
+                return nullptr;
+            }
+            // 更新剩余字节数
+            _m_mem = static_cast<char*>(mem);
+            _m_remain_bytes = CHUNK_BYTES;
+            _m_system_bytes += _m_remain_bytes;
         }
 
         // 初始化内存块上的T对象
@@ -40,6 +52,7 @@ public:
         // 更新内存指针和剩余字节数
         _m_mem += obj_size;
         _m_remain_bytes -= obj_size;
+        ++_m_in_use_count;
         // 显式调用对象构造函数
         new(obj)T;
         return obj;
@@ -54,6 +67,15 @@ public:
         // 将该内存块回收
         GetNextAddr(obj) = _m_free_list; // obj内存块存储原头节点地址
         _m_free_list = obj; // 自由链表执行新内存块地址
+        --_m_in_use_count;
+    }
+
+    // 正在使用的对象个数和向OS申请的字节数， 与New/Delete在同一把锁内读取
+    size_t in_use_count() const noexcept {
+        return _m_in_use_count;
+    }
+    size_t system_bytes() const noexcept {
+        return _m_system_bytes;
     }
 
     void lock() noexcept {
@@ -68,6 +90,8 @@ private:
     char* _m_mem{nullptr}; // 指向内存块的指针
     size_t _m_remain_bytes{0}; // 剩余字节数
     void* _m_free_list{nullptr}; // 自由链表
+    size_t _m_in_use_count{0}; // 正在使用的对象个数
+    size_t _m_system_bytes{0}; // 向OS申请的字节数
 
     std::mutex _m_mtx;
 };
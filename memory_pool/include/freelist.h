@@ -2,12 +2,64 @@
 
 #include <cstddef>
 
+#ifdef HNC_MALLOC_HARDENED
+#include "common.h"
+
+#include <sys/auxv.h>
+#endif
+
 // 自由链表 管理多个定长内存块
 namespace hnc::core::mem_pool::details {
 
+#ifndef HNC_MALLOC_HARDENED
 inline void*& GetNextAddr(void* obj) {
     return *static_cast<void**>(obj);
 }
+#else
+// 进程启动时内核提供的随机数(AT_RANDOM)， 不依赖任何初始化， 第一次读取后缓存
+inline uintptr_t HardenedSecret() noexcept {
+    static const uintptr_t secret = *reinterpret_cast<const uintptr_t*>(getauxval(AT_RANDOM));
+    return secret;
+}
+
+/**
+ * 加固模式下空闲内存块中保存的next指针与随机数和自身所在的页号异或后存储(safe-linking)
+ * 释放后写入的数据解码后几乎不可能是合法地址， 读取时检查对齐和地址范围， 发现被改写立即终止
+ * 所有读写next指针的地方都经过 GetNextAddr， 因此返回一个代理对象， 用法与引用相同
+ */
+class EncodedNext {
+public:
+    explicit EncodedNext(void* obj) noexcept : _m_slot(static_cast<uintptr_t*>(obj)) {}
+
+    operator void*() const noexcept {
+        const uintptr_t next = *_m_slot ^ _m_key();
+        if ((next & (sizeof(void*) - 1)) != 0 || (next >> constant::ADDRESS_BITS) != 0) [[unlikely]] {
+            SystemAbort("corrupted free list (write after free?) in block", _m_slot);
+        }
+        return reinterpret_cast<void*>(next);
+    }
+
+    EncodedNext& operator=(void* next) noexcept {
+        *_m_slot = reinterpret_cast<uintptr_t>(next) ^ _m_key();
+        return *this;
+    }
+
+    EncodedNext& operator=(const EncodedNext& other) noexcept {
+        return *this = static_cast<void*>(other);
+    }
+
+private:
+    uintptr_t _m_key() const noexcept {
+        return HardenedSecret() ^ (reinterpret_cast<uintptr_t>(_m_slot) >> constant::PAGE_SHIFT);
+    }
+
+    uintptr_t* _m_slot;
+};
+
+inline EncodedNext GetNextAddr(void* obj) {
+    return EncodedNext(obj);
+}
+#endif
 
 class Freelist {
 public:
@@ -18,6 +70,13 @@ public:
 
     void increment() noexcept;
 
+    // 收缩一次可申请的内存块数， 减半但不小于1
+    void shrink() noexcept;
+
+    // 上次重置以来自由链表的最小长度， 这部分内存块一直没有被使用
+    size_t low_water() const noexcept;
+    void reset_low_water() noexcept;
+
     size_t size() const noexcept;
 
     /**  将一个内存块归还给自由链表*/
@@ -32,6 +91,7 @@ private:
     void* _m_freelist_header{nullptr};
     size_t _m_apply_count{1}; // 当前自由链表一次可申请的内存块数，但不会超过thresh_hold阈值
     size_t _m_size{};
+    size_t _m_low_water{}; // 自由链表长度的低水位
 };
 
 }
@@ -0,0 +1,290 @@
+#pragma once
+
+#include "common.h"
+#include "span.h"
+
+#include <cstring>
+#include <iterator>
+
+namespace hnc::core::mem_pool::details {
+/**
+ * 加固模式(HNC_MALLOC_HARDENED)的检查， 未开启时全部为空函数， 不影响正常的申请释放路径
+ *
+ * 1. 小块内存尾部 CANARY_BYTES 字节写入与地址相关的金丝雀， 释放时检查， 发现越界写入后终止
+ * 2. span中每个内存块一个释放位， 释放时已经置位说明重复释放， 回到自由链表时清除; 申请路径不查找span
+ * 3. 释放的内存块头部填充释放标记后放入tc的隔离区， 被挤出时检查标记是否被改写(释放后使用)， 然后才回到自由链表
+ *    其他线程释放的内存块送回所属线程的远程释放队列， 不经过隔离区， 所属线程取回时同样检查
+ *    第二个字记录加密后的span和块序号， 回到自由链表时不需要查找span; 金丝雀的位置写入释放标记， 之后再次释放同样能发现
+ *    最小块大小为 MIN_BLOCK_BYTES， 链表指针、记录和金丝雀互不重叠
+ * 4. 直接分配的大块内存尾部多映射一页并设置为不可访问， 越界访问立即触发段错误
+ *
+ * 填充字节数、隔离区大小、完整检查的采样间隔和是否写金丝雀在编译时可调， 见下面的常量和 CANARY_BYTES;
+ * 没有采样到的释放只确认span在使用中， 记录写为0， 不填充也不进入隔离区
+ */
+namespace hardened {
+inline constexpr unsigned char POISON_BYTE = 0xdb; // 隔离区中内存块的填充值
+inline constexpr uint64_t POISON_WORD = 0xdbdbdbdbdbdbdbdbULL;
+// 每个内存块最多填充的字节数(默认一个缓存行)， 0 表示不填充， 不再检查释放后写入
+#ifdef HNC_MALLOC_HARDENED_POISON_BYTES
+inline constexpr size_t POISON_BYTES = HNC_MALLOC_HARDENED_POISON_BYTES;
+#else
+inline constexpr size_t POISON_BYTES = 64;
+#endif
+static_assert(POISON_BYTES % sizeof(uint64_t) == 0, "HNC_MALLOC_HARDENED_POISON_BYTES must be a multiple of 8");
+// 每个tc隔离区的内存块数， 0 表示释放后直接回到自由链表
+#ifdef HNC_MALLOC_HARDENED_QUARANTINE
+inline constexpr size_t QUARANTINE_COUNT = HNC_MALLOC_HARDENED_QUARANTINE;
+#else
+inline constexpr size_t QUARANTINE_COUNT = 128;
+#endif
+// 每个线程每 SAMPLE_PERIOD 次释放做一次完整检查(金丝雀、释放位、填充和隔离区)， 默认每次都检查
+#ifdef HNC_MALLOC_HARDENED_SAMPLE
+inline constexpr size_t SAMPLE_PERIOD = HNC_MALLOC_HARDENED_SAMPLE;
+#else
+inline constexpr size_t SAMPLE_PERIOD = 1;
+#endif
+static_assert(SAMPLE_PERIOD >= 1, "HNC_MALLOC_HARDENED_SAMPLE must be at least 1");
+}
+
+#ifdef HNC_MALLOC_HARDENED
+namespace hardened {
+inline uintptr_t canary_of(const void* addr) noexcept {
+    return HardenedSecret() ^ reinterpret_cast<uintptr_t>(addr) ^ 0x5a5a5a5a5a5a5a5aULL;
+}
+
+// 金丝雀位于内存块的最后 CANARY_BYTES 字节
+inline uintptr_t* canary_slot(void* obj, const size_t align_size) noexcept {
+    return reinterpret_cast<uintptr_t*>(static_cast<char*>(obj) + align_size - constant::CANARY_BYTES);
+}
+
+// 释放后写入金丝雀第一个字的值， 与金丝雀不同， 再次释放时据此判断重复释放
+inline uintptr_t freed_mark_of(const void* addr) noexcept {
+    return ~canary_of(addr);
+}
+
+inline size_t poison_size(const size_t align_size) noexcept {
+    return std::min(align_size - constant::CANARY_BYTES, POISON_BYTES);
+}
+
+// 释放后第二个字的记录: span地址的高位不使用， 存放块序号
+inline constexpr uintptr_t SPAN_MASK = (uintptr_t{1} << constant::ADDRESS_BITS) - 1;
+
+static_assert(constant::MIN_BLOCK_BYTES >= 2 * sizeof(uintptr_t) + constant::CANARY_BYTES);
+inline uintptr_t* record_slot(void* obj) noexcept {
+    return static_cast<uintptr_t*>(obj) + 1;
+}
+
+// 本线程距离下一次完整检查还有几次释放
+inline thread_local size_t free_countdown HNC_TLS_INITIAL_EXEC = 0;
+
+// span内的偏移乘以倒数的误差(小于块大小)不超过 2^MAGIC_SHIFT 时， 乘以 _block_magic 后右移的结果与除法相同
+inline constexpr int MAGIC_SHIFT = 40;
+static_assert((size_t{constant::MAX_PAGE_COUNT} << constant::PAGE_SHIFT) * constant::MAX_ALLOC_BYTES <= size_t{1} << MAGIC_SHIFT);
+
+// 内存块在span中的序号， 不是块的起始地址时终止
+inline size_t block_index(const void* obj, const Span* span) noexcept {
+    const size_t offset = reinterpret_cast<uintptr_t>(obj) - (span->_page_id << constant::PAGE_SHIFT);
+    const size_t index = offset * span->_block_magic >> MAGIC_SHIFT;
+    if (index * span->_block_size != offset) [[unlikely]] {
+        SystemAbort("free of pointer not at block start", obj);
+    }
+    return index;
+}
+}
+
+// 切分新的span之前清除所有释放位(span对象会在pc中复用)， 块大小已经设置好
+inline void hardened_reset_span(Span* span) noexcept {
+    span->_block_magic = ((uint64_t{1} << hardened::MAGIC_SHIFT) + span->_block_size - 1) / span->_block_size;
+    for (auto& bits : span->_freed_bits) {
+        bits.store(0, std::memory_order_relaxed);
+    }
+    span->_has_guard = false;
+}
+
+// 申请到小块内存后写入金丝雀， 释放位在回到自由链表时已经清除
+inline void hardened_on_alloc(void* obj, const size_t align_size) noexcept {
+    if constexpr (constant::CANARY_BYTES == 0) {
+        return;
+    }
+    uintptr_t* slot = hardened::canary_slot(obj, align_size);
+    slot[0] = hardened::canary_of(slot);
+    slot[1] = hardened::canary_of(slot + 1);
+}
+
+/**
+ * 释放小块内存前检查: span必须在使用中、地址是块的起始地址、金丝雀完好、没有被重复释放
+ * 检查通过后头部填充释放标记， 第二个字记录span和块序号， 金丝雀的位置写入释放标记
+ * 没有采样到的释放只检查span， 记录写为0， 重复释放隔离区中的内存块时记录被改写， 挤出时发现
+ */
+inline void hardened_on_free(void* obj, Span* span) noexcept {
+    if (span == nullptr || !span->_is_use) [[unlikely]] {
+        SystemAbort("invalid free or double free of", obj);
+    }
+    if constexpr (hardened::SAMPLE_PERIOD > 1) {
+        if (hardened::free_countdown != 0) [[likely]] {
+            --hardened::free_countdown;
+            *hardened::record_slot(obj) = 0;
+            return;
+        }
+        hardened::free_countdown = hardened::SAMPLE_PERIOD - 1;
+    }
+    const size_t index = hardened::block_index(obj, span);
+    const uint64_t bit = uint64_t{1} << (index % 64);
+    uintptr_t* slot = hardened::canary_slot(obj, span->_block_size);
+    if constexpr (constant::CANARY_BYTES > 0) {
+        if (slot[0] == hardened::freed_mark_of(slot)) [[unlikely]] {
+            SystemAbort("double free of", obj);
+        }
+        if (slot[0] != hardened::canary_of(slot) || slot[1] != hardened::canary_of(slot + 1)) [[unlikely]] {
+            SystemAbort("heap buffer overflow detected, canary overwritten in block", obj);
+        }
+    }
+    if ((span->_freed_bits[index / 64].fetch_or(bit, std::memory_order_relaxed) & bit) != 0) [[unlikely]] {
+        SystemAbort("double free of", obj);
+    }
+    memset(obj, hardened::POISON_BYTE, hardened::poison_size(span->_block_size));
+    if constexpr (constant::CANARY_BYTES > 0) {
+        slot[0] = hardened::freed_mark_of(slot);
+    }
+    uintptr_t* record = hardened::record_slot(obj);
+    *record = (reinterpret_cast<uintptr_t>(span) | index << constant::ADDRESS_BITS) ^ hardened::canary_of(record);
+}
+
+// 释放时是否做了完整检查， 只有完整检查过的内存块进入隔离区
+inline bool hardened_is_checked(void* obj) noexcept {
+    if constexpr (hardened::SAMPLE_PERIOD == 1) {
+        return true;
+    }
+    // 完整检查的记录与金丝雀异或过， 不会是0
+    return *hardened::record_slot(obj) != 0;
+}
+
+/**
+ * 内存块离开隔离区或者远程释放队列回到自由链表: 填充的释放标记和记录必须完好， 再由记录的span清除释放位
+ * 只读写内存块的头部， 不查找span也不做除法; 没有完整检查的内存块(记录为0)直接返回
+ * @param linked 第一个字是远程释放队列的链表指针， 不检查
+ */
+inline void hardened_on_release(void* obj, const size_t align_size, const bool linked) noexcept {
+    if (!hardened_is_checked(obj)) {
+        return;
+    }
+    const auto words = static_cast<const uint64_t*>(obj);
+    const size_t count = hardened::poison_size(align_size) / sizeof(uint64_t);
+    // 块大小和金丝雀都是8字节的倍数， 按8字节比较， 跳过第二个字的记录
+    uint64_t diff = 0;
+    if (!linked && count > 0) {
+        diff |= words[0] ^ hardened::POISON_WORD;
+    }
+    for (size_t i = 2; i < count; ++i) {
+        diff |= words[i] ^ hardened::POISON_WORD;
+    }
+    const uintptr_t* record = hardened::record_slot(obj);
+    const uintptr_t decoded = *record ^ hardened::canary_of(record);
+    const auto span = reinterpret_cast<Span*>(decoded & hardened::SPAN_MASK);
+    const size_t index = decoded >> constant::ADDRESS_BITS;
+    if (diff != 0 || (decoded & (alignof(Span) - 1)) != 0 || index >= std::size(span->_freed_bits) * 64
+        || reinterpret_cast<uintptr_t>(obj) != (span->_page_id << constant::PAGE_SHIFT) + index * align_size) [[unlikely]] {
+        SystemAbort("write after free detected in block", obj);
+    }
+    span->_freed_bits[index / 64].fetch_and(~(uint64_t{1} << (index % 64)), std::memory_order_relaxed);
+}
+
+// 内存块离开隔离区: 放入时都经过完整检查， 记录为0说明在隔离区期间又被没有采样到的释放重复释放了一次
+inline void hardened_on_evict(void* obj, const size_t align_size) noexcept {
+    if (!hardened_is_checked(obj)) [[unlikely]] {
+        SystemAbort("double free of", obj);
+    }
+    hardened_on_release(obj, align_size, false);
+}
+
+// 压入远程释放队列失败(所属线程已经关闭队列)时， 重试过程中可能已经写入了链表指针， 恢复第一个字的填充值
+inline void hardened_on_unlink(void* obj, const size_t align_size) noexcept {
+    if (hardened::poison_size(align_size) >= sizeof(uint64_t)) {
+        *static_cast<uint64_t*>(obj) = hardened::POISON_WORD;
+    }
+}
+
+// 直接分配的大块内存: 最后一页设为保护页， 可用大小不包括保护页
+inline void hardened_guard_direct(Span* span) noexcept {
+    span->_block_size = (span->_page_size - 1) << constant::PAGE_SHIFT;
+    mprotect(reinterpret_cast<char*>(span->_page_id << constant::PAGE_SHIFT) + span->_block_size, constant::PAGE_BYTES, PROT_NONE);
+    span->_has_guard = true;
+}
+
+// 释放直接分配的大块内存前检查， 并恢复保护页的访问权限(页面之后会被pc复用)
+inline void hardened_on_free_direct(void* obj, Span* span) noexcept {
+    if (span == nullptr || !span->_is_use || obj != reinterpret_cast<void*>(span->_page_id << constant::PAGE_SHIFT)) [[unlikely]] {
+        SystemAbort("invalid free or double free of", obj);
+    }
+    if (span->_has_guard) {
+        mprotect(static_cast<char*>(obj) + span->_block_size, constant::PAGE_BYTES, PROT_READ | PROT_WRITE);
+        span->_has_guard = false;
+    }
+}
+
+/**
+ * tc的释放隔离区， 先进先出的环形队列
+ * 内存块在隔离区中停留 QUARANTINE_COUNT 次释放， 期间对头部的写入都会在被挤出时发现
+ */
+class Quarantine {
+public:
+    /**
+     * 放入隔离区， 内存块已经在 hardened_on_free 中填充了释放标记
+     * @return 隔离区满时挤出最早的内存块， 通过参数返回， 由调用方真正释放; 否则返回false
+     */
+    bool push(void*& obj, size_t& align_size) noexcept {
+        if constexpr (hardened::QUARANTINE_COUNT == 0) {
+            hardened_on_release(obj, align_size, false);
+            return true;
+        }
+        const size_t slot = _m_head;
+        _m_head = (_m_head + 1) % SLOT_COUNT;
+        if (_m_objs[slot] == nullptr) {
+            _m_objs[slot] = obj;
+            _m_sizes[slot] = static_cast<uint32_t>(align_size);
+            return false;
+        }
+        std::swap(obj, _m_objs[slot]);
+        const size_t evicted_size = _m_sizes[slot];
+        _m_sizes[slot] = static_cast<uint32_t>(align_size);
+        align_size = evicted_size;
+        hardened_on_evict(obj, align_size);
+        return true;
+    }
+
+    /**
+     * 取出隔离区中的一个内存块， tc回收时依次取出
+     * @return 隔离区为空时返回false
+     */
+    bool pop(void*& obj, size_t& align_size) noexcept {
+        for (size_t i = 0; i < hardened::QUARANTINE_COUNT; ++i) {
+            if (_m_objs[i] != nullptr) {
+                obj = _m_objs[i];
+                align_size = _m_sizes[i];
+                _m_objs[i] = nullptr;
+                hardened_on_evict(obj, align_size);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    // 关闭隔离区时数组长度不能为0
+    static constexpr size_t SLOT_COUNT = std::max<size_t>(hardened::QUARANTINE_COUNT, 1);
+
+    void* _m_objs[SLOT_COUNT]{};
+    uint32_t _m_sizes[SLOT_COUNT]{};
+    size_t _m_head{0};
+};
+#else
+inline void hardened_reset_span(Span*) noexcept {}
+inline void hardened_on_alloc(void*, size_t) noexcept {}
+inline void hardened_on_free(void*, Span*) noexcept {}
+inline bool hardened_is_checked(void*) noexcept { return false; }
+inline void hardened_on_release(void*, size_t, bool) noexcept {}
+inline void hardened_on_unlink(void*, size_t) noexcept {}
+inline void hardened_guard_direct(Span*) noexcept {}
+inline void hardened_on_free_direct(void*, Span*) noexcept {}
+#endif
+}
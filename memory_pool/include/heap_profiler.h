@@ -0,0 +1,140 @@
+#pragma once
+
+#include "common.h"
+#include "span.h"
+#include "fixed_mem_pool.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace hnc::core::mem_pool::details {
+/**
+ * 采样堆分析器， 默认关闭
+ *
+ * 1. 几何分布采样: 每个线程记录距离下一个采样点还要申请的字节数， 间隔服从均值为 sample_period 的指数分布，
+ *    大块内存被采样的概率更高， pprof 按照采样间隔还原出真实的字节数
+ * 2. 没有被采样的申请只多一次TLS计数器的比较和减法， 释放时只多一次全局原子变量的读取(有存活的采样时才查找span)
+ * 3. 被采样的内存块记录调用栈(libgcc 的 _Unwind_Backtrace， 不依赖帧指针)， 存放在按地址哈希的采样表中，
+ *    采样记录来自定长内存池， 整个过程不经过 malloc
+ * 4. 采样表可以随时或者在收到信号时以 pprof 兼容的 heap_v2 文本格式输出
+ */
+class HeapProfiler {
+public:
+    static constexpr int MAX_DEPTH = 32; // 调用栈最大深度
+    static constexpr size_t BUCKET_COUNT = 4096; // 采样表的哈希桶个数
+    static constexpr size_t DISABLED_REFRESH_BYTES = 1 << 20; // 关闭时每个线程每申请1MB检查一次是否已经开启
+
+    static HeapProfiler& GetInstance() noexcept {
+        return _m_heap_profiler;
+    }
+
+    // 平均每申请 bytes 字节采样一次， 0 表示关闭， 已经记录的采样在释放前仍然保留
+    void set_sample_period(size_t bytes) noexcept;
+    size_t sample_period() const noexcept {
+        return _m_sample_period.load(std::memory_order_relaxed);
+    }
+
+    // 是否有存活的采样， 释放路径据此决定是否需要检查采样表
+    bool has_samples() const noexcept {
+        return _m_live_count.load(std::memory_order_relaxed) != 0;
+    }
+    size_t live_count() const noexcept {
+        return _m_live_count.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * 当前线程的采样计数器用完时调用， 重新生成下一个采样间隔
+     * @return 本次申请是否需要采样
+     */
+    bool pick_sample() noexcept;
+
+    // 记录一个被采样的内存块和当前调用栈
+    void record(void* ptr, size_t size) noexcept;
+
+    // 内存块释放时从采样表中删除， span中没有被采样的内存块时直接返回
+    void erase(void* ptr, Span* span) noexcept;
+
+    /**
+     * 以 pprof 的 heap_v2 文本格式输出所有存活的采样， 以及 /proc/self/maps 用于符号化
+     * @return 写入失败返回false
+     */
+    bool dump(int fd) noexcept;
+
+    /**
+     * 收到信号时输出到 path_prefix.<pid>.<序号>.heap
+     * 信号处理函数只向管道写一个字节， 由后台线程完成输出， 避免在信号处理函数中加锁
+     */
+    bool dump_on_signal(int signo, const char* path_prefix) noexcept;
+
+private:
+    HeapProfiler() = default;
+    ~HeapProfiler() = default;
+
+    HeapProfiler(const HeapProfiler&) = delete;
+    HeapProfiler(HeapProfiler&&) = delete;
+    HeapProfiler& operator=(const HeapProfiler&) = delete;
+    HeapProfiler& operator=(HeapProfiler&&) = delete;
+
+    // 一个被采样的内存块
+    struct Sample {
+        void* _ptr{nullptr};
+        size_t _size{0}; // 申请的字节数
+        int _depth{0};
+        void* _stack[MAX_DEPTH]{};
+        Sample* _next{nullptr}; // 同一个哈希桶中的下一个采样
+    };
+
+    static size_t _m_bucket_of(const void* ptr) noexcept;
+
+    // 后台输出线程， 每从管道读到一个字节输出一次
+    void _m_signal_dump_loop() noexcept;
+
+    // 第一次开启采样或者注册信号时注册 fork 处理函数， 需要持有 _m_mtx
+    void _m_register_fork_handlers() noexcept;
+
+    /**
+     * fork 时持有采样表的锁， 采样表的锁内不会再获取内存池的其他锁， 与其他 fork 处理函数的顺序无关
+     * 子进程中没有后台输出线程， 关闭管道， 需要时重新调用 dump_on_signal
+     */
+    static void _m_prepare_fork() noexcept;
+    static void _m_parent_fork() noexcept;
+    static void _m_child_fork() noexcept;
+
+private:
+    std::atomic<size_t> _m_sample_period{0};
+    std::atomic<size_t> _m_profile_period{0}; // 最近一次开启时的采样间隔， 关闭后输出仍然需要
+    std::atomic<size_t> _m_live_count{0}; // 存活的采样个数
+
+    std::mutex _m_mtx; // 保护以下成员
+    Sample* _m_buckets[BUCKET_COUNT]{};
+    FixedMemPool<Sample> _m_sample_pool;
+    size_t _m_live_bytes{0}; // 存活的采样的字节数
+    size_t _m_total_count{0}; // 累计采样次数
+    size_t _m_total_bytes{0}; // 累计采样的字节数
+
+    // 信号触发输出
+    int _m_signal_pipe[2]{-1, -1};
+    char _m_dump_path[256]{};
+    unsigned _m_dump_seq{0};
+    bool _m_registered{false}; // 是否已经注册 fork 处理函数
+
+    // 必须在cpp中初始化，否则每个翻译单元包含一个static，违背ODR原则，重复定义编译报错
+    static HeapProfiler _m_heap_profiler;
+};
+
+// 当前线程距离下一个采样点还要申请的字节数， 为0表示还没有初始化
+inline thread_local size_t tls_bytes_until_sample_ HNC_TLS_INITIAL_EXEC = 0;
+
+/**
+ * 申请路径的采样检查， 计数器没有用完时只有一次比较和减法
+ */
+inline void sample_allocation(void* ptr, const size_t size) noexcept {
+    if (tls_bytes_until_sample_ > size) [[likely]] {
+        tls_bytes_until_sample_ -= size;
+        return;
+    }
+    if (HeapProfiler::GetInstance().pick_sample()) [[unlikely]] {
+        HeapProfiler::GetInstance().record(ptr, size);
+    }
+}
+}
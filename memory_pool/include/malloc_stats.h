@@ -0,0 +1,22 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdio>
+
+namespace hnc::core::mem_pool::details {
+/**
+ * 汇总各层的统计
+ * 1. tc: 遍历所有存活的tc(持有预算锁)， 累加自由链表块数和每个tc自己递增的计数， 已经退出的线程计数也保留
+ * 2. cc: 逐个桶加锁遍历span， 由span的块数和 _use_count 得到空闲块数和分配出去的块数
+ * 3. pc: 持有pc锁统计空闲span和OS映射
+ * 分配出去的块数减去tc中缓存的块数即为用户正在使用的块数
+ */
+MallocStats collect_stats() noexcept;
+
+/**
+ * 以JSON格式输出统计， 只输出有内存块的块大小和有空闲span的页数
+ * 只使用 fprintf， 不经过内存池申请内存
+ */
+void print_stats(const MallocStats& stats, FILE* out) noexcept;
+}
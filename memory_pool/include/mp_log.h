@@ -0,0 +1,15 @@
+#pragma once
+
+/**
+ * 内存池内部日志
+ *
+ * 编译为全局 malloc 替换库(libhncmalloc.so)时定义 HNC_MALLOC_NO_LOG:
+ * 日志本身要拼接 std::string 会再次调用 malloc， 并且日志库会启动后台线程， 因此必须在编译期整体去掉，
+ * 使用宏保证连日志参数都不会被求值
+ */
+#ifdef HNC_MALLOC_NO_LOG
+#define MP_LOG(level, msg) ((void)0)
+#else
+#include "hnc_log.h"
+#define MP_LOG(level, msg) ::hnc::core::logger::log_##level(msg)
+#endif
@@ -0,0 +1,390 @@
+#pragma once
+
+#include "common.h"
+#include "fixed_mem_pool.h"
+#include "page_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+
+namespace hnc::core::mem_pool {
+/**
+ * 线程安全的定长对象池， 用于连接/会话这类高频创建销毁的同类型对象
+ * FixedMemPool 需要调用方在外部加锁， 只适合内存池内部的元数据， 这里提供给用户直接使用
+ *
+ * 1. 每个线程两个弹夹(magazine， 每个缓存64个对象指针)， New/Delete 只操作本线程的弹夹， 没有任何同步
+ * 2. 两个弹夹都满/都空时与全局仓库交换一整个弹夹， 仓库是带版本号的无锁栈(Treiber stack)， 版本号防止ABA
+ * 3. 仓库也没有对象时加锁从chunk中切出一整个弹夹的对象， chunk是从pc申请的span， 起始处存放chunk头
+ * 4. 仓库中的空闲对象过多时整理仓库: chunk中的对象全部在仓库中时将chunk归还pc， 其余对象重新装回弹夹
+ * 5. 弹夹本身从不释放， 无锁栈读取栈顶弹夹的 _next 时不会访问到已经归还的内存
+ */
+template <typename T>
+class ObjectPool {
+public:
+    static constexpr size_t MAGAZINE_SIZE = 64;
+
+    // 每个类型一个全局对象池
+    static ObjectPool& GetInstance() noexcept {
+        return _m_pool;
+    }
+
+    // 用参数构造一个对象
+    template <typename... Args>
+    T* New(Args&&... args) {
+        void* obj = _m_pop();
+        try {
+            return new (obj) T(std::forward<Args>(args)...);
+        } catch (...) {
+            _m_push(obj);
+            throw;
+        }
+    }
+
+    // 析构并回收对象
+    void Delete(T* obj) noexcept {
+        if (obj == nullptr) {
+            return;
+        }
+        obj->~T();
+        _m_push(obj);
+    }
+
+    // 整理仓库， 将完全空闲的chunk归还pc， 返回归还的chunk个数
+    size_t release_free_chunks() noexcept {
+        std::lock_guard<std::mutex> lock(_m_chunk_mtx);
+        return _m_trim();
+    }
+
+    // 从pc申请的chunk个数和字节数
+    size_t chunk_count() noexcept {
+        std::lock_guard<std::mutex> lock(_m_chunk_mtx);
+        return _m_chunk_count;
+    }
+    size_t system_bytes() noexcept {
+        return chunk_count() * CHUNK_BYTES;
+    }
+
+private:
+    constexpr ObjectPool() = default;
+    ~ObjectPool() = default;
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool(ObjectPool&&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+    ObjectPool& operator=(ObjectPool&&) = delete;
+
+    struct Magazine {
+        std::atomic<Magazine*> _next{nullptr}; // 仓库栈中的后继， 其他线程出栈时可能同时读取
+        size_t _count{0};
+        void* _objs[MAGAZINE_SIZE];
+    };
+
+    // chunk头， 位于span的起始地址
+    struct Chunk {
+        Chunk* _next; // 所有chunk串成单链表
+        details::Span* _span;
+        size_t _carved; // 已经切出的对象个数
+        size_t _free_mark; // 整理仓库时统计在仓库中的对象个数
+        bool _releasing; // 整理仓库时标记为要归还
+    };
+
+    static constexpr size_t OBJECT_OFFSET = (sizeof(Chunk) + alignof(T) - 1) & ~(alignof(T) - 1);
+    // 每个chunk至少放8个对象， 页数取2的幂， 至少16页
+    static constexpr size_t CHUNK_PAGES = std::bit_ceil(std::max<size_t>(16,
+        (OBJECT_OFFSET + 8 * sizeof(T) + details::constant::PAGE_BYTES - 1) >> details::constant::PAGE_SHIFT));
+    static constexpr size_t CHUNK_BYTES = CHUNK_PAGES << details::constant::PAGE_SHIFT;
+    static constexpr size_t CHUNK_CAPACITY = (CHUNK_BYTES - OBJECT_OFFSET) / sizeof(T);
+    static_assert(CHUNK_PAGES <= details::constant::MAX_PAGE_COUNT, "object too large for ObjectPool");
+    static_assert(alignof(T) <= details::constant::PAGE_BYTES, "over-aligned object for ObjectPool");
+
+    /**
+     * 带版本号的无锁栈， 高16位是版本号， 低48位是弹夹地址(用户态地址只有48位)
+     * 每次修改栈顶都增加版本号， 栈顶被弹出又压回同一个弹夹时CAS也会失败
+     */
+    class MagazineStack {
+    public:
+        void push(Magazine* magazine) noexcept {
+            assert((reinterpret_cast<uint64_t>(magazine) & ~PTR_MASK) == 0);
+            uint64_t head = _m_head.load(std::memory_order_relaxed);
+            uint64_t new_head;
+            do {
+                magazine->_next.store(_m_ptr(head), std::memory_order_relaxed);
+                new_head = reinterpret_cast<uint64_t>(magazine) | _m_next_tag(head);
+            } while (!_m_head.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        Magazine* pop() noexcept {
+            uint64_t head = _m_head.load(std::memory_order_acquire);
+            while (Magazine* top = _m_ptr(head)) {
+                // top可能已经被其他线程弹出并重新使用， 读到的_next是旧值时版本号已经变化， CAS会失败
+                const uint64_t new_head = reinterpret_cast<uint64_t>(top->_next.load(std::memory_order_relaxed)) | _m_next_tag(head);
+                if (_m_head.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_acquire)) {
+                    return top;
+                }
+            }
+            return nullptr;
+        }
+
+        // 一次取出整个栈
+        Magazine* pop_all() noexcept {
+            uint64_t head = _m_head.load(std::memory_order_acquire);
+            while (!_m_head.compare_exchange_weak(head, _m_next_tag(head), std::memory_order_acquire, std::memory_order_acquire)) {
+            }
+            return _m_ptr(head);
+        }
+
+    private:
+        static constexpr uint64_t PTR_MASK = (uint64_t{1} << details::constant::ADDRESS_BITS) - 1;
+
+        static Magazine* _m_ptr(const uint64_t head) noexcept {
+            return reinterpret_cast<Magazine*>(head & PTR_MASK);
+        }
+        static uint64_t _m_next_tag(const uint64_t head) noexcept {
+            return (head & ~PTR_MASK) + (PTR_MASK + 1);
+        }
+
+        std::atomic<uint64_t> _m_head{0};
+    };
+
+    // 线程退出时将弹夹还给仓库
+    struct ThreadMagazines {
+        Magazine* _loaded{nullptr};
+        Magazine* _previous{nullptr};
+
+        ~ThreadMagazines() {
+            _m_pool._m_return_magazine(_loaded);
+            _m_pool._m_return_magazine(_previous);
+        }
+    };
+
+    void* _m_pop() {
+        ThreadMagazines& tls = tls_magazines_;
+        if (tls._previous == nullptr && !_m_init_magazines(tls)) [[unlikely]] {
+            throw std::bad_alloc();
+        }
+        if (tls._loaded->_count == 0) [[unlikely]] {
+            if (tls._previous->_count > 0) {
+                std::swap(tls._loaded, tls._previous);
+            } else if (Magazine* full = _m_full_magazines.pop()) {
+                _m_depot_objs.fetch_sub(full->_count, std::memory_order_relaxed);
+                _m_empty_magazines.push(tls._previous);
+                tls._previous = tls._loaded;
+                tls._loaded = full;
+            } else {
+                _m_carve(tls._loaded);
+            }
+        }
+        return tls._loaded->_objs[--tls._loaded->_count];
+    }
+
+    void _m_push(void* obj) noexcept {
+        ThreadMagazines& tls = tls_magazines_;
+        // 回收对象不能失败， 没有内存创建弹夹时只能终止
+        if (tls._previous == nullptr && !_m_init_magazines(tls)) [[unlikely]] {
+            details::SystemAbort("out of memory creating an object pool magazine for", obj);
+        }
+        if (tls._loaded->_count == MAGAZINE_SIZE) [[unlikely]] {
+            if (tls._previous->_count < MAGAZINE_SIZE) {
+                std::swap(tls._loaded, tls._previous);
+            } else {
+                Magazine* empty = _m_empty_magazines.pop();
+                if (empty == nullptr) {
+                    empty = _m_new_magazine();
+                    if (empty == nullptr) [[unlikely]] {
+                        details::SystemAbort("out of memory creating an object pool magazine for", obj);
+                    }
+                }
+                _m_push_full(tls._previous);
+                tls._previous = tls._loaded;
+                tls._loaded = empty;
+                if (_m_depot_objs.load(std::memory_order_relaxed) > _m_trim_threshold.load(std::memory_order_relaxed)
+                    && _m_chunk_mtx.try_lock()) {
+                    _m_trim();
+                    _m_chunk_mtx.unlock();
+                }
+            }
+        }
+        tls._loaded->_objs[tls._loaded->_count++] = obj;
+    }
+
+    void _m_push_full(Magazine* magazine) noexcept {
+        _m_depot_objs.fetch_add(magazine->_count, std::memory_order_relaxed);
+        _m_full_magazines.push(magazine);
+    }
+
+    void _m_return_magazine(Magazine* magazine) noexcept {
+        if (magazine == nullptr) {
+            return;
+        }
+        if (magazine->_count > 0) {
+            _m_push_full(magazine);
+        } else {
+            _m_empty_magazines.push(magazine);
+        }
+    }
+
+    // 当前线程的两个弹夹， 第一次使用时创建， 弹夹对象池向OS申请内存失败时返回false
+    bool _m_init_magazines(ThreadMagazines& tls) noexcept {
+        if (tls._loaded == nullptr) {
+            tls._loaded = _m_new_magazine();
+        }
+        if (tls._loaded != nullptr) {
+            tls._previous = _m_new_magazine();
+        }
+        return tls._previous != nullptr;
+    }
+
+    // 优先复用仓库中的空弹夹， 向OS申请内存失败时返回nullptr
+    Magazine* _m_new_magazine() noexcept {
+        if (Magazine* magazine = _m_empty_magazines.pop()) {
+            return magazine;
+        }
+        _m_magazine_pool.lock();
+        Magazine* magazine = _m_magazine_pool.New();
+        _m_magazine_pool.unlock();
+        return magazine;
+    }
+
+    // 从chunk中切出一整个弹夹的对象
+    void _m_carve(Magazine* magazine) {
+        std::lock_guard<std::mutex> lock(_m_chunk_mtx);
+        while (magazine->_count < MAGAZINE_SIZE) {
+            if (_m_current == nullptr || _m_current->_carved == CHUNK_CAPACITY) {
+                _m_current = _m_new_chunk();
+            }
+            char* objs = reinterpret_cast<char*>(_m_current) + OBJECT_OFFSET;
+            magazine->_objs[magazine->_count++] = objs + _m_current->_carved++ * sizeof(T);
+        }
+    }
+
+    Chunk* _m_new_chunk() {
+        details::PageCache& page_cache = details::PageCache::GetInstance();
+        page_cache.lock();
+        details::Span* span = page_cache.create_pc_span(CHUNK_PAGES);
+        // 与 TncArena 相同， 先解锁再报告失败
+        if (span == nullptr) [[unlikely]] {
+            page_cache.unlock();
+            throw std::bad_alloc();
+        }
+        span->_is_use = true;
+        span->_is_direct = true;
+        span->_block_size = CHUNK_BYTES;
+        page_cache.unlock();
+
+        auto chunk = reinterpret_cast<Chunk*>(span->_page_id << details::constant::PAGE_SHIFT);
+        *chunk = Chunk{_m_chunks, span, 0, 0, false};
+        _m_chunks = chunk;
+        ++_m_chunk_count;
+        return chunk;
+    }
+
+    static Chunk* _m_chunk_of(void* obj) noexcept {
+        const details::Span* span = details::PageCache::find_span_by_address(obj);
+        return reinterpret_cast<Chunk*>(span->_page_id << details::constant::PAGE_SHIFT);
+    }
+
+    /**
+     * 整理仓库， 需要持有 _m_chunk_mtx
+     * 对象只会在用户手中、某个线程的弹夹或者仓库中三者之一， 一个chunk切出的对象全部在仓库中时没有其他地方引用它
+     */
+    size_t _m_trim() noexcept {
+        Magazine* magazines = _m_full_magazines.pop_all();
+        for (Magazine* magazine = magazines; magazine != nullptr; magazine = magazine->_next.load(std::memory_order_relaxed)) {
+            _m_depot_objs.fetch_sub(magazine->_count, std::memory_order_relaxed);
+            for (size_t i = 0; i < magazine->_count; ++i) {
+                ++_m_chunk_of(magazine->_objs[i])->_free_mark;
+            }
+        }
+        for (Chunk* chunk = _m_chunks; chunk != nullptr; chunk = chunk->_next) {
+            chunk->_releasing = chunk->_carved == CHUNK_CAPACITY && chunk->_free_mark == CHUNK_CAPACITY;
+            chunk->_free_mark = 0;
+        }
+
+        // 剩余的对象重新紧凑地装回弹夹， 写入位置不会超过读取位置
+        Magazine* dst = magazines;
+        size_t dst_count = 0;
+        for (Magazine* src = magazines; src != nullptr; src = src->_next.load(std::memory_order_relaxed)) {
+            const size_t src_count = src->_count;
+            for (size_t i = 0; i < src_count; ++i) {
+                void* obj = src->_objs[i];
+                if (_m_chunk_of(obj)->_releasing) {
+                    continue;
+                }
+                if (dst_count == MAGAZINE_SIZE) {
+                    dst->_count = dst_count;
+                    dst = dst->_next.load(std::memory_order_relaxed);
+                    dst_count = 0;
+                }
+                dst->_objs[dst_count++] = obj;
+            }
+        }
+        if (dst != nullptr) {
+            dst->_count = dst_count;
+            for (Magazine* rest = dst->_next.load(std::memory_order_relaxed); rest != nullptr; rest = rest->_next.load(std::memory_order_relaxed)) {
+                rest->_count = 0;
+            }
+        }
+        while (magazines != nullptr) {
+            Magazine* next = magazines->_next.load(std::memory_order_relaxed);
+            _m_return_magazine(magazines);
+            magazines = next;
+        }
+
+        // 归还chunk， 连续属于同一个pc分片的chunk只加一次锁
+        size_t released = 0;
+        details::PageCache* page_cache = nullptr;
+        for (Chunk** link = &_m_chunks; *link != nullptr;) {
+            Chunk* chunk = *link;
+            if (!chunk->_releasing) {
+                link = &chunk->_next;
+                continue;
+            }
+            *link = chunk->_next;
+            if (chunk == _m_current) {
+                _m_current = nullptr;
+            }
+            details::PageCache* owner = &details::PageCache::OwnerOf(chunk->_span);
+            if (owner != page_cache) {
+                if (page_cache != nullptr) {
+                    page_cache->unlock();
+                }
+                page_cache = owner;
+                page_cache->lock();
+            }
+            page_cache->recover_span_to_page_cache(chunk->_span);
+            --_m_chunk_count;
+            ++released;
+        }
+        if (page_cache != nullptr) {
+            page_cache->unlock();
+        }
+        // 留出余量， 避免仓库中的对象分散在很多chunk时反复整理
+        _m_trim_threshold.store(_m_depot_objs.load(std::memory_order_relaxed) + 4 * CHUNK_CAPACITY, std::memory_order_relaxed);
+        MP_LOG(debug, "object pool trim, released_chunks=" + std::to_string(released));
+        return released;
+    }
+
+    static inline thread_local ThreadMagazines tls_magazines_;
+    static ObjectPool _m_pool;
+
+    MagazineStack _m_full_magazines; // 装有对象的弹夹
+    MagazineStack _m_empty_magazines; // 空弹夹
+    std::atomic<size_t> _m_depot_objs{0}; // 仓库中的对象个数
+    std::atomic<size_t> _m_trim_threshold{4 * CHUNK_CAPACITY}; // 仓库中的对象超过该值时整理仓库
+
+    std::mutex _m_chunk_mtx; // 切分chunk和整理仓库
+    Chunk* _m_chunks{nullptr};
+    Chunk* _m_current{nullptr}; // 正在切分的chunk
+    size_t _m_chunk_count{0};
+
+    details::FixedMemPool<Magazine> _m_magazine_pool;
+};
+
+template <typename T>
+constinit ObjectPool<T> ObjectPool<T>::_m_pool;
+}
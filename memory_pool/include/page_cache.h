@@ -3,30 +3,106 @@
 #include "common.h"
 #include "span.h"
 #include "fixed_mem_pool.h"
+#include "radix_tree.h"
 
+#include <atomic>
 #include <mutex>
-#include <unordered_map>
 
 namespace hnc::core::mem_pool::details {
+// 当前线程使用的pc分片序号+1， 0表示还没有分配
+inline thread_local uint8_t tls_page_arena_ HNC_TLS_INITIAL_EXEC = 0;
+
 /**
- *  这里的span要分裂，合并，多个不同的线程可能同时在调用cc的函数操作pc，因此pc要全局锁
+ *  这里的span要分裂，合并，多个不同的线程可能同时在调用cc的函数操作pc，因此pc要加锁
+ *
+ *  pc分为 ARENA_COUNT 个独立的分片(arena)， 每个分片有自己的span_list、锁和从OS映射的内存:
+ *  1. 线程第一次访问pc时轮流分配一个分片， 之后申请span都在该分片中， 不同分片的线程不会竞争同一把锁
+ *  2. span记录所属分片， 释放时归还到所属分片， 相邻的span属于不同分片时不合并
+ *  3. 页号 -> span 的基数树和大页区域的基数树所有分片共享， 不同分片只会写自己的页面
+ *  4. 开启 HNC_MALLOC_NUMA 时分片按序号轮流属于各个NUMA节点， 映射的内存优先从所属节点分配物理页，
+ *     线程只会分配到自己所在节点的分片
  */
 class PageCache {
 public:
-    // 全局唯一page_cache 单例
-    static PageCache& GetInstance() {
-        return _m_page_cache;
+    static constexpr size_t ARENA_COUNT = constant::PAGE_ARENA_COUNT;
+
+    // 当前线程使用的pc分片， 第一次调用时按线程所在的NUMA节点分配
+    static PageCache& GetInstance() noexcept;
+
+    // 实际使用的NUMA节点数， 不超过 MAX_NUMA_NODES 和分片个数， 未开启时为1
+    static size_t NodeCount() noexcept;
+
+    // 序号为index的pc分片
+    static PageCache& Arena(size_t index) noexcept;
+
+    // span所属的pc分片， 释放span时必须归还到所属分片
+    static PageCache& OwnerOf(const Span* span) noexcept;
+
+    // 本分片所属的NUMA节点
+    size_t node() const noexcept {
+        return (_m_id() - 1) % NodeCount();
     }
 
-    // 将page_count数量的span 返回给central_cache
+    // 按序号锁住/解锁所有分片， fork时使用
+    static void lock_all() noexcept;
+    static void unlock_all() noexcept;
+
+    /**
+     * 将page_count数量的span 返回给central_cache， 需要在pc锁内调用
+     * @return 向OS申请内存失败时返回nullptr， 调用方解锁后再报告失败
+     */
     Span* create_pc_span(size_t page_count) noexcept;
 
-    // 根据地址再unordered_map中查找对应的span
-    Span* find_span_by_address(void* addr) noexcept;
+    /**
+     * 切出一个起始页号是align_pages倍数的span， 用于超过一页的对齐申请， 需要在pc锁内调用
+     * 返回的span已经标记为使用中， 多申请的首尾页面放回pc或者直接归还OS
+     * @param align_pages 2的幂
+     * @return 向OS申请内存失败时返回nullptr
+     */
+    Span* create_aligned_span(size_t page_count, size_t align_pages) noexcept;
+
+    /**
+     * 调整直接分配给用户的span(大块内存)的页数， 用于 tnc_realloc 原地扩大或缩小， 需要在pc锁内调用
+     * @return 无法原地调整返回false， 由调用方重新申请并复制； 成功时span的起始页号可能改变(mremap)
+     */
+    bool resize_span(Span* span, size_t page_count) noexcept;
+
+    // 根据地址在基数树中查找对应的span， 不加锁
+    // 与 find_span_by_address 相同， 但是地址不属于内存池时返回nullptr而不是断言失败， 加固模式检查非法释放时使用
+    static Span* lookup_span(void* addr) noexcept {
+        return static_cast<Span*>(_m_page_span_map.get(reinterpret_cast<size_t>(addr) >> constant::PAGE_SHIFT));
+    }
+
+    static Span* find_span_by_address(void* addr) noexcept;
 
     // 回收一个完整的span加入到对应的page_span_list中
     void recover_span_to_page_cache(Span *span) noexcept;
 
+    /**
+     * 将空闲时间超过 release_age_ms 的span通过madvise归还OS， 需要在pc锁内调用
+     * @param max_pages 本次最多归还的页数
+     * @param force 忽略空闲时间和保留预算， 归还所有空闲span
+     * @return 本次归还的页数
+     */
+    size_t release_idle_spans(size_t max_pages, bool force) noexcept;
+
+    // 归还OS的配置， 需要在pc锁内调用
+    const ReleaseConfig& release_config() const noexcept { return _m_release_config; }
+    void set_release_config(const ReleaseConfig& config) noexcept { _m_release_config = config; }
+
+    // pc与OS之间的内存统计， 需要在pc锁内调用
+    ReleaseStats release_stats() const noexcept;
+
+    // 累加本分片每种页数的空闲span个数、OS映射字节数和span对象池的使用， 需要在pc锁内调用
+    void collect_stats(MallocStats& stats) const noexcept;
+
+    // 大页模式， 只影响之后新映射的区域， 需要在pc锁内调用
+    HugePageMode huge_page_mode() const noexcept { return _m_huge_page_mode; }
+    void set_huge_page_mode(const HugePageMode mode) noexcept { _m_huge_page_mode = mode; }
+
+    // 大页覆盖统计， 需要在pc锁内调用
+    HugePageStats huge_page_stats() const noexcept;
+
     // 提供上锁接口 和 解锁接口
     void lock() noexcept {
         _m_mtx.lock();
@@ -36,7 +112,7 @@ public:
     }
 
 private:
-    PageCache() = default;
+    constexpr PageCache() = default;
     ~PageCache() = default;
 
     PageCache(const PageCache&) = delete;
@@ -44,18 +120,127 @@ private:
     PageCache& operator=(const PageCache&) = delete;
     PageCache& operator=(PageCache&&) = delete;
     
+    // 本分片的编号(序号+1)， 记录在span中
+    uint8_t _m_id() const noexcept;
+
+    // 刚从OS映射的页面绑定到本分片所属的NUMA节点
+    void _m_bind_node(void* ptr, size_t page_count) const noexcept;
+
+    // 从span对象池中取出一个span并标记为属于本分片， 对象池向OS申请失败时返回nullptr
+    Span* _m_new_span() noexcept;
+
+    // 创建直接分配的span两端页号的映射节点， 失败时返回false
+    bool _m_ensure_map(size_t page_id, size_t page_count) noexcept;
+
+    // 空闲span挂入/移出span_list， 同时维护空闲页的统计
+    void _m_insert_free_span(Span* span) noexcept;
+    void _m_erase_free_span(Span* span) noexcept;
+
+    /**
+     * 一个2MB对齐的大页区域， 被切分为 512 / 128 = 4 个span
+     * 区域内的span不会与区域外的span合并， 区域只会整体归还OS， 避免拆散大页
+     */
+    struct HugeRegion {
+        size_t _used_pages{0}; // 区域内正在使用的页数
+        bool _is_hugetlb{false}; // 是否通过 MAP_HUGETLB 映射
+    };
+
+    // 映射一个新的大页区域并切分为空闲span， 失败时返回false
+    bool _m_create_huge_region() noexcept;
+
+    // 页号所在的大页区域， 不属于任何大页区域返回nullptr
+    HugeRegion* _m_region_of(size_t page_id) const noexcept;
+
+    // 页面分配出去/回到pc时更新所在大页区域的使用页数
+    void _m_update_region_usage(size_t page_id, size_t page_count, bool in_use) noexcept;
+
+    /**
+     * 从空闲链表中选择一个span: 优先选择所在大页区域使用页数最多的span，
+     * 使新的分配集中在已经在使用的大页上， 稀疏的大页可以尽快整体空闲并归还
+     */
+    Span* _m_pick_free_span(const SpanList& span_list) const noexcept;
+
+    // 整个大页区域都空闲时整体归还OS， 返回本次新归还的页数
+    size_t _m_release_region(size_t region_page_id, size_t now, bool force) noexcept;
+
 private:
     SpanList _m_span_lists[constant::MAX_PAGE_COUNT]; // 按页面数量不同管理不同span_list， 默认是256个页面
-    std::mutex _m_mtx; // 对整体加锁
-    std::unordered_map<size_t, Span*> _m_page_span_map;
+    std::mutex _m_mtx; // 对整个分片加锁
 
     // span对象的定长内存池
     FixedMemPool<Span> _m_span_pool;
 
-    // page_cache 也是全局唯一单例
-    static PageCache _m_page_cache;
+    ReleaseConfig _m_release_config;
+    size_t _m_system_pages{0}; // span从OS映射的页数
+    size_t _m_system_alloc_count{0}; // 向OS映射内存的次数
+    size_t _m_free_pages{0}; // 空闲且驻留内存的页数
+    size_t _m_released_pages{0}; // 空闲且已经归还OS的页数
+    size_t _m_release_count{0}; // 累计madvise次数
+    size_t _m_total_released_pages{0}; // 累计归还OS的页数
+
+    HugePageMode _m_huge_page_mode{HugePageMode::none};
+    FixedMemPool<HugeRegion> _m_region_pool;
+    size_t _m_hugepage_regions{0}; // 大页区域个数
+    size_t _m_hugetlb_regions{0}; // 通过 MAP_HUGETLB 映射的区域个数
+    size_t _m_hugepage_used_pages{0}; // 大页区域中正在使用的页数
+    size_t _m_region_release_count{0}; // 大页区域整体归还的次数
+
+    // 页号 -> span 的映射， 每个分片只写自己的页面(在分片锁内)，读操作无锁
+    static RadixTree<constant::ADDRESS_BITS - constant::PAGE_SHIFT> _m_page_span_map;
+    // 大页号 -> 大页区域 的映射， 区域一旦映射就不会解除
+    static RadixTree<constant::ADDRESS_BITS - constant::HUGE_PAGE_SHIFT> _m_huge_regions;
+
+    // 所有pc分片， 全局饿汉单例
+    // 数组包在结构体中: gcc 12 对类的静态成员数组做常量初始化时会丢掉 SpanList 头节点的自引用指针
+    struct Arenas;
+    static Arenas _m_page_caches;
+    static std::atomic<size_t> _m_next_arena[constant::MAX_NUMA_NODES]; // 每个节点下一个线程分配的分片
+    static std::atomic<size_t> _m_node_count; // 第一次使用时探测， 0表示还没有探测
 };
 
+struct PageCache::Arenas {
+    PageCache _arenas[ARENA_COUNT];
+};
+
+inline PageCache& PageCache::GetInstance() noexcept {
+    if (tls_page_arena_ == 0) [[unlikely]] {
+        const size_t nodes = NodeCount();
+        const size_t node = nodes == 1 ? 0 : SystemCurrentNode() % nodes;
+        // 属于node的分片序号为 node, node + nodes, node + 2 * nodes ...
+        const size_t node_arenas = (ARENA_COUNT - node + nodes - 1) / nodes;
+        const size_t index = node + nodes * (_m_next_arena[node].fetch_add(1, std::memory_order_relaxed) % node_arenas);
+        tls_page_arena_ = static_cast<uint8_t>(index + 1);
+    }
+    return _m_page_caches._arenas[tls_page_arena_ - 1];
+}
+
+inline size_t PageCache::NodeCount() noexcept {
+    if constexpr (constant::MAX_NUMA_NODES == 1) {
+        return 1;
+    } else {
+        size_t count = _m_node_count.load(std::memory_order_relaxed);
+        if (count == 0) [[unlikely]] {
+            // 并发探测的结果相同， 不需要加锁
+            count = std::min({SystemNumaNodeCount(), constant::MAX_NUMA_NODES, ARENA_COUNT});
+            _m_node_count.store(count, std::memory_order_relaxed);
+        }
+        return count;
+    }
+}
+
+inline uint8_t PageCache::_m_id() const noexcept {
+    return static_cast<uint8_t>(this - _m_page_caches._arenas + 1);
+}
+
+inline PageCache& PageCache::Arena(const size_t index) noexcept {
+    return _m_page_caches._arenas[index];
+}
+
+inline PageCache& PageCache::OwnerOf(const Span* span) noexcept {
+    assert(span->arena_id() > 0);
+    return _m_page_caches._arenas[span->arena_id() - 1];
+}
+
 
 
 }
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "common.h"
+#include "fixed_mem_pool.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace hnc::core::mem_pool::details {
+
+/**
+ * 三层基数树， 用于 页号 -> Span* 的映射， 替代 unordered_map
+ *
+ * 1. 用户态地址只有低48位有效， 去掉页内偏移后页号只有 BITS = 48 - PAGE_SHIFT 位，平均分给三层
+ * 2. 根节点直接作为成员数组(静态存储区)， 中间节点和叶子节点按需从定长内存池申请， 不会走 operator new
+ * 3. 写操作(set/ensure)由外部的pc分片锁保护， 不同分片只写自己的页面， 创建节点时另外加节点锁， 读操作(get)不加锁:
+ *    只会去读已经分配出去的内存块所在页， 这些页的映射一定在该内存块交给用户之前就已经写好了(由cc桶锁/pc锁保证可见性)，
+ *    而节点一旦创建就不会释放， 因此读线程看到的节点指针永远有效
+ * 4. 合并span时会读到其他分片正在写的相邻页， 节点指针和映射值都通过 atomic_ref 读写(x86上与普通读写相同)
+ */
+template <int BITS>
+class RadixTree {
+private:
+    static constexpr int LEAF_BITS = (BITS + 2) / 3; // 叶子节点占用的位数
+    static constexpr int MID_BITS = (BITS - LEAF_BITS + 1) / 2; // 中间节点占用的位数
+    static constexpr int ROOT_BITS = BITS - LEAF_BITS - MID_BITS; // 根节点占用的位数
+
+    static constexpr size_t ROOT_LENGTH = size_t{1} << ROOT_BITS;
+    static constexpr size_t MID_LENGTH = size_t{1} << MID_BITS;
+    static constexpr size_t LEAF_LENGTH = size_t{1} << LEAF_BITS;
+
+    // 叶子节点， 存储真正的映射值, 默认成员初始化保证从内存池取出时全部为nullptr
+    struct Leaf {
+        void* _values[LEAF_LENGTH]{};
+    };
+
+    // 中间节点
+    struct Mid {
+        Leaf* _leafs[MID_LENGTH]{};
+    };
+
+public:
+    /**
+     * 查找页号对应的值， 不加锁
+     * @return 超出范围或者未映射则返回nullptr
+     */
+    void* get(const size_t page_id) const noexcept {
+        if ((page_id >> BITS) > 0) {
+            return nullptr;
+        }
+        Mid* mid = _m_load(_m_root[page_id >> (MID_BITS + LEAF_BITS)]);
+        if (mid == nullptr) {
+            return nullptr;
+        }
+        Leaf* leaf = _m_load(mid->_leafs[(page_id >> LEAF_BITS) & (MID_LENGTH - 1)]);
+        if (leaf == nullptr) {
+            return nullptr;
+        }
+        return _m_load(leaf->_values[page_id & (LEAF_LENGTH - 1)]);
+    }
+
+    /**
+     * 设置页号对应的值， 需要在pc锁内调用
+     * 新映射的内存由调用方先 ensure 整个范围， 申请节点失败时可以回退; 这里再创建节点失败只能终止
+     */
+    void set(const size_t page_id, void* value) noexcept {
+        assert((page_id >> BITS) == 0);
+        // 清空一个从未映射过的页， 不需要创建节点
+        if (value == nullptr && get(page_id) == nullptr) {
+            return;
+        }
+        if (!ensure(page_id, 1)) [[unlikely]] {
+            SystemAbort("out of memory creating the page map node for", reinterpret_cast<void*>(page_id << constant::PAGE_SHIFT));
+        }
+        Leaf* leaf = _m_load(_m_load(_m_root[page_id >> (MID_BITS + LEAF_BITS)])->_leafs[(page_id >> LEAF_BITS) & (MID_LENGTH - 1)]);
+        std::atomic_ref(leaf->_values[page_id & (LEAF_LENGTH - 1)]).store(value, std::memory_order_relaxed);
+    }
+
+    /**
+     * 确保从start开始的page_count个页面的节点都已经创建， 需要在pc锁内调用
+     * @return 超出地址范围或者申请节点失败时返回false， 之后对这些页面调用 set 才是安全的
+     */
+    bool ensure(const size_t start, const size_t page_count) noexcept {
+        for (size_t key = start; key <= start + page_count - 1;) {
+            const size_t i1 = key >> (MID_BITS + LEAF_BITS);
+            const size_t i2 = (key >> LEAF_BITS) & (MID_LENGTH - 1);
+            // 超出地址范围
+            if (i1 >= ROOT_LENGTH) {
+                return false;
+            }
+            Mid* mid = _m_load(_m_root[i1]);
+            if (mid == nullptr || _m_load(mid->_leafs[i2]) == nullptr) [[unlikely]] {
+                // 不同pc分片可能同时创建同一个节点
+                std::lock_guard<std::mutex> lock(_m_node_mtx);
+                mid = _m_load(_m_root[i1]);
+                if (mid == nullptr) {
+                    mid = _m_mid_pool.New();
+                    if (mid == nullptr) [[unlikely]] {
+                        return false;
+                    }
+                    std::atomic_ref(_m_root[i1]).store(mid, std::memory_order_release);
+                }
+                if (_m_load(mid->_leafs[i2]) == nullptr) {
+                    Leaf* leaf = _m_leaf_pool.New();
+                    if (leaf == nullptr) [[unlikely]] {
+                        return false;
+                    }
+                    std::atomic_ref(mid->_leafs[i2]).store(leaf, std::memory_order_release);
+                }
+            }
+            // 跳过当前叶子节点覆盖的所有页
+            key = ((key >> LEAF_BITS) + 1) << LEAF_BITS;
+        }
+        return true;
+    }
+
+private:
+    // 读取节点指针， 与创建节点时的 release 配对， 保证看到初始化完成的节点
+    template <typename Node>
+    static Node* _m_load(Node* const& node) noexcept {
+        return std::atomic_ref(const_cast<Node*&>(node)).load(std::memory_order_acquire);
+    }
+
+private:
+    Mid* _m_root[ROOT_LENGTH]{}; // 根节点
+
+    // 节点的定长内存池， 节点只增不减
+    FixedMemPool<Mid> _m_mid_pool;
+    FixedMemPool<Leaf> _m_leaf_pool;
+    std::mutex _m_node_mtx; // 创建节点
+};
+
+}
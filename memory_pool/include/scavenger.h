@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <new>
+
+namespace hnc::core::mem_pool::details {
+/**
+ * 后台回收线程， 按照 ReleaseConfig 周期性地将pc中空闲过久的span归还OS
+ *
+ * 1. 线程是 detach 的， 进程退出时由 atexit 通知它退出并等待
+ * 2. 单例不析构: fork 出的子进程中条件变量还记录着父进程后台线程的等待， 析构(pthread_cond_destroy)会一直阻塞
+ * 3. fork 时持有 _m_mtx， 子进程中没有后台线程， 重置运行状态并重新构造条件变量
+ */
+class Scavenger {
+public:
+    static Scavenger& GetInstance() noexcept {
+        alignas(Scavenger) static char storage[sizeof(Scavenger)];
+        static Scavenger* scavenger = new (storage) Scavenger();
+        return *scavenger;
+    }
+
+    // 启动后台回收线程， 已经启动则直接返回
+    void start();
+
+    // 通知后台回收线程退出并等待
+    void stop() noexcept;
+
+private:
+    Scavenger() = default;
+    ~Scavenger() = default;
+
+    Scavenger(const Scavenger&) = delete;
+    Scavenger(Scavenger&&) = delete;
+    Scavenger& operator=(const Scavenger&) = delete;
+    Scavenger& operator=(Scavenger&&) = delete;
+
+    // 后台线程函数
+    void _m_run() noexcept;
+
+    // fork 处理函数
+    static void _m_prepare_fork() noexcept;
+    static void _m_parent_fork() noexcept;
+    static void _m_child_fork() noexcept;
+
+private:
+    std::mutex _m_mtx;
+    std::condition_variable _m_cond;
+    bool _m_running{false}; // 是否需要继续运行
+    bool _m_exited{true}; // 后台线程是否已经退出
+    bool _m_registered{false}; // 是否已经注册 fork/atexit 处理函数
+};
+}
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <cassert>
+#include <cstdint>
 #include <mutex>
 
-#include "hnc_log.h"
+#include "mp_log.h"
 
 namespace hnc::core::mem_pool::details {
 /** 双向链表节点类型Span,内部管理多个Page(OS Page,8KB) */
@@ -19,12 +22,49 @@ struct Span {
 
     // false 表示Span默认在pc中
     bool _is_use{false};
+    // span直接分配给用户(大块内存或超过一页的对齐内存)， 不经过cc， 释放时整体归还pc
+    bool _is_direct{false};
+    // pc中的空闲span的页面已经通过madvise归还OS
+    bool _is_released{false};
+    // span回到pc的时间(ms)， 用于判断空闲了多久
+    size_t _free_time{0};
+    // span内被堆采样记录的内存块数， 不为0时释放需要先从采样表中删除
+    std::atomic<uint32_t> _sampled_count{0};
+    // 所属pc分片的编号(从1开始)， span对象只在所属分片内复用， 其他分片合并时读到的只可能是0或者所属分片
+    // 没有默认初始值: 定长池复用span对象时不会重新写入， 其他分片通过过期的映射读取时不会与构造冲突
+    uint8_t _arena_id;
+    // 正在从这个span切分内存块的线程的远程释放队列编号(从1开始， 0表示没有)， 其他线程释放的内存块送回这个线程
+    // cc的桶锁内写入， 释放时不加锁读取
+    uint16_t _owner{0};
+
+#ifdef HNC_MALLOC_HARDENED
+    // 加固模式: 每个内存块是否处于释放状态(cc切分的span最多512个块)， 用于检测重复释放
+    std::atomic<uint64_t> _freed_bits[8]{};
+    // 2^40 / 块大小(向上取整)， 释放时用乘法代替除法求块序号
+    uint64_t _block_magic{0};
+    // 直接分配的大块内存尾部有一页不可访问的保护页
+    bool _has_guard{false};
+#endif
+
+    uint8_t arena_id() const noexcept {
+        return std::atomic_ref(const_cast<uint8_t&>(_arena_id)).load(std::memory_order_relaxed);
+    }
+    void set_arena_id(const uint8_t arena_id) noexcept {
+        std::atomic_ref(_arena_id).store(arena_id, std::memory_order_relaxed);
+    }
+    uint16_t owner() const noexcept {
+        return std::atomic_ref(const_cast<uint16_t&>(_owner)).load(std::memory_order_relaxed);
+    }
+    void set_owner(const uint16_t owner) noexcept {
+        std::atomic_ref(_owner).store(owner, std::memory_order_relaxed);
+    }
 };
 
 /** span双向链表 */
 class SpanList {
 public:
-    SpanList() {
+    // constexpr 构造保证cc和pc单例是常量初始化的， 作为全局malloc时可能在静态构造之前就被调用
+    constexpr SpanList() : _m_header_span{} {
         // 初始化头节点
         /**
          * 此处 三个单例还没有初始化！  尝试调用会错误， 所以头节点不能是指针
@@ -84,7 +124,7 @@ public:
         span->_prev = pos->_prev;
         span->_next = pos;
         pos->_prev = span;
-        logger::log_trace("insert span, page_size=" + std::to_string(span->_page_size));
+        MP_LOG(trace, "insert span, page_size=" + std::to_string(span->_page_size));
     }
     // 删除一个Span节点
     void erase(const Span* span) const noexcept {
@@ -95,7 +135,7 @@ public:
         span->_next->_prev = span->_prev;
         // pos指向的span节点不需要删除， 而是进行回收, 由pc统一回收
 
-        logger::log_trace("erase span, page_size=" + std::to_string(span->_page_size));
+        MP_LOG(trace, "erase span, page_size=" + std::to_string(span->_page_size));
     }
 
     Span* pop_front() const noexcept {
@@ -2,40 +2,235 @@
 
 #include "common.h"
 #include "freelist.h"
+#include "hardened.h"
+#include "page_cache.h"
 
+#include <atomic>
 #include <cstddef>
+#include <mutex>
 
 
 namespace hnc::core::mem_pool::details {
 class ThreadCache {
 public:
-    // 分配size大小的内存块
+    /**
+     * 持有per-cpu缓存的锁时收集需要归还给cc的内存块链表和缓存上限的调整， 释放锁之后再调用 flush 完成
+     * 收集满时不再从自由链表取出内存块， 留下的内存块等下一次释放时再归还
+     */
+    struct DeferredRelease {
+        static constexpr size_t CAPACITY = 16;
+
+        struct Chain {
+            void* start;
+            void* end;
+            size_t count;
+            size_t align_size;
+        };
+        Chain chains[CAPACITY];
+        size_t size{0};
+        ThreadCache* grow_cache{nullptr}; // 需要增加缓存上限的缓存， 调整时要获取全局的预算锁
+
+        bool full() const noexcept {
+            return size == CAPACITY;
+        }
+        void flush() noexcept;
+    };
+
+    // 分配size大小的内存块， 向OS申请内存失败时返回nullptr
     void* allocate(size_t size) noexcept;
 
-    // 释放指定地址的内存, 这里的size已经时对齐过的
-    void deallocate(void* obj, size_t align_size) noexcept;
+    /**
+     * 释放指定地址的内存, 这里的size已经时对齐过的
+     * deferred 不为空时需要归还给cc的内存块只放入deferred， 由调用方释放锁之后归还
+     */
+    void deallocate(void* obj, size_t align_size, DeferredRelease* deferred = nullptr) noexcept;
+
+    /**
+     * 只从自由链表分配， 供per-cpu缓存在持有锁时调用
+     * 自由链表为空时返回nullptr， fetch_count 为慢开始算法决定的向cc申请的块数，
+     * 调用方释放锁之后向cc申请， 再加锁用 refill 放入除第一块之外的内存块
+     */
+    void* allocate_cached(size_t size, size_t& fetch_count) noexcept;
+    void refill(void* start, void* end, size_t count, size_t align_size) noexcept;
+
+    // 调用方还没有查找span(已知大小的释放)， 由 deallocate_remote 在需要时查找所属线程
+    static constexpr uint16_t UNKNOWN_OWNER = UINT16_MAX;
+    static_assert(constant::MAX_REMOTE_HEAPS < UNKNOWN_OWNER);
+
+    /**
+     * 释放其他线程正在切分的span中的内存块: 无锁压入所属线程(owner)的远程释放队列， 由它下次补充自由链表时整批取回
+     * 内存块属于本线程、 span没有所属线程(owner为0)或者所属线程已经退出时返回false， 由调用方走普通的释放路径
+     * owner为 UNKNOWN_OWNER 时， 只有存在其他线程的远程释放队列才通过页号查找span
+     */
+    bool deallocate_remote(void* obj, const size_t align_size, uint16_t owner) noexcept {
+        if (owner == UNKNOWN_OWNER) {
+            if (!_m_has_remote_heaps()) [[likely]] {
+                return false;
+            }
+            owner = PageCache::find_span_by_address(obj)->owner();
+        }
+        return owner != 0 && owner != _m_heap_id && _m_push_remote(obj, align_size, owner);
+    }
+
+    /**
+     * 批量申请count个size大小的内存块写入out
+     * 自由链表中的内存块一次 pop_range 整段取出， 不足的部分直接向cc申请剩余的块数
+     * @return 写入out的块数， 只有向OS申请内存失败时少于count
+     */
+    size_t allocate_batch(size_t size, size_t count, void** out) noexcept;
+
+    // 只从自由链表批量分配， 返回写入out的块数， 剩余的块数由调用方释放锁之后用 fetch_from_central 申请
+    size_t allocate_batch_cached(size_t size, size_t count, void** out) noexcept;
+
+    // 向cc申请count个对齐后大小为align_size的内存块写入out， span的所属线程设为owner， 返回写入的块数
+    static size_t fetch_from_central(size_t align_size, size_t count, void** out, uint16_t owner) noexcept;
+
+    /**
+     * 批量释放count个对齐后大小为align_size的内存块
+     * 先串成链表一次 push_range 挂入自由链表， 超过一次可申请的块数时按批归还cc
+     */
+    void deallocate_batch(void** objs, size_t count, size_t align_size, DeferredRelease* deferred = nullptr) noexcept;
+
+    // 没有可用的缓存(创建缓存时向OS申请内存失败)时， 将已经通过释放检查的内存块直接归还cc
+    static void release_to_central(void* obj, size_t align_size) noexcept;
+
+    // 将所有自由链表(以及加固模式隔离区)中的内存块归还给cc， 线程退出时调用
+    void release_all() noexcept;
+
+    // 为当前线程创建tc， 并注册线程退出时的回收函数， 向OS申请内存失败时返回nullptr
+    static ThreadCache* create() noexcept;
+
+    // 创建一个不属于任何线程的缓存， 作为per-cpu缓存使用， 同样受总预算的约束， 失败时返回nullptr
+    static ThreadCache* create_unbound() noexcept;
+
+    // 线程退出时归还所有内存块和缓存上限， 回收tc
+    static void destroy(ThreadCache* tc) noexcept;
+
+    /**
+     * 所有tc缓存内存的总预算， 每个tc有自己的缓存上限， 上限之和不超过总预算(每个tc至少 MIN_THREAD_CACHE_BYTES)
+     * 缓存超过上限的tc会先收缩空闲的自由链表， 再从未分配的预算或者其他tc的上限中获取额度
+     */
+    static void set_overall_budget(size_t bytes) noexcept;
+    static size_t overall_budget() noexcept;
+
+    /**
+     * 汇总所有tc的自由链表块数、缓存字节数和累计计数
+     * 其他线程的自由链表不加锁读取， 只是一个近似值
+     */
+    static void collect_stats(MallocStats& stats) noexcept;
+
+    // fork前锁住tc的全局锁， 避免子进程继承到其他线程持有的锁
+    static void lock_all() noexcept;
+    static void unlock_all() noexcept;
+
+    // 当前缓存的字节数和缓存上限
+    size_t cached_bytes() const noexcept {
+        return _m_cached_bytes;
+    }
+    size_t max_bytes() const noexcept {
+        return _m_max_bytes.load(std::memory_order_relaxed);
+    }
 
 private:
+    // 只有一个写者的计数器， 递增不需要原子的读改写， 原子类型只是为了统计时其他线程可以安全地读取
+    struct Counter {
+        std::atomic<size_t> _value{0};
+
+        void increment(const size_t count = 1) noexcept {
+            _value.store(_value.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        }
+        size_t load() const noexcept {
+            return _value.load(std::memory_order_relaxed);
+        }
+    };
+
+    // 当前tc的累计计数
+    ThreadCacheCounters _m_counters() const noexcept;
+
+    /**
+     * 除了本线程之外是否还有打开的远程释放队列
+     * 没有时任何内存块都不会送回其他线程(所属线程的队列已经关闭)， 不需要为了所属线程查找span
+     */
+    bool _m_has_remote_heaps() const noexcept {
+        return _m_open_heaps.load(std::memory_order_relaxed) > (_m_heap_id != 0 ? 1u : 0u);
+    }
+
+    // 压入owner的远程释放队列， 队列已经关闭时返回false
+    bool _m_push_remote(void* obj, size_t align_size, uint16_t owner) noexcept;
+
+    // 整批取出本线程远程释放队列中下标为index的内存块， 返回块数
+    size_t _m_collect_remote(size_t index, void*& start, void*& end) noexcept;
+
+    // 分配/关闭本线程的远程释放队列， 关闭时队列中剩余的内存块放入自由链表
+    void _m_open_remote() noexcept;
+    void _m_close_remote() noexcept;
+
     // freelist中没有空闲空间时尝试从CentralCache中获取内存块
     void* _m_alloc_from_central(size_t index, size_t align_size) noexcept;
 
+    // 本次向cc申请的块数， 没有超过阈值时下次多申请一块(慢开始)
+    size_t _m_next_fetch_count(size_t index, size_t align_size) noexcept;
+
     // list 回收 内存块大小为size的内存块，数量为list.apple_count
-    void _m_release_block(Freelist &free_list, size_t align_size) const noexcept;
+    void _m_release_block(Freelist &free_list, size_t align_size, DeferredRelease* deferred) noexcept;
+
+    // 将从自由链表取出的一串内存块归还给cc， deferred 不为空时只放入deferred
+    void _m_release_range(void* start, void* end, size_t count, size_t align_size, DeferredRelease* deferred) noexcept;
+
+    // 缓存超过上限时， 将每个自由链表低水位以下一直没有使用的内存块归还一半， 并收缩一次可申请的块数
+    void _m_scavenge(DeferredRelease* deferred) noexcept;
+
+    // 从未分配的预算中获取额度， 没有则从其他tc的上限中窃取， 需要持有 _m_budget_mtx
+    void _m_increase_max_bytes_locked() noexcept;
+
+    // 加入/移出所有tc组成的链表， 并分配/归还缓存上限
+    void _m_register() noexcept;
+    void _m_unregister() noexcept;
 
 private:
     Freelist _m_free_lists[constant::FREE_LIST_SIZE];
+#ifdef HNC_MALLOC_HARDENED
+    Quarantine _m_quarantine; // 释放隔离区， 内存块先在这里停留一段时间再回到自由链表
+#endif
+
+    size_t _m_cached_bytes{0}; // 自由链表中缓存的字节数， 只有本线程访问
+    std::atomic<size_t> _m_max_bytes{0}; // 缓存上限， 其他线程窃取额度时会修改
+
+    // 累计计数， 由本线程(per-cpu缓存为持有锁的线程)递增
+    Counter _m_alloc_count;
+    Counter _m_free_count;
+    Counter _m_central_fetch_count;
+    Counter _m_central_release_count;
+    Counter _m_scavenge_count;
+    Counter _m_remote_free_count;
+    Counter _m_remote_collect_count;
+
+    uint16_t _m_heap_id{0}; // 远程释放队列编号(从1开始)， 0表示没有队列(per-cpu缓存或者线程太多)
+
+    // 所有存活的tc组成的双向链表， 由 _m_budget_mtx 保护
+    ThreadCache* _m_next{nullptr};
+    ThreadCache* _m_prev{nullptr};
+
+    static std::mutex _m_budget_mtx;
+    static size_t _m_overall_budget; // 总预算
+    static ptrdiff_t _m_unclaimed_budget; // 还没有分配给tc的预算， tc太多时可以为负
+    static ThreadCache* _m_cache_list; // 所有存活的tc
+    static ThreadCache* _m_next_victim; // 下一个被窃取额度的tc， 轮流窃取
+    static ThreadCacheCounters _m_retired_counters; // 已经回收的tc的累计计数
+    static std::atomic<uint32_t> _m_open_heaps; // 打开的远程释放队列数， 由 _m_budget_mtx 保护写入， 释放路径不加锁读取
 };
 
 // 每个线程都拥有自己独立的 局部线程缓存
-static inline thread_local ThreadCache* tls_thread_cache_ptr_ = nullptr;
+// initial-exec 模型访问TLS不会经过 __tls_get_addr， 作为全局malloc时不会在首次访问时反过来调用malloc
+inline thread_local ThreadCache* tls_thread_cache_ptr_ HNC_TLS_INITIAL_EXEC = nullptr;
 }
 
 
 /**
-[1,128]                 8B对齐            freelist[0,16)
-[128+1,1024]            16B对齐           freelist[16,72)
-[1024+1,8*1024]         128B对齐          freelist [72,128)
-[8*1024+1,64*1024]      1024B对齐         freelist [128,184)
-[64*1024+1,256*1024]    8*1024B对齐       freelist[184,208)
+默认 CLASS_SPLITS = 16 时的块大小(common.h 中 SizeClassTable 编译期生成)
+[1,256]                 8B对齐            freelist[0,32)
+(256,512]               16B对齐           freelist[32,48)
+(512,1024]              32B对齐           freelist[48,64)
+(2^k,2^(k+1)]           2^k/16对齐        每个区间16个自由链表
+(128*1024,256*1024]     8*1024B对齐       freelist[176,192)
 */
-
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+
+#include <mutex>
+
+namespace hnc::core::mem_pool::details {
+/**
+ * cc中每个块大小对应一个传输缓存， 缓存tc整批归还的内存块链表
+ *
+ * 1. tc归还一批内存块时直接整批放入， 另一个tc申请时再整批取走， 都是O(1)的， 不需要逐个内存块查找span并挂回span
+ * 2. 使用独立的锁， 临界区只有几次赋值， 命中传输缓存时不会去竞争cc的桶锁
+ * 3. 缓存满了则由cc逐块归还给span， 缓存中的内存块仍然计入所属span的 _use_count
+ */
+class TransferCache {
+public:
+    static constexpr size_t MAX_BATCHES = 16; // 每个块大小最多缓存的批数
+
+    constexpr TransferCache() = default;
+
+    /**
+     * 放入一批内存块 [start -> ... -> end], end 的next为nullptr
+     * @return 缓存已满返回false
+     */
+    bool push(void* start, void* end, size_t block_count) noexcept;
+
+    /**
+     * 取出最后放入的一批内存块， 该批的块数超过 max_count 则不取
+     * @return 取出的块数， 没有取出返回0
+     */
+    size_t pop(void*& start, void*& end, size_t max_count) noexcept;
+
+    // 当前缓存的内存块数
+    size_t block_count() noexcept;
+
+    // fork前持有锁， 避免子进程继承到其他线程持有的锁
+    void lock() noexcept {
+        _m_mtx.lock();
+    }
+    void unlock() noexcept {
+        _m_mtx.unlock();
+    }
+
+private:
+    // 一批首尾相连的内存块
+    struct Batch {
+        void* _start{nullptr};
+        void* _end{nullptr};
+        size_t _block_count{0};
+    };
+
+    std::mutex _m_mtx;
+    Batch _m_batches[MAX_BATCHES]{}; // 按栈使用， 最后放入的最先取出， 内存块更可能还在cpu缓存中
+    size_t _m_size{0}; // 当前缓存的批数
+};
+}
@@ -0,0 +1,237 @@
+#include "alloc_tracer.h"
+#include "mp_log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace hnc::core::mem_pool::details {
+constinit std::atomic<bool> AllocTracer::_m_enabled{false};
+thread_local AllocTracer::ThreadBuffer* AllocTracer::_m_tls_buffer HNC_TLS_INITIAL_EXEC = nullptr;
+thread_local bool AllocTracer::_m_tls_busy HNC_TLS_INITIAL_EXEC = false;
+
+namespace {
+// 与 tc 相同， 使用 pthread key 的析构函数在线程退出时归还缓冲区， 不注册 thread_local 析构
+pthread_key_t trace_key;
+pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+
+uint64_t NowNs() noexcept {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+bool WriteAll(const int fd, const void* data, size_t len) noexcept {
+    auto buf = static_cast<const char*>(data);
+    while (len > 0) {
+        const ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+}
+
+bool AllocTracer::start(const char* path) {
+    std::unique_lock locker(_m_mtx);
+    if (_m_running) {
+        return false;
+    }
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    TraceFileHeader header{};
+    memcpy(header._magic, TRACE_MAGIC, sizeof(header._magic));
+    header._version = TRACE_VERSION;
+    header._record_size = sizeof(TraceRecord);
+    if (!WriteAll(fd, &header, sizeof(header))) {
+        close(fd);
+        return false;
+    }
+    if (!_m_registered) {
+        _m_registered = true;
+        pthread_atfork(_m_prepare_fork, _m_parent_fork, _m_child_fork);
+        std::atexit([] { GetInstance().stop(); });
+    }
+    // 丢弃上一次停止后才写入缓冲区的记录
+    for (ThreadBuffer* buffer = _m_buffers.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->_next) {
+        buffer->_tail.store(buffer->_head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+    _m_fd = fd;
+    _m_written.store(0, std::memory_order_relaxed);
+    _m_start_ns.store(NowNs(), std::memory_order_relaxed);
+    _m_running = true;
+    _m_exited = false;
+    // 先启动后台线程再开启记录， 创建线程时的申请不会被记录
+    std::thread(&AllocTracer::_m_run, this).detach();
+    _m_enabled.store(true, std::memory_order_release);
+    MP_LOG(info, std::string("alloc trace start, path=") + path);
+    return true;
+}
+
+void AllocTracer::stop() noexcept {
+    std::unique_lock locker(_m_mtx);
+    if (!_m_running) {
+        return;
+    }
+    _m_enabled.store(false, std::memory_order_relaxed);
+    _m_running = false;
+    _m_cond.notify_all();
+    _m_cond.wait(locker, [this] { return _m_exited; });
+    // 后台线程已经退出， 写完剩下的记录
+    _m_flush();
+    close(_m_fd);
+    _m_fd = -1;
+    MP_LOG(info, "alloc trace stop, records=" + std::to_string(_m_written.load(std::memory_order_relaxed)));
+}
+
+void AllocTracer::record(const TraceOp op, const void* ptr, const size_t size) noexcept {
+    if (_m_tls_busy) {
+        return;
+    }
+    ThreadBuffer* buffer = _m_tls_buffer;
+    if (buffer == nullptr) [[unlikely]] {
+        _m_tls_busy = true;
+        buffer = _m_acquire_buffer();
+        _m_tls_busy = false;
+        if (buffer == nullptr) {
+            return;
+        }
+    }
+    const size_t head = buffer->_head.load(std::memory_order_relaxed);
+    if (head - buffer->_tail.load(std::memory_order_acquire) >= BUFFER_RECORDS) [[unlikely]] {
+        // 缓冲区满， 唤醒后台线程并等待， 跟踪停止时直接丢弃
+        _m_cond.notify_one();
+        while (head - buffer->_tail.load(std::memory_order_acquire) >= BUFFER_RECORDS) {
+            if (!enabled()) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+    TraceRecord& record = buffer->_records[head % BUFFER_RECORDS];
+    record._time_ns = NowNs() - _m_start_ns.load(std::memory_order_relaxed);
+    record._ptr = reinterpret_cast<uintptr_t>(ptr);
+    record._size = static_cast<uint32_t>(std::min<size_t>(size, UINT32_MAX));
+    record._thread = buffer->_thread;
+    record._op = static_cast<uint8_t>(op);
+    record._reserved = 0;
+    buffer->_head.store(head + 1, std::memory_order_release);
+}
+
+AllocTracer::ThreadBuffer* AllocTracer::_m_acquire_buffer() noexcept {
+    ThreadBuffer* buffer = nullptr;
+    for (ThreadBuffer* it = _m_buffers.load(std::memory_order_acquire); it != nullptr; it = it->_next) {
+        bool expected = false;
+        if (!it->_in_use.load(std::memory_order_relaxed)
+            && it->_in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            buffer = it;
+            break;
+        }
+    }
+    if (buffer == nullptr) {
+        void* mem_ptr = nullptr;
+        try {
+            mem_ptr = SystemAlloc(_RoundUp(sizeof(ThreadBuffer), constant::PAGE_BYTES) >> constant::PAGE_SHIFT);
+        } catch (const std::bad_alloc&) {
+            return nullptr;
+        }
+        buffer = new (mem_ptr) ThreadBuffer();
+        buffer->_in_use.store(true, std::memory_order_relaxed);
+        ThreadBuffer* next = _m_buffers.load(std::memory_order_relaxed);
+        do {
+            buffer->_next = next;
+        } while (!_m_buffers.compare_exchange_weak(next, buffer, std::memory_order_release, std::memory_order_relaxed));
+    }
+    // 编号0保留给无效记录
+    uint16_t thread = 0;
+    while (thread == 0) {
+        thread = _m_next_thread.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    buffer->_thread = thread;
+
+    // 先设置TLS， pthread_setspecific 内部申请内存时不会再次进入这里
+    _m_tls_buffer = buffer;
+    pthread_once(&trace_key_once, [] { pthread_key_create(&trace_key, _m_release_buffer); });
+    pthread_setspecific(trace_key, buffer);
+    return buffer;
+}
+
+void AllocTracer::_m_release_buffer(void* ptr) noexcept {
+    _m_tls_buffer = nullptr;
+    // 没有写入文件的记录留在缓冲区中， 由后台线程继续写出
+    static_cast<ThreadBuffer*>(ptr)->_in_use.store(false, std::memory_order_release);
+}
+
+void AllocTracer::_m_flush() noexcept {
+    for (ThreadBuffer* buffer = _m_buffers.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->_next) {
+        size_t tail = buffer->_tail.load(std::memory_order_relaxed);
+        const size_t head = buffer->_head.load(std::memory_order_acquire);
+        while (tail != head) {
+            // 环形缓冲区回绕时分两段写出
+            const size_t index = tail % BUFFER_RECORDS;
+            const size_t count = std::min(head - tail, BUFFER_RECORDS - index);
+            if (_m_fd >= 0 && WriteAll(_m_fd, &buffer->_records[index], count * sizeof(TraceRecord))) {
+                _m_written.fetch_add(count, std::memory_order_relaxed);
+            }
+            tail += count;
+        }
+        buffer->_tail.store(tail, std::memory_order_release);
+    }
+}
+
+void AllocTracer::_m_run() noexcept {
+    // 后台线程自己的申请释放不记录， 否则缓冲区满时会等待自己
+    _m_tls_busy = true;
+    std::unique_lock locker(_m_mtx);
+    while (true) {
+        // 缓冲区满时记录的线程会提前唤醒， 这里不使用谓词
+        _m_cond.wait_for(locker, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+        if (!_m_running) {
+            _m_exited = true;
+            _m_cond.notify_all();
+            return;
+        }
+        _m_flush();
+    }
+}
+
+void AllocTracer::_m_prepare_fork() noexcept {
+    GetInstance()._m_mtx.lock();
+}
+
+void AllocTracer::_m_parent_fork() noexcept {
+    GetInstance()._m_mtx.unlock();
+}
+
+void AllocTracer::_m_child_fork() noexcept {
+    AllocTracer& tracer = GetInstance();
+    // 子进程中没有后台线程， 也不再写父进程的跟踪文件
+    _m_enabled.store(false, std::memory_order_relaxed);
+    tracer._m_running = false;
+    tracer._m_exited = true;
+    if (tracer._m_fd >= 0) {
+        close(tracer._m_fd);
+        tracer._m_fd = -1;
+    }
+    new (&tracer._m_cond) std::condition_variable();
+    tracer._m_mtx.unlock();
+}
+
+}
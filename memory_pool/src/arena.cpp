@@ -0,0 +1,72 @@
+#include "arena.h"
+#include "page_cache.h"
+
+namespace hnc::core::mem_pool {
+
+void TncArena::reset() noexcept {
+    if (_m_spans == nullptr) {
+        return;
+    }
+    // 整批归还， 连续属于同一个pc分片的span只加一次锁
+    details::PageCache* page_cache = nullptr;
+    while (_m_spans != nullptr) {
+        details::Span* span = _m_spans;
+        // 归还后span可能被合并删除， 先取出后继
+        _m_spans = span->_next;
+        span->_next = nullptr;
+        details::PageCache* owner = &details::PageCache::OwnerOf(span);
+        if (owner != page_cache) {
+            if (page_cache != nullptr) {
+                page_cache->unlock();
+            }
+            page_cache = owner;
+            page_cache->lock();
+        }
+        page_cache->recover_span_to_page_cache(span);
+    }
+    page_cache->unlock();
+    MP_LOG(debug, "arena reset, reserved_bytes=" + std::to_string(_m_reserved_bytes));
+    _m_cur = _m_end = nullptr;
+    _m_allocated_bytes = _m_reserved_bytes = 0;
+}
+
+void* TncArena::_m_allocate_slow(const size_t size, const size_t align) {
+    // span起始地址页对齐， 超过一页的对齐需要多申请 align - 一页 的空间
+    const size_t need_bytes = size + (align > details::constant::PAGE_BYTES ? align - details::constant::PAGE_BYTES : 0);
+    const size_t need_pages = details::_RoundUp(need_bytes, details::constant::PAGE_BYTES) >> details::constant::PAGE_SHIFT;
+
+    // 超过一个span的大对象单独申请span， 当前span剩余的空间继续使用
+    if (need_pages > _m_chunk_pages) {
+        const auto ptr = reinterpret_cast<uintptr_t>(_m_new_span(need_pages));
+        _m_allocated_bytes += size;
+        return reinterpret_cast<void*>((ptr + align - 1) & ~(align - 1));
+    }
+
+    _m_cur = _m_new_span(_m_chunk_pages);
+    _m_end = _m_cur + (_m_chunk_pages << details::constant::PAGE_SHIFT);
+    // 申请次数越多说明请求越大， 页数翻倍直到pc的最大span
+    _m_chunk_pages = std::min<size_t>(_m_chunk_pages * 2, details::constant::MAX_PAGE_COUNT);
+    return allocate(size, align);
+}
+
+char* TncArena::_m_new_span(const size_t page_count) {
+    details::PageCache& page_cache = details::PageCache::GetInstance();
+    page_cache.lock();
+    details::Span* span = page_cache.create_pc_span(page_count);
+    if (span == nullptr) [[unlikely]] {
+        page_cache.unlock();
+        throw std::bad_alloc();
+    }
+    // 与大块内存一样标记为直接分配， 不会被相邻的空闲span合并
+    span->_is_use = true;
+    span->_is_direct = true;
+    span->_block_size = span->_page_size << details::constant::PAGE_SHIFT;
+    page_cache.unlock();
+
+    span->_next = _m_spans;
+    _m_spans = span;
+    _m_reserved_bytes += page_count << details::constant::PAGE_SHIFT;
+    MP_LOG(debug, "arena new span, page_count=" + std::to_string(page_count));
+    return reinterpret_cast<char*>(span->_page_id << details::constant::PAGE_SHIFT);
+}
+}
@@ -1,11 +1,15 @@
 #include "central_cache.h"
 #include "page_cache.h"
+#include "hardened.h"
 
 #include <freelist.h>
 
+#include <algorithm>
+#include <cstdint>
+
 
 namespace hnc::core::mem_pool::details{
-CentralCache CentralCache::_m_central_cache; // central_cache的饿汉单例
+constinit CentralCache::Nodes CentralCache::_m_central_caches; // 每个节点的central_cache饿汉单例, 常量初始化不依赖静态构造顺序
 
 // 根据内存块字节数大小 获取适应的 申请页面数量， 即使申请最大的内存块，也最高只会去申请管理128页面的spanlist
 size_t PageThreshHold(const size_t align_size) {
@@ -24,19 +28,33 @@ size_t PageThreshHold(const size_t align_size) {
 
 /** 尝试从对应块大小的span_list中 的一些span 中分配block_count数量的align_size的块给thread cache
  *  有可能span_list中的span内的块数量 < block_count, 但是一定会至少分配出一个内存块给tc
+ *  pc向OS申请内存失败时返回0， 此时不持有任何锁
  */
-size_t CentralCache::alloc_to_thread(void *&start, void *&end, const size_t block_count, const size_t align_size) noexcept {
-    // 找到链表，获取是哪一个内存块大小对应的链表（208个不同内存块大小的链表）
+size_t CentralCache::alloc_to_thread(void *&start, void *&end, const size_t block_count, const size_t align_size, const uint16_t owner) noexcept {
+    // 找到链表，获取是哪一个内存块大小对应的链表（FREE_LIST_SIZE个不同内存块大小的链表）
     // 函数保证至少可以返回一个内存块
+    const size_t list_index = Index(align_size);
+
+    // 优先从传输缓存中整批取出其他tc归还的内存块， 不需要持有桶锁
+    if (const size_t batch_count = _m_transfer_caches[list_index].pop(start, end, block_count)) {
+        MP_LOG(debug, "thread cache {empty} -> transfer cache {batch}, block_count=" + std::to_string(batch_count));
+        _m_transfer_hits.fetch_add(1, std::memory_order_relaxed);
+        return batch_count;
+    }
+
     size_t actual_count = 1; // 实际返回的内存块数
+    _m_span_fetches.fetch_add(1, std::memory_order_relaxed);
 
     // 此处可能会有多个线程同时访问同一个index的span list，要加锁
-    _m_span_lists[Index(align_size)].lock();
+    _m_span_lists[list_index].lock();
 
     // 获取到一个保证不为空的span
-    Span* span = _m_get_span(_m_span_lists[Index(align_size)], align_size);
+    Span* span = _m_get_span(_m_span_lists[list_index], align_size);
+    if (span == nullptr) [[unlikely]] {
+        _m_span_lists[list_index].unlock();
+        return 0;
+    }
     // 注意，只有上述函数内是持有pc锁的，运行到这里后 span的use_count并没有初始化！！！
-    assert(span);
     assert(span->_freelist_header);
 
     // 初始start和end都指向span中的第一个内存块
@@ -52,16 +70,39 @@ size_t CentralCache::alloc_to_thread(void *&start, void *&end, const size_t bloc
     span->_freelist_header = GetNextAddr(end);
     // 更新该span具体分配了多少内存块出去，回收才会使用这个参数
     span->_use_count += actual_count;
+    // 最近从span切分内存块的线程成为所属线程， 之后其他线程释放这个span的内存块时送回该线程
+    span->set_owner(owner);
+    // span的内存块分配完了， 移到满链表， 下次获取span时不需要再跳过它
+    if (span->_freelist_header == nullptr) {
+        _m_span_lists[list_index].erase(span);
+        _m_full_span_lists[list_index].push_front(span);
+    }
     // 更新完链表后可以对该cc解锁
-    _m_span_lists[Index(align_size)].unlock();
+    _m_span_lists[list_index].unlock();
 
     // 将返回的尾节点 next指针置空
     GetNextAddr(end) = nullptr;
     return actual_count;
 }
 
-// tc释放的一系列内存块返还给spans (可能是从属于多个span的)
+// tc释放的一系列内存块返还给spans (可能是从属于多个span、多个节点的)
 void CentralCache::recover_blocks_to_spans(void *start, const size_t align_size) noexcept {
+    if (PageCache::NodeCount() == 1) {
+        Node(0)._m_recover_blocks(start, align_size);
+        return;
+    }
+    void* heads[constant::MAX_NUMA_NODES];
+    void* tails[constant::MAX_NUMA_NODES];
+    size_t counts[constant::MAX_NUMA_NODES];
+    _m_split_by_node(start, heads, tails, counts);
+    for (size_t node = 0; node < PageCache::NodeCount(); ++node) {
+        if (heads[node] != nullptr) {
+            Node(node)._m_recover_blocks(heads[node], align_size);
+        }
+    }
+}
+
+void CentralCache::_m_recover_blocks(void *start, const size_t align_size) noexcept {
     // 根据内存块的地址 计算出它对应的页面号， 根据页号 从哈希表中 找到 对应的 span地址， 复杂度即O(1)
     // 计算对应链表序号
     const size_t list_index = Index(align_size);
@@ -72,11 +113,16 @@ void CentralCache::recover_blocks_to_spans(void *start, const size_t align_size)
     // 依次遍历start起始的链表， 归还每一个内存块
     while (start != nullptr) {
         // 找到对应span
-        const auto span = PageCache::GetInstance().find_span_by_address(start);
+        const auto span = PageCache::find_span_by_address(start);
+        // 满的span归还内存块后重新可以分配， 移回可分配链表
+        if (span->_freelist_header == nullptr) {
+            _m_full_span_lists[list_index].erase(span);
+            _m_span_lists[list_index].push_front(span);
+        }
         // 归还内存块
         void *next = GetNextAddr(start);
         GetNextAddr(start) = span->_freelist_header;
-        span->_freelist_header = next; // 更新span的头节点
+        span->_freelist_header = start; // 更新span的头节点为归还的内存块
 
         // 当一个span的内存块使用数量归为0时说明这个span的所有内存块都归还， 则将其归还给pc 进行合并
         --span->_use_count;
@@ -94,9 +140,10 @@ void CentralCache::recover_blocks_to_spans(void *start, const size_t align_size)
 
 
             // page_cache 可能需要将span进行合并, 加锁
-            PageCache::GetInstance().lock();
-            PageCache::GetInstance().recover_span_to_page_cache(span);
-            PageCache::GetInstance().unlock();
+            PageCache& page_cache = PageCache::OwnerOf(span);
+            page_cache.lock();
+            page_cache.recover_span_to_page_cache(span);
+            page_cache.unlock();
 
             // 重新对这个链表上锁
             _m_span_lists[list_index].lock();
@@ -110,37 +157,159 @@ void CentralCache::recover_blocks_to_spans(void *start, const size_t align_size)
     _m_span_lists[list_index].unlock();
 }
 
+void CentralCache::recover_from_thread(void *start, void *end, const size_t block_count, const size_t align_size) noexcept {
+    if (PageCache::NodeCount() == 1) {
+        Node(0)._m_recover_batch(start, end, block_count, align_size);
+        return;
+    }
+    // 远端释放的内存块回到它所属节点的cc， 不会被本节点的线程继续使用
+    void* heads[constant::MAX_NUMA_NODES];
+    void* tails[constant::MAX_NUMA_NODES];
+    size_t counts[constant::MAX_NUMA_NODES];
+    _m_split_by_node(start, heads, tails, counts);
+    for (size_t node = 0; node < PageCache::NodeCount(); ++node) {
+        if (heads[node] != nullptr) {
+            Node(node)._m_recover_batch(heads[node], tails[node], counts[node], align_size);
+        }
+    }
+}
+
+void CentralCache::_m_recover_batch(void *start, void *end, const size_t block_count, const size_t align_size) noexcept {
+    if (_m_transfer_caches[Index(align_size)].push(start, end, block_count)) {
+        MP_LOG(debug, "thread cache -> transfer cache {batch}, block_count=" + std::to_string(block_count));
+        return;
+    }
+    _m_recover_blocks(start, align_size);
+}
+
+void CentralCache::_m_split_by_node(void *start, void **heads, void **tails, size_t *counts) noexcept {
+    for (size_t node = 0; node < constant::MAX_NUMA_NODES; ++node) {
+        heads[node] = tails[node] = nullptr;
+        counts[node] = 0;
+    }
+    while (start != nullptr) {
+        void *next = GetNextAddr(start);
+        const size_t node = PageCache::OwnerOf(PageCache::find_span_by_address(start)).node();
+        GetNextAddr(start) = nullptr;
+        if (heads[node] == nullptr) {
+            heads[node] = start;
+        } else {
+            GetNextAddr(tails[node]) = start;
+        }
+        tails[node] = start;
+        ++counts[node];
+        start = next;
+    }
+}
+
+void CentralCache::drain_transfer_caches() noexcept {
+    for (size_t node = 0; node < PageCache::NodeCount(); ++node) {
+        CentralCache& central_cache = Node(node);
+        for (auto& transfer_cache : central_cache._m_transfer_caches) {
+            void *start, *end;
+            while (transfer_cache.pop(start, end, SIZE_MAX) != 0) {
+                // 同一个传输缓存的内存块大小相同且属于同一个节点， 从所属的span得到块大小
+                central_cache._m_recover_blocks(start, PageCache::find_span_by_address(start)->_block_size);
+            }
+        }
+    }
+}
+
+size_t CentralCache::collect_stats(MallocStats &stats) noexcept {
+    size_t span_pages = 0;
+    for (size_t node = 0; node < PageCache::NodeCount(); ++node) {
+        span_pages += Node(node)._m_collect_stats(stats);
+    }
+    return span_pages;
+}
+
+size_t CentralCache::_m_collect_stats(MallocStats &stats) noexcept {
+    size_t span_pages = 0;
+    for (size_t i = 0; i < constant::FREE_LIST_SIZE; ++i) {
+        SizeClassStats& class_stats = stats.size_classes[i];
+        const size_t align_size = IndexToSize(i);
+        _m_span_lists[i].lock();
+        for (SpanList* span_list : {&_m_span_lists[i], &_m_full_span_lists[i]}) {
+            for (auto it = span_list->begin(); it != span_list->end(); ++it) {
+                const size_t block_count = (it->_page_size << constant::PAGE_SHIFT) / align_size;
+                ++class_stats.span_count;
+                class_stats.central_cache_blocks += block_count - it->_use_count;
+                class_stats.in_use_blocks += it->_use_count;
+                span_pages += it->_page_size;
+            }
+        }
+        _m_span_lists[i].unlock();
+        // 传输缓存中的内存块仍然计入span的 _use_count
+        const size_t transfer_blocks = _m_transfer_caches[i].block_count();
+        class_stats.central_cache_blocks += transfer_blocks;
+        class_stats.in_use_blocks -= std::min(transfer_blocks, class_stats.in_use_blocks);
+    }
+    stats.transfer_cache_hits += _m_transfer_hits.load(std::memory_order_relaxed);
+    stats.central_span_fetches += _m_span_fetches.load(std::memory_order_relaxed);
+    stats.page_cache_span_fetches += _m_page_fetches.load(std::memory_order_relaxed);
+    return span_pages;
+}
+
+void CentralCache::lock_all() noexcept {
+    for (auto& central_cache : _m_central_caches._nodes) {
+        for (auto& span_list : central_cache._m_span_lists) {
+            span_list.lock();
+        }
+        for (auto& transfer_cache : central_cache._m_transfer_caches) {
+            transfer_cache.lock();
+        }
+    }
+}
+
+void CentralCache::unlock_all() noexcept {
+    for (auto& central_cache : _m_central_caches._nodes) {
+        for (auto& transfer_cache : central_cache._m_transfer_caches) {
+            transfer_cache.unlock();
+        }
+        for (auto& span_list : central_cache._m_span_lists) {
+            span_list.unlock();
+        }
+    }
+}
+
 /**
- * ① 有span，且 freelist有内存块
- * ③ 有span，但是freelist已经用完了， 无span， 向pc申请 k 页的 span
- * @return freelist 内至少有一个内存块的span
+ * ① span_list 中只有freelist不为空的span， 直接返回第一个
+ * ② span_list 为空， 向pc申请 k 页的 span
+ * @return freelist 内至少有一个内存块的span， pc向OS申请内存失败时返回nullptr(仍然持有桶锁)
  */
 Span * CentralCache::_m_get_span(SpanList &span_list, const size_t align_size) noexcept {
-    // ① 遍历所有span查找是否有不为空的freelist，找到即返回该span中的
-    for (auto it = span_list.begin(); it != span_list.end(); ++it) {
-        if (it->_freelist_header != nullptr) {
-            logger::log_debug("thread cache {empty} -> central cache {not empty}, block_size=" + std::to_string(align_size));
-            return *it;
-        }
+    // ① 满的span在另一个链表中， 不需要遍历查找
+    if (!span_list.empty()) {
+        MP_LOG(debug, "thread cache {empty} -> central cache {not empty}, block_size=" + std::to_string(align_size));
+        return *span_list.begin();
     }
 
     // 在这里一个tc 在cc中找不到可用的资源， 可以先把cc的锁释放掉
     span_list.unlock();
 
-    // ② 有span，但无内存块，和无span一样，从pc申请一个合适大小的span
+    // ② 没有可分配的span，从pc申请一个合适大小的span
     // 先获取该内存块最多对应的字节数对应的Page数
     const size_t page_count = PageThreshHold(align_size);
+    _m_page_fetches.fetch_add(1, std::memory_order_relaxed);
 
     // 由于span_to_central 函数会递归调用自己，因此在调用这个函数外层手动做加锁和解锁操作，不使用RAII
-    PageCache::GetInstance().lock();
-    // 从pc中获取一个全新的span 包含了page_count 个页面
-    Span *span = PageCache::GetInstance().create_pc_span(page_count);
-    logger::log_debug("thread cache {empty} -> central cache {add new span} page_count=" + std::to_string(span->_page_size));
+    PageCache& page_cache = PageCache::GetInstance();
+    page_cache.lock();
+    // 从当前线程的pc分片中获取一个全新的span 包含了page_count 个页面
+    Span *span = page_cache.create_pc_span(page_count);
+    if (span == nullptr) [[unlikely]] {
+        page_cache.unlock();
+        span_list.lock();
+        return nullptr;
+    }
+    MP_LOG(debug, "thread cache {empty} -> central cache {add new span} page_count=" + std::to_string(span->_page_size));
     // 这里还没有释放互斥锁，对于pc的操作是只有一个线程会执行的，因此只要在这一处修改为true即可
     span->_is_use = true;
     span->_block_size = align_size; // 内存块大小
+    span->set_owner(0);
+    hardened_reset_span(span);
     // 对pc的操作结束，释放pc的锁
-    PageCache::GetInstance().unlock();
+    page_cache.unlock();
 
     // 先获取该span的起始地址和结束地址(真正的结束地址)
     auto start = reinterpret_cast<char*>(span->_page_id << constant::PAGE_SHIFT);
@@ -149,10 +318,10 @@ Span * CentralCache::_m_get_span(SpanList &span_list, const size_t align_size) n
     // 将该空间起始地址填入span的freelist
     span->_freelist_header = static_cast<void*>(start);
 
-    // 初始化span块，填充为一个链表
+    // 初始化span块，填充为一个链表, span的字节数不一定是块大小的整数倍， 尾部不足一个块的部分不能切出去
     void* tail = start;
     start += align_size;
-    while (start < end) {
+    while (start + align_size <= end) {
         // tail内存块设为下一个内存块的地址
         GetNextAddr(tail) = start;
         // tail 设为下一个内存块的地址
@@ -166,7 +335,7 @@ Span * CentralCache::_m_get_span(SpanList &span_list, const size_t align_size) n
     // 对cc的桶操作前再重新对cc上锁, 函数调用方会负责解锁
     span_list.lock();
     // 将该链表放入对应的span_list中
-    span_list.insert(*span_list.begin(), span);
+    span_list.push_front(span);
     return span;
 }
 
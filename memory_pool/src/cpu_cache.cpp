@@ -0,0 +1,122 @@
+#include "cpu_cache.h"
+#include "central_cache.h"
+#include "mp_log.h"
+
+#include <cassert>
+#include <sched.h>
+
+namespace hnc::core::mem_pool::details {
+constinit CpuCache CpuCache::_m_cpu_cache; // per-cpu缓存的饿汉单例, 常量初始化不依赖静态构造顺序
+
+void CpuCache::Slab::lock() noexcept {
+    while (_locked.exchange(true, std::memory_order_acquire)) {
+        // 持有锁的线程大概率在同一个cpu上被抢占了， 让出cpu让它先执行完临界区
+        while (_locked.load(std::memory_order_relaxed)) {
+            sched_yield();
+        }
+    }
+}
+
+void* CpuCache::allocate(const int cpu, const size_t size) noexcept {
+    ThreadCache* cache = _m_lock_cache(cpu);
+    if (cache == nullptr) [[unlikely]] {
+        return nullptr;
+    }
+    size_t fetch_count = 0;
+    void* obj = cache->allocate_cached(size, fetch_count);
+    _m_slabs[cpu].unlock();
+    if (obj != nullptr) {
+        return obj;
+    }
+    // 缓存为空时释放锁之后再向cc批量申请， 第一块返回给调用方， 剩余的加锁放入缓存
+    const size_t align_size = RoundUp(size);
+    void *start, *end;
+    const size_t actual_count = CentralCache::GetInstance().alloc_to_thread(start, end, fetch_count, align_size, 0);
+    if (actual_count == 0) [[unlikely]] {
+        return nullptr;
+    }
+    if (actual_count > 1) {
+        _m_lock_cache(cpu)->refill(GetNextAddr(start), end, actual_count - 1, align_size);
+        _m_slabs[cpu].unlock();
+    }
+    return start;
+}
+
+void CpuCache::deallocate(const int cpu, void* obj, const size_t align_size, const uint16_t owner) noexcept {
+    ThreadCache::DeferredRelease deferred;
+    ThreadCache* cache = _m_lock_cache(cpu);
+    if (cache == nullptr) [[unlikely]] {
+        ThreadCache::release_to_central(obj, align_size);
+        return;
+    }
+    // per-cpu缓存没有自己的队列， 回退到线程局部缓存的线程申请的内存块送回该线程
+    if (!cache->deallocate_remote(obj, align_size, owner)) {
+        cache->deallocate(obj, align_size, &deferred);
+    }
+    _m_slabs[cpu].unlock();
+    deferred.flush();
+}
+
+size_t CpuCache::allocate_batch(const int cpu, const size_t size, const size_t count, void** out) noexcept {
+    ThreadCache* cache = _m_lock_cache(cpu);
+    if (cache == nullptr) [[unlikely]] {
+        return 0;
+    }
+    size_t filled = cache->allocate_batch_cached(size, count, out);
+    _m_slabs[cpu].unlock();
+    if (filled < count) {
+        filled += ThreadCache::fetch_from_central(RoundUp(size), count - filled, out + filled, 0);
+    }
+    return filled;
+}
+
+void CpuCache::deallocate_batch(const int cpu, void** objs, const size_t count, const size_t align_size) noexcept {
+    ThreadCache* cache = _m_lock_cache(cpu);
+    if (cache == nullptr) [[unlikely]] {
+        for (size_t i = 0; i < count; ++i) {
+            ThreadCache::release_to_central(objs[i], align_size);
+        }
+        return;
+    }
+    ThreadCache::DeferredRelease deferred;
+    cache->deallocate_batch(objs, count, align_size, &deferred);
+    _m_slabs[cpu].unlock();
+    deferred.flush();
+}
+
+void CpuCache::lock_all() noexcept {
+    for (auto& slab : _m_slabs) {
+        slab.lock();
+    }
+}
+
+void CpuCache::unlock_all() noexcept {
+    for (auto& slab : _m_slabs) {
+        slab.unlock();
+    }
+}
+
+ThreadCache* CpuCache::_m_lock_cache(const int cpu) noexcept {
+    assert(cpu >= 0 && cpu < MAX_CPU_COUNT);
+    Slab& slab = _m_slabs[cpu];
+    ThreadCache* cache = slab._cache.load(std::memory_order_acquire);
+    if (cache == nullptr) [[unlikely]] {
+        // 创建时会获取tc对象池和预算的互斥锁， 可能mmap， 不能持有自旋锁
+        cache = ThreadCache::create_unbound();
+        if (cache == nullptr) {
+            return nullptr;
+        }
+        // 其他线程先创建好了， 回收自己创建的
+        if (ThreadCache* expected = nullptr;
+            !slab._cache.compare_exchange_strong(expected, cache, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            ThreadCache::destroy(cache);
+            cache = expected;
+        } else {
+            MP_LOG(debug, "create cpu cache, cpu=" + std::to_string(cpu));
+        }
+    }
+    slab.lock();
+    return cache;
+}
+
+}
@@ -2,7 +2,7 @@
 
 #include <assert.h>
 
-#include "hnc_log.h"
+#include "mp_log.h"
 
 namespace hnc::core::mem_pool::details {
 bool Freelist::empty() const noexcept {
@@ -16,9 +16,21 @@ size_t Freelist::apply_count() const noexcept {
 void Freelist::increment() noexcept {
     // 下次申请的内存块数量
     ++_m_apply_count;
-    logger::log_trace("apply_count=" + std::to_string(_m_apply_count));
+    MP_LOG(trace, "apply_count=" + std::to_string(_m_apply_count));
 }
 
+void Freelist::shrink() noexcept {
+    _m_apply_count = _m_apply_count > 1 ? _m_apply_count / 2 : 1;
+    MP_LOG(trace, "apply_count=" + std::to_string(_m_apply_count));
+}
+
+size_t Freelist::low_water() const noexcept {
+    return _m_low_water;
+}
+
+void Freelist::reset_low_water() noexcept {
+    _m_low_water = _m_size;
+}
 
 size_t Freelist::size() const noexcept {
     return _m_size;
@@ -30,7 +42,7 @@ void Freelist::push_front(void* obj) noexcept {
     _m_freelist_header = obj;
     // 内存块+1
     ++_m_size;
-    logger::log_trace("add block=1, size=" + std::to_string(_m_size));
+    MP_LOG(trace, "add block=1, size=" + std::to_string(_m_size));
 }
 
 void Freelist::push_range(void *start, void *end, const size_t size) noexcept {
@@ -38,7 +50,7 @@ void Freelist::push_range(void *start, void *end, const size_t size) noexcept {
     GetNextAddr(end) = _m_freelist_header;
     _m_freelist_header = start;
     _m_size += size;
-    logger::log_trace("adds block=" + std::to_string(size) + ", size = " + std::to_string(_m_size));
+    MP_LOG(trace, "adds block=" + std::to_string(size) + ", size = " + std::to_string(_m_size));
 }
 /**
  * 将头部的block_count个内存块回收
@@ -48,6 +60,9 @@ void Freelist::pop_range(void *&start, void *&end, size_t block_count) noexcept
     assert(block_count <= _m_size);
     // 更新freelist的新容量
     _m_size -= block_count;
+    if (_m_size < _m_low_water) {
+        _m_low_water = _m_size;
+    }
     // 初始化都指向第一个内存块
     start = end = _m_freelist_header;
     // 找到弹出的最后一个内存块
@@ -57,7 +72,7 @@ void Freelist::pop_range(void *&start, void *&end, size_t block_count) noexcept
     // 新起始地址即最后一个内存块内的地址
     _m_freelist_header = GetNextAddr(end);
     GetNextAddr(end) = nullptr;
-    logger::log_trace("recycle block=" + std::to_string(block_count) + ", size = " + std::to_string(_m_size));
+    MP_LOG(trace, "recycle block=" + std::to_string(block_count) + ", size = " + std::to_string(_m_size));
 }
 
 void* Freelist::pop_front() noexcept {
@@ -66,7 +81,10 @@ void* Freelist::pop_front() noexcept {
     _m_freelist_header = GetNextAddr(obj);
     // 内存块-1
     --_m_size;
-    logger::log_trace("recycle block=1, size = " + std::to_string(_m_size));
+    if (_m_size < _m_low_water) {
+        _m_low_water = _m_size;
+    }
+    MP_LOG(trace, "recycle block=1, size = " + std::to_string(_m_size));
     return obj;
 }
 }
\ No newline at end of file
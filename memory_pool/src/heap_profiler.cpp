@@ -0,0 +1,278 @@
+#include "heap_profiler.h"
+#include "page_cache.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <unwind.h>
+
+namespace hnc::core::mem_pool::details {
+constinit HeapProfiler HeapProfiler::_m_heap_profiler; // 堆分析器的饿汉单例, 常量初始化不依赖静态构造顺序
+
+namespace {
+// 每个线程独立的随机数状态， 为0表示还没有初始化
+thread_local uint64_t tls_sample_rng_ HNC_TLS_INITIAL_EXEC = 0;
+
+// xorshift64*， 足够生成采样间隔， 不需要加锁
+uint64_t NextRandom() noexcept {
+    uint64_t x = tls_sample_rng_;
+    if (x == 0) [[unlikely]] {
+        x = (reinterpret_cast<uintptr_t>(&tls_sample_rng_) ^ static_cast<uint64_t>(time(nullptr))) * 0x9E3779B97F4A7C15ull | 1;
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    tls_sample_rng_ = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+struct UnwindState {
+    void** _stack;
+    int _depth;
+    int _skip;
+};
+
+_Unwind_Reason_Code UnwindCallback(_Unwind_Context* context, void* arg) {
+    auto* state = static_cast<UnwindState*>(arg);
+    const uintptr_t ip = _Unwind_GetIP(context);
+    if (ip == 0) {
+        return _URC_END_OF_STACK;
+    }
+    if (state->_skip > 0) {
+        --state->_skip;
+        return _URC_NO_REASON;
+    }
+    state->_stack[state->_depth++] = reinterpret_cast<void*>(ip);
+    return state->_depth == HeapProfiler::MAX_DEPTH ? _URC_END_OF_STACK : _URC_NO_REASON;
+}
+
+bool WriteAll(const int fd, const char* buf, size_t len) noexcept {
+    while (len > 0) {
+        const ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+}
+
+void HeapProfiler::set_sample_period(const size_t bytes) noexcept {
+    if (bytes != 0) {
+        std::lock_guard locker(_m_mtx);
+        _m_register_fork_handlers();
+        _m_profile_period.store(bytes, std::memory_order_relaxed);
+    }
+    _m_sample_period.store(bytes, std::memory_order_relaxed);
+}
+
+/**
+ * 采样间隔服从指数分布 -ln(u) * period， 每个字节被采样的概率都是 1/period
+ * 线程第一次进入时只生成间隔， 不采样
+ */
+bool HeapProfiler::pick_sample() noexcept {
+    const size_t period = sample_period();
+    if (period == 0) {
+        tls_bytes_until_sample_ = DISABLED_REFRESH_BYTES;
+        return false;
+    }
+    const bool initialized = tls_bytes_until_sample_ != 0;
+    // 取53位得到 (0, 1] 之间的均匀分布
+    const double u = static_cast<double>((NextRandom() >> 11) + 1) * 0x1.0p-53;
+    const double next = -std::log(u) * static_cast<double>(period);
+    tls_bytes_until_sample_ = next < 1.0 ? 1 : next > 0x1.0p62 ? size_t{1} << 62 : static_cast<size_t>(next);
+    return initialized;
+}
+
+void HeapProfiler::record(void* ptr, const size_t size) noexcept {
+    // 获取调用栈时不持有任何锁， 栈回溯内部即使申请内存也只会走普通的申请路径
+    void* stack[MAX_DEPTH];
+    UnwindState state{stack, 0, 1};
+    _Unwind_Backtrace(UnwindCallback, &state);
+
+    Span* span = PageCache::find_span_by_address(ptr);
+    std::lock_guard locker(_m_mtx);
+    Sample* sample = _m_sample_pool.New();
+    // 内存不足时放弃这次采样
+    if (sample == nullptr) [[unlikely]] {
+        return;
+    }
+    sample->_ptr = ptr;
+    sample->_size = size;
+    sample->_depth = state._depth;
+    memcpy(sample->_stack, stack, state._depth * sizeof(void*));
+    const size_t bucket = _m_bucket_of(ptr);
+    sample->_next = _m_buckets[bucket];
+    _m_buckets[bucket] = sample;
+
+    _m_live_bytes += size;
+    ++_m_total_count;
+    _m_total_bytes += size;
+    span->_sampled_count.fetch_add(1, std::memory_order_relaxed);
+    _m_live_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void HeapProfiler::erase(void* ptr, Span* span) noexcept {
+    if (span->_sampled_count.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    std::lock_guard locker(_m_mtx);
+    for (Sample** prev = &_m_buckets[_m_bucket_of(ptr)]; *prev != nullptr; prev = &(*prev)->_next) {
+        Sample* sample = *prev;
+        if (sample->_ptr != ptr) {
+            continue;
+        }
+        *prev = sample->_next;
+        _m_live_bytes -= sample->_size;
+        span->_sampled_count.fetch_sub(1, std::memory_order_relaxed);
+        _m_live_count.fetch_sub(1, std::memory_order_relaxed);
+        _m_sample_pool.Delete(sample);
+        return;
+    }
+}
+
+/**
+ * heap_v2 格式:
+ * heap profile: <存活个数>: <存活字节数> [<累计个数>: <累计字节数>] @ heap_v2/<采样间隔>
+ * <个数>: <字节数> [<个数>: <字节数>] @ <调用栈地址...>
+ * MAPPED_LIBRARIES:
+ * <内存映射>
+ */
+bool HeapProfiler::dump(const int fd) noexcept {
+    char buf[1024];
+    {
+        std::lock_guard locker(_m_mtx);
+        const size_t period = _m_profile_period.load(std::memory_order_relaxed);
+        int len = snprintf(buf, sizeof(buf), "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+                           live_count(), _m_live_bytes, _m_total_count, _m_total_bytes, period == 0 ? 1 : period);
+        if (!WriteAll(fd, buf, len)) {
+            return false;
+        }
+        for (const Sample* bucket : _m_buckets) {
+            for (const Sample* sample = bucket; sample != nullptr; sample = sample->_next) {
+                len = snprintf(buf, sizeof(buf), "1: %zu [1: %zu] @", sample->_size, sample->_size);
+                for (int i = 0; i < sample->_depth; ++i) {
+                    len += snprintf(buf + len, sizeof(buf) - len, " %p", sample->_stack[i]);
+                }
+                buf[len++] = '\n';
+                if (!WriteAll(fd, buf, len)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    // pprof 根据内存映射将地址还原为符号
+    constexpr char MAPS_HEADER[] = "\nMAPPED_LIBRARIES:\n";
+    if (!WriteAll(fd, MAPS_HEADER, sizeof(MAPS_HEADER) - 1)) {
+        return false;
+    }
+    const int maps_fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps_fd < 0) {
+        return false;
+    }
+    bool ok = true;
+    ssize_t n;
+    while (ok && (n = read(maps_fd, buf, sizeof(buf))) > 0) {
+        ok = WriteAll(fd, buf, n);
+    }
+    close(maps_fd);
+    return ok && n == 0;
+}
+
+bool HeapProfiler::dump_on_signal(const int signo, const char* path_prefix) noexcept {
+    {
+        std::lock_guard locker(_m_mtx);
+        _m_register_fork_handlers();
+        snprintf(_m_dump_path, sizeof(_m_dump_path), "%s", path_prefix);
+        if (_m_signal_pipe[0] < 0) {
+            if (pipe2(_m_signal_pipe, O_CLOEXEC) != 0) {
+                return false;
+            }
+            // 信号处理函数中的写入不能阻塞
+            fcntl(_m_signal_pipe[1], F_SETFL, O_NONBLOCK);
+            try {
+                std::thread(&HeapProfiler::_m_signal_dump_loop, this).detach();
+            } catch (...) {
+                return false;
+            }
+        }
+    }
+    struct sigaction action{};
+    action.sa_handler = [](int) {
+        const int saved_errno = errno;
+        constexpr char c = 0;
+        (void)!write(GetInstance()._m_signal_pipe[1], &c, 1);
+        errno = saved_errno;
+    };
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(signo, &action, nullptr) == 0;
+}
+
+size_t HeapProfiler::_m_bucket_of(const void *ptr) noexcept {
+    // 内存块至少8字节对齐， 乘法哈希打散低位
+    return (reinterpret_cast<uintptr_t>(ptr) >> 3) * 0x9E3779B97F4A7C15ull >> (64 - 12) & (BUCKET_COUNT - 1);
+}
+
+void HeapProfiler::_m_signal_dump_loop() noexcept {
+    char c;
+    while (true) {
+        const ssize_t n = read(_m_signal_pipe[0], &c, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        char path[sizeof(_m_dump_path) + 32];
+        {
+            std::lock_guard locker(_m_mtx);
+            snprintf(path, sizeof(path), "%s.%d.%04u.heap", _m_dump_path, getpid(), _m_dump_seq++);
+        }
+        const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            continue;
+        }
+        dump(fd);
+        close(fd);
+    }
+}
+
+void HeapProfiler::_m_register_fork_handlers() noexcept {
+    if (!_m_registered) {
+        _m_registered = true;
+        pthread_atfork(_m_prepare_fork, _m_parent_fork, _m_child_fork);
+    }
+}
+
+void HeapProfiler::_m_prepare_fork() noexcept {
+    GetInstance()._m_mtx.lock();
+}
+
+void HeapProfiler::_m_parent_fork() noexcept {
+    GetInstance()._m_mtx.unlock();
+}
+
+void HeapProfiler::_m_child_fork() noexcept {
+    HeapProfiler& profiler = GetInstance();
+    if (profiler._m_signal_pipe[0] >= 0) {
+        close(profiler._m_signal_pipe[0]);
+        close(profiler._m_signal_pipe[1]);
+        profiler._m_signal_pipe[0] = profiler._m_signal_pipe[1] = -1;
+    }
+    profiler._m_mtx.unlock();
+}
+}
@@ -0,0 +1,358 @@
+/**
+ * libhncmalloc.so : 全局 malloc/free/operator new/delete 替换库
+ *
+ * 使用方式:  LD_PRELOAD=/path/to/libhncmalloc.so ./service
+ * 不需要重新编译业务代码， 进程内所有的 malloc/new 都会走 tc -> cc -> pc
+ *
+ * 1. 编译时定义 HNC_MALLOC_NO_LOG， 内存池内部不会再调用日志(日志本身会申请内存)
+ * 2. cc/pc 单例都是常量初始化的， 在任何静态构造函数之前调用 malloc 也是安全的
+ * 3. 页号映射使用基数树， 节点来自定长内存池(mmap)， 整个申请路径不会经过 libc 的 malloc
+ */
+
+#include "alloc.h"
+#include "central_cache.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <pthread.h>
+
+#define HNC_EXPORT __attribute__((visibility("default")))
+
+namespace {
+using namespace hnc::core::mem_pool;
+
+constexpr size_t MIN_ALIGN = 16; // 与 glibc 一致， malloc 返回的地址至少 16 字节对齐(max_align_t)
+constexpr size_t PAGE_BYTES = details::constant::PAGE_BYTES;
+constexpr size_t MAX_REQUEST_BYTES = PTRDIFF_MAX; // 与 glibc 一致， 超过时指针相减会溢出， 直接返回ENOMEM
+
+/**
+ * 内存池的小块内存只保证8字节对齐(如24B的内存块)， 而 glibc 的 malloc 保证16字节对齐，
+ * 作为替换库时 > 8 字节的申请向上取整到16的倍数
+ * 带大小的 operator delete 释放时也要经过同样的换算， 才能得到申请时的内存块大小
+ */
+size_t alloc_size(const size_t size) noexcept {
+    return size <= sizeof(void*) ? sizeof(void*) : details::_RoundUp(size, MIN_ALIGN);
+}
+
+void* do_malloc(const size_t size) noexcept {
+    // 否则取整到16的倍数或者页数时会回绕
+    if (size > MAX_REQUEST_BYTES) [[unlikely]] {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    try {
+        return tnc_malloc(alloc_size(size));
+    } catch (...) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+}
+
+// 对齐数 <= 16 时与 malloc 相同， 否则由 tnc_aligned_alloc 选择天然对齐的size class或者切出对齐的span
+void* do_aligned_alloc(const size_t align, const size_t size) noexcept {
+    if (size > MAX_REQUEST_BYTES) [[unlikely]] {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    try {
+        return align <= MIN_ALIGN ? tnc_malloc(alloc_size(size)) : tnc_aligned_alloc(size, align);
+    } catch (...) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+}
+
+void do_free(void* ptr) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    tnc_free(ptr);
+}
+
+// 带大小的释放不需要查找span
+void do_free_sized(void* ptr, const size_t size, const size_t align = MIN_ALIGN) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    if (align <= MIN_ALIGN) {
+        tnc_free_sized(ptr, alloc_size(size));
+    } else {
+        tnc_free_aligned_sized(ptr, size, align);
+    }
+}
+
+// operator new 申请失败时需要调用 new_handler, 没有 new_handler 则抛出 bad_alloc
+void* cpp_alloc(const size_t size, const size_t align = MIN_ALIGN) {
+    while (true) {
+        if (void* ptr = do_aligned_alloc(align, size)) {
+            return ptr;
+        }
+        const std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+bool is_power_of_two(const size_t n) noexcept {
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+// fork 时子进程只剩下调用fork的线程， 先持有所有锁， 保证子进程中的锁都是可用的
+void prepare_fork() noexcept {
+#ifdef HNC_MALLOC_PER_CPU
+    details::CpuCache::GetInstance().lock_all();
+#endif
+    details::ThreadCache::lock_all();
+    details::CentralCache::lock_all();
+    details::PageCache::lock_all();
+}
+
+void release_fork() noexcept {
+    details::PageCache::unlock_all();
+    details::CentralCache::unlock_all();
+    details::ThreadCache::unlock_all();
+#ifdef HNC_MALLOC_PER_CPU
+    details::CpuCache::GetInstance().unlock_all();
+#endif
+}
+
+// 读取环境变量中的无符号整数配置， 没有设置则保持默认值
+void read_env(const char* name, size_t& value) noexcept {
+    if (const char* env = getenv(name)) {
+        value = strtoull(env, nullptr, 10);
+    }
+}
+
+/**
+ * 通过环境变量配置空闲内存归还OS的策略， 不需要修改业务代码:
+ * HNC_MALLOC_SCAVENGER=1 启动后台回收线程
+ * HNC_MALLOC_RELEASE_AGE_MS / HNC_MALLOC_RETAIN_BYTES / HNC_MALLOC_RELEASE_RATE / HNC_MALLOC_RELEASE_INTERVAL_MS / HNC_MALLOC_MADV_FREE
+ * HNC_MALLOC_THREAD_CACHE_BYTES 所有线程tc缓存的总预算
+ * HNC_MALLOC_HUGEPAGE=1 使用透明大页， =2 优先使用 MAP_HUGETLB
+ * HNC_MALLOC_PROFILE_PERIOD 堆采样间隔(字节)， HNC_MALLOC_PROFILE_SIGNAL 收到该信号时输出到 HNC_MALLOC_PROFILE_PATH.<pid>.<序号>.heap
+ * HNC_MALLOC_TRACE 跟踪所有申请和释放并写入该文件， 用 mp_replay 回放
+ */
+void init_release_config() {
+    ReleaseConfig config = tnc_get_release_config();
+    size_t lazy = config.lazy;
+    read_env("HNC_MALLOC_RELEASE_AGE_MS", config.release_age_ms);
+    read_env("HNC_MALLOC_RETAIN_BYTES", config.retain_bytes);
+    read_env("HNC_MALLOC_RELEASE_RATE", config.release_rate);
+    read_env("HNC_MALLOC_RELEASE_INTERVAL_MS", config.interval_ms);
+    read_env("HNC_MALLOC_MADV_FREE", lazy);
+    config.lazy = lazy != 0;
+    tnc_set_release_config(config);
+
+    size_t thread_cache_bytes = tnc_get_thread_cache_budget();
+    read_env("HNC_MALLOC_THREAD_CACHE_BYTES", thread_cache_bytes);
+    tnc_set_thread_cache_budget(thread_cache_bytes);
+
+    size_t huge_page = 0;
+    read_env("HNC_MALLOC_HUGEPAGE", huge_page);
+    if (huge_page == 1) {
+        tnc_set_huge_page_mode(HugePageMode::transparent);
+    } else if (huge_page == 2) {
+        tnc_set_huge_page_mode(HugePageMode::hugetlb);
+    }
+
+    size_t profile_period = 0;
+    read_env("HNC_MALLOC_PROFILE_PERIOD", profile_period);
+    if (profile_period != 0) {
+        tnc_set_heap_profile_period(profile_period);
+    }
+    size_t profile_signal = 0;
+    read_env("HNC_MALLOC_PROFILE_SIGNAL", profile_signal);
+    if (profile_signal != 0) {
+        const char* path = getenv("HNC_MALLOC_PROFILE_PATH");
+        tnc_dump_heap_profile_on_signal(static_cast<int>(profile_signal), path != nullptr ? path : "hnc_malloc");
+    }
+
+    if (const char* path = getenv("HNC_MALLOC_TRACE")) {
+        tnc_start_trace(path);
+    }
+
+    size_t scavenger = 0;
+    read_env("HNC_MALLOC_SCAVENGER", scavenger);
+    if (scavenger != 0) {
+        tnc_start_scavenger();
+    }
+}
+
+__attribute__((constructor)) void init_hnc_malloc() {
+    pthread_atfork(prepare_fork, release_fork, release_fork);
+    init_release_config();
+}
+}
+
+extern "C" {
+
+HNC_EXPORT void* malloc(const size_t size) {
+    return do_malloc(size);
+}
+
+HNC_EXPORT void free(void* ptr) {
+    do_free(ptr);
+}
+
+HNC_EXPORT void* calloc(const size_t count, const size_t size) {
+    size_t bytes;
+    if (__builtin_mul_overflow(count, size, &bytes) || bytes > MAX_REQUEST_BYTES) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    void* ptr = do_malloc(bytes);
+    if (ptr != nullptr) {
+        // 内存块会被复用， 不能假设是OS新给的全0页
+        memset(ptr, 0, bytes);
+    }
+    return ptr;
+}
+
+HNC_EXPORT void* realloc(void* ptr, const size_t size) {
+    if (ptr == nullptr) {
+        return do_malloc(size);
+    }
+    if (size == 0) {
+        do_free(ptr);
+        return nullptr;
+    }
+    // 失败时原内存块保持不变
+    if (size > MAX_REQUEST_BYTES) [[unlikely]] {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    // 同一个块大小直接返回原地址， 大块内存原地扩大或者 mremap
+    try {
+        return tnc_realloc(ptr, alloc_size(size));
+    } catch (...) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+}
+
+HNC_EXPORT int posix_memalign(void** mem_ptr, const size_t align, const size_t size) {
+    if (!is_power_of_two(align) || align % sizeof(void*) != 0) {
+        return EINVAL;
+    }
+    void* ptr = do_aligned_alloc(align, size);
+    if (ptr == nullptr) {
+        return ENOMEM;
+    }
+    *mem_ptr = ptr;
+    return 0;
+}
+
+HNC_EXPORT void* aligned_alloc(const size_t align, const size_t size) {
+    if (!is_power_of_two(align)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    return do_aligned_alloc(align, size);
+}
+
+HNC_EXPORT void* memalign(const size_t align, const size_t size) {
+    return aligned_alloc(align, size);
+}
+
+HNC_EXPORT void* valloc(const size_t size) {
+    return do_aligned_alloc(PAGE_BYTES, size);
+}
+
+HNC_EXPORT void* pvalloc(const size_t size) {
+    return do_aligned_alloc(PAGE_BYTES, details::_RoundUp(size == 0 ? 1 : size, PAGE_BYTES));
+}
+
+HNC_EXPORT size_t malloc_usable_size(void* ptr) {
+    return ptr == nullptr ? 0 : tnc_usable_size(ptr);
+}
+
+// 与 glibc 同名， 输出到 stderr， 格式为JSON
+HNC_EXPORT void malloc_stats() {
+    tnc_print_stats(stderr);
+}
+
+}
+
+HNC_EXPORT void* operator new(const size_t size) {
+    return cpp_alloc(size);
+}
+
+HNC_EXPORT void* operator new[](const size_t size) {
+    return cpp_alloc(size);
+}
+
+HNC_EXPORT void* operator new(const size_t size, const std::nothrow_t&) noexcept {
+    return do_malloc(size);
+}
+
+HNC_EXPORT void* operator new[](const size_t size, const std::nothrow_t&) noexcept {
+    return do_malloc(size);
+}
+
+HNC_EXPORT void* operator new(const size_t size, const std::align_val_t align) {
+    return cpp_alloc(size, static_cast<size_t>(align));
+}
+
+HNC_EXPORT void* operator new[](const size_t size, const std::align_val_t align) {
+    return cpp_alloc(size, static_cast<size_t>(align));
+}
+
+HNC_EXPORT void* operator new(const size_t size, const std::align_val_t align, const std::nothrow_t&) noexcept {
+    return do_aligned_alloc(static_cast<size_t>(align), size);
+}
+
+HNC_EXPORT void* operator new[](const size_t size, const std::align_val_t align, const std::nothrow_t&) noexcept {
+    return do_aligned_alloc(static_cast<size_t>(align), size);
+}
+
+HNC_EXPORT void operator delete(void* ptr) noexcept {
+    do_free(ptr);
+}
+
+HNC_EXPORT void operator delete[](void* ptr) noexcept {
+    do_free(ptr);
+}
+
+HNC_EXPORT void operator delete(void* ptr, const size_t size) noexcept {
+    do_free_sized(ptr, size);
+}
+
+HNC_EXPORT void operator delete[](void* ptr, const size_t size) noexcept {
+    do_free_sized(ptr, size);
+}
+
+HNC_EXPORT void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    do_free(ptr);
+}
+
+HNC_EXPORT void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    do_free(ptr);
+}
+
+HNC_EXPORT void operator delete(void* ptr, std::align_val_t) noexcept {
+    do_free(ptr);
+}
+
+HNC_EXPORT void operator delete[](void* ptr, std::align_val_t) noexcept {
+    do_free(ptr);
+}
+
+HNC_EXPORT void operator delete(void* ptr, const size_t size, const std::align_val_t align) noexcept {
+    do_free_sized(ptr, size, static_cast<size_t>(align));
+}
+
+HNC_EXPORT void operator delete[](void* ptr, const size_t size, const std::align_val_t align) noexcept {
+    do_free_sized(ptr, size, static_cast<size_t>(align));
+}
+
+HNC_EXPORT void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    do_free(ptr);
+}
+
+HNC_EXPORT void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    do_free(ptr);
+}
@@ -0,0 +1,94 @@
+#include "malloc_stats.h"
+#include "thread_cache.h"
+#include "central_cache.h"
+#include "page_cache.h"
+
+#include <algorithm>
+
+namespace hnc::core::mem_pool::details {
+
+MallocStats collect_stats() noexcept {
+    MallocStats stats{};
+    for (size_t i = 0; i < constant::FREE_LIST_SIZE; ++i) {
+        stats.size_classes[i].block_size = IndexToSize(i);
+    }
+    ThreadCache::collect_stats(stats);
+    const size_t central_span_pages = CentralCache::collect_stats(stats);
+    for (size_t i = 0; i < PageCache::ARENA_COUNT; ++i) {
+        PageCache::Arena(i).lock();
+        PageCache::Arena(i).collect_stats(stats);
+        PageCache::Arena(i).unlock();
+    }
+
+    for (auto& class_stats : stats.size_classes) {
+        // 各层不是同时统计的， 避免出现负数
+        class_stats.in_use_blocks -= std::min(class_stats.thread_cache_blocks, class_stats.in_use_blocks);
+        stats.central_cache_bytes += class_stats.central_cache_blocks * class_stats.block_size;
+        stats.small_in_use_bytes += class_stats.in_use_blocks * class_stats.block_size;
+    }
+    // pc中不空闲的页面要么属于cc的span， 要么直接分配给了用户
+    const size_t used_bytes = stats.system_bytes - stats.page_cache_free_bytes - stats.page_cache_released_bytes;
+    const size_t central_bytes = central_span_pages << constant::PAGE_SHIFT;
+    stats.large_in_use_bytes = used_bytes > central_bytes ? used_bytes - central_bytes : 0;
+
+    const size_t resident_bytes = stats.system_bytes - stats.page_cache_released_bytes;
+    const size_t in_use_bytes = stats.small_in_use_bytes + stats.large_in_use_bytes;
+    stats.fragmentation = resident_bytes == 0 || in_use_bytes >= resident_bytes
+        ? 0.0 : 1.0 - static_cast<double>(in_use_bytes) / static_cast<double>(resident_bytes);
+    return stats;
+}
+
+void print_stats(const MallocStats& stats, FILE* out) noexcept {
+    fprintf(out, "{\n");
+    fprintf(out, "  \"system_bytes\": %zu,\n", stats.system_bytes);
+    fprintf(out, "  \"mmap_bytes\": %zu,\n", stats.mmap_bytes);
+    fprintf(out, "  \"brk_bytes\": %zu,\n", stats.brk_bytes);
+    fprintf(out, "  \"thread_cache_bytes\": %zu,\n", stats.thread_cache_bytes);
+    fprintf(out, "  \"central_cache_bytes\": %zu,\n", stats.central_cache_bytes);
+    fprintf(out, "  \"page_cache_free_bytes\": %zu,\n", stats.page_cache_free_bytes);
+    fprintf(out, "  \"page_cache_released_bytes\": %zu,\n", stats.page_cache_released_bytes);
+    fprintf(out, "  \"small_in_use_bytes\": %zu,\n", stats.small_in_use_bytes);
+    fprintf(out, "  \"large_in_use_bytes\": %zu,\n", stats.large_in_use_bytes);
+    fprintf(out, "  \"fragmentation\": %.4f,\n", stats.fragmentation);
+    fprintf(out, "  \"span_pool\": {\"in_use\": %zu, \"bytes\": %zu},\n", stats.span_pool_in_use, stats.span_pool_bytes);
+
+    const ThreadCacheCounters& counters = stats.thread_cache_counters;
+    fprintf(out, "  \"thread_caches\": {\"count\": %zu, \"alloc_count\": %zu, \"free_count\": %zu, "
+                 "\"central_fetch_count\": %zu, \"central_release_count\": %zu, \"scavenge_count\": %zu, "
+                 "\"remote_free_count\": %zu, \"remote_collect_count\": %zu},\n",
+            stats.thread_cache_count, counters.alloc_count, counters.free_count,
+            counters.central_fetch_count, counters.central_release_count, counters.scavenge_count,
+            counters.remote_free_count, counters.remote_collect_count);
+    fprintf(out, "  \"tiers\": {\"transfer_cache_hits\": %zu, \"central_span_fetches\": %zu, "
+                 "\"page_cache_span_fetches\": %zu, \"page_cache_system_allocs\": %zu},\n",
+            stats.transfer_cache_hits, stats.central_span_fetches,
+            stats.page_cache_span_fetches, stats.page_cache_system_allocs);
+
+    fprintf(out, "  \"page_cache_free_spans\": [");
+    bool first = true;
+    for (size_t i = 0; i < constant::MAX_PAGE_COUNT; ++i) {
+        if (stats.page_cache_free_spans[i] == 0) {
+            continue;
+        }
+        fprintf(out, "%s\n    {\"pages\": %zu, \"count\": %zu}", first ? "" : ",", i + 1, stats.page_cache_free_spans[i]);
+        first = false;
+    }
+    fprintf(out, "%s],\n", first ? "" : "\n  ");
+
+    fprintf(out, "  \"size_classes\": [");
+    first = true;
+    for (const auto& class_stats : stats.size_classes) {
+        if (class_stats.span_count == 0 && class_stats.thread_cache_blocks == 0) {
+            continue;
+        }
+        fprintf(out, "%s\n    {\"block_size\": %zu, \"spans\": %zu, \"thread_cache_blocks\": %zu, "
+                     "\"central_cache_blocks\": %zu, \"in_use_blocks\": %zu}",
+                first ? "" : ",", class_stats.block_size, class_stats.span_count, class_stats.thread_cache_blocks,
+                class_stats.central_cache_blocks, class_stats.in_use_blocks);
+        first = false;
+    }
+    fprintf(out, "%s]\n", first ? "" : "\n  ");
+    fprintf(out, "}\n");
+    fflush(out);
+}
+}
@@ -1,12 +1,27 @@
 #include "page_cache.h"
 
+#include <chrono>
+
 namespace hnc::core::mem_pool::details {
-PageCache PageCache::_m_page_cache; // _m_page_cache的全局饿汉单例
+constinit PageCache::Arenas PageCache::_m_page_caches; // 所有pc分片的全局饿汉单例, 常量初始化不依赖静态构造顺序
+constinit std::atomic<size_t> PageCache::_m_next_arena[constant::MAX_NUMA_NODES]{};
+constinit std::atomic<size_t> PageCache::_m_node_count{0};
+constinit RadixTree<constant::ADDRESS_BITS - constant::PAGE_SHIFT> PageCache::_m_page_span_map;
+constinit RadixTree<constant::ADDRESS_BITS - constant::HUGE_PAGE_SHIFT> PageCache::_m_huge_regions;
+
+namespace {
+// 单调时钟的毫秒数， 只用于计算span的空闲时间
+size_t NowMs() noexcept {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+}
 
 /** 将page_count数量的span 返回给central_cache
  *  1. 先检查自己对应的哈希桶中是否有空闲的span，有则返回
  *  2. 若没有则，继续向上查找，是否有空闲span，有则分割后返回
  *  3. 若所有哈希桶中均没有空闲span，则向OS申请一篇足够大的span分割后挂载到对应list中返回
+ *  调用方持有pc锁， 不能在这里抛出异常: 作为替换库时异常对象由 malloc 申请， 会等待同一把pc锁
+ *  向OS申请内存(包括span对象和页号映射的节点)失败时返回nullptr， 由调用方解锁后再报告失败
  */
 Span * PageCache::create_pc_span(const size_t page_count) noexcept {
     assert(page_count > 0);
@@ -15,15 +30,26 @@ Span * PageCache::create_pc_span(const size_t page_count) noexcept {
     // >= 512 直接走系统的mmap给
     // 超过512KB的申请，即超过128Page增加新的逻辑，这里的默认Page为4KB
     if (page_count > constant::MAX_PAGE_COUNT) {
-        auto ptr = SystemAlloc(page_count);
-        const auto span = _m_span_pool.New();
+        void* ptr = SystemAllocMMapNoThrow(page_count);
+        if (ptr == nullptr) {
+            return nullptr;
+        }
+        const size_t page_id = reinterpret_cast<size_t>(ptr) >> constant::PAGE_SHIFT;
+        Span* span = _m_ensure_map(page_id, page_count) ? _m_new_span() : nullptr;
+        if (span == nullptr) [[unlikely]] {
+            SystemFreeMMap(ptr, page_count);
+            return nullptr;
+        }
+        _m_bind_node(ptr, page_count);
 
-        span->_page_id = reinterpret_cast<size_t>(ptr) >> constant::PAGE_SHIFT;
+        span->_page_id = page_id;
         span->_page_size = page_count;
         span->_block_size = constant::MAX_ALLOC_BYTES + 1;
-        _m_page_span_map[span->_page_id] = span;
-        _m_page_span_map[span->_page_id + span->_page_size - 1] = span;
-        logger::log_debug("page cache {big block} -> os , page_count=" + std::to_string(page_count));
+        _m_system_pages += page_count;
+        ++_m_system_alloc_count;
+        _m_page_span_map.set(span->_page_id, span);
+        _m_page_span_map.set(span->_page_id + span->_page_size - 1, span);
+        MP_LOG(debug, "page cache {big block} -> os , page_count=" + std::to_string(page_count));
         return span;
     }
     // 1B ~ 256KB ~ 1024KB 即1Page ~ 32page ~ 128Page，
@@ -31,24 +57,31 @@ Span * PageCache::create_pc_span(const size_t page_count) noexcept {
     const int list_index = page_count - 1;
     // 1. 先检查自己对应的哈希桶中是否有空闲的span，有则返回
     if (!_m_span_lists[list_index].empty()) {
-        Span * span = _m_span_lists[list_index].pop_front();
+        Span * span = _m_pick_free_span(_m_span_lists[list_index]);
+        _m_erase_free_span(span);
+        // 已经归还OS的页面再次访问时由缺页中断重新分配， 不需要额外处理
+        span->_is_released = false;
+        _m_update_region_usage(span->_page_id, span->_page_size, true);
 
         // 更新分配出去的span和页号的哈希
         for (size_t i = 0; i < span->_page_size; ++i) {
-            _m_page_span_map[span->_page_id + i] = span;
+            _m_page_span_map.set(span->_page_id + i, span);
         }
-        logger::log_debug("thread cache {empty} -> central cache {empty} -> page cache {not empty}, page_count=" + std::to_string(page_count));
+        MP_LOG(debug, "thread cache {empty} -> central cache {empty} -> page cache {not empty}, page_count=" + std::to_string(page_count));
         return span;
     }
 
     // 2. 若没有则，继续向上查找，是否有空闲span，有则分割后返回
     for (int i = list_index; i < constant::MAX_PAGE_COUNT; ++i) {
         if (!_m_span_lists[i].empty()) {
+            // 动态申请一个新的span，将该span分割， 申请失败时空闲span保持不变
+            auto *prev_span = _m_new_span();
+            if (prev_span == nullptr) [[unlikely]] {
+                return nullptr;
+            }
             // 取出该span
-            Span *complete_span = _m_span_lists[i].pop_front();
-
-            // 动态申请一个新的span，将该span分割
-            auto *prev_span = _m_span_pool.New();
+            Span *complete_span = _m_pick_free_span(_m_span_lists[i]);
+            _m_erase_free_span(complete_span);
 
             // 新span的页号 = 老span的页号， 页数 = 传入参数page_count
             prev_span->_page_id = complete_span->_page_id;
@@ -57,58 +90,233 @@ Span * PageCache::create_pc_span(const size_t page_count) noexcept {
             complete_span->_page_id += page_count;
             complete_span->_page_size -= page_count;
 
-            // 将老span放回对应的span_list中
-            _m_span_lists[complete_span->_page_size - 1].push_front(complete_span);
+            // 将老span放回对应的span_list中, 保留原来的归还状态和空闲时间
+            _m_insert_free_span(complete_span);
 
             // 考虑极端情况
             // 申请的list_index 是0， 那么会跳过当前for，申请一个128页的span，一定会到这里分割
             // 变成1page的span和127page的span， 那么这个分割后的page_span只需要记录两端页号即可
             // 下次再来一个新的，也只会走这里，
 
-            // TODO: 替换 `_m_page_span_map` 为基数树（Radix Tree），避免 `unordered_map` 触发 operator new 递归 死锁
-            //  `std::unordered_map` 在插入新元素或 rehash 时，会调用 `operator new` 分配新内存。
-            //  如果全局 `operator new` 被重载，它可能会 递归调用 unordered_map.insert()，导致 卡死在这里
-            //  解决方案：用 基数树（Radix Tree） 代替 `unordered_map`，避免 `operator new` 的干扰。
-
-            _m_page_span_map[complete_span->_page_id] = complete_span;
-            _m_page_span_map[complete_span->_page_id + complete_span->_page_size - 1] = complete_span;
+            _m_page_span_map.set(complete_span->_page_id, complete_span);
+            _m_page_span_map.set(complete_span->_page_id + complete_span->_page_size - 1, complete_span);
             // std::cout << 'update\n';
 
             // 更新分配出去的span和页号的哈希
             for (size_t j = 0; j < prev_span->_page_size; ++j) {
-                _m_page_span_map[prev_span->_page_id + j] = prev_span;
+                _m_page_span_map.set(prev_span->_page_id + j, prev_span);
             }
-            logger::log_debug("thread cache {empty} -> central cache {empty} -> page cache {not empty}, split=" + std::to_string(page_count)  + ", " + std::to_string(i + 1));
+            _m_update_region_usage(prev_span->_page_id, prev_span->_page_size, true);
+            MP_LOG(debug, "thread cache {empty} -> central cache {empty} -> page cache {not empty}, split=" + std::to_string(page_count)  + ", " + std::to_string(i + 1));
             return prev_span;
         }
     }
 
     // 3. 若所有哈希桶中均没有空闲span，则向OS申请一篇足够大的span分割后挂载到对应list中返回
-    void* mem_ptr = SystemAlloc(constant::MAX_PAGE_COUNT);
-    logger::log_debug("thread cache {empty} -> central cache {empty} -> page cache {empty} -> os {span(128 page)}");
-
-    // 动态申请一个新的span，
-    auto *span = _m_span_pool.New();
+    // 大页模式下映射一个2MB对齐的区域， 失败时退回普通映射
+    if (_m_huge_page_mode != HugePageMode::none && _m_create_huge_region()) {
+        return create_pc_span(page_count);
+    }
+    void* mem_ptr = SystemAllocMMapNoThrow(constant::MAX_PAGE_COUNT);
+    if (mem_ptr == nullptr) {
+        return nullptr;
+    }
+    // 动态申请一个新的span， 之后切分时写入的页号映射节点也在这里一次创建好
+    const size_t page_id = reinterpret_cast<size_t>(mem_ptr) >> constant::PAGE_SHIFT;
+    auto *span = _m_page_span_map.ensure(page_id, constant::MAX_PAGE_COUNT) ? _m_new_span() : nullptr;
+    if (span == nullptr) [[unlikely]] {
+        SystemFreeMMap(mem_ptr, constant::MAX_PAGE_COUNT);
+        return nullptr;
+    }
+    _m_bind_node(mem_ptr, constant::MAX_PAGE_COUNT);
+    MP_LOG(debug, "thread cache {empty} -> central cache {empty} -> page cache {empty} -> os {span(128 page)}");
 
     // 新span的页号 = 老span的页号， 页数 = 传入参数page_count
-    span->_page_id = reinterpret_cast<size_t>(mem_ptr) >> constant::PAGE_SHIFT;
+    span->_page_id = page_id;
     span->_page_size = constant::MAX_PAGE_COUNT;
+    // 刚映射的页面还没有被访问过， 不占用物理内存， 视为已经归还OS
+    span->_is_released = true;
+    span->_free_time = NowMs();
+    _m_system_pages += constant::MAX_PAGE_COUNT;
+    ++_m_system_alloc_count;
 
     // 将这个span放回span_list
-    _m_span_lists[constant::MAX_PAGE_COUNT - 1].push_front(span);
+    _m_insert_free_span(span);
     // 递归调用自己
     return create_pc_span(page_count);
 }
 
-// 根据地址再unordered_map中查找对应的span
-Span * PageCache::find_span_by_address(void *addr) noexcept {
-    std::unique_lock guard(_m_mtx);
-    if (const size_t page_id = reinterpret_cast<size_t>(addr) >> constant::PAGE_SHIFT; _m_page_span_map.contains(page_id)) {
-        return _m_page_span_map[page_id];
+/** 切出一个起始页号对齐的span
+ *  多申请 align_pages - 1 页， 其中一定有一段满足对齐的连续page_count页
+ *  1. 总页数超过128页时直接mmap， 首尾多出的页面直接munmap归还OS
+ *  2. 否则从pc中取出总页数的span， 首尾多出的页面切分为新的span放回pc
+ */
+Span * PageCache::create_aligned_span(const size_t page_count, const size_t align_pages) noexcept {
+    assert(page_count > 0 && align_pages > 0 && (align_pages & (align_pages - 1)) == 0);
+    const size_t total_pages = page_count + align_pages - 1;
+    if (total_pages > constant::MAX_PAGE_COUNT) {
+        // 与 create_pc_span 相同， 由调用方解锁后再报告失败
+        void* mem_ptr = SystemAllocMMapNoThrow(total_pages);
+        if (mem_ptr == nullptr) {
+            return nullptr;
+        }
+        const size_t start_page_id = reinterpret_cast<size_t>(mem_ptr) >> constant::PAGE_SHIFT;
+        const size_t page_id = _RoundUp(start_page_id, align_pages);
+        const size_t tail_page_id = page_id + page_count;
+        Span* span = _m_ensure_map(page_id, page_count) ? _m_new_span() : nullptr;
+        if (span == nullptr) [[unlikely]] {
+            SystemFreeMMap(mem_ptr, total_pages);
+            return nullptr;
+        }
+        _m_bind_node(mem_ptr, total_pages);
+        if (page_id > start_page_id) {
+            SystemFreeMMap(reinterpret_cast<void*>(start_page_id << constant::PAGE_SHIFT), page_id - start_page_id);
+        }
+        if (start_page_id + total_pages > tail_page_id) {
+            SystemFreeMMap(reinterpret_cast<void*>(tail_page_id << constant::PAGE_SHIFT), start_page_id + total_pages - tail_page_id);
+        }
+        span->_page_id = page_id;
+        span->_page_size = page_count;
+        span->_is_use = true;
+        _m_system_pages += page_count;
+        ++_m_system_alloc_count;
+        _m_page_span_map.set(span->_page_id, span);
+        _m_page_span_map.set(span->_page_id + span->_page_size - 1, span);
+        MP_LOG(debug, "page cache {aligned block} -> os , page_count=" + std::to_string(page_count));
+        return span;
+    }
+
+    // 首尾页面的span对象先申请好， 切分之后不会再失败
+    auto *head_span = _m_new_span();
+    auto *tail_span = _m_new_span();
+    Span* span = head_span != nullptr && tail_span != nullptr ? create_pc_span(total_pages) : nullptr;
+    if (span == nullptr) [[unlikely]] {
+        if (head_span != nullptr) {
+            _m_span_pool.Delete(head_span);
+        }
+        if (tail_span != nullptr) {
+            _m_span_pool.Delete(tail_span);
+        }
+        return nullptr;
+    }
+    // 先标记为使用中， 首尾页面放回pc时不会再合并回来
+    span->_is_use = true;
+    const size_t head_pages = _RoundUp(span->_page_id, align_pages) - span->_page_id;
+    const size_t tail_pages = total_pages - head_pages - page_count;
+    span->_page_id += head_pages;
+    span->_page_size = page_count;
+    // 首尾页面仍然在span分配时计入了大页区域的使用页数， 放回pc时一并扣除
+    if (head_pages > 0) {
+        head_span->_page_id = span->_page_id - head_pages;
+        head_span->_page_size = head_pages;
+        recover_span_to_page_cache(head_span);
+    } else {
+        _m_span_pool.Delete(head_span);
+    }
+    if (tail_pages > 0) {
+        tail_span->_page_id = span->_page_id + page_count;
+        tail_span->_page_size = tail_pages;
+        recover_span_to_page_cache(tail_span);
+    } else {
+        _m_span_pool.Delete(tail_span);
+    }
+    MP_LOG(debug, "page cache {aligned span}, page_count=" + std::to_string(page_count) + ", align_pages=" + std::to_string(align_pages));
+    return span;
+}
+
+/** 调整直接分配给用户的span的页数
+ *  1. 单独mmap的span通过mremap调整， 内核只移动页表， 不复制数据， 起始地址可能改变; 调整后仍然要超过128页
+ *  2. 缩小时尾部多出的页面切分为新的span放回pc
+ *  3. 扩大时右侧相邻的空闲span足够大则吞并所需的页面， 多余的部分留在pc中
+ */
+bool PageCache::resize_span(Span *span, const size_t page_count) noexcept {
+    assert(span->_is_use && span->_is_direct && page_count > 0);
+    if (span->_page_size > constant::MAX_PAGE_COUNT) {
+        // 缩小到128页以内的span释放时会进入pc的空闲链表， 不再munmap， 由调用方重新申请
+        if (page_count <= constant::MAX_PAGE_COUNT) {
+            return false;
+        }
+        // 先清除映射: 原地址被内核回收后可能立即被其他分片映射并写入自己的映射
+        _m_page_span_map.set(span->_page_id, nullptr);
+        _m_page_span_map.set(span->_page_id + span->_page_size - 1, nullptr);
+        void* mem_ptr = SystemRemap(reinterpret_cast<void*>(span->_page_id << constant::PAGE_SHIFT), span->_page_size, page_count);
+        if (mem_ptr == nullptr) {
+            _m_page_span_map.set(span->_page_id, span);
+            _m_page_span_map.set(span->_page_id + span->_page_size - 1, span);
+            return false;
+        }
+        _m_system_pages = _m_system_pages - span->_page_size + page_count;
+        span->_page_id = reinterpret_cast<size_t>(mem_ptr) >> constant::PAGE_SHIFT;
+        span->_page_size = page_count;
+        _m_page_span_map.set(span->_page_id, span);
+        _m_page_span_map.set(span->_page_id + span->_page_size - 1, span);
+        MP_LOG(debug, "page cache {remap}, page_count=" + std::to_string(page_count));
+        return true;
+    }
+
+    if (page_count < span->_page_size) {
+        auto *tail_span = _m_new_span();
+        if (tail_span == nullptr) [[unlikely]] {
+            return false;
+        }
+        tail_span->_page_id = span->_page_id + page_count;
+        tail_span->_page_size = span->_page_size - page_count;
+        span->_page_size = page_count;
+        recover_span_to_page_cache(tail_span);
+        return true;
+    }
+
+    if (page_count > constant::MAX_PAGE_COUNT) {
+        return false;
+    }
+    const size_t extra_pages = page_count - span->_page_size;
+    const size_t right_page_id = span->_page_id + span->_page_size;
+    const auto right_span = static_cast<Span*>(_m_page_span_map.get(right_page_id));
+    if (right_span == nullptr || right_span->arena_id() != _m_id()
+        || right_span->_is_use || right_span->_page_size < extra_pages) {
+        return false;
+    }
+    // 大页区域内的span不能吞并区域外的页面
+    if (_m_region_of(right_page_id) != _m_region_of(span->_page_id)) {
+        return false;
+    }
+    _m_erase_free_span(right_span);
+    if (right_span->_page_size > extra_pages) {
+        right_span->_page_id += extra_pages;
+        right_span->_page_size -= extra_pages;
+        _m_insert_free_span(right_span);
+        _m_page_span_map.set(right_span->_page_id, right_span);
+    } else {
+        _m_span_pool.Delete(right_span);
+    }
+    for (size_t i = 0; i < extra_pages; ++i) {
+        _m_page_span_map.set(right_page_id + i, span);
     }
-    // 不应该到达这里
-    assert(false);
-    return nullptr;
+    span->_page_size = page_count;
+    _m_update_region_usage(right_page_id, extra_pages, true);
+    MP_LOG(debug, "page cache {grow in place}, page_count=" + std::to_string(page_count));
+    return true;
+}
+
+void PageCache::lock_all() noexcept {
+    for (auto& page_cache : _m_page_caches._arenas) {
+        page_cache.lock();
+    }
+}
+
+void PageCache::unlock_all() noexcept {
+    for (auto& page_cache : _m_page_caches._arenas) {
+        page_cache.unlock();
+    }
+}
+
+// 根据地址在基数树中查找对应的span， 读基数树不需要加pc锁
+Span * PageCache::find_span_by_address(void *addr) noexcept {
+    const size_t page_id = reinterpret_cast<size_t>(addr) >> constant::PAGE_SHIFT;
+    const auto span = static_cast<Span*>(_m_page_span_map.get(page_id));
+    // 不应该找不到
+    assert(span != nullptr);
+    return span;
 }
 
 // 回收一个span， 并尝试合并到更大的page对应的span_list中
@@ -116,21 +324,33 @@ void PageCache::recover_span_to_page_cache(Span *span) noexcept {
 
     // 超过128页面的span直接归还OS
     if (span->_page_size > constant::MAX_PAGE_COUNT) {
+        // 这段地址要还给OS， 清除两端页号的映射， 避免之后相邻的span合并时访问到已经回收的span
+        // 必须在munmap之前清除， 之后这段地址可能立即被其他分片重新映射
+        _m_page_span_map.set(span->_page_id, nullptr);
+        _m_page_span_map.set(span->_page_id + span->_page_size - 1, nullptr);
         SystemFreeMMap(reinterpret_cast<void*>(span->_page_id << constant::PAGE_SHIFT), span->_page_size);
+        _m_system_pages -= span->_page_size;
         // 从定长内存池中删除span(归还定长内存池)
 
         _m_span_pool.Delete(span);
-        logger::log_debug("free to pc(os) ,page_size=" + std::to_string(span->_page_size));
+        MP_LOG(debug, "free to pc(os) ,page_size=" + std::to_string(span->_page_size));
         return;
     }
 
+    _m_update_region_usage(span->_page_id, span->_page_size, false);
+    // 大页区域内的span不能和区域外的span合并
+    const HugeRegion* region = _m_region_of(span->_page_id);
+
     // 合并左侧span
     while (true) {
         const size_t left_page_id = span->_page_id - 1;
+        const auto left_span = static_cast<Span*>(_m_page_span_map.get(left_page_id));
         // 没有该span的相邻左页面则跳过
-        if (!_m_page_span_map.contains(left_page_id))
+        if (left_span == nullptr)
+            break;
+        // 属于其他分片的span不能读取它的其他字段， 更不能合并
+        if (left_span->arena_id() != _m_id())
             break;
-        const auto left_span = _m_page_span_map[left_page_id];
         // 有相邻左页面，但是正在被cc使用则跳过
         // (这里必须使用isUse这个在pc锁内就被改的变量，而不能使用use_count),
         // 因为use_count 在一个span刚划分出去时也是0， 还没有增加，可能会让其他线程误认为是没有使用的span
@@ -139,42 +359,293 @@ void PageCache::recover_span_to_page_cache(Span *span) noexcept {
         // 如果两个相邻span合并后超过Page_Num个page也要跳过，因为page_cache无法管理超过Page_Max_Num个页面的Span
         if (left_span->_page_size + span->_page_size > constant::MAX_PAGE_COUNT)
             break;
+        if (_m_region_of(left_page_id) != region)
+            break;
         // 进行两个span的合并
         span->_page_id = left_span->_page_id;
         span->_page_size += left_span->_page_size;
         // 删除原有的左侧span
-        _m_span_lists[left_span->_page_size - 1].erase(left_span);
+        _m_erase_free_span(left_span);
 
         // 因为span是new出来的所以需要显式delete, 从定长内存池中删除(归还定长内存池)
         _m_span_pool.Delete(left_span);
-        logger::log_debug("free to pc ,left merge=" + std::to_string(span->_page_size));
+        MP_LOG(debug, "free to pc ,left merge=" + std::to_string(span->_page_size));
     }
     // 合并右侧span， 相同逻辑
     while (true) {
         const size_t right_page_id = span->_page_id + span->_page_size;
-        // 没有该span的相邻左页面则跳过
-        if (!_m_page_span_map.contains(right_page_id))
+        const auto right_span = static_cast<Span*>(_m_page_span_map.get(right_page_id));
+        // 没有该span的相邻右页面则跳过
+        if (right_span == nullptr)
+            break;
+        if (right_span->arena_id() != _m_id())
             break;
-        const auto right_span = _m_page_span_map[right_page_id];
         if (right_span->_is_use == true)
             break;
         if (right_span->_page_size + span->_page_size > constant::MAX_PAGE_COUNT)
             break;
+        if (_m_region_of(right_page_id) != region)
+            break;
         span->_page_size += right_span->_page_size;
-        _m_span_lists[right_span->_page_size - 1].erase(right_span);
+        _m_erase_free_span(right_span);
         // 因为span是new出来的所以需要显式delete, 从定长内存池中删除(归还定长内存池)
         _m_span_pool.Delete(right_span);
-        logger::log_debug("free to pc ,right merge=" + std::to_string(span->_page_size));
+        MP_LOG(debug, "free to pc ,right merge=" + std::to_string(span->_page_size));
     }
 
     // 合并完成后， 将当前span挂载到对应的哈希桶中
-    _m_span_lists[span->_page_size - 1].push_front(span);
+    // 合并进来的相邻span可能已经归还过OS， 合并后整体视为驻留内存， 下次回收时会整体再归还一次
     span->_is_use = false; // 回收回page_cache 的span
+    span->_is_direct = false;
+    span->_is_released = false;
+    span->_free_time = NowMs();
+    _m_insert_free_span(span);
 
     // 将当前span的两端页面映射到哈希表上，以供下次合并使用
-    _m_page_span_map[span->_page_id] = span;
-    _m_page_span_map[span->_page_id + span->_page_size - 1] = span;
-    logger::log_debug("free to pc ,span page_size=" + std::to_string(span->_page_size));
+    _m_page_span_map.set(span->_page_id, span);
+    _m_page_span_map.set(span->_page_id + span->_page_size - 1, span);
+    MP_LOG(debug, "free to pc ,span page_size=" + std::to_string(span->_page_size));
+
+}
+
+size_t PageCache::release_idle_spans(const size_t max_pages, const bool force) noexcept {
+    const size_t now = NowMs();
+    size_t released_pages = 0;
+    // 优先归还页数多的span， 减少系统调用次数
+    for (int i = constant::MAX_PAGE_COUNT - 1; i >= 0; --i) {
+        for (auto it = _m_span_lists[i].begin(); it != _m_span_lists[i].end(); ++it) {
+            // 超过本次归还的速率限制， 或者驻留的空闲内存已经不超过预算
+            if (released_pages >= max_pages) {
+                return released_pages;
+            }
+            // 保留预算由所有分片平分
+            if (!force && (_m_free_pages << constant::PAGE_SHIFT) <= _m_release_config.retain_bytes / ARENA_COUNT) {
+                return released_pages;
+            }
+            Span* span = *it;
+            if (span->_is_released || (!force && now - span->_free_time < _m_release_config.release_age_ms)) {
+                continue;
+            }
+            // 大页区域内的span单独归还会拆散大页: 整个区域都空闲时整体归还，
+            // 否则只有强制归还或者空闲时间超过两倍归还时间(区域长期只有少量页面在使用)时才单独归还
+            if (const HugeRegion* region = _m_region_of(span->_page_id)) {
+                if (region->_used_pages == 0) {
+                    released_pages += _m_release_region(span->_page_id & ~(constant::HUGE_PAGE_PAGE_COUNT - 1), now, force);
+                    continue;
+                }
+                if (!force && now - span->_free_time < 2 * _m_release_config.release_age_ms) {
+                    continue;
+                }
+            }
+            if (!SystemRelease(reinterpret_cast<void*>(span->_page_id << constant::PAGE_SHIFT), span->_page_size, _m_release_config.lazy)) {
+                continue;
+            }
+            span->_is_released = true;
+            _m_free_pages -= span->_page_size;
+            _m_released_pages += span->_page_size;
+            _m_total_released_pages += span->_page_size;
+            ++_m_release_count;
+            released_pages += span->_page_size;
+        }
+    }
+    MP_LOG(debug, "release to os, page_count=" + std::to_string(released_pages));
+    return released_pages;
+}
+
+ReleaseStats PageCache::release_stats() const noexcept {
+    return {
+        .system_bytes = _m_system_pages << constant::PAGE_SHIFT,
+        .free_bytes = _m_free_pages << constant::PAGE_SHIFT,
+        .released_bytes = _m_released_pages << constant::PAGE_SHIFT,
+        .release_count = _m_release_count,
+        .total_released_bytes = _m_total_released_pages << constant::PAGE_SHIFT,
+    };
+}
+
+void PageCache::collect_stats(MallocStats &stats) const noexcept {
+    for (size_t i = 0; i < constant::MAX_PAGE_COUNT; ++i) {
+        size_t span_count = 0;
+        for (auto it = _m_span_lists[i].begin(); it != _m_span_lists[i].end(); ++it) {
+            ++span_count;
+        }
+        stats.page_cache_free_spans[i] += span_count;
+    }
+    stats.system_bytes += _m_system_pages << constant::PAGE_SHIFT;
+    stats.page_cache_system_allocs += _m_system_alloc_count;
+    // 向OS申请页面全部使用mmap
+    stats.mmap_bytes += _m_system_pages << constant::PAGE_SHIFT;
+    stats.brk_bytes = 0;
+    stats.page_cache_free_bytes += _m_free_pages << constant::PAGE_SHIFT;
+    stats.page_cache_released_bytes += _m_released_pages << constant::PAGE_SHIFT;
+    stats.span_pool_in_use += _m_span_pool.in_use_count();
+    stats.span_pool_bytes += _m_span_pool.system_bytes();
+}
+
+HugePageStats PageCache::huge_page_stats() const noexcept {
+    return {
+        .system_bytes = _m_system_pages << constant::PAGE_SHIFT,
+        .hugepage_bytes = _m_hugepage_regions << constant::HUGE_PAGE_SHIFT,
+        .hugepage_used_bytes = _m_hugepage_used_pages << constant::PAGE_SHIFT,
+        .hugepage_regions = _m_hugepage_regions,
+        .hugetlb_regions = _m_hugetlb_regions,
+        .region_release_count = _m_region_release_count,
+    };
+}
+
+void PageCache::_m_bind_node(void* ptr, const size_t page_count) const noexcept {
+    if (NodeCount() > 1) {
+        SystemBindNode(ptr, page_count, node());
+    }
+}
+
+Span* PageCache::_m_new_span() noexcept {
+    Span* span = _m_span_pool.New();
+    if (span == nullptr) [[unlikely]] {
+        return nullptr;
+    }
+    span->set_arena_id(_m_id());
+    return span;
+}
+
+bool PageCache::_m_ensure_map(const size_t page_id, const size_t page_count) noexcept {
+    return _m_page_span_map.ensure(page_id, 1) && _m_page_span_map.ensure(page_id + page_count - 1, 1);
+}
+
+void PageCache::_m_insert_free_span(Span *span) noexcept {
+    _m_span_lists[span->_page_size - 1].push_front(span);
+    (span->_is_released ? _m_released_pages : _m_free_pages) += span->_page_size;
+}
 
+void PageCache::_m_erase_free_span(Span *span) noexcept {
+    _m_span_lists[span->_page_size - 1].erase(span);
+    (span->_is_released ? _m_released_pages : _m_free_pages) -= span->_page_size;
+}
+
+bool PageCache::_m_create_huge_region() noexcept {
+    bool is_hugetlb = false;
+    void* mem_ptr = SystemAllocHugeRegion(_m_huge_page_mode == HugePageMode::hugetlb, is_hugetlb);
+    if (mem_ptr == nullptr) {
+        return false;
+    }
+    const size_t region_page_id = reinterpret_cast<size_t>(mem_ptr) >> constant::PAGE_SHIFT;
+    const size_t region_index = region_page_id >> (constant::HUGE_PAGE_SHIFT - constant::PAGE_SHIFT);
+    // 区域对象、所有span对象和映射节点都先申请好， 任何一个失败都归还整个区域， 由调用方退回普通映射
+    constexpr size_t SPAN_COUNT = constant::HUGE_PAGE_PAGE_COUNT / constant::MAX_PAGE_COUNT;
+    Span* spans[SPAN_COUNT]{};
+    bool ok = _m_page_span_map.ensure(region_page_id, constant::HUGE_PAGE_PAGE_COUNT) && _m_huge_regions.ensure(region_index, 1);
+    for (size_t i = 0; i < SPAN_COUNT && ok; ++i) {
+        spans[i] = _m_new_span();
+        ok = spans[i] != nullptr;
+    }
+    HugeRegion* region = ok ? _m_region_pool.New() : nullptr;
+    if (region == nullptr) [[unlikely]] {
+        for (Span* span : spans) {
+            if (span != nullptr) {
+                _m_span_pool.Delete(span);
+            }
+        }
+        SystemFreeMMap(mem_ptr, constant::HUGE_PAGE_PAGE_COUNT);
+        return false;
+    }
+    _m_bind_node(mem_ptr, constant::HUGE_PAGE_PAGE_COUNT);
+    region->_is_hugetlb = is_hugetlb;
+    _m_huge_regions.set(region_index, region);
+    ++_m_hugepage_regions;
+    _m_hugetlb_regions += is_hugetlb;
+    _m_system_pages += constant::HUGE_PAGE_PAGE_COUNT;
+    ++_m_system_alloc_count;
+
+    // 切分为最大的span， 两端页号写入映射， 整体归还时据此遍历区域内的所有空闲span
+    for (size_t i = 0; i < SPAN_COUNT; ++i) {
+        Span* span = spans[i];
+        span->_page_id = region_page_id + i * constant::MAX_PAGE_COUNT;
+        span->_page_size = constant::MAX_PAGE_COUNT;
+        // 刚映射的页面还没有被访问过， 不占用物理内存， 视为已经归还OS
+        span->_is_released = true;
+        span->_free_time = NowMs();
+        _m_insert_free_span(span);
+        _m_page_span_map.set(span->_page_id, span);
+        _m_page_span_map.set(span->_page_id + span->_page_size - 1, span);
+    }
+    MP_LOG(debug, "page cache {empty} -> os {huge page region}, hugetlb=" + std::to_string(is_hugetlb));
+    return true;
+}
+
+PageCache::HugeRegion* PageCache::_m_region_of(const size_t page_id) const noexcept {
+    return static_cast<HugeRegion*>(_m_huge_regions.get(page_id >> (constant::HUGE_PAGE_SHIFT - constant::PAGE_SHIFT)));
+}
+
+void PageCache::_m_update_region_usage(const size_t page_id, const size_t page_count, const bool in_use) noexcept {
+    HugeRegion* region = _m_region_of(page_id);
+    if (region == nullptr) {
+        return;
+    }
+    if (in_use) {
+        region->_used_pages += page_count;
+        _m_hugepage_used_pages += page_count;
+    } else {
+        region->_used_pages -= page_count;
+        _m_hugepage_used_pages -= page_count;
+    }
+}
+
+Span * PageCache::_m_pick_free_span(const SpanList &span_list) const noexcept {
+    Span* best = *span_list.begin();
+    if (_m_hugepage_regions == 0) {
+        return best;
+    }
+    // 只比较链表头部的几个span， 避免链表很长时遍历
+    constexpr int MAX_CANDIDATES = 8;
+    size_t best_used = 0;
+    int candidates = 0;
+    for (auto it = span_list.begin(); it != span_list.end() && candidates < MAX_CANDIDATES; ++it, ++candidates) {
+        const HugeRegion* region = _m_region_of(it->_page_id);
+        // 不属于大页区域的span没有拆散大页的问题， 视为使用最多
+        const size_t used = region == nullptr ? constant::HUGE_PAGE_PAGE_COUNT : region->_used_pages;
+        if (candidates == 0 || used > best_used) {
+            best = *it;
+            best_used = used;
+        }
+    }
+    return best;
+}
+
+size_t PageCache::_m_release_region(const size_t region_page_id, const size_t now, const bool force) noexcept {
+    const size_t region_end = region_page_id + constant::HUGE_PAGE_PAGE_COUNT;
+    // 空闲span的首页映射总是有效的， 区域内的空闲span首尾相接覆盖整个区域
+    bool resident = false;
+    for (size_t page_id = region_page_id; page_id < region_end;) {
+        const auto span = static_cast<Span*>(_m_page_span_map.get(page_id));
+        assert(span != nullptr && span->_page_id == page_id && !span->_is_use);
+        if (!span->_is_released) {
+            if (!force && now - span->_free_time < _m_release_config.release_age_ms) {
+                return 0;
+            }
+            resident = true;
+        }
+        page_id += span->_page_size;
+    }
+    if (!resident) {
+        return 0;
+    }
+    if (!SystemRelease(reinterpret_cast<void*>(region_page_id << constant::PAGE_SHIFT), constant::HUGE_PAGE_PAGE_COUNT, _m_release_config.lazy)) {
+        return 0;
+    }
+
+    size_t released_pages = 0;
+    for (size_t page_id = region_page_id; page_id < region_end;) {
+        const auto span = static_cast<Span*>(_m_page_span_map.get(page_id));
+        if (!span->_is_released) {
+            span->_is_released = true;
+            _m_free_pages -= span->_page_size;
+            _m_released_pages += span->_page_size;
+            released_pages += span->_page_size;
+        }
+        page_id += span->_page_size;
+    }
+    _m_total_released_pages += released_pages;
+    ++_m_release_count;
+    ++_m_region_release_count;
+    return released_pages;
 }
 }
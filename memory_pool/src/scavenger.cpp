@@ -0,0 +1,83 @@
+#include "scavenger.h"
+#include "page_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#include <pthread.h>
+
+namespace hnc::core::mem_pool::details {
+
+void Scavenger::start() {
+    std::unique_lock locker(_m_mtx);
+    if (_m_running) {
+        return;
+    }
+    if (!_m_registered) {
+        _m_registered = true;
+        pthread_atfork(_m_prepare_fork, _m_parent_fork, _m_child_fork);
+        std::atexit([] { GetInstance().stop(); });
+    }
+    _m_running = true;
+    _m_exited = false;
+    std::thread(&Scavenger::_m_run, this).detach();
+    MP_LOG(info, "scavenger start");
+}
+
+void Scavenger::stop() noexcept {
+    std::unique_lock locker(_m_mtx);
+    if (!_m_running) {
+        return;
+    }
+    _m_running = false;
+    _m_cond.notify_all();
+    _m_cond.wait(locker, [this] { return _m_exited; });
+    MP_LOG(info, "scavenger stop");
+}
+
+void Scavenger::_m_run() noexcept {
+    while (true) {
+        PageCache::Arena(0).lock();
+        const ReleaseConfig config = PageCache::Arena(0).release_config();
+        PageCache::Arena(0).unlock();
+
+        {
+            // 只在等待时持有 _m_mtx， 不会和pc锁嵌套
+            std::unique_lock locker(_m_mtx);
+            if (_m_cond.wait_for(locker, std::chrono::milliseconds(config.interval_ms), [this] { return !_m_running; })) {
+                _m_exited = true;
+                _m_cond.notify_all();
+                return;
+            }
+        }
+
+        // 按照速率限制， 本轮最多归还的页数， 由所有pc分片平分
+        const size_t max_pages = std::max<size_t>(1, config.release_rate * config.interval_ms / 1000 / PageCache::ARENA_COUNT);
+        for (size_t i = 0; i < PageCache::ARENA_COUNT; ++i) {
+            PageCache::Arena(i).lock();
+            PageCache::Arena(i).release_idle_spans(max_pages, false);
+            PageCache::Arena(i).unlock();
+        }
+    }
+}
+
+void Scavenger::_m_prepare_fork() noexcept {
+    GetInstance()._m_mtx.lock();
+}
+
+void Scavenger::_m_parent_fork() noexcept {
+    GetInstance()._m_mtx.unlock();
+}
+
+void Scavenger::_m_child_fork() noexcept {
+    Scavenger& scavenger = GetInstance();
+    // 子进程中没有后台线程
+    scavenger._m_running = false;
+    scavenger._m_exited = true;
+    new (&scavenger._m_cond) std::condition_variable();
+    scavenger._m_mtx.unlock();
+}
+
+}
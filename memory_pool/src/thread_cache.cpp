@@ -1,46 +1,322 @@
 #include "thread_cache.h"
 #include "central_cache.h"
+#include "page_cache.h"
+#include "fixed_mem_pool.h"
 
 #include <algorithm>
 #include <cassert>
+#include <pthread.h>
 
 namespace hnc::core::mem_pool::details {
 
+namespace {
+// 所有线程的tc都从这里申请， 线程退出后归还复用
+constinit FixedMemPool<ThreadCache> tc_pool;
+
+/**
+ * 每个线程的远程释放队列， 按自由链表分开， 是其他线程压入、所属线程整批取出的无锁栈
+ * 不放在tc对象中: 释放线程读到的所属线程编号可能已经过期， 队列本身必须一直有效
+ * 线程退出时队列被关闭， 编号复用时重新打开， 过期的释放最多送到复用编号的新线程， 内存块仍然是合法的
+ */
+struct RemoteFreeQueue {
+    std::atomic<void*> _heads[constant::FREE_LIST_SIZE];
+};
+constinit RemoteFreeQueue remote_queues[constant::MAX_REMOTE_HEAPS];
+bool remote_queue_used[constant::MAX_REMOTE_HEAPS]; // 由 _m_budget_mtx 保护
+
+// 已经关闭的队列的头节点
+inline void* closed_queue() noexcept {
+    return reinterpret_cast<void*>(uintptr_t{1});
+}
+
+// 远程释放队列取出的链表的尾节点和块数， 加固模式下同时检查每个内存块的释放标记并清除释放位
+size_t list_tail(void* start, void*& end, const size_t align_size) noexcept {
+    size_t count = 1;
+    end = start;
+    hardened_on_release(end, align_size, true);
+    for (void* next = GetNextAddr(end); next != nullptr; next = GetNextAddr(end)) {
+        end = next;
+        hardened_on_release(end, align_size, true);
+        ++count;
+    }
+    return count;
+}
+
+/**
+ * 使用 pthread key 的析构函数而不是 thread_local 对象的析构函数:
+ * 注册 thread_local 析构(__cxa_thread_atexit)内部会调用 calloc, 作为全局malloc时会递归
+ */
+pthread_key_t tc_key;
+pthread_once_t tc_key_once = PTHREAD_ONCE_INIT;
+
+// 线程退出时回收tc， 之后本线程的其他析构函数再申请内存时会重新创建tc， 并再次触发这里
+void destroy_thread_cache(void* ptr) {
+    tls_thread_cache_ptr_ = nullptr;
+    ThreadCache::destroy(static_cast<ThreadCache*>(ptr));
+    MP_LOG(debug, "thread exit, recycle thread cache");
+}
+}
+
+constinit std::mutex ThreadCache::_m_budget_mtx;
+size_t ThreadCache::_m_overall_budget = constant::OVERALL_THREAD_CACHE_BYTES;
+ptrdiff_t ThreadCache::_m_unclaimed_budget = constant::OVERALL_THREAD_CACHE_BYTES;
+ThreadCache* ThreadCache::_m_cache_list = nullptr;
+ThreadCache* ThreadCache::_m_next_victim = nullptr;
+ThreadCacheCounters ThreadCache::_m_retired_counters{};
+std::atomic<uint32_t> ThreadCache::_m_open_heaps{0};
+
+ThreadCache* ThreadCache::create() noexcept {
+    pthread_once(&tc_key_once, [] { pthread_key_create(&tc_key, destroy_thread_cache); });
+
+    ThreadCache* tc = create_unbound();
+    if (tc == nullptr) [[unlikely]] {
+        return nullptr;
+    }
+    tc->_m_open_remote();
+
+    // 只有设置了非空值的线程退出时才会调用析构函数
+    pthread_setspecific(tc_key, tc);
+    return tc;
+}
+
+ThreadCache* ThreadCache::create_unbound() noexcept {
+    // 这里不把锁的逻辑放在New里面是因为， span也会需要加锁，这就影响效率了，而span的New 已经保证了线程安全
+    tc_pool.lock();
+    ThreadCache* tc = tc_pool.New();
+    tc_pool.unlock();
+    if (tc == nullptr) [[unlikely]] {
+        return nullptr;
+    }
+    tc->_m_register();
+    return tc;
+}
+
+void ThreadCache::destroy(ThreadCache* tc) noexcept {
+    tc->_m_close_remote();
+    tc->release_all();
+    tc->_m_unregister();
+
+    tc_pool.lock();
+    tc_pool.Delete(tc);
+    tc_pool.unlock();
+}
+
+void ThreadCache::set_overall_budget(const size_t bytes) noexcept {
+    std::lock_guard locker(_m_budget_mtx);
+    // 预算减少时已经分配给tc的上限不会立即收回， 之后由活跃的tc逐步窃取
+    _m_unclaimed_budget += static_cast<ptrdiff_t>(bytes) - static_cast<ptrdiff_t>(_m_overall_budget);
+    _m_overall_budget = bytes;
+}
+
+size_t ThreadCache::overall_budget() noexcept {
+    std::lock_guard locker(_m_budget_mtx);
+    return _m_overall_budget;
+}
+
+void ThreadCache::collect_stats(MallocStats &stats) noexcept {
+    std::lock_guard locker(_m_budget_mtx);
+    ThreadCacheCounters& counters = stats.thread_cache_counters;
+    counters = _m_retired_counters;
+    for (const ThreadCache* tc = _m_cache_list; tc != nullptr; tc = tc->_m_next) {
+        ++stats.thread_cache_count;
+        for (size_t i = 0; i < constant::FREE_LIST_SIZE; ++i) {
+            const size_t block_count = tc->_m_free_lists[i].size();
+            stats.size_classes[i].thread_cache_blocks += block_count;
+            stats.thread_cache_bytes += block_count * IndexToSize(i);
+        }
+        const ThreadCacheCounters tc_counters = tc->_m_counters();
+        counters.alloc_count += tc_counters.alloc_count;
+        counters.free_count += tc_counters.free_count;
+        counters.central_fetch_count += tc_counters.central_fetch_count;
+        counters.central_release_count += tc_counters.central_release_count;
+        counters.scavenge_count += tc_counters.scavenge_count;
+        counters.remote_free_count += tc_counters.remote_free_count;
+        counters.remote_collect_count += tc_counters.remote_collect_count;
+    }
+}
+
+void ThreadCache::lock_all() noexcept {
+    tc_pool.lock();
+    _m_budget_mtx.lock();
+}
+
+void ThreadCache::unlock_all() noexcept {
+    _m_budget_mtx.unlock();
+    tc_pool.unlock();
+}
+
 void* ThreadCache::allocate(const size_t size) noexcept{
     assert(size <= constant::MAX_ALLOC_BYTES);
     const size_t align_size = RoundUp(size); // 内存对齐字节数
     const size_t list_index = Index(size); // 对应大小的链表序号
+    _m_alloc_count.increment();
 
     // 若链表内有内存块则从自由链表分配内存
     if (!_m_free_lists[list_index].empty()) {
-        logger::log_debug("thread cache -> not empty, return");
+        MP_LOG(debug, "thread cache -> not empty, return");
+        _m_cached_bytes -= align_size;
         return _m_free_lists[list_index].pop_front();
     }
     // 向centralcache 申请内存，并修改自由链表
     return _m_alloc_from_central(list_index, align_size);
 }
 
+void* ThreadCache::allocate_cached(const size_t size, size_t& fetch_count) noexcept {
+    assert(size <= constant::MAX_ALLOC_BYTES);
+    const size_t align_size = RoundUp(size);
+    const size_t list_index = Index(size);
+    _m_alloc_count.increment();
+
+    if (!_m_free_lists[list_index].empty()) {
+        _m_cached_bytes -= align_size;
+        return _m_free_lists[list_index].pop_front();
+    }
+    // 没有所属线程， 不需要取回远程释放队列
+    _m_central_fetch_count.increment();
+    fetch_count = _m_next_fetch_count(list_index, align_size);
+    return nullptr;
+}
+
+void ThreadCache::refill(void* start, void* end, const size_t count, const size_t align_size) noexcept {
+    assert(count > 0);
+    _m_free_lists[Index(align_size)].push_range(start, end, count);
+    _m_cached_bytes += count * align_size;
+}
+
 /**
  * @param obj 归还内存池的内存地址
  * @param align_size 内存块大小
  * 回收时当一个 free_list 的块数 > 一次可最多申请的内存块时触发回收动作
  * 定义 这一次回收  一次可申请的内存块的数
  */
-void ThreadCache::deallocate(void *obj, const size_t align_size) noexcept {
+void ThreadCache::deallocate(void *obj, size_t align_size, DeferredRelease* deferred) noexcept {
     assert(obj);
     assert(align_size <= constant::MAX_ALLOC_BYTES);
+#ifdef HNC_MALLOC_HARDENED
+    // 隔离区没有满时内存块暂不回到自由链表， 满了则真正释放被挤出的最早的内存块
+    if (hardened_is_checked(obj) && !_m_quarantine.push(obj, align_size)) {
+        _m_free_count.increment();
+        return;
+    }
+#endif
     const size_t list_index = Index(align_size);
+    _m_free_count.increment();
     // 将内存块返回对应链表
     _m_free_lists[list_index].push_front(obj);
-    logger::log_debug("free to tlc ,block_size=" + std::to_string(align_size));
+    _m_cached_bytes += align_size;
+    MP_LOG(debug, "free to tlc ,block_size=" + std::to_string(align_size));
     // 可用内存块 > 下一次可申请的内存块， 则回收apple_count数量的内存块
     if (_m_free_lists[list_index].size() >= _m_free_lists[list_index].apply_count()) {
-        _m_release_block(_m_free_lists[list_index], align_size);
+        _m_release_block(_m_free_lists[list_index], align_size, deferred);
+    }
+    // 整个tc缓存的内存超过上限
+    if (_m_cached_bytes > _m_max_bytes.load(std::memory_order_relaxed)) {
+        _m_scavenge(deferred);
     }
 }
 
-void * ThreadCache::_m_alloc_from_central(const size_t index, const size_t align_size) noexcept {
+size_t ThreadCache::allocate_batch(const size_t size, const size_t count, void** out) noexcept {
+    size_t filled = allocate_batch_cached(size, count, out);
+    if (filled < count) {
+        filled += fetch_from_central(RoundUp(size), count - filled, out + filled, _m_heap_id);
+    }
+    MP_LOG(debug, "thread cache batch alloc, block_count=" + std::to_string(filled));
+    return filled;
+}
+
+size_t ThreadCache::allocate_batch_cached(const size_t size, const size_t count, void** out) noexcept {
+    assert(size <= constant::MAX_ALLOC_BYTES && count > 0);
+    const size_t align_size = RoundUp(size);
+    Freelist& free_list = _m_free_lists[Index(size)];
+    _m_alloc_count.increment(count);
+
+    size_t filled = std::min(free_list.size(), count);
+    if (filled > 0) {
+        void *start, *end;
+        free_list.pop_range(start, end, filled);
+        _m_cached_bytes -= filled * align_size;
+        void* obj = start;
+        for (size_t i = 0; i < filled; ++i) {
+            out[i] = obj;
+            obj = GetNextAddr(obj);
+        }
+    }
+    // 剩余的块数整批向cc申请， 计为一次申请
+    if (filled < count) {
+        _m_central_fetch_count.increment();
+    }
+    return filled;
+}
+
+size_t ThreadCache::fetch_from_central(const size_t align_size, const size_t count, void** out, const uint16_t owner) noexcept {
+    // cc每次至少返回一个内存块， 可能少于请求的块数， 返回0说明向OS申请内存失败
+    size_t filled = 0;
+    while (filled < count) {
+        void *start, *end;
+        const size_t actual_count = CentralCache::GetInstance().alloc_to_thread(start, end, count - filled, align_size, owner);
+        if (actual_count == 0) [[unlikely]] {
+            break;
+        }
+        void* obj = start;
+        for (size_t i = 0; i < actual_count; ++i) {
+            out[filled++] = obj;
+            obj = GetNextAddr(obj);
+        }
+    }
+    return filled;
+}
 
+void ThreadCache::deallocate_batch(void** objs, const size_t count, const size_t align_size, DeferredRelease* deferred) noexcept {
+    assert(align_size <= constant::MAX_ALLOC_BYTES && count > 0);
+    Freelist& free_list = _m_free_lists[Index(align_size)];
+
+    // 其他线程正在切分的span中的内存块送回所属线程， 其余的串成链表
+    // 没有其他线程的远程释放队列时不查找span; 否则同一个span中的内存块只查找一次， 记住span的地址范围和所属线程
+    const bool route = _m_has_remote_heaps();
+    uintptr_t span_begin = 0;
+    uintptr_t span_bytes = 0;
+    uint16_t owner = 0;
+    void* start = nullptr;
+    void* end = nullptr;
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+        void* obj = objs[i];
+        if (route) {
+            if (reinterpret_cast<uintptr_t>(obj) - span_begin >= span_bytes) {
+                const Span* span = PageCache::find_span_by_address(obj);
+                span_begin = span->_page_id << constant::PAGE_SHIFT;
+                span_bytes = span->_page_size << constant::PAGE_SHIFT;
+                owner = span->owner();
+            }
+            if (deallocate_remote(obj, align_size, owner)) {
+                continue;
+            }
+        }
+        if (end == nullptr) {
+            start = obj;
+        } else {
+            GetNextAddr(end) = obj;
+        }
+        end = obj;
+        ++kept;
+    }
+    if (kept == 0) {
+        return;
+    }
+    _m_free_count.increment(kept);
+    free_list.push_range(start, end, kept);
+    _m_cached_bytes += kept * align_size;
+    // 与逐个释放相同， 每次归还一次可申请的块数， 传输缓存中的每一批都能被其他tc整批取走
+    while (free_list.size() >= free_list.apply_count() && (deferred == nullptr || !deferred->full())) {
+        _m_release_block(free_list, align_size, deferred);
+    }
+    if (_m_cached_bytes > _m_max_bytes.load(std::memory_order_relaxed)) {
+        _m_scavenge(deferred);
+    }
+    MP_LOG(debug, "thread cache batch free, block_count=" + std::to_string(count));
+}
+
+size_t ThreadCache::_m_next_fetch_count(const size_t index, const size_t align_size) noexcept {
     // 获取本次需要向cc申请的内存块数量(不超过阈值)
     const size_t block_count = std::min(_m_free_lists[index].apply_count(), BlockThreshHold(align_size));
     // 只要没有超过阈值，那么下次在这个类型的freelist申请块数+1，动态增长
@@ -48,37 +324,306 @@ void * ThreadCache::_m_alloc_from_central(const size_t index, const size_t align
         /** 慢开始调节算法 */
         _m_free_lists[index].increment();
     }
+    return block_count;
+}
+
+void * ThreadCache::_m_alloc_from_central(const size_t index, const size_t align_size) noexcept {
+    const size_t block_count = _m_next_fetch_count(index, align_size);
 
     // 申请到的内存块区域范围 左闭右闭[], start和end都指向一个可以使用的内存块
     void *start, *end;
 
+    // 优先取回其他线程释放到本线程的内存块， 不需要访问cc
+    if (const size_t remote_count = _m_collect_remote(index, start, end)) {
+        if (remote_count > 1) {
+            _m_free_lists[index].push_range(GetNextAddr(start), end, remote_count - 1);
+            _m_cached_bytes += (remote_count - 1) * align_size;
+        }
+        MP_LOG(debug, "thread cache {remote frees} block_count=" + std::to_string(remote_count));
+        return start;
+    }
+    _m_central_fetch_count.increment();
+
     // 向cc申请n块大小size的内存块(有可能小于申请的数量，但是一定至少会申请到一个内存块)
 
     // 申请到的第一个内存块需要返回给线程，剩余的内存块才可加入自由链表，当只申请到一个内存块时，则不用更新tc对应的自由链表
-    const size_t actual_count = CentralCache::GetInstance().alloc_to_thread(start, end, block_count, align_size);
-    logger::log_debug("thread cache {get cc's blocks} block_count=" + std::to_string(actual_count));
+    const size_t actual_count = CentralCache::GetInstance().alloc_to_thread(start, end, block_count, align_size, _m_heap_id);
+    MP_LOG(debug, "thread cache {get cc's blocks} block_count=" + std::to_string(actual_count));
+    if (actual_count == 0) [[unlikely]] {
+        return nullptr;
+    }
     if (actual_count == 1)
     {
         assert(start == end);
-        logger::log_debug("thread cache {to user} align_size=" + std::to_string(align_size));
+        MP_LOG(debug, "thread cache {to user} align_size=" + std::to_string(align_size));
         return start;
     }
 
     // 更新自由链表
     _m_free_lists[index].push_range(GetNextAddr(start), end, actual_count - 1);
-    logger::log_debug("thread cache {remain block} block_count=" + std::to_string(actual_count - 1));
+    _m_cached_bytes += (actual_count - 1) * align_size;
+    MP_LOG(debug, "thread cache {remain block} block_count=" + std::to_string(actual_count - 1));
     return start;
 }
 
+void ThreadCache::release_to_central(void* obj, const size_t align_size) noexcept {
+    // 不经过隔离区， 直接清除释放位
+    hardened_on_release(obj, align_size, false);
+    GetNextAddr(obj) = nullptr;
+    CentralCache::recover_from_thread(obj, obj, 1, align_size);
+}
+
+void ThreadCache::release_all() noexcept {
+#ifdef HNC_MALLOC_HARDENED
+    void* obj;
+    size_t align_size;
+    while (_m_quarantine.pop(obj, align_size)) {
+        _m_free_lists[Index(align_size)].push_front(obj);
+    }
+#endif
+    for (auto& free_list : _m_free_lists) {
+        if (free_list.empty()) {
+            continue;
+        }
+        void *start, *end;
+        free_list.pop_range(start, end, free_list.size());
+        // 同一个链表的内存块大小相同， 从第一个内存块所属的span得到块大小
+        const size_t align_size = PageCache::find_span_by_address(start)->_block_size;
+        CentralCache::recover_blocks_to_spans(start, align_size);
+    }
+    _m_cached_bytes = 0;
+}
+
 // list 回收 内存块大小为size的内存块，数量为list.apple_count
-void ThreadCache::_m_release_block(Freelist &free_list, const size_t align_size) const noexcept {
+void ThreadCache::_m_release_block(Freelist &free_list, const size_t align_size, DeferredRelease* deferred) noexcept {
+    if (deferred != nullptr && deferred->full()) {
+        return;
+    }
     void *start, *end;
     // 回收指定数量的内存块， 内存块序号为[start -> ... -> ... -> end]
     free_list.pop_range(start, end, free_list.apply_count());
-    // 将这串内存块 ( 单向链表 ,且end节点已经指向了nullptr) 归还给cc
-    logger::log_debug("free to cc ,block_size=" + std::to_string(free_list.apply_count()));
-    CentralCache::GetInstance().recover_blocks_to_spans(start, align_size);
+    MP_LOG(debug, "free to cc ,block_size=" + std::to_string(free_list.apply_count()));
+    // 将这串内存块 ( 单向链表 ,且end节点已经指向了nullptr) 整批归还给cc
+    _m_release_range(start, end, free_list.apply_count(), align_size, deferred);
+}
+
+void ThreadCache::_m_release_range(void* start, void* end, const size_t count, const size_t align_size, DeferredRelease* deferred) noexcept {
+    _m_cached_bytes -= count * align_size;
+    _m_central_release_count.increment();
+    if (deferred == nullptr) {
+        CentralCache::recover_from_thread(start, end, count, align_size);
+        return;
+    }
+    assert(!deferred->full());
+    deferred->chains[deferred->size++] = {start, end, count, align_size};
+}
+
+void ThreadCache::DeferredRelease::flush() noexcept {
+    for (size_t i = 0; i < size; ++i) {
+        const Chain& chain = chains[i];
+        CentralCache::recover_from_thread(chain.start, chain.end, chain.count, chain.align_size);
+    }
+    size = 0;
+    if (grow_cache != nullptr) {
+        // 上限是原子变量， 其他线程窃取额度时同样只持有预算锁
+        std::lock_guard locker(_m_budget_mtx);
+        grow_cache->_m_increase_max_bytes_locked();
+        grow_cache = nullptr;
+    }
 }
 
+/**
+ * ① 低水位以下的内存块自上次收缩以来一直没有被使用， 归还一半， 并将慢开始的申请块数减半(加法增长， 乘法减少)
+ * ② 缓存超过上限说明本线程在频繁地申请释放， 尝试增加上限
+ * ③ 仍然超过上限(总预算已经用完)， 直接归还自由链表直到不超过上限， 保证每个tc缓存的内存都是有界的
+ */
+void ThreadCache::_m_scavenge(DeferredRelease* deferred) noexcept {
+    _m_scavenge_count.increment();
+    // 收集满时停止收缩， 剩下的自由链表保留低水位， 下一次收缩时再处理
+    const auto deferred_full = [deferred] { return deferred != nullptr && deferred->full(); };
+    for (auto& free_list : _m_free_lists) {
+        if (deferred_full()) {
+            break;
+        }
+        if (const size_t low_water = free_list.low_water(); low_water > 0) {
+            const size_t drop_count = low_water > 1 ? low_water / 2 : 1;
+            void *start, *end;
+            free_list.pop_range(start, end, drop_count);
+            const size_t align_size = PageCache::find_span_by_address(start)->_block_size;
+            _m_release_range(start, end, drop_count, align_size, deferred);
+            free_list.shrink();
+        }
+        free_list.reset_low_water();
+    }
+
+    // per-cpu缓存持有自旋锁时不获取预算锁， 释放锁之后再增加上限， 这一次仍然按原来的上限收缩
+    if (deferred != nullptr) {
+        deferred->grow_cache = this;
+    } else {
+        std::lock_guard locker(_m_budget_mtx);
+        _m_increase_max_bytes_locked();
+    }
+
+    for (size_t i = 0; i < constant::FREE_LIST_SIZE && _m_cached_bytes > max_bytes() && !deferred_full(); ++i) {
+        Freelist& free_list = _m_free_lists[i];
+        if (free_list.empty()) {
+            continue;
+        }
+        const size_t block_count = free_list.size();
+        void *start, *end;
+        free_list.pop_range(start, end, block_count);
+        const size_t align_size = PageCache::find_span_by_address(start)->_block_size;
+        _m_release_range(start, end, block_count, align_size, deferred);
+        free_list.reset_low_water();
+    }
+    MP_LOG(debug, "thread cache scavenge, cached_bytes=" + std::to_string(_m_cached_bytes));
+}
+
+void ThreadCache::_m_increase_max_bytes_locked() noexcept {
+    const auto steal = static_cast<ptrdiff_t>(constant::STEAL_THREAD_CACHE_BYTES);
+    // ① 还有未分配的预算
+    if (_m_unclaimed_budget >= steal) {
+        _m_unclaimed_budget -= steal;
+        _m_max_bytes.fetch_add(constant::STEAL_THREAD_CACHE_BYTES, std::memory_order_relaxed);
+        return;
+    }
+    // ② 轮流从其他tc的上限中窃取， 被窃取的tc下一次释放内存时发现超过上限会自行收缩
+    for (int i = 0; i < 10 && _m_cache_list != nullptr; ++i) {
+        if (_m_next_victim == nullptr) {
+            _m_next_victim = _m_cache_list;
+        }
+        ThreadCache* victim = _m_next_victim;
+        _m_next_victim = victim->_m_next;
+        if (victim == this) {
+            continue;
+        }
+        const size_t victim_max_bytes = victim->max_bytes();
+        if (victim_max_bytes >= constant::MIN_THREAD_CACHE_BYTES + constant::STEAL_THREAD_CACHE_BYTES) {
+            victim->_m_max_bytes.store(victim_max_bytes - constant::STEAL_THREAD_CACHE_BYTES, std::memory_order_relaxed);
+            _m_max_bytes.fetch_add(constant::STEAL_THREAD_CACHE_BYTES, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+void ThreadCache::_m_register() noexcept {
+    std::lock_guard locker(_m_budget_mtx);
+    // 每个tc至少有最小上限， tc太多时未分配的预算为负， 之后增加上限只能从其他tc窃取
+    _m_max_bytes.store(constant::MIN_THREAD_CACHE_BYTES, std::memory_order_relaxed);
+    _m_unclaimed_budget -= static_cast<ptrdiff_t>(constant::MIN_THREAD_CACHE_BYTES);
+
+    _m_prev = nullptr;
+    _m_next = _m_cache_list;
+    if (_m_cache_list != nullptr) {
+        _m_cache_list->_m_prev = this;
+    }
+    _m_cache_list = this;
+}
+
+void ThreadCache::_m_unregister() noexcept {
+    std::lock_guard locker(_m_budget_mtx);
+    _m_unclaimed_budget += static_cast<ptrdiff_t>(max_bytes());
+
+    // 线程退出后累计计数仍然计入统计
+    const ThreadCacheCounters counters = _m_counters();
+    _m_retired_counters.alloc_count += counters.alloc_count;
+    _m_retired_counters.free_count += counters.free_count;
+    _m_retired_counters.central_fetch_count += counters.central_fetch_count;
+    _m_retired_counters.central_release_count += counters.central_release_count;
+    _m_retired_counters.scavenge_count += counters.scavenge_count;
+    _m_retired_counters.remote_free_count += counters.remote_free_count;
+    _m_retired_counters.remote_collect_count += counters.remote_collect_count;
+
+    if (_m_next_victim == this) {
+        _m_next_victim = _m_next;
+    }
+    if (_m_prev != nullptr) {
+        _m_prev->_m_next = _m_next;
+    } else {
+        _m_cache_list = _m_next;
+    }
+    if (_m_next != nullptr) {
+        _m_next->_m_prev = _m_prev;
+    }
+    _m_next = _m_prev = nullptr;
+}
+
+ThreadCacheCounters ThreadCache::_m_counters() const noexcept {
+    return {
+        .alloc_count = _m_alloc_count.load(),
+        .free_count = _m_free_count.load(),
+        .central_fetch_count = _m_central_fetch_count.load(),
+        .central_release_count = _m_central_release_count.load(),
+        .scavenge_count = _m_scavenge_count.load(),
+        .remote_free_count = _m_remote_free_count.load(),
+        .remote_collect_count = _m_remote_collect_count.load(),
+    };
+}
+
+bool ThreadCache::_m_push_remote(void* obj, const size_t align_size, const uint16_t owner) noexcept {
+    std::atomic<void*>& head = remote_queues[owner - 1]._heads[Index(align_size)];
+    void* old_head = head.load(std::memory_order_relaxed);
+    do {
+        if (old_head == closed_queue()) [[unlikely]] {
+            hardened_on_unlink(obj, align_size);
+            return false;
+        }
+        GetNextAddr(obj) = old_head;
+    } while (!head.compare_exchange_weak(old_head, obj, std::memory_order_release, std::memory_order_relaxed));
+    _m_free_count.increment();
+    _m_remote_free_count.increment();
+    return true;
+}
+
+size_t ThreadCache::_m_collect_remote(const size_t index, void*& start, void*& end) noexcept {
+    if (_m_heap_id == 0) {
+        return 0;
+    }
+    std::atomic<void*>& head = remote_queues[_m_heap_id - 1]._heads[index];
+    // 先不加锁地检查一次， 队列为空时不需要原子交换
+    if (head.load(std::memory_order_relaxed) == nullptr) {
+        return 0;
+    }
+    start = head.exchange(nullptr, std::memory_order_acquire);
+    if (start == nullptr) {
+        return 0;
+    }
+    _m_remote_collect_count.increment();
+    return list_tail(start, end, IndexToSize(index));
+}
+
+void ThreadCache::_m_open_remote() noexcept {
+    std::lock_guard locker(_m_budget_mtx);
+    for (size_t i = 0; i < constant::MAX_REMOTE_HEAPS; ++i) {
+        if (!remote_queue_used[i]) {
+            remote_queue_used[i] = true;
+            for (auto& head : remote_queues[i]._heads) {
+                head.store(nullptr, std::memory_order_relaxed);
+            }
+            _m_heap_id = static_cast<uint16_t>(i + 1);
+            _m_open_heaps.store(_m_open_heaps.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+void ThreadCache::_m_close_remote() noexcept {
+    if (_m_heap_id == 0) {
+        return;
+    }
+    // 关闭之后其他线程的释放走普通路径， 已经压入的内存块放入自由链表， 随后由 release_all 归还cc
+    for (size_t i = 0; i < constant::FREE_LIST_SIZE; ++i) {
+        void* start = remote_queues[_m_heap_id - 1]._heads[i].exchange(closed_queue(), std::memory_order_acquire);
+        if (start != nullptr) {
+            void* end;
+            const size_t count = list_tail(start, end, IndexToSize(i));
+            _m_free_lists[i].push_range(start, end, count);
+        }
+    }
+    std::lock_guard locker(_m_budget_mtx);
+    remote_queue_used[_m_heap_id - 1] = false;
+    _m_open_heaps.store(_m_open_heaps.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    _m_heap_id = 0;
+}
 
 }
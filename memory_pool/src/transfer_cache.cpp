@@ -0,0 +1,35 @@
+#include "transfer_cache.h"
+
+namespace hnc::core::mem_pool::details {
+
+bool TransferCache::push(void* start, void* end, const size_t block_count) noexcept {
+    assert(start != nullptr && end != nullptr && block_count > 0);
+    std::lock_guard locker(_m_mtx);
+    if (_m_size == MAX_BATCHES) {
+        return false;
+    }
+    _m_batches[_m_size++] = Batch{start, end, block_count};
+    return true;
+}
+
+size_t TransferCache::pop(void*& start, void*& end, const size_t max_count) noexcept {
+    std::lock_guard locker(_m_mtx);
+    if (_m_size == 0 || _m_batches[_m_size - 1]._block_count > max_count) {
+        return 0;
+    }
+    const Batch& batch = _m_batches[--_m_size];
+    start = batch._start;
+    end = batch._end;
+    return batch._block_count;
+}
+
+size_t TransferCache::block_count() noexcept {
+    std::lock_guard locker(_m_mtx);
+    size_t block_count = 0;
+    for (size_t i = 0; i < _m_size; ++i) {
+        block_count += _m_batches[i]._block_count;
+    }
+    return block_count;
+}
+
+}
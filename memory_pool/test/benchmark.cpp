@@ -1,109 +1,591 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
-#include <vector>
+#include <random>
+#include <string>
 #include <thread>
+#include <vector>
 
-#include "tnc_malloc.h"
+#include <dlfcn.h>
+#include <malloc.h>
 
-#include "benchmark.h"
+#include "alloc.h"
 
+/**
+ * 内存池基准测试， 对比 tnc_malloc、glibc malloc 以及安装了的 jemalloc/tcmalloc(运行时 dlopen)
+ *
+ * 用法: mp_benchmark [--threads N] [--ops N] [--allocators glibc,tnc,jemalloc,tcmalloc]
+ *                    [--workloads trace,producer_consumer,larson,threadtest,fragmentation]
+ *                    [--trace file] [--csv file] [--json file]
+ *
+ * 1. trace: 按trace文件(每行一个字节数， #开头为注释)中的大小顺序申请， 每个对象存活固定次数的申请后释放，
+ *    没有trace文件时使用内置的大小分布
+ * 2. producer_consumer: 一半线程申请、一半线程释放， 内存块经过无锁队列跨线程释放
+ * 3. larson: 每个线程随机替换槽位中的对象， 每一轮线程退出后由新线程接手上一轮的槽位， 释放其他线程申请的内存
+ * 4. threadtest: 每个线程反复申请一批对象再全部释放
+ * 5. fragmentation: 申请大量小对象， 随机释放90%后申请更大的对象， 记录每个阶段的RSS
+ *
+ * 线程数从1开始翻倍直到 --threads(默认为核数)， 每次调用约1/32被计时， 统计 p50/p99/p999 延迟，
+ * 每次运行前重置 RSS 峰值(/proc/self/clear_refs)， 运行后释放所有内存并归还OS
+ */
 
+using namespace hnc::core::mem_pool;
 
-constexpr size_t SMALL_BLOCK = 128;  // 128B 此会走tc线程局部缓存
-constexpr size_t MEDIUM_BLOCK = 384 * 1024; // 384KB  此会走pc 但是仍然pc内部的span分配（brk）
-constexpr size_t LARGE_BLOCK = 768 * 1024;  // 768KB  此会走pc  但是走的是mmap系统调用
+namespace {
+constexpr uint32_t SAMPLE_MASK = 31; // 每32次调用计时一次
+constexpr size_t TRACE_WINDOW = 1024; // trace中每个对象存活的申请次数
+constexpr size_t QUEUE_CAPACITY = 1024; // 生产者消费者之间的队列长度
+constexpr size_t LARSON_SLOTS = 1024; // larson每个线程的槽位数
+constexpr size_t LARSON_ROUNDS = 8; // larson的线程轮数
+constexpr size_t THREADTEST_BATCH = 1000; // threadtest每批的对象数
 
-constexpr int NUM_THREADS = 4;
-constexpr int ALLOC_COUNT = 10000;  // 每个线程分配的次数
-using namespace hnc::core::mem_pool;
-using namespace hnc::core::logger;
+struct Allocator {
+    std::string name;
+    void* (*malloc)(size_t);
+    void (*free)(void*);
+    void (*trim)(); // 归还缓存的内存， 可以为空
+};
+
+struct Options {
+    size_t max_threads{std::max(1u, std::thread::hardware_concurrency())};
+    size_t ops{200000}; // 每个线程的申请次数
+    std::vector<std::string> allocators{"glibc", "tnc", "jemalloc", "tcmalloc"};
+    std::vector<std::string> workloads{"trace", "producer_consumer", "larson", "threadtest", "fragmentation"};
+    std::string trace_path;
+    std::string csv_path;
+    std::string json_path;
+};
+
+struct Result {
+    std::string allocator;
+    std::string workload;
+    size_t threads{0};
+    uint64_t ops{0}; // malloc和free的调用次数
+    double seconds{0};
+    uint32_t p50_ns{0};
+    uint32_t p99_ns{0};
+    uint32_t p999_ns{0};
+    size_t peak_rss_kb{0};
+    size_t final_rss_kb{0};
+    std::vector<size_t> rss_timeline_kb; // fragmentation每个阶段结束时的RSS
+};
+
+// 申请的大小序列， 来自trace文件或者内置分布
+class SizeTrace {
+public:
+    explicit SizeTrace(const std::string& path) {
+        if (!path.empty()) {
+            std::ifstream in(path);
+            std::string line;
+            while (std::getline(in, line)) {
+                if (!line.empty() && line[0] != '#') {
+                    _m_sizes.push_back(static_cast<uint32_t>(std::stoul(line)));
+                }
+            }
+        }
+        if (_m_sizes.empty()) {
+            _m_generate();
+        }
+    }
+
+    size_t size() const noexcept {
+        return _m_sizes.size();
+    }
+    uint32_t operator[](const size_t i) const noexcept {
+        return _m_sizes[i % _m_sizes.size()];
+    }
 
-//  基础的 malloc 和 tnc_malloc 对比
-void benchmark_alloc_free() {
-    // 测试小块内存
-    {
-        TICK(malloc_small_block)
-        for (int i = 0; i < ALLOC_COUNT; ++i) {
-            void* ptr = malloc(SMALL_BLOCK);
-            free(ptr);
+private:
+    // 服务中常见的分布: 大部分是小对象， 少量几KB到几百KB的缓冲区
+    void _m_generate() {
+        std::mt19937_64 rng(42);
+        for (size_t i = 0; i < 1 << 16; ++i) {
+            const size_t p = rng() % 100;
+            if (p < 60) {
+                _m_sizes.push_back(8 + rng() % 121);
+            } else if (p < 90) {
+                _m_sizes.push_back(129 + rng() % 896);
+            } else if (p < 99) {
+                _m_sizes.push_back(1025 + rng() % (15 * 1024));
+            } else {
+                _m_sizes.push_back(16 * 1024 + rng() % (240 * 1024));
+            }
         }
-        TOCK(malloc_small_block)
     }
-    {
-        TICK(tnc_malloc_small_block)
-        for (int i = 0; i < ALLOC_COUNT; ++i) {
-            void* ptr = tnc_malloc(SMALL_BLOCK);
-            tnc_free(ptr);
+
+    std::vector<uint32_t> _m_sizes;
+};
+
+// 每个线程的计数和延迟采样
+class ThreadContext {
+public:
+    ThreadContext(const Allocator& allocator, const uint64_t seed) : rng(seed), _m_allocator(allocator) {}
+
+    void* malloc(const size_t size) {
+        ++ops;
+        void* ptr;
+        if ((++_m_tick & SAMPLE_MASK) == 0) {
+            const auto start = std::chrono::steady_clock::now();
+            ptr = _m_allocator.malloc(size);
+            _m_record(start);
+        } else {
+            ptr = _m_allocator.malloc(size);
         }
-        TOCK(tnc_malloc_small_block)
+        // 写入第一个字节， 与真实使用一样触发缺页
+        *static_cast<char*>(ptr) = 1;
+        return ptr;
     }
 
-    // 测试中等内存块
-    {
-        TICK(malloc_medium_block)
-        for (int i = 0; i < ALLOC_COUNT; ++i) {
-            void* ptr = malloc(MEDIUM_BLOCK);
-            free(ptr);
+    void free(void* ptr) {
+        ++ops;
+        if ((++_m_tick & SAMPLE_MASK) == 0) {
+            const auto start = std::chrono::steady_clock::now();
+            _m_allocator.free(ptr);
+            _m_record(start);
+        } else {
+            _m_allocator.free(ptr);
         }
-        TOCK(malloc_medium_block)
     }
-    {
-        TICK(tnc_malloc_medium_block)
-        for (int i = 0; i < ALLOC_COUNT; ++i) {
-            void* ptr = tnc_malloc(MEDIUM_BLOCK);
-            tnc_free(ptr);
+
+    std::mt19937_64 rng;
+    uint64_t ops{0};
+    std::vector<uint32_t> samples;
+
+private:
+    void _m_record(const std::chrono::steady_clock::time_point start) {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        samples.push_back(static_cast<uint32_t>(std::min<int64_t>(ns, UINT32_MAX)));
+    }
+
+    const Allocator& _m_allocator;
+    uint32_t _m_tick{0};
+};
+
+// 多个线程的计数和延迟采样汇总
+struct Measurement {
+    uint64_t ops{0};
+    std::vector<uint32_t> samples;
+    std::vector<size_t> rss_timeline_kb;
+
+    void merge(ThreadContext& ctx) {
+        ops += ctx.ops;
+        samples.insert(samples.end(), ctx.samples.begin(), ctx.samples.end());
+    }
+};
+
+// 启动threads个线程执行fn(ctx, index)， 结束后汇总到measurement
+void run_threads(const Allocator& allocator, const size_t threads, Measurement& measurement,
+                 const std::function<void(ThreadContext&, size_t)>& fn) {
+    std::vector<ThreadContext> contexts;
+    contexts.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        contexts.emplace_back(allocator, 0x9e3779b97f4a7c15ULL * (i + 1));
+    }
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&fn, &contexts, i] { fn(contexts[i], i); });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (auto& ctx : contexts) {
+        measurement.merge(ctx);
+    }
+}
+
+// 当前和峰值RSS(KB)
+size_t read_status_kb(const char* key) {
+    std::ifstream in("/proc/self/status");
+    std::string line;
+    const size_t key_length = strlen(key);
+    while (std::getline(in, line)) {
+        if (line.compare(0, key_length, key) == 0) {
+            return std::stoul(line.substr(key_length + 1));
         }
-        TOCK(tnc_malloc_medium_block)
     }
+    return 0;
+}
+
+size_t current_rss_kb() {
+    return read_status_kb("VmRSS");
+}
+
+size_t peak_rss_kb() {
+    return read_status_kb("VmHWM");
+}
+
+// 重置RSS峰值， 内核不支持时峰值是整个进程的
+void reset_peak_rss() {
+    if (FILE* file = fopen("/proc/self/clear_refs", "w")) {
+        fputs("5", file);
+        fclose(file);
+    }
+}
 
-    // 测试大块内存（mmap）
-    {
-        TICK(malloc_large_block)
-        for (int i = 0; i < ALLOC_COUNT; ++i) {
-            void* ptr = malloc(LARGE_BLOCK);
-            free(ptr);
+void workload_trace(const Allocator& allocator, const size_t threads, const Options& options, const SizeTrace& trace, Measurement& measurement) {
+    run_threads(allocator, threads, measurement, [&](ThreadContext& ctx, const size_t index) {
+        std::vector<void*> window(TRACE_WINDOW, nullptr);
+        // 每个线程从trace的不同位置开始
+        const size_t offset = index * trace.size() / threads;
+        for (size_t i = 0; i < options.ops; ++i) {
+            void*& slot = window[i % TRACE_WINDOW];
+            if (slot != nullptr) {
+                ctx.free(slot);
+            }
+            slot = ctx.malloc(trace[offset + i]);
         }
-        TOCK(malloc_large_block)
+        for (const auto ptr : window) {
+            if (ptr != nullptr) {
+                ctx.free(ptr);
+            }
+        }
+    });
+}
+
+// 单生产者单消费者的有界无锁队列
+class SpscQueue {
+public:
+    bool push(void* ptr) {
+        const size_t tail = _m_tail.load(std::memory_order_relaxed);
+        if (tail - _m_head.load(std::memory_order_acquire) == QUEUE_CAPACITY) {
+            return false;
+        }
+        _m_slots[tail % QUEUE_CAPACITY] = ptr;
+        _m_tail.store(tail + 1, std::memory_order_release);
+        return true;
     }
-    {
-        TICK(tnc_malloc_large_block)
-        for (int i = 0; i < ALLOC_COUNT; ++i) {
-            void* ptr = tnc_malloc(LARGE_BLOCK);
-            tnc_free(ptr);
+
+    bool pop(void*& ptr) {
+        const size_t head = _m_head.load(std::memory_order_relaxed);
+        if (head == _m_tail.load(std::memory_order_acquire)) {
+            return false;
         }
-        TOCK(tnc_malloc_large_block)
+        ptr = _m_slots[head % QUEUE_CAPACITY];
+        _m_head.store(head + 1, std::memory_order_release);
+        return true;
     }
+
+private:
+    void* _m_slots[QUEUE_CAPACITY]{};
+    alignas(64) std::atomic<size_t> _m_head{0};
+    alignas(64) std::atomic<size_t> _m_tail{0};
+};
+
+// 线程数为1时也需要一对线程
+void workload_producer_consumer(const Allocator& allocator, const size_t threads, const Options& options, const SizeTrace& trace, Measurement& measurement) {
+    const size_t pairs = std::max<size_t>(1, threads / 2);
+    std::vector<SpscQueue> queues(pairs);
+    run_threads(allocator, pairs * 2, measurement, [&](ThreadContext& ctx, const size_t index) {
+        SpscQueue& queue = queues[index / 2];
+        if (index % 2 == 0) {
+            for (size_t i = 0; i < options.ops; ++i) {
+                void* ptr = ctx.malloc(trace[index * 7919 + i]);
+                while (!queue.push(ptr)) {
+                    std::this_thread::yield();
+                }
+            }
+            while (!queue.push(nullptr)) {
+                std::this_thread::yield();
+            }
+            return;
+        }
+        for (;;) {
+            void* ptr;
+            if (!queue.pop(ptr)) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (ptr == nullptr) {
+                return;
+            }
+            ctx.free(ptr);
+        }
+    });
 }
 
-//  容器测试
-void benchmark_vector() {
-    // 标准容器
-    {
-        TICK(vector_int)
-        std::vector<int> vec;
-        for (int i = 0; i < ALLOC_COUNT; ++i) vec.push_back(i);
-        TOCK(vector_int)
+void workload_larson(const Allocator& allocator, const size_t threads, const Options& options, const SizeTrace& trace, Measurement& measurement) {
+    std::vector<std::vector<void*>> slots(threads, std::vector<void*>(LARSON_SLOTS, nullptr));
+    for (size_t round = 0; round < LARSON_ROUNDS; ++round) {
+        // 新一轮的线程接手上一轮其他线程的槽位
+        std::rotate(slots.begin(), slots.begin() + 1, slots.end());
+        run_threads(allocator, threads, measurement, [&](ThreadContext& ctx, const size_t index) {
+            std::vector<void*>& own = slots[index];
+            for (size_t i = 0; i < options.ops / LARSON_ROUNDS; ++i) {
+                void*& slot = own[ctx.rng() % LARSON_SLOTS];
+                if (slot != nullptr) {
+                    ctx.free(slot);
+                }
+                slot = ctx.malloc(trace[ctx.rng()]);
+            }
+        });
     }
-    // 使用内存池适配器的标准容器
-    {
-        TICK(tnc_vector_int)
-        std::vector<int, TncAllocator<int>> vec;
-        for (int i = 0; i < ALLOC_COUNT; ++i) vec.push_back(i);
-        TOCK(tnc_vector_int)
+    run_threads(allocator, threads, measurement, [&](ThreadContext& ctx, const size_t index) {
+        for (const auto ptr : slots[index]) {
+            if (ptr != nullptr) {
+                ctx.free(ptr);
+            }
+        }
+    });
+}
+
+void workload_threadtest(const Allocator& allocator, const size_t threads, const Options& options, const SizeTrace& trace, Measurement& measurement) {
+    run_threads(allocator, threads, measurement, [&](ThreadContext& ctx, const size_t index) {
+        std::vector<void*> batch(THREADTEST_BATCH);
+        for (size_t done = 0; done < options.ops; done += THREADTEST_BATCH) {
+            for (size_t i = 0; i < THREADTEST_BATCH; ++i) {
+                batch[i] = ctx.malloc(trace[index * 104729 + done + i]);
+            }
+            for (const auto ptr : batch) {
+                ctx.free(ptr);
+            }
+        }
+    });
+}
+
+/**
+ * ① 每个线程申请 ops 个小对象 ② 随机释放90% ③ 申请同样总字节数的4倍大小的对象 ④ 全部释放
+ * 每个阶段结束时记录RSS， 碎片多的分配器在第③阶段无法复用第②阶段释放的内存
+ */
+void workload_fragmentation(const Allocator& allocator, const size_t threads, const Options& options, const SizeTrace& trace, Measurement& measurement) {
+    std::vector<std::vector<void*>> objects(threads);
+    const auto phase = [&](const std::function<void(ThreadContext&, std::vector<void*>&, size_t)>& fn) {
+        run_threads(allocator, threads, measurement, [&](ThreadContext& ctx, const size_t index) {
+            fn(ctx, objects[index], index);
+        });
+        measurement.rss_timeline_kb.push_back(current_rss_kb());
+    };
+    phase([&](ThreadContext& ctx, std::vector<void*>& own, const size_t index) {
+        for (size_t i = 0; i < options.ops; ++i) {
+            own.push_back(ctx.malloc(std::min<uint32_t>(trace[index * 15485863 + i], 1024)));
+        }
+    });
+    phase([&](ThreadContext& ctx, std::vector<void*>& own, size_t) {
+        std::shuffle(own.begin(), own.end(), ctx.rng);
+        const size_t kept = own.size() / 10;
+        for (size_t i = kept; i < own.size(); ++i) {
+            ctx.free(own[i]);
+        }
+        own.resize(kept);
+    });
+    phase([&](ThreadContext& ctx, std::vector<void*>& own, const size_t index) {
+        for (size_t i = 0; i < options.ops * 9 / 10 / 4; ++i) {
+            own.push_back(ctx.malloc(4 * std::min<uint32_t>(trace[index * 15485863 + i], 1024)));
+        }
+    });
+    phase([&](ThreadContext& ctx, std::vector<void*>& own, size_t) {
+        for (const auto ptr : own) {
+            ctx.free(ptr);
+        }
+        own.clear();
+    });
+}
+
+using Workload = void (*)(const Allocator&, size_t, const Options&, const SizeTrace&, Measurement&);
+
+Workload find_workload(const std::string& name) {
+    if (name == "trace") return workload_trace;
+    if (name == "producer_consumer") return workload_producer_consumer;
+    if (name == "larson") return workload_larson;
+    if (name == "threadtest") return workload_threadtest;
+    if (name == "fragmentation") return workload_fragmentation;
+    return nullptr;
+}
+
+// jemalloc/tcmalloc 没有安装时返回false
+bool load_allocator(const std::string& name, Allocator& allocator) {
+    if (name == "glibc") {
+        allocator = {name, ::malloc, ::free, [] { malloc_trim(0); }};
+        return true;
+    }
+    if (name == "tnc") {
+        allocator = {name, [](const size_t size) { return tnc_malloc(size); }, [](void* ptr) { tnc_free(ptr); }, [] { tnc_release_memory(); }};
+        return true;
+    }
+    std::vector<const char*> libraries;
+    if (name == "jemalloc") {
+        libraries = {"libjemalloc.so.2", "libjemalloc.so"};
+    } else if (name == "tcmalloc") {
+        libraries = {"libtcmalloc_minimal.so.4", "libtcmalloc.so.4"};
     }
-    // pmr容器
-    {
-        TncMemRe mem;
-        TICK(pmr_vector_int)
-        std::pmr::vector<int> vec(&mem);
-        for (int i = 0; i < ALLOC_COUNT; ++i) vec.push_back(i);
-        TOCK(pmr_vector_int)
+    for (const auto library : libraries) {
+        // RTLD_LOCAL 不替换进程中其他代码使用的 malloc， 只通过函数指针调用
+        if (void* handle = dlopen(library, RTLD_NOW | RTLD_LOCAL)) {
+            allocator.name = name;
+            allocator.malloc = reinterpret_cast<void* (*)(size_t)>(dlsym(handle, "malloc"));
+            allocator.free = reinterpret_cast<void (*)(void*)>(dlsym(handle, "free"));
+            allocator.trim = nullptr;
+            return allocator.malloc != nullptr && allocator.free != nullptr;
+        }
     }
+    return false;
 }
 
-int main() {
-    change_log_file_name("mem_pool/benchmark");
+Result run(const Allocator& allocator, const std::string& workload_name, const Workload workload, const size_t threads,
+           const Options& options, const SizeTrace& trace) {
+    reset_peak_rss();
+    Measurement measurement;
+    const auto start = std::chrono::steady_clock::now();
+    workload(allocator, threads, options, trace, measurement);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-    benchmark_alloc_free();
-    benchmark_vector();
+    Result result{.allocator = allocator.name, .workload = workload_name, .threads = threads, .ops = measurement.ops,
+                  .seconds = seconds, .p50_ns = 0, .p99_ns = 0, .p999_ns = 0, .peak_rss_kb = 0, .final_rss_kb = 0, .rss_timeline_kb = {}};
+    auto& samples = measurement.samples;
+    if (!samples.empty()) {
+        const auto percentile = [&samples](const double p) {
+            const auto nth = samples.begin() + static_cast<ptrdiff_t>(p * static_cast<double>(samples.size() - 1));
+            std::nth_element(samples.begin(), nth, samples.end());
+            return *nth;
+        };
+        result.p50_ns = percentile(0.5);
+        result.p99_ns = percentile(0.99);
+        result.p999_ns = percentile(0.999);
+    }
+    result.peak_rss_kb = peak_rss_kb();
+    result.final_rss_kb = current_rss_kb();
+    result.rss_timeline_kb = std::move(measurement.rss_timeline_kb);
+    // 归还缓存的内存， 不影响下一个运行的RSS
+    if (allocator.trim != nullptr) {
+        allocator.trim();
+    }
+    return result;
+}
+
+void write_csv(const std::string& path, const std::vector<Result>& results) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (out == nullptr) {
+        perror(path.c_str());
+        return;
+    }
+    fprintf(out, "allocator,workload,threads,ops,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,peak_rss_kb,final_rss_kb\n");
+    for (const auto& r : results) {
+        fprintf(out, "%s,%s,%zu,%lu,%.6f,%.0f,%u,%u,%u,%zu,%zu\n", r.allocator.c_str(), r.workload.c_str(), r.threads,
+                r.ops, r.seconds, static_cast<double>(r.ops) / r.seconds, r.p50_ns, r.p99_ns, r.p999_ns, r.peak_rss_kb, r.final_rss_kb);
+    }
+    fclose(out);
+}
+
+void write_json(const std::string& path, const std::vector<Result>& results) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (out == nullptr) {
+        perror(path.c_str());
+        return;
+    }
+    fprintf(out, "[\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        fprintf(out, "  {\"allocator\": \"%s\", \"workload\": \"%s\", \"threads\": %zu, \"ops\": %lu, \"seconds\": %.6f, "
+                     "\"ops_per_sec\": %.0f, \"p50_ns\": %u, \"p99_ns\": %u, \"p999_ns\": %u, \"peak_rss_kb\": %zu, "
+                     "\"final_rss_kb\": %zu, \"rss_timeline_kb\": [",
+                r.allocator.c_str(), r.workload.c_str(), r.threads, r.ops, r.seconds, static_cast<double>(r.ops) / r.seconds,
+                r.p50_ns, r.p99_ns, r.p999_ns, r.peak_rss_kb, r.final_rss_kb);
+        for (size_t j = 0; j < r.rss_timeline_kb.size(); ++j) {
+            fprintf(out, "%s%zu", j == 0 ? "" : ", ", r.rss_timeline_kb[j]);
+        }
+        fprintf(out, "]}%s\n", i + 1 == results.size() ? "" : ",");
+    }
+    fprintf(out, "]\n");
+    fclose(out);
+}
+
+// 1, 2, 4 ... 直到max_threads(包括max_threads)
+std::vector<size_t> thread_counts(const size_t max_threads) {
+    std::vector<size_t> counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(max_threads);
+    return counts;
+}
+
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size()) {
+        const size_t end = std::min(list.find(',', start), list.size());
+        if (end > start) {
+            items.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return items;
+}
+
+bool parse_options(const int argc, char** argv, Options& options) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string key = argv[i];
+        const std::string value = argv[i + 1];
+        if (key == "--threads") {
+            options.max_threads = std::max<size_t>(1, std::stoul(value));
+        } else if (key == "--ops") {
+            options.ops = std::max<size_t>(THREADTEST_BATCH, std::stoul(value));
+        } else if (key == "--allocators") {
+            options.allocators = split(value);
+        } else if (key == "--workloads") {
+            options.workloads = split(value);
+        } else if (key == "--trace") {
+            options.trace_path = value;
+        } else if (key == "--csv") {
+            options.csv_path = value;
+        } else if (key == "--json") {
+            options.json_path = value;
+        } else {
+            return false;
+        }
+    }
+    return argc % 2 == 1;
+}
+}
+
+int main(const int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "usage: " << argv[0] << " [--threads N] [--ops N] [--allocators glibc,tnc,jemalloc,tcmalloc]\n"
+                  << "       [--workloads trace,producer_consumer,larson,threadtest,fragmentation] [--trace file] [--csv file] [--json file]\n";
+        return 1;
+    }
+    const SizeTrace trace(options.trace_path);
+
+    std::vector<Allocator> allocators;
+    for (const auto& name : options.allocators) {
+        Allocator allocator;
+        if (load_allocator(name, allocator)) {
+            allocators.push_back(allocator);
+        } else {
+            std::cout << "skip allocator " << name << " (unknown or not installed)\n";
+        }
+    }
+
+    printf("%-10s %-18s %7s %14s %8s %8s %8s %12s %12s\n", "allocator", "workload", "threads", "ops/s", "p50(ns)", "p99(ns)", "p999(ns)", "peak_rss(KB)", "final_rss(KB)");
+    std::vector<Result> results;
+    for (const auto& workload_name : options.workloads) {
+        const Workload workload = find_workload(workload_name);
+        if (workload == nullptr) {
+            std::cout << "skip unknown workload " << workload_name << "\n";
+            continue;
+        }
+        for (const size_t threads : thread_counts(options.max_threads)) {
+            for (const auto& allocator : allocators) {
+                const Result r = run(allocator, workload_name, workload, threads, options, trace);
+                printf("%-10s %-18s %7zu %14.0f %8u %8u %8u %12zu %12zu\n", r.allocator.c_str(), r.workload.c_str(), r.threads,
+                       static_cast<double>(r.ops) / r.seconds, r.p50_ns, r.p99_ns, r.p999_ns, r.peak_rss_kb, r.final_rss_kb);
+                fflush(stdout);
+                results.push_back(r);
+            }
+        }
+    }
+
+    if (!options.csv_path.empty()) {
+        write_csv(options.csv_path, results);
+    }
+    if (!options.json_path.empty()) {
+        write_json(options.json_path, results);
+    }
     return 0;
-}
\ No newline at end of file
+}
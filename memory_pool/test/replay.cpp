@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "alloc.h"
+
+/**
+ * 回放 tnc_start_trace / HNC_MALLOC_TRACE 记录的申请释放， 统计各层的命中率和碎片率
+ *
+ * 用法: mp_replay <trace file> [--json file]
+ *
+ * 1. 记录按时间排序后， 每个被跟踪的线程对应一个回放线程， 通过全局序号严格按照原来的交错顺序执行，
+ *    线程局部缓存、远程释放和传输缓存看到的访问模式与原进程一致
+ * 2. 记录中的地址只用来匹配申请和释放， 回放时使用新申请到的地址， 找不到申请的释放跳过并计数
+ * 3. 每回放 STATS_INTERVAL 条记录汇总一次统计， 记录映射字节数的峰值和最大碎片率
+ * 4. --json 输出回放结束时(释放剩余内存块之前) tnc_print_stats 的JSON
+ */
+
+using namespace hnc::core::mem_pool;
+using details::TraceRecord;
+using details::TraceOp;
+
+namespace {
+constexpr size_t STATS_INTERVAL = 1 << 16; // 汇总统计的间隔记录数
+
+struct Replay {
+    std::vector<TraceRecord> records;
+    std::atomic<size_t> next{0}; // 下一条要回放的记录
+    std::unordered_map<uint64_t, void*> live; // 跟踪中的地址 -> 回放申请到的地址， 只由持有序号的线程访问
+
+    size_t unmatched_frees{0};
+    size_t unmatched_mallocs{0}; // 同一地址没有释放又被申请(例如原地完成的 realloc)
+    size_t peak_system_bytes{0};
+    double max_fragmentation{0};
+};
+
+bool load_trace(const std::string& path, std::vector<TraceRecord>& records) {
+    std::ifstream in(path, std::ios::binary);
+    details::TraceFileHeader header{};
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        std::cerr << "cannot read " << path << "\n";
+        return false;
+    }
+    if (memcmp(header._magic, details::TRACE_MAGIC, sizeof(header._magic)) != 0
+        || header._version != details::TRACE_VERSION || header._record_size != sizeof(TraceRecord)) {
+        std::cerr << path << " is not a trace file of this version\n";
+        return false;
+    }
+    TraceRecord record{};
+    while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        records.push_back(record);
+    }
+    // 后台线程按线程写出， 同一线程的记录保持原来的顺序
+    std::stable_sort(records.begin(), records.end(), [](const TraceRecord& a, const TraceRecord& b) {
+        return a._time_ns < b._time_ns;
+    });
+    return true;
+}
+
+void sample_stats(Replay& replay) {
+    const MallocStats stats = tnc_get_stats();
+    replay.peak_system_bytes = std::max(replay.peak_system_bytes, stats.system_bytes);
+    replay.max_fragmentation = std::max(replay.max_fragmentation, stats.fragmentation);
+}
+
+void replay_one(Replay& replay, const TraceRecord& record) {
+    if (record._op == static_cast<uint8_t>(TraceOp::malloc)) {
+        void* ptr = tnc_malloc(std::max<size_t>(record._size, 1));
+        // 写一个字节， 与真实程序一样让页面驻留
+        *static_cast<char*>(ptr) = 0;
+        auto [it, inserted] = replay.live.try_emplace(record._ptr, ptr);
+        if (!inserted) {
+            ++replay.unmatched_mallocs;
+            tnc_free(it->second);
+            it->second = ptr;
+        }
+        return;
+    }
+    const auto it = replay.live.find(record._ptr);
+    if (it == replay.live.end()) {
+        ++replay.unmatched_frees;
+        return;
+    }
+    tnc_free(it->second);
+    replay.live.erase(it);
+}
+
+// 依次回放 indexes 中的记录， 轮到自己之前让出CPU
+void replay_thread(Replay& replay, const std::vector<size_t>& indexes) {
+    for (const size_t index : indexes) {
+        while (replay.next.load(std::memory_order_acquire) != index) {
+            std::this_thread::yield();
+        }
+        replay_one(replay, replay.records[index]);
+        if ((index + 1) % STATS_INTERVAL == 0) {
+            sample_stats(replay);
+        }
+        replay.next.store(index + 1, std::memory_order_release);
+    }
+}
+
+double ratio(const size_t part, const size_t total) {
+    return total == 0 ? 0.0 : static_cast<double>(part) / static_cast<double>(total);
+}
+
+void print_report(const Replay& replay, const MallocStats& before, const MallocStats& after, const size_t threads, const double seconds) {
+    const ThreadCacheCounters& b = before.thread_cache_counters;
+    const ThreadCacheCounters& a = after.thread_cache_counters;
+    const size_t alloc_count = a.alloc_count - b.alloc_count;
+    const size_t central_fetches = a.central_fetch_count - b.central_fetch_count;
+    const size_t remote_collects = a.remote_collect_count - b.remote_collect_count;
+    const size_t transfer_hits = after.transfer_cache_hits - before.transfer_cache_hits;
+    const size_t span_fetches = after.central_span_fetches - before.central_span_fetches;
+
+    printf("records            %zu (%zu threads, %.3fs, %.0f ops/s)\n", replay.records.size(), threads, seconds,
+           static_cast<double>(replay.records.size()) / seconds);
+    printf("unmatched          %zu frees, %zu mallocs\n", replay.unmatched_frees, replay.unmatched_mallocs);
+    printf("thread cache       %zu small allocs, hit rate %.4f, %zu central fetches, %zu remote collects\n",
+           alloc_count, 1.0 - ratio(central_fetches + remote_collects, alloc_count), central_fetches, remote_collects);
+    printf("transfer cache     %zu batch hits, hit rate %.4f of central fetches\n", transfer_hits, ratio(transfer_hits, central_fetches));
+    printf("central cache      %zu span fetches, %zu new spans from page cache\n", span_fetches,
+           after.page_cache_span_fetches - before.page_cache_span_fetches);
+    printf("page cache         %zu system allocs, peak %zu KB mapped, %zu KB mapped at end\n",
+           after.page_cache_system_allocs - before.page_cache_system_allocs, replay.peak_system_bytes >> 10, after.system_bytes >> 10);
+    printf("fragmentation      %.4f at end, %.4f max\n", after.fragmentation, replay.max_fragmentation);
+    printf("live at end        %zu blocks, %zu KB small, %zu KB large\n", replay.live.size(),
+           after.small_in_use_bytes >> 10, after.large_in_use_bytes >> 10);
+}
+}
+
+int main(const int argc, char** argv) {
+    std::string trace_path;
+    std::string json_path;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (trace_path.empty() && argv[i][0] != '-') {
+            trace_path = argv[i];
+        } else {
+            trace_path.clear();
+            break;
+        }
+    }
+    if (trace_path.empty()) {
+        std::cerr << "usage: " << argv[0] << " <trace file> [--json file]\n";
+        return 1;
+    }
+
+    Replay replay;
+    if (!load_trace(trace_path, replay.records)) {
+        return 1;
+    }
+
+    // 按照跟踪中的线程编号分配回放线程
+    std::unordered_map<uint16_t, size_t> thread_slots;
+    std::vector<std::vector<size_t>> thread_indexes;
+    for (size_t i = 0; i < replay.records.size(); ++i) {
+        const auto [it, inserted] = thread_slots.try_emplace(replay.records[i]._thread, thread_indexes.size());
+        if (inserted) {
+            thread_indexes.emplace_back();
+        }
+        thread_indexes[it->second].push_back(i);
+    }
+
+    const MallocStats before = tnc_get_stats();
+    const auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (const auto& indexes : thread_indexes) {
+        threads.emplace_back(replay_thread, std::ref(replay), std::cref(indexes));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    sample_stats(replay);
+    const MallocStats after = tnc_get_stats();
+    print_report(replay, before, after, thread_indexes.size(), seconds);
+    if (!json_path.empty()) {
+        FILE* out = fopen(json_path.c_str(), "w");
+        if (out == nullptr) {
+            std::cerr << "cannot open " << json_path << "\n";
+            return 1;
+        }
+        tnc_print_stats(out);
+        fclose(out);
+    }
+
+    for (const auto& [trace_ptr, ptr] : replay.live) {
+        tnc_free(ptr);
+    }
+    return 0;
+}
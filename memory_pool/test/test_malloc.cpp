@@ -0,0 +1,270 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <map>
+#include <set>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <new>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/**
+ * libhncmalloc.so 的测试， 本程序链接了 libhncmalloc.so， 下面所有的 malloc/new 都由内存池提供
+ * 同样可以使用 LD_PRELOAD=libhncmalloc.so 运行其他程序
+ */
+
+void test_malloc_free() {
+    std::cout << "\n[Test] malloc/free\n";
+
+    for (size_t size : {0ul, 1ul, 24ul, 129ul, 1000ul, 8193ul, 256ul * 1024, 256ul * 1024 + 1, 4ul * 1024 * 1024}) {
+        auto ptr = static_cast<char*>(malloc(size));
+        assert(ptr != nullptr);
+        // 与 glibc 一致至少16字节对齐
+        assert(size <= 8 || reinterpret_cast<uintptr_t>(ptr) % 16 == 0);
+        assert(malloc_usable_size(ptr) >= size);
+        memset(ptr, 0x5a, size);
+        free(ptr);
+    }
+    free(nullptr);
+}
+
+void test_calloc_realloc() {
+    std::cout << "\n[Test] calloc/realloc\n";
+
+    auto arr = static_cast<int*>(calloc(1000, sizeof(int)));
+    assert(arr != nullptr);
+    for (int i = 0; i < 1000; ++i) {
+        assert(arr[i] == 0);
+        arr[i] = i;
+    }
+
+    // 从小块内存一直增长到pc的大块内存和单独mmap的大块内存
+    for (size_t count = 2000; count <= 4000000; count *= 2) {
+        arr = static_cast<int*>(realloc(arr, count * sizeof(int)));
+        assert(arr != nullptr);
+        for (int i = 0; i < 1000; ++i) {
+            assert(arr[i] == i);
+        }
+    }
+    free(arr);
+
+    // 溢出， volatile 避免编译器在编译期检查大小
+    volatile size_t huge = SIZE_MAX / 2;
+    assert(calloc(huge, 4) == nullptr);
+
+    // 过大的申请返回nullptr并设置ENOMEM
+    huge = SIZE_MAX;
+    errno = 0;
+    assert(malloc(huge) == nullptr && errno == ENOMEM);
+    // 没有超过 PTRDIFF_MAX， 但是mmap一定失败， 不能在持有pc锁时终止进程
+    huge = PTRDIFF_MAX;
+    errno = 0;
+    assert(malloc(huge) == nullptr && errno == ENOMEM);
+    huge = SIZE_MAX - 255;
+    assert(malloc(huge) == nullptr);
+    // realloc 失败时原内存块不变
+    auto ptr = static_cast<char*>(malloc(100));
+    ptr[0] = 'x';
+    assert(realloc(ptr, huge) == nullptr && ptr[0] == 'x');
+    free(ptr);
+}
+
+void test_out_of_memory() {
+    std::cout << "\n[Test] out of memory\n";
+
+    // 限制地址空间后不断申请小块内存， pc向OS映射新区域失败时返回nullptr， 而不是在持有锁时终止进程
+    const pid_t pid = fork();
+    if (pid == 0) {
+        // 在持有锁时抛出异常会死锁， 超时视为失败
+        alarm(60);
+        long vm_pages = 0;
+        FILE* statm = fopen("/proc/self/statm", "r");
+        assert(statm != nullptr && fscanf(statm, "%ld", &vm_pages) == 1);
+        fclose(statm);
+        const rlim_t limit = static_cast<rlim_t>(vm_pages) * sysconf(_SC_PAGESIZE) + (4 << 20);
+        const rlimit rl{limit, limit};
+        assert(setrlimit(RLIMIT_AS, &rl) == 0);
+
+        // 申请到的内存块串成链表， 不再申请其他内存
+        void* head = nullptr;
+        for (const size_t size : {48ul, 8192ul}) {
+            void* ptr;
+            errno = 0;
+            while ((ptr = malloc(size)) != nullptr) {
+                *static_cast<void**>(ptr) = head;
+                head = ptr;
+            }
+            assert(errno == ENOMEM);
+        }
+        bool thrown = false;
+        try {
+            [[maybe_unused]] volatile auto obj = new char[48];
+        } catch (const std::bad_alloc&) {
+            thrown = true;
+        }
+        assert(thrown);
+        while (head != nullptr) {
+            void* next = *static_cast<void**>(head);
+            free(head);
+            head = next;
+        }
+        // 释放之后可以再次申请
+        void* ptr = malloc(48);
+        assert(ptr != nullptr);
+        free(ptr);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void test_aligned_alloc() {
+    std::cout << "\n[Test] aligned alloc\n";
+
+    for (size_t align : {8ul, 16ul, 32ul, 64ul, 256ul, 4096ul, 8192ul, 65536ul, 1ul << 21}) {
+        void* ptr = nullptr;
+        assert(posix_memalign(&ptr, align, 100) == 0);
+        assert(reinterpret_cast<uintptr_t>(ptr) % align == 0);
+        free(ptr);
+
+        ptr = aligned_alloc(align, align * 3);
+        assert(ptr != nullptr);
+        assert(reinterpret_cast<uintptr_t>(ptr) % align == 0);
+        free(ptr);
+    }
+    // 超过一页的对齐， 大块内存
+    void* ptr = aligned_alloc(1 << 16, 1 << 20);
+    assert(ptr != nullptr && reinterpret_cast<uintptr_t>(ptr) % (1 << 16) == 0);
+    assert(malloc_usable_size(ptr) >= 1 << 20);
+    memset(ptr, 1, 1 << 20);
+    free(ptr);
+
+    assert(posix_memalign(&ptr, 24, 100) == EINVAL);
+}
+
+void test_operator_new() {
+    std::cout << "\n[Test] operator new/delete\n";
+
+    struct alignas(64) CacheLine {
+        char data[64];
+    };
+    auto line = new CacheLine[10];
+    assert(reinterpret_cast<uintptr_t>(line) % 64 == 0);
+    delete[] line;
+
+    std::map<int, std::string> map;
+    for (int i = 0; i < 10000; ++i) {
+        map[i] = std::to_string(i) + " : a string long enough to leave the small string buffer";
+    }
+    assert(map[9999].starts_with("9999"));
+}
+
+void test_cross_thread_free() {
+    std::cout << "\n[Test] cross thread free\n";
+
+    // 另一个线程释放的内存块， 该线程从没有申请过内存
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 10000; ++i) {
+        ptrs.push_back(malloc(i % 2048 + 1));
+    }
+    std::thread t([&ptrs] {
+        for (const auto ptr : ptrs) {
+            free(ptr);
+        }
+    });
+    t.join();
+}
+
+// malloc_stats 输出到 stderr， 临时重定向到文件后读出远程释放的次数
+size_t remote_free_count() {
+    fflush(stderr);
+    const int saved = dup(STDERR_FILENO);
+    FILE* file = tmpfile();
+    dup2(fileno(file), STDERR_FILENO);
+    malloc_stats();
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+
+    rewind(file);
+    std::string stats;
+    char buffer[4096];
+    size_t bytes;
+    while ((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        stats.append(buffer, bytes);
+    }
+    fclose(file);
+    constexpr std::string_view KEY = "\"remote_free_count\": ";
+    const size_t pos = stats.find(KEY);
+    assert(pos != std::string::npos);
+    return std::strtoull(stats.c_str() + pos + KEY.size(), nullptr, 10);
+}
+
+void test_cross_thread_delete() {
+    std::cout << "\n[Test] cross thread delete\n";
+
+    // 一个线程new， 另一个线程delete(带大小的operator delete)， 内存块送回new的线程而不是进入delete线程的自由链表
+    struct Node {
+        size_t value;
+        char payload[88];
+    };
+    constexpr size_t COUNT = 20000;
+    std::vector<Node*> nodes(COUNT);
+    std::vector<Node*> reused(COUNT);
+    std::atomic<bool> deleted{false};
+    const size_t before = remote_free_count();
+    std::thread producer([&] {
+        for (size_t i = 0; i < COUNT; ++i) {
+            nodes[i] = new Node{i, {}};
+        }
+        std::thread consumer([&] {
+            for (size_t i = 0; i < COUNT; ++i) {
+                assert(nodes[i]->value == i);
+                delete nodes[i];
+            }
+            deleted.store(true, std::memory_order_release);
+        });
+        consumer.join();
+        // 下次补充自由链表时从远程释放队列取回
+        for (auto& node : reused) {
+            node = new Node{};
+        }
+    });
+    producer.join();
+    assert(deleted.load(std::memory_order_acquire));
+    // 传输缓存中的内存块所属线程可能已经过期， 允许少量走普通的释放路径
+    assert(remote_free_count() - before >= COUNT * 9 / 10);
+    const std::set<void*> freed(nodes.begin(), nodes.end());
+    assert(std::any_of(reused.begin(), reused.end(), [&](Node* node) { return freed.contains(node); }));
+    for (const auto node : reused) {
+        delete node;
+    }
+}
+
+int main() {
+    test_malloc_free();
+    test_calloc_realloc();
+    test_out_of_memory();
+    test_aligned_alloc();
+    test_operator_new();
+    test_cross_thread_free();
+    // per-cpu缓存没有所属线程， 不使用远程释放队列
+#ifndef HNC_MALLOC_PER_CPU
+    test_cross_thread_delete();
+#endif
+
+    std::cout << "\n[All Tests Passed]\n";
+    return 0;
+}
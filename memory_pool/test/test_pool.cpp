@@ -1,6 +1,17 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
+#include <map>
+#include <set>
 #include <cassert>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "tnc_malloc.h"
 
@@ -21,6 +32,29 @@ void test_class_new_delete() {
     delete obj;
 }
 
+void test_size_class() {
+    std::cout << "\n[Test] size class\n";
+
+    using namespace hnc::core::mem_pool::details;
+    for (size_t size = 1; size <= constant::MAX_ALLOC_BYTES; ++size) {
+        const size_t index = Index(size);
+        const size_t class_size = IndexToSize(index);
+        // 选中不小于size的最小块大小(不小于 MIN_BLOCK_BYTES)， 内部碎片不超过 1/CLASS_SPLITS
+        assert(class_size >= std::max(size, constant::MIN_BLOCK_BYTES));
+        assert(index == 0 || IndexToSize(index - 1) < std::max(size, constant::MIN_BLOCK_BYTES));
+        assert(size <= 8 * constant::CLASS_SPLITS || (class_size - size) * constant::CLASS_SPLITS < size);
+    }
+    // 对齐数的倍数选中的块大小也是对齐数的倍数
+    for (size_t align = 8; align <= constant::PAGE_BYTES; align *= 2) {
+        for (size_t size = align; size <= constant::MAX_ALLOC_BYTES; size += align) {
+            assert(RoundUp(size) % align == 0);
+        }
+    }
+    auto ptr = tnc_malloc(1025);
+    assert(tnc_usable_size(ptr) + constant::CANARY_BYTES == 1024 + 1024 / constant::CLASS_SPLITS);
+    tnc_free(ptr);
+}
+
 void test_global_malloc_dealloc() {
     std::cout << "\n[Test] global malloc/dealloc\n";
 
@@ -43,6 +77,19 @@ void test_global_malloc_dealloc() {
     tnc_free(ptr3);
 }
 
+void test_free_sized() {
+    std::cout << "\n[Test] free sized\n";
+
+    // 已知大小的释放， 覆盖所有对齐区间以及pc的大块内存
+    for (size_t size : {1ul, 8ul, 129ul, 1025ul, 8 * 1024ul + 1, 64 * 1024ul + 1, 256 * 1024ul, 256 * 1024ul + 1}) {
+        for (int i = 0; i < 100; ++i) {
+            void* ptr = tnc_malloc(size);
+            assert(ptr != nullptr);
+            tnc_free_sized(ptr, size);
+        }
+    }
+}
+
 void test_stl_allocator() {
     std::cout << "\n[Test] STL Allocator\n";
 
@@ -67,15 +114,1024 @@ void test_pmr_stl_malloc_dealloc() {
     assert(pmr_vec[0] == 100 && pmr_vec[1] == 200);
 }
 
+void test_aligned_alloc() {
+    std::cout << "\n[Test] aligned alloc\n";
+
+    // 对齐数 <= 一页时走size class， 超过一页时由pc切出对齐的span， 覆盖小块、pc大块和mmap大块
+    for (size_t align : {8ul, 64ul, 512ul, 4096ul, 8192ul, 65536ul, 1ul << 21}) {
+        for (size_t size : {1ul, 100ul, 3000ul, 256 * 1024ul + 1, 600 * 1024ul}) {
+            std::vector<char*> ptrs;
+            for (int i = 0; i < 8; ++i) {
+                auto ptr = static_cast<char*>(tnc_aligned_alloc(size, align));
+                assert(reinterpret_cast<uintptr_t>(ptr) % align == 0);
+                assert(tnc_usable_size(ptr) >= size);
+                ptr[0] = ptr[size - 1] = static_cast<char>(i);
+                ptrs.push_back(ptr);
+            }
+            for (size_t i = 0; i < ptrs.size(); ++i) {
+                // 交替使用两种释放接口
+                if (i % 2 == 0) {
+                    tnc_free(ptrs[i]);
+                } else {
+                    tnc_free_aligned_sized(ptrs[i], size, align);
+                }
+            }
+        }
+    }
+
+    // pmr 按 alignment 申请
+    TncMemRe resource;
+    void* ptr = resource.allocate(48, 64);
+    assert(reinterpret_cast<uintptr_t>(ptr) % 64 == 0);
+    resource.deallocate(ptr, 48, 64);
+
+    // 超过默认对齐的对象
+    struct alignas(64) Counter : TncMemObj {
+        long value{0};
+    };
+    auto counters = new Counter();
+    assert(reinterpret_cast<uintptr_t>(counters) % 64 == 0);
+    delete counters;
+}
+
+void test_realloc() {
+    std::cout << "\n[Test] realloc\n";
+
+    // 同一个块大小原地返回
+    auto ptr = static_cast<char*>(tnc_malloc(100));
+    memset(ptr, 1, 100);
+    assert(tnc_realloc(ptr, 104) == ptr);
+    ptr = static_cast<char*>(tnc_realloc(ptr, 3000));
+    assert(ptr[0] == 1 && ptr[99] == 1);
+
+    // pc中的大块内存: 缩小一定原地， 缩小后放回pc的尾部页面还在， 再扩大也是原地
+    // 加固模式的大块内存尾部有保护页， 总是重新申请
+    constexpr size_t page = 4096;
+    ptr = static_cast<char*>(tnc_realloc(ptr, 100 * page));
+    assert(ptr[0] == 1 && ptr[99] == 1);
+    memset(ptr, 2, 100 * page);
+    auto resized = static_cast<char*>(tnc_realloc(ptr, 70 * page));
+    assert(resized == ptr || hnc::core::mem_pool::details::constant::HARDENED);
+    ptr = resized;
+    assert(tnc_usable_size(ptr) == 70 * page);
+    resized = static_cast<char*>(tnc_realloc(ptr, 90 * page));
+    assert(resized == ptr || hnc::core::mem_pool::details::constant::HARDENED);
+    ptr = resized;
+    assert(tnc_usable_size(ptr) == 90 * page);
+    assert(ptr[70 * page - 1] == 2);
+
+    // 单独mmap的大块内存使用mremap
+    ptr = static_cast<char*>(tnc_realloc(ptr, 1 << 20));
+    assert(ptr[0] == 2 && ptr[70 * page - 1] == 2);
+    memset(ptr, 3, 1 << 20);
+    ptr = static_cast<char*>(tnc_realloc(ptr, 8 << 20));
+    assert(tnc_usable_size(ptr) == 8 << 20);
+    assert(ptr[0] == 3 && ptr[(1 << 20) - 1] == 3);
+    ptr[(8 << 20) - 1] = 4;
+    ptr = static_cast<char*>(tnc_realloc(ptr, 2 << 20));
+    assert(ptr[(1 << 20) - 1] == 3);
+
+    // 单独mmap的span不会mremap到128页以内， 重新申请后原来的映射被munmap， 不会留在pc的空闲链表中
+    char* mapped = ptr;
+    ptr = static_cast<char*>(tnc_realloc(ptr, 100 * page));
+    assert(ptr != mapped && ptr[100 * page - 1] == 3);
+    assert(hnc::core::mem_pool::details::PageCache::lookup_span(mapped) == nullptr);
+
+    // 缩小回小块内存
+    ptr = static_cast<char*>(tnc_realloc(ptr, 64));
+    assert(ptr[63] == 3);
+    assert(tnc_realloc(ptr, 0) == nullptr);
+}
+
+void test_batch() {
+    std::cout << "\n[Test] batch malloc/free\n";
+
+    // 数量超过自由链表缓存的块数， 不足的部分向cc申请
+    constexpr size_t count = 5000;
+    std::vector<void*> ptrs(count);
+    tnc_malloc_batch(48, count, ptrs.data());
+    std::set<void*> unique(ptrs.begin(), ptrs.end());
+    assert(unique.size() == count);
+    for (size_t i = 0; i < count; ++i) {
+        assert(ptrs[i] != nullptr && tnc_usable_size(ptrs[i]) == 48);
+        memset(ptrs[i], static_cast<int>(i), 48);
+    }
+    tnc_free_batch(ptrs.data(), count, 48);
+
+    // 释放后的内存块可以被单个申请复用， 批量和单个申请可以混合释放
+    tnc_malloc_batch(48, 16, ptrs.data());
+    ptrs[16] = tnc_malloc(48);
+    tnc_free_batch(ptrs.data(), 17, 48);
+
+    // 大块内存逐个申请
+    tnc_malloc_batch(300 * 1024, 4, ptrs.data());
+    for (size_t i = 0; i < 4; ++i) {
+        assert(tnc_usable_size(ptrs[i]) >= 300 * 1024);
+    }
+    tnc_free_batch(ptrs.data(), 4, 300 * 1024);
+}
+
+void test_arena() {
+    std::cout << "\n[Test] arena\n";
+
+    const size_t large_in_use = tnc_get_stats().large_in_use_bytes;
+    {
+        TncArena arena;
+        // 小对象在同一个span中连续分配
+        auto first = static_cast<char*>(arena.allocate(10, 1));
+        auto second = static_cast<char*>(arena.allocate(10, 1));
+        assert(second == first + 10);
+        for (size_t align : {8ul, 64ul, 4096ul, 65536ul}) {
+            auto ptr = arena.allocate(100, align);
+            assert(reinterpret_cast<uintptr_t>(ptr) % align == 0);
+        }
+        // 超过span页数的大对象单独申请span
+        auto big = static_cast<char*>(arena.allocate(1 << 20));
+        memset(big, 1, 1 << 20);
+        assert(arena.reserved_bytes() >= (1 << 20) && arena.allocated_bytes() >= (1 << 20));
+
+        struct Node {
+            int _value;
+            Node* _next;
+        };
+        Node* head = nullptr;
+        for (int i = 0; i < 10000; ++i) {
+            head = arena.create<Node>(i, head);
+        }
+        assert(head->_value == 9999 && head->_next->_value == 9998);
+
+        arena.reset();
+        assert(arena.reserved_bytes() == 0 && arena.allocated_bytes() == 0);
+        assert(tnc_get_stats().large_in_use_bytes == large_in_use);
+
+        // reset之后可以继续使用， pmr容器释放时是空操作
+        TncArenaRe resource(arena);
+        std::pmr::vector<std::pmr::string> strs(&resource);
+        for (int i = 0; i < 1000; ++i) {
+            strs.emplace_back(std::to_string(i) + " a string longer than sso buffer");
+        }
+        assert(strs[999] == "999 a string longer than sso buffer");
+    }
+    // 析构时归还所有span
+    assert(tnc_get_stats().large_in_use_bytes == large_in_use);
+}
+
+void test_object_pool() {
+    std::cout << "\n[Test] object pool\n";
+
+    struct Session {
+        int _fd;
+        std::string _name;
+        Session(const int fd, std::string name) : _fd(fd), _name(std::move(name)) {}
+    };
+    auto& pool = ObjectPool<Session>::GetInstance();
+
+    // 多个线程同时申请释放， 释放的对象经过仓库被其他线程复用
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&pool, t]() {
+            std::vector<Session*> sessions;
+            for (int round = 0; round < 20; ++round) {
+                for (int i = 0; i < 1000; ++i) {
+                    sessions.push_back(pool.New(i, "session-" + std::to_string(t)));
+                }
+                for (int i = 0; i < 1000; ++i) {
+                    assert(sessions[i]->_fd == i && sessions[i]->_name == "session-" + std::to_string(t));
+                }
+                for (auto session : sessions) {
+                    pool.Delete(session);
+                }
+                sessions.clear();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // 大量对象全部释放后， 完全空闲的chunk归还pc， 只保留本线程弹夹中的对象所在的chunk
+    std::vector<Session*> sessions;
+    for (int i = 0; i < 100000; ++i) {
+        sessions.push_back(pool.New(i, ""));
+    }
+    const size_t chunk_count = pool.chunk_count();
+    for (auto session : sessions) {
+        pool.Delete(session);
+    }
+    pool.release_free_chunks();
+    assert(pool.chunk_count() < chunk_count && pool.chunk_count() <= 4);
+    // 归还后可以继续申请
+    auto session = pool.New(1, "again");
+    assert(session->_fd == 1 && session->_name == "again");
+    pool.Delete(session);
+
+    // 限制地址空间后pc申请不到新的chunk， New 抛出 bad_alloc 而不是访问空指针
+    // AddressSanitizer 自身的映射同样受地址空间限制， 不做这项检查
+#ifndef __SANITIZE_ADDRESS__
+    const pid_t pid = fork();
+    if (pid == 0) {
+        alarm(60);
+        struct Page {
+            char _data[4096];
+        };
+        auto& page_pool = ObjectPool<Page>::GetInstance();
+        // 先确保当前线程的弹夹已经创建， 之后的失败只来自chunk
+        page_pool.Delete(page_pool.New());
+        long vm_pages = 0;
+        FILE* statm = fopen("/proc/self/statm", "r");
+        assert(statm != nullptr && fscanf(statm, "%ld", &vm_pages) == 1);
+        fclose(statm);
+        const rlim_t limit = static_cast<rlim_t>(vm_pages) * sysconf(_SC_PAGESIZE) + (4 << 20);
+        const rlimit rl{limit, limit};
+        assert(setrlimit(RLIMIT_AS, &rl) == 0);
+        bool thrown = false;
+        try {
+            while (true) {
+                page_pool.New();
+            }
+        } catch (const std::bad_alloc&) {
+            thrown = true;
+        }
+        assert(thrown);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+#endif
+}
+
+void test_multi_thread_malloc_free() {
+    std::cout << "\n[Test] multi thread malloc/free\n";
+
+    // 多个线程同时申请释放不同大小的内存块， free时查找span不再经过pc的全局锁
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([t] {
+            std::vector<void*> ptrs;
+            for (size_t i = 1; i <= 2000; ++i) {
+                const size_t size = (i * (t + 1) * 37) % (64 * 1024) + 1;
+                auto ptr = static_cast<char*>(tnc_malloc(size));
+                assert(ptr != nullptr);
+                ptr[0] = ptr[size - 1] = static_cast<char>(i);
+                ptrs.push_back(ptr);
+            }
+            for (const auto ptr : ptrs) {
+                tnc_free(ptr);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+void test_transfer_cache() {
+    std::cout << "\n[Test] transfer cache\n";
+
+    // 生产者申请、消费者释放， 消费者整批归还的内存块经过传输缓存再被生产者取走
+    constexpr size_t SIZE = 48;
+    constexpr size_t COUNT = 200000;
+    std::vector<void*> ptrs(COUNT);
+    std::atomic<size_t> produced{0};
+    std::thread producer([&] {
+        for (size_t i = 0; i < COUNT; ++i) {
+            auto ptr = static_cast<size_t*>(tnc_malloc(SIZE));
+            *ptr = i;
+            ptrs[i] = ptr;
+            produced.store(i + 1, std::memory_order_release);
+        }
+    });
+    std::thread consumer([&] {
+        for (size_t i = 0; i < COUNT; ++i) {
+            while (produced.load(std::memory_order_acquire) <= i) {
+                std::this_thread::yield();
+            }
+            assert(*static_cast<size_t*>(ptrs[i]) == i);
+            tnc_free_sized(ptrs[i], SIZE);
+        }
+    });
+    producer.join();
+    consumer.join();
+}
+
+void test_remote_free() {
+    std::cout << "\n[Test] remote free\n";
+
+    // 消费者释放的内存块送回生产者的远程释放队列， 生产者下次补充自由链表时整批取回， 不经过cc
+    constexpr size_t SIZE = 96;
+    constexpr size_t COUNT = 100000;
+    constexpr size_t KEPT = 1000;
+    const ThreadCacheCounters before = tnc_get_stats().thread_cache_counters;
+    std::vector<void*> ptrs(COUNT);
+    std::vector<void*> reused(COUNT);
+    std::atomic<size_t> produced{0};
+    std::atomic<bool> consumed{false};
+    std::thread producer([&] {
+        for (size_t i = 0; i < COUNT; ++i) {
+            auto ptr = static_cast<size_t*>(tnc_malloc(SIZE));
+            *ptr = i;
+            ptrs[i] = ptr;
+            produced.store(i + 1, std::memory_order_release);
+        }
+        while (!consumed.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        for (size_t i = 0; i < COUNT; ++i) {
+            reused[i] = tnc_malloc(SIZE);
+        }
+    });
+    std::thread consumer([&] {
+        // 三种释放接口轮流使用， 都要送回生产者
+        constexpr size_t BATCH = 8;
+        for (size_t i = 0; i < COUNT - KEPT; i += BATCH) {
+            while (produced.load(std::memory_order_acquire) < i + BATCH) {
+                std::this_thread::yield();
+            }
+            for (size_t j = i; j < i + BATCH; ++j) {
+                assert(*static_cast<size_t*>(ptrs[j]) == j);
+            }
+            switch (i / BATCH % 3) {
+                case 0:
+                    for (size_t j = i; j < i + BATCH; ++j) {
+                        tnc_free(ptrs[j]);
+                    }
+                    break;
+                case 1:
+                    for (size_t j = i; j < i + BATCH; ++j) {
+                        tnc_free_sized(ptrs[j], SIZE);
+                    }
+                    break;
+                default:
+                    tnc_free_batch(&ptrs[i], BATCH, SIZE);
+                    break;
+            }
+        }
+        consumed.store(true, std::memory_order_release);
+    });
+    producer.join();
+    consumer.join();
+
+    const ThreadCacheCounters after = tnc_get_stats().thread_cache_counters;
+    // 传输缓存中的内存块所属线程可能已经过期， 允许少量走普通的释放路径
+    assert(after.remote_free_count - before.remote_free_count >= (COUNT - KEPT) * 9 / 10);
+    assert(after.remote_collect_count > before.remote_collect_count);
+    // 生产者取回了消费者释放的内存块: 消费者跟得上时第一轮后面的申请就已经取回(同一地址出现多次)， 否则在第二轮取回
+    const std::set<void*> freed(ptrs.begin(), ptrs.end() - KEPT);
+    assert(freed.size() < COUNT - KEPT
+        || std::any_of(reused.begin(), reused.end(), [&](void* ptr) { return freed.contains(ptr); }));
+
+    // 生产者已经退出， 队列已经关闭， 剩余的内存块走普通的释放路径
+    for (size_t i = COUNT - KEPT; i < COUNT; ++i) {
+        tnc_free(ptrs[i]);
+    }
+    for (const auto ptr : reused) {
+        tnc_free(ptr);
+    }
+}
+
+void test_page_arenas() {
+    std::cout << "\n[Test] page cache arenas\n";
+    using hnc::core::mem_pool::details::PageCache;
+
+    // 每个线程从自己的pc分片申请大块内存， 交给下一个线程释放， span要回到申请时的分片
+    constexpr int THREADS = 8;
+    constexpr size_t COUNT = 200;
+    std::vector<std::vector<void*>> ptrs(THREADS);
+    std::vector<PageCache*> arenas(THREADS);
+    std::atomic<int> ready{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&, t] {
+            arenas[t] = &PageCache::GetInstance();
+            for (size_t i = 0; i < COUNT; ++i) {
+                void* ptr = tnc_malloc(300 * 1024 + i * 4096);
+                memset(ptr, t, 4096);
+                assert(&PageCache::OwnerOf(PageCache::find_span_by_address(ptr)) == arenas[t]);
+                ptrs[t].push_back(ptr);
+            }
+            ready.fetch_add(1);
+            while (ready.load() < THREADS) {
+                std::this_thread::yield();
+            }
+            const int other = (t + 1) % THREADS;
+            for (const auto ptr : ptrs[other]) {
+                assert(*static_cast<unsigned char*>(ptr) == other);
+                assert(&PageCache::OwnerOf(PageCache::find_span_by_address(ptr)) == arenas[other]);
+                tnc_free(ptr);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    // 线程轮流分配到不同的分片(多个NUMA节点时只在所在节点的分片中轮流)
+    const std::set<PageCache*> used(arenas.begin(), arenas.end());
+    if (PageCache::NodeCount() == 1) {
+        assert(used.size() == std::min<size_t>(THREADS, PageCache::ARENA_COUNT));
+    } else {
+        assert(used.size() > 1);
+    }
+    std::cout << "arenas=" << PageCache::ARENA_COUNT << ", used=" << used.size() << '\n';
+}
+
+void test_numa_nodes() {
+    std::cout << "\n[Test] numa nodes\n";
+    using hnc::core::mem_pool::details::PageCache;
+    using hnc::core::mem_pool::details::CentralCache;
+
+    const size_t nodes = PageCache::NodeCount();
+    assert(nodes >= 1 && nodes <= hnc::core::mem_pool::details::constant::MAX_NUMA_NODES);
+    assert(nodes <= PageCache::ARENA_COUNT);
+    // 每个节点至少有一个分片
+    for (size_t i = 0; i < PageCache::ARENA_COUNT; ++i) {
+        assert(PageCache::Arena(i).node() == i % nodes);
+    }
+
+    // 每个线程的内存块来自自己节点的分片， 交给其他线程释放后回到所属节点
+    constexpr int THREADS = 4;
+    constexpr size_t COUNT = 20000;
+    std::vector<std::vector<void*>> ptrs(THREADS);
+    std::atomic<int> ready{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&, t] {
+            const size_t node = PageCache::GetInstance().node();
+            assert(&CentralCache::GetInstance() == &CentralCache::Node(node));
+            for (size_t i = 0; i < COUNT; ++i) {
+                void* ptr = tnc_malloc(i % 512 + 1);
+                assert(PageCache::OwnerOf(PageCache::find_span_by_address(ptr)).node() == node);
+                ptrs[t].push_back(ptr);
+            }
+            ready.fetch_add(1);
+            while (ready.load() < THREADS) {
+                std::this_thread::yield();
+            }
+            for (const auto ptr : ptrs[(t + 1) % THREADS]) {
+                tnc_free(ptr);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::cout << "nodes=" << nodes << '\n';
+}
+
+void test_thread_cache_budget() {
+    std::cout << "\n[Test] thread cache budget\n";
+
+    const size_t old_budget = tnc_get_thread_cache_budget();
+    tnc_set_thread_cache_budget(16 * 1024 * 1024);
+
+    // 多个线程申请释放大量内存块， 每个tc缓存的字节数都不会超过自己的上限
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([] {
+            std::vector<void*> ptrs;
+            for (int round = 0; round < 4; ++round) {
+                for (size_t i = 1; i <= 4000; ++i) {
+                    ptrs.push_back(tnc_malloc((i % 64 + 1) * 1024));
+                }
+                for (const auto ptr : ptrs) {
+                    tnc_free(ptr);
+                }
+                ptrs.clear();
+            }
+            const auto tc = hnc::core::mem_pool::details::tls_thread_cache_ptr_;
+            // per-cpu 前端下内存块缓存在cpu的缓存中， 线程没有自己的tc
+            if (tc == nullptr) {
+                return;
+            }
+            assert(tc->cached_bytes() <= tc->max_bytes());
+            // 活跃的线程从预算中获取了额度
+            assert(tc->max_bytes() > hnc::core::mem_pool::details::constant::MIN_THREAD_CACHE_BYTES);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    tnc_set_thread_cache_budget(old_budget);
+}
+
+#ifdef HNC_MALLOC_PER_CPU
+void test_cpu_cache() {
+    std::cout << "\n[Test] per-cpu cache\n";
+
+    // 大量线程共享per-cpu缓存， rseq可用时线程不会再创建自己的tc
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 64; ++t) {
+        threads.emplace_back([t] {
+            std::vector<void*> ptrs;
+            for (size_t i = 1; i <= 1000; ++i) {
+                const size_t size = (i * (t + 1) * 31) % 4096 + 1;
+                auto ptr = static_cast<char*>(tnc_malloc(size));
+                ptr[0] = ptr[size - 1] = static_cast<char>(i);
+                ptrs.push_back(ptr);
+            }
+            for (const auto ptr : ptrs) {
+                tnc_free(ptr);
+            }
+            if (hnc::core::mem_pool::details::CpuCache::current_cpu() >= 0) {
+                assert(hnc::core::mem_pool::details::tls_thread_cache_ptr_ == nullptr);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // 批量申请释放， 以及一次释放很多个大小的内存块: 向cc申请和归还在锁外进行， 锁内最多收集16串
+    threads.clear();
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([t] {
+            for (int round = 0; round < 20; ++round) {
+                void* batch[512];
+                tnc_malloc_batch(64 + t, 512, batch);
+                std::set<void*> distinct(batch, batch + 512);
+                assert(distinct.size() == 512);
+                for (const auto ptr : batch) {
+                    memset(ptr, t, 64 + t);
+                }
+                tnc_free_batch(batch, 512, 64 + t);
+
+                std::vector<void*> ptrs;
+                for (size_t size = 8; size <= 64 * 1024; size += size / 4) {
+                    for (int i = 0; i < 16; ++i) {
+                        auto ptr = static_cast<char*>(tnc_malloc(size));
+                        ptr[0] = ptr[size - 1] = static_cast<char>(i);
+                        ptrs.push_back(ptr);
+                    }
+                }
+                for (const auto ptr : ptrs) {
+                    tnc_free(ptr);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+#endif
+
+#ifdef HNC_MALLOC_HARDENED
+// 在子进程中执行fn， 返回终止子进程的信号， 正常退出返回0， 以非0状态退出返回-1
+// report 不为空时收集子进程写到标准错误的内容
+template <typename Fn>
+int run_in_child(Fn fn, std::string* report = nullptr) {
+    int fds[2] = {-1, -1};
+    if (report != nullptr) {
+        assert(pipe(fds) == 0);
+    }
+    const pid_t pid = fork();
+    if (pid == 0) {
+        if (report != nullptr) {
+            dup2(fds[1], STDERR_FILENO);
+            close(fds[0]);
+            close(fds[1]);
+        }
+        fn();
+        _exit(0);
+    }
+    if (report != nullptr) {
+        close(fds[1]);
+        char buf[256];
+        for (ssize_t n; (n = read(fds[0], buf, sizeof(buf))) > 0;) {
+            report->append(buf, n);
+        }
+        close(fds[0]);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (WIFSIGNALED(status)) {
+        return WTERMSIG(status);
+    }
+    return WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+// 采样完整检查时让这一次释放一定被完整检查， 子进程中的结果与采样间隔无关
+void free_checked(void* ptr) {
+    hnc::core::mem_pool::details::hardened::free_countdown = 0;
+    tnc_free(ptr);
+}
+
+void test_hardened() {
+    std::cout << "\n[Test] hardened mode\n";
+
+    namespace details = hnc::core::mem_pool::details;
+    constexpr bool canary = details::constant::CANARY_BYTES > 0;
+    constexpr size_t quarantine = details::hardened::QUARANTINE_COUNT;
+    constexpr size_t poison = details::hardened::POISON_BYTES;
 
+    // 可用大小不包括尾部金丝雀， 写满可用大小是合法的
+    auto ptr = static_cast<char*>(tnc_malloc(100));
+    assert(tnc_usable_size(ptr) >= 100);
+    memset(ptr, 1, tnc_usable_size(ptr));
+    assert(run_in_child([] {}) == 0);
+
+    // 子进程只释放和写父进程申请好的内存， 避免fork时其他线程持有的锁
+    // 1. 越界写覆盖金丝雀
+    if constexpr (canary) {
+        assert(run_in_child([ptr] { ptr[tnc_usable_size(ptr)] = 0; free_checked(ptr); }) == SIGABRT);
+    }
+    // 2. 重复释放， 第二次释放时内存块还在隔离区中(没有隔离区时由金丝雀位置的释放标记发现)
+    if constexpr (canary || quarantine > 0) {
+        assert(run_in_child([ptr] { free_checked(ptr); free_checked(ptr); }) == SIGABRT);
+    }
+    // 3. 释放时传入的大小和申请时不一致
+    assert(run_in_child([ptr] { tnc_free_sized(ptr, 3000); }) == SIGABRT);
+    // 4. 释放后写入， 内存块被挤出隔离区时发现毒化字节被修改
+    std::vector<void*> fillers(quarantine);
+    for (auto& filler : fillers) {
+        filler = tnc_malloc(64);
+    }
+    if constexpr (poison > 0 && quarantine > 0) {
+        assert(run_in_child([ptr, &fillers] {
+            free_checked(ptr);
+            ptr[0] = 2;
+            for (const auto filler : fillers) {
+                free_checked(filler);
+            }
+        }) == SIGABRT);
+    }
+    // 5. 重复释放， 第二次释放时内存块已经被挤出隔离区
+    if constexpr (canary) {
+        assert(run_in_child([ptr, &fillers] {
+            free_checked(ptr);
+            for (const auto filler : fillers) {
+                free_checked(filler);
+            }
+            free_checked(ptr);
+        }) == SIGABRT);
+    }
+    // 6. 大块内存尾部的保护页(sanitizer会接管段错误， 以非0状态退出)
+    auto large = static_cast<char*>(tnc_malloc(1 << 20));
+    assert(tnc_usable_size(large) == 1 << 20);
+    large[(1 << 20) - 1] = 1;
+    assert(run_in_child([large] { large[1 << 20] = 1; }) != 0);
+    // 7. 非法地址
+    assert(run_in_child([large] { tnc_free(large + 8); }) == SIGABRT);
+    // 8. 其他线程释放后写入， 所属线程从远程释放队列取回时发现填充被改写
+#ifndef HNC_MALLOC_PER_CPU
+    if constexpr (poison > 16) {
+        // 先取空传输缓存， 最后一块来自本线程切分的span(所属线程是本线程)， 而不是已经退出的线程留下的
+        std::vector<void*> drained(1 << 14);
+        for (auto& block : drained) {
+            block = tnc_malloc(100);
+        }
+        auto remote = static_cast<char*>(drained.back());
+        drained.pop_back();
+        std::thread([remote] { free_checked(remote); }).join();
+        assert(run_in_child([remote] {
+            remote[16] = 2;
+            for (int i = 0; i < 1 << 16; ++i) {
+                tnc_malloc(100);
+            }
+        }) == SIGABRT);
+        for (const auto block : drained) {
+            tnc_free(block);
+        }
+    }
+#endif
+    // 9. 最小的块重复释放， 金丝雀、记录和链表指针不能互相覆盖， 报告的是重复释放而不是越界
+    if constexpr (canary) {
+        for (const size_t size : {size_t{0}, size_t{1}, size_t{8}}) {
+            auto tiny = static_cast<char*>(tnc_malloc(size));
+            tiny[0] = 1;
+            std::string report;
+            assert(run_in_child([tiny] { free_checked(tiny); free_checked(tiny); }, &report) == SIGABRT);
+            assert(report.find("double free") != std::string::npos);
+            report.clear();
+            assert(run_in_child([tiny, &fillers] {
+                free_checked(tiny);
+                for (const auto filler : fillers) {
+                    free_checked(filler);
+                }
+                free_checked(tiny);
+            }, &report) == SIGABRT);
+            assert(report.find("double free") != std::string::npos);
+            tnc_free(tiny);
+        }
+    }
+    // 10. 采样时没有完整检查的释放重复释放了隔离区中的内存块， 挤出时发现
+    if constexpr (details::hardened::SAMPLE_PERIOD > 1 && quarantine > 0) {
+        std::string report;
+        assert(run_in_child([ptr, &fillers] {
+            free_checked(ptr);
+            details::hardened::free_countdown = details::hardened::SAMPLE_PERIOD - 1;
+            tnc_free(ptr);
+            for (const auto filler : fillers) {
+                free_checked(filler);
+            }
+        }, &report) == SIGABRT);
+        assert(report.find("double free") != std::string::npos);
+    }
+
+    // 父进程中正常释放
+    tnc_free(large);
+    for (const auto filler : fillers) {
+        tnc_free(filler);
+    }
+    tnc_free(ptr);
+}
+#endif
+
+void test_huge_page() {
+    std::cout << "\n[Test] huge page region\n";
+
+    tnc_set_huge_page_mode(HugePageMode::transparent);
+    const HugePageStats before = tnc_get_huge_page_stats();
+
+    // pc中原有的空闲span用完之后从2MB对齐的大页区域中切分
+    std::vector<void*> ptrs;
+    while (tnc_get_huge_page_stats().hugepage_regions == before.hugepage_regions) {
+        ptrs.push_back(tnc_malloc(300 * 1024));
+    }
+    for (int i = 0; i < 64; ++i) {
+        ptrs.push_back(tnc_malloc(300 * 1024));
+    }
+    const HugePageStats used = tnc_get_huge_page_stats();
+    assert(used.hugepage_regions > before.hugepage_regions);
+    assert(used.hugepage_bytes == used.hugepage_regions << hnc::core::mem_pool::details::constant::HUGE_PAGE_SHIFT);
+    assert(used.hugepage_used_bytes > before.hugepage_used_bytes);
+    assert(used.hugepage_bytes <= used.system_bytes);
+
+    for (const auto ptr : ptrs) {
+        tnc_free(ptr);
+    }
+    assert(tnc_get_huge_page_stats().hugepage_used_bytes == before.hugepage_used_bytes);
+
+    // 完全空闲的大页区域整体归还
+    tnc_release_memory();
+    assert(tnc_get_huge_page_stats().region_release_count > before.region_release_count);
+    tnc_set_huge_page_mode(HugePageMode::none);
+}
+
+void test_stats() {
+    std::cout << "\n[Test] stats\n";
+
+    // 加固模式的块大小包括尾部金丝雀， 隔离区中的内存块仍然算作使用中
+    namespace details = hnc::core::mem_pool::details;
+    const size_t index = details::Index(48 + details::constant::CANARY_BYTES);
+    constexpr size_t quarantined = details::constant::HARDENED ? details::hardened::QUARANTINE_COUNT : 0;
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 1000; ++i) {
+        ptrs.push_back(tnc_malloc(48));
+    }
+    void* large = tnc_malloc(1 << 20);
+
+    const MallocStats stats = tnc_get_stats();
+    assert(stats.size_classes[index].block_size == details::RoundUp(48 + details::constant::CANARY_BYTES));
+    assert(stats.size_classes[index].in_use_blocks >= 1000);
+    assert(stats.size_classes[index].span_count > 0);
+    assert(stats.large_in_use_bytes >= 1 << 20);
+    assert(stats.system_bytes > 0 && stats.brk_bytes == 0);
+    assert(stats.fragmentation >= 0.0 && stats.fragmentation < 1.0);
+    assert(stats.span_pool_in_use > 0 && stats.span_pool_bytes > 0);
+    assert(stats.thread_cache_count > 0);
+    assert(stats.thread_cache_counters.alloc_count >= 1000);
+
+    for (const auto ptr : ptrs) {
+        tnc_free(ptr);
+    }
+    tnc_free(large);
+    const MallocStats after = tnc_get_stats();
+    assert(after.size_classes[index].in_use_blocks + 1000 <= stats.size_classes[index].in_use_blocks + quarantined);
+    assert(after.thread_cache_counters.free_count >= stats.thread_cache_counters.free_count + 1000);
+
+    // JSON输出
+    char* buffer = nullptr;
+    size_t length = 0;
+    FILE* out = open_memstream(&buffer, &length);
+    tnc_print_stats(out);
+    fclose(out);
+    assert(buffer[0] == '{' && strstr(buffer, "\"size_classes\"") != nullptr);
+    free(buffer);
+}
+
+void test_heap_profiler() {
+    std::cout << "\n[Test] heap profiler\n";
+
+    auto& profiler = hnc::core::mem_pool::details::HeapProfiler::GetInstance();
+    tnc_set_heap_profile_period(4096);
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 2000; ++i) {
+        ptrs.push_back(tnc_malloc(1000));
+    }
+    ptrs.push_back(tnc_malloc(1 << 20));
+    // 平均每4KB采样一次， 约500个采样， 1MB的大块内存一定被采样
+    assert(profiler.live_count() > 100);
+
+    FILE* file = tmpfile();
+    assert(tnc_dump_heap_profile(fileno(file)));
+    rewind(file);
+    char line[256];
+    assert(fgets(line, sizeof(line), file) != nullptr);
+    assert(strncmp(line, "heap profile: ", 14) == 0 && strstr(line, "@ heap_v2/4096") != nullptr);
+    bool has_maps = false;
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        has_maps = has_maps || strncmp(line, "MAPPED_LIBRARIES:", 17) == 0;
+    }
+    assert(has_maps);
+    fclose(file);
+
+    // 两种释放接口都会从采样表中删除
+    tnc_free(ptrs.back());
+    ptrs.pop_back();
+    for (size_t i = 0; i < ptrs.size(); ++i) {
+        if (i % 2 == 0) {
+            tnc_free(ptrs[i]);
+        } else {
+            tnc_free_sized(ptrs[i], 1000);
+        }
+    }
+    assert(profiler.live_count() == 0);
+    tnc_set_heap_profile_period(0);
+}
+
+void test_thread_exit_recycle() {
+    std::cout << "\n[Test] thread exit recycle thread cache\n";
+
+    // 线程不断创建退出， 每个线程退出时tc中缓存的内存块归还cc，tc本身也被复用
+    for (int round = 0; round < 50; ++round) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; ++t) {
+            threads.emplace_back([] {
+                std::vector<void*> ptrs;
+                for (size_t i = 1; i <= 500; ++i) {
+                    ptrs.push_back(tnc_malloc(i * 16));
+                }
+                for (const auto ptr : ptrs) {
+                    tnc_free(ptr);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+}
+void test_release_memory() {
+    std::cout << "\n[Test] release memory to os\n";
+
+    // pc中的大块内存释放后仍然驻留， 主动归还后变为已归还
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 64; ++i) {
+        ptrs.push_back(tnc_malloc(300 * 1024));
+        memset(ptrs.back(), 1, 300 * 1024);
+    }
+    for (const auto ptr : ptrs) {
+        tnc_free(ptr);
+    }
+    const ReleaseStats before = tnc_get_release_stats();
+    assert(before.free_bytes >= 64 * 300 * 1024);
+
+    const size_t released = tnc_release_memory();
+    const ReleaseStats after = tnc_get_release_stats();
+    assert(released >= 64 * 300 * 1024);
+    assert(after.free_bytes == 0);
+    assert(after.release_count > before.release_count);
+    // 传输缓存中的内存块先归还， 空出的span可能与已归还的span合并后再一起归还
+    assert(after.released_bytes >= before.released_bytes + before.free_bytes);
+
+    // 后台回收线程按照空闲时间和预算归还
+    ReleaseConfig config = tnc_get_release_config();
+    config.release_age_ms = 0;
+    config.retain_bytes = 0;
+    config.interval_ms = 10;
+    tnc_set_release_config(config);
+    tnc_start_scavenger();
+
+    ptrs.clear();
+    for (int i = 0; i < 16; ++i) {
+        ptrs.push_back(tnc_malloc(300 * 1024));
+        memset(ptrs.back(), 1, 300 * 1024);
+    }
+    for (const auto ptr : ptrs) {
+        tnc_free(ptr);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    assert(tnc_get_release_stats().free_bytes == 0);
+    tnc_stop_scavenger();
+}
+
+void test_alloc_trace() {
+    std::cout << "\n[Test] alloc trace\n";
+    using hnc::core::mem_pool::details::TraceRecord;
+    using hnc::core::mem_pool::details::TraceFileHeader;
+    using hnc::core::mem_pool::details::TraceOp;
+    using hnc::core::mem_pool::details::TRACE_MAGIC;
+    using hnc::core::mem_pool::details::TRACE_VERSION;
+
+    const char* path = "mem_pool/trace.bin";
+    assert(tnc_start_trace(path));
+    assert(!tnc_start_trace(path));
+    // 主线程申请， 另一个线程释放， 超过一个线程缓冲区的记录数
+    std::vector<void*> ptrs;
+    for (size_t i = 0; i < 10000; ++i) {
+        ptrs.push_back(tnc_malloc(i % 1000 + 1));
+    }
+    std::thread([&ptrs] {
+        for (const auto ptr : ptrs) {
+            tnc_free(ptr);
+        }
+    }).join();
+    tnc_free(tnc_malloc(1 << 20));
+    void* batch[16];
+    tnc_malloc_batch(64, 16, batch);
+    tnc_free_batch(batch, 16, 64);
+    // mremap 扩大时通常会移动地址
+    void* big = tnc_malloc(1 << 20);
+    void* moved = tnc_realloc(big, 64 << 20);
+    tnc_free(moved);
+    const size_t realloc_records = moved != big ? 4 : 2;
+    tnc_stop_trace();
+    // 停止后不再记录
+    tnc_free(tnc_malloc(8));
+
+    FILE* file = fopen(path, "rb");
+    assert(file != nullptr);
+    TraceFileHeader header{};
+    assert(fread(&header, sizeof(header), 1, file) == 1);
+    assert(memcmp(header._magic, TRACE_MAGIC, sizeof(header._magic)) == 0);
+    assert(header._version == TRACE_VERSION && header._record_size == sizeof(TraceRecord));
+    std::vector<TraceRecord> records(20100);
+    records.resize(fread(records.data(), sizeof(TraceRecord), records.size(), file));
+    fclose(file);
+    assert(records.size() == 2 * (10000 + 1 + 16) + realloc_records);
+
+    // 同一线程的记录按时间顺序写出， 申请和释放来自两个线程
+    size_t malloc_count = 0;
+    uint16_t malloc_thread = 0;
+    uint16_t free_thread = 0;
+    std::map<uint16_t, uint64_t> last_time;
+    for (const auto& record : records) {
+        const bool is_malloc = record._op == static_cast<uint8_t>(TraceOp::malloc);
+        assert(record._time_ns >= last_time[record._thread]);
+        last_time[record._thread] = record._time_ns;
+        if (is_malloc) {
+            if (malloc_count < 10000) {
+                assert(record._ptr == reinterpret_cast<uintptr_t>(ptrs[malloc_count]) && record._size == malloc_count % 1000 + 1);
+                malloc_thread = record._thread;
+            }
+            ++malloc_count;
+        } else if (free_thread == 0) {
+            free_thread = record._thread;
+        }
+    }
+    assert(malloc_count == 10000 + 1 + 16 + realloc_records / 2);
+
+    // 按时间回放时每次释放的地址都是存活的
+    std::stable_sort(records.begin(), records.end(), [](const TraceRecord& a, const TraceRecord& b) {
+        return a._time_ns < b._time_ns;
+    });
+    std::set<uint64_t> live;
+    for (const auto& record : records) {
+        if (record._op == static_cast<uint8_t>(TraceOp::malloc)) {
+            assert(live.insert(record._ptr).second);
+        } else {
+            assert(live.erase(record._ptr) == 1);
+        }
+    }
+    assert(live.empty());
+    assert(malloc_thread != 0 && free_thread != 0 && malloc_thread != free_thread);
+}
 
 int main() {
     change_log_file_name("mem_pool/test_log");
 
     test_class_new_delete();
+    test_size_class();
     test_global_malloc_dealloc();
+    test_free_sized();
     test_stl_allocator();
     test_pmr_stl_malloc_dealloc();
+    test_aligned_alloc();
+    test_realloc();
+    test_batch();
+    test_arena();
+    test_object_pool();
+    test_multi_thread_malloc_free();
+    test_transfer_cache();
+    // per-cpu缓存没有所属线程， 不使用远程释放队列
+#ifndef HNC_MALLOC_PER_CPU
+    test_remote_free();
+#endif
+    test_page_arenas();
+    test_numa_nodes();
+    test_thread_cache_budget();
+#ifdef HNC_MALLOC_PER_CPU
+    test_cpu_cache();
+#endif
+#ifdef HNC_MALLOC_HARDENED
+    test_hardened();
+#endif
+    test_huge_page();
+    test_stats();
+    test_heap_profiler();
+    test_alloc_trace();
+    test_thread_exit_recycle();
+    test_release_memory();
 
     std::cout << "\n[All Tests Passed]\n";
     return 0;
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "alloc.h"
+#include "arena.h"
+#include "object_pool.h"
 #include <memory_resource> // for cpp17
 
 
@@ -10,8 +12,8 @@
  *  alloc = tc_malloc   // pt_malloc,tc_malloc,je_malloc
  *  new = ...
  *
- *  TODO: 2. 目前全局重载operator new 会导致内部使用的unordered_map 也会走 operator new 陷入死循环，
- *   后续需要替换unordered_map 或者寻找其他解决方法
+ *  2. 页号映射已经替换为基数树， 内存池内部不再调用 operator new，
+ *   需要全局替换 malloc/operator new 时使用 libhncmalloc.so (LD_PRELOAD 或直接链接)，而不是在头文件中重载
 */
 
 
@@ -44,7 +46,7 @@
  */
 // inline void operator delete(void* ptr, size_t size) noexcept {
 //     std::cout << "operator delete with size!\n";
-//     hnc::core::mem_pool::tnc_free(ptr);
+//     hnc::core::mem_pool::tnc_free_sized(ptr, size);
 // }
 
 // 普通对象 继承此类重载operator new
@@ -56,9 +58,21 @@ public:
         return hnc::core::mem_pool::tnc_malloc(size);
     }
 
-    void operator delete(void* ptr) noexcept {
+    // 只提供带大小的 operator delete， 释放时不需要查找span
+    void operator delete(void* ptr, size_t size) noexcept {
         hnc::core::logger::log_trace("operator delete !");
-        hnc::core::mem_pool::tnc_free(ptr);
+        hnc::core::mem_pool::tnc_free_sized(ptr, size);
+    }
+
+    // 超过默认对齐的子类(如 alignas(64) 的计数器)使用对齐版本
+    void* operator new(size_t size, std::align_val_t align) {
+        hnc::core::logger::log_trace("operator new aligned !");
+        return hnc::core::mem_pool::tnc_aligned_alloc(size, static_cast<size_t>(align));
+    }
+
+    void operator delete(void* ptr, size_t size, std::align_val_t align) noexcept {
+        hnc::core::logger::log_trace("operator delete aligned !");
+        hnc::core::mem_pool::tnc_free_aligned_sized(ptr, size, static_cast<size_t>(align));
     }
 };
 
@@ -70,13 +84,14 @@ struct TncAllocator {
     // 分配内存
     T* allocate(std::size_t size) {
         hnc::core::logger::log_trace("TncAllocator alloc !");
-        return static_cast<T*>(hnc::core::mem_pool::tnc_malloc(size * sizeof(T)));
+        // 小块内存只保证8字节对齐， 按元素类型的对齐申请
+        return static_cast<T*>(hnc::core::mem_pool::tnc_aligned_alloc(size * sizeof(T), alignof(T)));
     }
 
     // 释放内存
-    void deallocate(T* p, std::size_t) noexcept {
+    void deallocate(T* p, std::size_t size) noexcept {
         hnc::core::logger::log_trace("TncAllocator dealloc !");
-        hnc::core::mem_pool::tnc_free(p);
+        hnc::core::mem_pool::tnc_free_aligned_sized(p, size * sizeof(T), alignof(T));
     }
 };
 
@@ -85,15 +100,38 @@ class TncMemRe : public std::pmr::memory_resource {
 protected:
     void* do_allocate(std::size_t bytes, std::size_t alignment) override {
         hnc::core::logger::log_trace("pmr alloc !");
-        return hnc::core::mem_pool::tnc_malloc(bytes);
+        return hnc::core::mem_pool::tnc_aligned_alloc(bytes, alignment);
     }
 
-    void do_deallocate(void* p, std::size_t, std::size_t) override {
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
         hnc::core::logger::log_trace("pmr dealloc !");
-        hnc::core::mem_pool::tnc_free(p);
+        hnc::core::mem_pool::tnc_free_aligned_sized(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+/**
+ * 基于 TncArena 的pmr内存资源， 代替 TncMemRe 用于生命周期与请求相同的容器
+ * 释放是空操作， arena reset 或析构时整批归还
+ */
+class TncArenaRe : public std::pmr::memory_resource {
+public:
+    explicit TncArenaRe(hnc::core::mem_pool::TncArena& arena) noexcept : _m_arena(arena) {}
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return _m_arena.allocate(bytes, alignment);
     }
 
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+
     bool do_is_equal(const memory_resource& other) const noexcept override {
         return this == &other;
     }
+
+private:
+    hnc::core::mem_pool::TncArena& _m_arena;
 };
@@ -20,20 +20,36 @@ public:
      * @brief 获取固定大小线程池
      * @param name 线程池名称
      * @param thread_count 线程数
+     * @param lock_free_queue 是否使用无锁任务队列
      * @return std::shared_ptr<HncThreadPool>
      */
-    static std::shared_ptr<details::HncThreadPool> get_fixed_pool(const std::string& name, const size_t thread_count = details::constant::INIT_THREAD_SIZE) {
-        return m_get_pool(name, details::TPoolMode::FIXED, thread_count);
+    static std::shared_ptr<details::HncThreadPool> get_fixed_pool(const std::string& name, const size_t thread_count = details::constant::INIT_THREAD_SIZE,
+                                                                  const bool lock_free_queue = false) {
+        return m_get_pool(name, details::TPoolMode::FIXED, thread_count, lock_free_queue);
     }
 
     /**
      * @brief 获取可变大小线程池
      * @param name 线程池名称
      * @param init_threads 初始线程数
+     * @param lock_free_queue 是否使用无锁任务队列
      * @return std::shared_ptr<HncThreadPool>
      */
-    static std::shared_ptr<details::HncThreadPool> get_cached_pool(const std::string& name, const size_t init_threads = details::constant::INIT_THREAD_SIZE) {
-        return m_get_pool(name, details::TPoolMode::CACHED, init_threads);
+    static std::shared_ptr<details::HncThreadPool> get_cached_pool(const std::string& name, const size_t init_threads = details::constant::INIT_THREAD_SIZE,
+                                                                   const bool lock_free_queue = false) {
+        return m_get_pool(name, details::TPoolMode::CACHED, init_threads, lock_free_queue);
+    }
+
+    /**
+     * @brief 获取工作窃取线程池， 适合任务内继续拆分子任务的 fork/join 计算
+     * @param name 线程池名称
+     * @param thread_count 线程数
+     * @param lock_free_queue 是否使用无锁任务队列
+     * @return std::shared_ptr<HncThreadPool>
+     */
+    static std::shared_ptr<details::HncThreadPool> get_work_stealing_pool(const std::string& name, const size_t thread_count = details::constant::INIT_THREAD_SIZE,
+                                                                          const bool lock_free_queue = false) {
+        return m_get_pool(name, details::TPoolMode::WORK_STEALING, thread_count, lock_free_queue);
     }
 
 private:
@@ -44,14 +60,17 @@ private:
      * @param name 线程池名称
      * @param mode 线程池模式（Fixed 或 Cached）
      * @param thread_count 初始线程数
+     * @param lock_free_queue 是否使用无锁任务队列
      * @return std::shared_ptr<HncThreadPool>
      */
-    static std::shared_ptr<details::HncThreadPool> m_get_pool(const std::string& name, details::TPoolMode mode, const size_t thread_count) {
+    static std::shared_ptr<details::HncThreadPool> m_get_pool(const std::string& name, details::TPoolMode mode, const size_t thread_count,
+                                                              const bool lock_free_queue) {
         std::lock_guard<std::mutex> lock(m_mtx_);
         const auto it = m_thread_pools_.find(name);
         if (!m_thread_pools_.contains(name)) {
             // 第一次创建新的线程池
             auto pool = std::make_shared<details::HncThreadPool>(mode, thread_count);
+            pool->set_lock_free_queue(lock_free_queue);
             pool->start();
             //thread_pools_[name] = pool;
             return pool;
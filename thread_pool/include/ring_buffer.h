@@ -3,63 +3,113 @@
 #include <functional>
 #include <atomic>
 #include <optional>
-#include <iostream>
+#include <stdexcept>
 
+namespace hnc::core::thread_pool::details {
 
+/**
+ * @brief 有界多生产者多消费者无锁环形队列 (Vyukov)
+ *
+ * 1. 每个槽位有一个序号: 等于入队位置时可以写入， 等于入队位置 + 1 时可以读出， 读出后加上容量留给下一轮
+ * 2. 生产者/消费者各自只 CAS 竞争自己的位置计数器， 抢到位置后独占该槽位， 不需要加锁
+ * 3. 生产者抢到位置但还没有写完时， 消费者看到的是空队列， 稍后重试即可
+ */
 class LockFreeRingQueue {
 public:
     explicit LockFreeRingQueue(size_t size) : size_(size), mask_(size - 1), buffer_(size), head_(0), tail_(0) {
-        if ((size & (size - 1)) != 0) {
+        if (size == 0 || (size & (size - 1)) != 0) {
             throw std::runtime_error("Queue size must be power of 2");
         }
+        for (size_t i = 0; i < size; ++i) {
+            buffer_[i].sequence.store(i, std::memory_order_relaxed);
+        }
     }
 
     // 禁止拷贝
     LockFreeRingQueue(const LockFreeRingQueue&) = delete;
     LockFreeRingQueue& operator=(const LockFreeRingQueue&) = delete;
 
-    // 插入任务（无锁）
-    bool push(std::function<void()> task) {
-        uint32_t tail = tail_.load(std::memory_order_relaxed);
-        uint32_t next_tail = (tail + 1) & mask_;
-
-        if (next_tail == head_.load(std::memory_order_acquire)) {
-            return false; // 队列满
+    // 插入任务（无锁）， 队列满时返回false， 任务保持不变
+    bool push(std::function<void()>&& task) {
+        Slot* slot;
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            slot = &buffer_[tail & mask_];
+            const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(tail);
+            if (diff == 0) {
+                // 槽位空闲， 抢占入队位置
+                if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // 队列满: 槽位还没有被上一轮的消费者读走
+            } else {
+                tail = tail_.load(std::memory_order_relaxed);
+            }
         }
-
-        buffer_[tail] = std::move(task);
-        tail_.store(next_tail, std::memory_order_release);
+        slot->task = std::move(task);
+        slot->sequence.store(tail + 1, std::memory_order_release);
         return true;
     }
 
     // 获取任务（无锁）
     std::optional<std::function<void()>> pop() {
-        uint32_t head = head_.load(std::memory_order_relaxed);
-
-        if (head == tail_.load(std::memory_order_acquire)) {
-            return std::nullopt; // 队列空
+        Slot* slot;
+        size_t head = head_.load(std::memory_order_relaxed);
+        while (true) {
+            slot = &buffer_[head & mask_];
+            const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(head + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return std::nullopt; // 队列空
+            } else {
+                head = head_.load(std::memory_order_relaxed);
+            }
         }
-
-        std::function<void()> task = std::move(buffer_[head]);
-        head_.store((head + 1) & mask_, std::memory_order_release);
+        std::function<void()> task = std::move(slot->task);
+        slot->task = nullptr;
+        slot->sequence.store(head + size_, std::memory_order_release);
         return task;
     }
 
+    // 估计的任务数， 并发修改时只作为提示
+    size_t size() const {
+        const size_t tail = tail_.load(std::memory_order_acquire);
+        const size_t head = head_.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
     // 判断队列是否为空
     bool empty() const {
-        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+        return size() == 0;
     }
 
     // 判断队列是否已满
     bool full() const {
-        return ((tail_.load(std::memory_order_acquire) + 1) & mask_) == head_.load(std::memory_order_acquire);
+        return size() >= size_;
+    }
+
+    size_t capacity() const {
+        return size_;
     }
 
 private:
+    struct alignas(64) Slot {
+        std::atomic<size_t> sequence{0};
+        std::function<void()> task;
+    };
+
     const size_t size_;              // 队列大小
-    const uint32_t mask_;            // 用于计算索引 `(index & mask_)`
-    std::vector<std::function<void()>> buffer_;  // 任务存储
+    const size_t mask_;              // 用于计算索引 `(index & mask_)`
+    std::vector<Slot> buffer_;       // 任务存储
 
-    alignas(64) std::atomic<uint32_t> head_; // 头指针
-    alignas(64) std::atomic<uint32_t> tail_; // 尾指针
+    alignas(64) std::atomic<size_t> head_; // 出队位置
+    alignas(64) std::atomic<size_t> tail_; // 入队位置
 };
+
+}
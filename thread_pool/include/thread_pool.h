@@ -9,11 +9,14 @@
 #include <condition_variable>
 #include <future>
 #include <iostream>
+#include <vector>
 
 #include "hnc_thread.h"
 #include "tp_common.h"
 #include "hnc_log.h"
 #include "hnc_task.h"
+#include "work_stealing_deque.h"
+#include "ring_buffer.h"
 
 namespace hnc::core::thread_pool::details {
 
@@ -38,6 +41,23 @@ public:
           std::bind(std::forward<Func>(func), std::forward<Args>(args)...));
         std::future<ResultType> result = task_ptr->get_future();
 
+        // 工作窃取模式下由线程池中的线程提交的任务直接放入该线程的本地队列， 不需要加锁
+        if (m_mode_ == TPoolMode::WORK_STEALING && m_push_local([task_ptr] { (*task_ptr)(); })) {
+            return result;
+        }
+
+        // 无锁队列模式: 提交不需要加锁， 队列满时最多等待1秒
+        if (m_ring_ != nullptr) {
+            if (!m_push_ring([task_ptr] { (*task_ptr)(); })) {
+                std::cerr << "task queue is full, submit task fail\n";
+                logger::log_debug("task queue is full, submit task fail");
+                auto emptyTask = std::make_shared<std::packaged_task<ResultType()>>(
+                  []() -> ResultType { return ResultType(); });
+                return emptyTask->get_future();
+            }
+            return result;
+        }
+
         // RAII
         std::unique_lock<std::mutex> locker(m_task_mtx_);
 
@@ -91,6 +111,24 @@ public:
         using ResultType = decltype(task());
         auto task_ptr = std::make_shared<std::packaged_task<ResultType()>>(std::move(task));
         std::future<ResultType> result = task_ptr->get_future();
+
+        // 工作窃取模式下由线程池中的线程提交的任务直接放入该线程的本地队列， 不需要加锁
+        if (m_mode_ == TPoolMode::WORK_STEALING && m_push_local([task_ptr] { (*task_ptr)(); })) {
+            return result;
+        }
+
+        // 无锁队列模式: 提交不需要加锁， 队列满时最多等待1秒
+        if (m_ring_ != nullptr) {
+            if (!m_push_ring([task_ptr] { (*task_ptr)(); })) {
+                std::cerr << "task queue is full, submit task fail\n";
+                logger::log_debug("task queue is full, submit task fail");
+                auto emptyTask = std::make_shared<std::packaged_task<ResultType()>>(
+                  []() -> ResultType { return ResultType(); });
+                return emptyTask->get_future();
+            }
+            return result;
+        }
+
         // RAII
         std::unique_lock<std::mutex> locker(m_task_mtx_);
 
@@ -133,6 +171,29 @@ public:
         return result;
     }
 
+    /**
+     * @brief 工作窃取模式下， 在任务内等待子任务的结果， 等待期间执行其他等待中的任务，
+     *        避免所有线程都阻塞在等待上； 不是线程池中的线程调用时直接等待
+     */
+    template <typename T>
+    T wait_task(std::future<T>& future) {
+        if (!m_is_worker()) {
+            return future.get();
+        }
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (!run_pending_task()) {
+                std::this_thread::yield();
+            }
+        }
+        return future.get();
+    }
+
+    /**
+     * @brief 工作窃取模式下在线程池中的线程上执行一个等待中的任务
+     * @return 没有取到任务或者不是线程池中的线程则返回false
+     */
+    bool run_pending_task() noexcept;
+
     /**
      * @brief 判断是否为固定线程数线程池
      */
@@ -150,6 +211,13 @@ public:
      */
     bool set_task_thresh_hold(size_t task_thresh_hold) noexcept;
 
+    /**
+     * @brief 使用无锁环形队列代替 m_task_que_ + m_task_mtx_， 容量为任务上限向上取整到2的幂，
+     *        空闲线程自旋一段时间后在 futex 上睡眠， 需要在启动和提交任务之前调用
+     * @return 线程池已启动则返回false
+     */
+    bool set_lock_free_queue(bool enable);
+
 private:
 
     // 禁止线程池拷贝构造和赋值
@@ -184,6 +252,62 @@ private:
      */
     void m_get_task(std::function<void()> &task) noexcept;
 
+    /**
+     * @brief 提供给线程运行的 工作窃取函数
+     * @param index 线程对应的本地队列下标
+     */
+    void m_stealing_func(int threadId, size_t index) noexcept;
+
+    /**
+     * @brief 当前线程是否为本线程池的工作窃取线程
+     */
+    bool m_is_worker() const noexcept;
+
+    /**
+     * @brief 当前线程是本线程池的线程时， 将任务放入它的本地队列
+     * @return 不是本线程池的线程返回false， 由调用方放入全局队列
+     */
+    bool m_push_local(std::function<void()>&& task);
+
+    /**
+     * @brief 依次尝试 本地队列 -> 全局队列 -> 随机窃取其他线程的队列
+     */
+    bool m_find_task(size_t index, std::function<void()>& task) noexcept;
+
+    /**
+     * @brief 提供给线程运行的 无锁队列模式的固定/可变线程数函数
+     */
+    void m_lock_free_func(int threadId) noexcept;
+
+    /**
+     * @brief 放入无锁队列， 有睡眠线程时唤醒一个， 可变模式下按需添加线程
+     * @return 队列满并且等待1秒后仍然满时返回false
+     */
+    bool m_push_ring(std::function<void()>&& task);
+
+    /**
+     * @brief 无锁队列模式下登记为睡眠线程， 确认没有任务后在 m_wake_seq_ 上睡眠
+     * @param stealing 是否为工作窃取线程， 决定检查哪些队列
+     * @param timeout_ms 睡眠超时， 0 表示一直等待
+     * @return 超时返回false
+     */
+    bool m_park(bool stealing, long timeout_ms) noexcept;
+
+    /**
+     * @brief 无锁队列模式下唤醒一个睡眠线程
+     */
+    void m_wake_one() noexcept;
+
+    /**
+     * @brief 全局队列中的任务数
+     */
+    size_t m_pending_size() const noexcept;
+
+    /**
+     * @brief 全局队列或者任意本地队列中是否有任务， 睡眠前在 m_task_mtx_ 内检查
+     */
+    bool m_has_stealing_task() const noexcept;
+
 
 
 private:
@@ -209,5 +333,18 @@ private:
     std::atomic_bool m_running_;// 线程运行状态
 
     std::condition_variable m_cond_exit_;// 析构时使用
+
+    // 工作窃取模式下每个线程的状态
+    struct Worker {
+        WorkStealingDeque<std::function<void()>*> m_deque_{constant::LOCAL_DEQUE_CAPACITY}; // 本地队列
+        uint64_t m_rand_{0}; // 随机选择窃取对象
+    };
+    std::vector<std::unique_ptr<Worker>> m_workers_; // 启动后不再修改
+    std::atomic_uint m_sleeping_{0}; // 睡眠的线程数: 工作窃取线程， 或者无锁队列模式下的所有线程
+    std::atomic<size_t> m_steal_count_{0}; // 累计窃取成功次数
+
+    // 无锁队列模式， 为空时使用 m_task_que_ + m_task_mtx_
+    std::unique_ptr<LockFreeRingQueue> m_ring_;
+    std::atomic<uint32_t> m_wake_seq_{0}; // 睡眠线程等待的 futex 字， 唤醒时递增
 };
 }
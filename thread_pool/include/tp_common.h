@@ -3,10 +3,11 @@
 #include <atomic>
 
 namespace hnc::core::thread_pool::details {
-// 线程池可选择固定数量线程的模式，或 可变模式
+// 线程池可选择固定数量线程的模式，或 可变模式， 或 工作窃取模式(固定线程数， 每个线程有自己的任务队列)
 enum class TPoolMode {
     FIXED,
     CACHED,
+    WORK_STEALING,
 };
 
 namespace constant {
@@ -14,6 +15,9 @@ constexpr size_t INIT_THREAD_SIZE = 4; // 线程池启动时初始线程数
 constexpr size_t THREAD_HOLD_THREAD_SIZE = 10; // 最大可存在线程数 通常可以设为CPU核心线程数少一点点
 constexpr size_t THRESH_HOLD_TASK_SIZE = 1024; // 任务队列最大任务数量
 constexpr size_t THREAD_IDLE_TIME = 8; // 可变模式下空闲线程多久回收自己
+constexpr size_t LOCAL_DEQUE_CAPACITY = 256; // 工作窃取模式下每个线程本地队列的初始容量(2的幂)， 满时自动扩容
+constexpr size_t STEAL_ROUNDS = 64; // 工作窃取模式下空闲线程睡眠前尝试窃取的轮数
+constexpr size_t SPIN_ROUNDS = 64; // 无锁队列模式下空闲线程睡眠前自旋出队的轮数
 }
 
 }
\ No newline at end of file
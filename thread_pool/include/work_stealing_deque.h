@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace hnc::core::thread_pool::details {
+
+/**
+ * @brief Chase-Lev 工作窃取双端队列 (Lê 等人的 C11 内存模型版本)
+ *
+ * 1. 所属线程在底部 push/pop， 后进先出， 刚拆分出的子任务还在缓存中
+ * 2. 其他线程在顶部 steal， 先进先出， 偷走的是最早拆分出的较大的任务
+ * 3. 只有队列中剩最后一个元素时 pop 和 steal 才需要 CAS 竞争 top
+ * 4. 数组满时由所属线程扩容为两倍， 旧数组可能还在被窃取线程读取， 保留到队列析构
+ *
+ * @tparam T 可以原子读写的类型， 通常是任务指针
+ */
+template <typename T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(const size_t capacity = 256)
+        : m_top_(0), m_bottom_(0) {
+        auto array = std::make_unique<Array>(capacity);
+        m_array_.store(array.get(), std::memory_order_relaxed);
+        m_arrays_.push_back(std::move(array));
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    /**
+     * @brief 所属线程在底部压入
+     */
+    void push(T value) {
+        const int64_t bottom = m_bottom_.load(std::memory_order_relaxed);
+        const int64_t top = m_top_.load(std::memory_order_acquire);
+        Array* array = m_array_.load(std::memory_order_relaxed);
+        if (bottom - top > static_cast<int64_t>(array->m_mask_)) {
+            array = m_grow(array, bottom, top);
+        }
+        array->put(bottom, value);
+        // release: 窃取线程读到新的 bottom 时一定能看到写入的元素
+        m_bottom_.store(bottom + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief 所属线程从底部弹出
+     */
+    std::optional<T> pop() {
+        const int64_t bottom = m_bottom_.load(std::memory_order_relaxed) - 1;
+        Array* array = m_array_.load(std::memory_order_relaxed);
+        m_bottom_.store(bottom, std::memory_order_relaxed);
+        // 先声明要取走 bottom， 再读取 top， 与 steal 中的读取顺序相反， 必须是全序
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = m_top_.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            // 队列为空
+            m_bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        std::optional<T> value = array->get(bottom);
+        if (top == bottom) {
+            // 最后一个元素， 与窃取线程竞争
+            if (!m_top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                value = std::nullopt;
+            }
+            m_bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return value;
+    }
+
+    /**
+     * @brief 其他线程从顶部窃取， 与其他窃取线程或所属线程竞争失败时返回空
+     */
+    std::optional<T> steal() {
+        int64_t top = m_top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = m_bottom_.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return std::nullopt;
+        }
+        Array* array = m_array_.load(std::memory_order_acquire);
+        T value = array->get(top);
+        if (!m_top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    /**
+     * @brief 估计的元素个数， 并发修改时只作为提示
+     */
+    size_t size() const noexcept {
+        const int64_t bottom = m_bottom_.load(std::memory_order_acquire);
+        const int64_t top = m_top_.load(std::memory_order_acquire);
+        return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+    }
+
+    bool empty() const noexcept { return size() == 0; }
+
+private:
+    // 环形数组， 容量是2的幂
+    struct Array {
+        explicit Array(const size_t capacity) : m_mask_(capacity - 1), m_slots_(capacity) {}
+
+        void put(const int64_t index, T value) noexcept {
+            m_slots_[index & m_mask_].store(value, std::memory_order_relaxed);
+        }
+        T get(const int64_t index) const noexcept {
+            return m_slots_[index & m_mask_].load(std::memory_order_relaxed);
+        }
+
+        const size_t m_mask_;
+        std::vector<std::atomic<T>> m_slots_;
+    };
+
+    /**
+     * @brief 扩容为两倍， 只由所属线程调用
+     */
+    Array* m_grow(Array* old_array, const int64_t bottom, const int64_t top) {
+        auto array = std::make_unique<Array>((old_array->m_mask_ + 1) * 2);
+        for (int64_t i = top; i < bottom; ++i) {
+            array->put(i, old_array->get(i));
+        }
+        Array* result = array.get();
+        m_arrays_.push_back(std::move(array));
+        m_array_.store(result, std::memory_order_release);
+        return result;
+    }
+
+    alignas(64) std::atomic<int64_t> m_top_; // 窃取端
+    alignas(64) std::atomic<int64_t> m_bottom_; // 所属线程端
+    std::atomic<Array*> m_array_;
+    std::vector<std::unique_ptr<Array>> m_arrays_; // 当前和扩容前的所有数组， 只由所属线程修改
+};
+
+}
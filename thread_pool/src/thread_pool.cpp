@@ -2,10 +2,43 @@
 
 #include <hnc_thread.h>
 
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <climits>
 #include <ranges>
+#include <thread>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace hnc::core::thread_pool::details {
 
+namespace {
+// 工作窃取模式下当前线程所属的线程池和本地队列下标， 不是线程池中的线程时 pool 为空
+struct StealingContext {
+    const HncThreadPool* pool{nullptr};
+    size_t index{0};
+};
+thread_local StealingContext tls_stealing_;
+
+/**
+ * 无锁队列模式的睡眠与唤醒直接使用 futex: 可变模式需要带超时的等待来回收空闲线程， std::atomic::wait 不支持超时
+ * @return 超时返回false， 被唤醒、值已经改变或者被信号中断返回true
+ */
+bool FutexWait(std::atomic<uint32_t>& word, const uint32_t expected, const long timeout_ms) noexcept {
+    timespec timeout{timeout_ms / 1000, (timeout_ms % 1000) * 1000000};
+    const long ret = syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected,
+                             timeout_ms > 0 ? &timeout : nullptr, nullptr, 0);
+    return ret == 0 || errno != ETIMEDOUT;
+}
+
+void FutexWake(std::atomic<uint32_t>& word, const int count) noexcept {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+}
+
 HncThreadPool::HncThreadPool(const TPoolMode mode, const uint8_t init_thread_size)
     : m_init_size_(init_thread_size)
     , m_cur_size_(init_thread_size)
@@ -20,6 +53,11 @@ HncThreadPool::HncThreadPool(const TPoolMode mode, const uint8_t init_thread_siz
 
 HncThreadPool::~HncThreadPool() {
     m_running_.store(false, std::memory_order_release);
+    if (m_ring_ != nullptr) {
+        // 在读到新值之前睡眠的线程被唤醒， 之后的线程一定能看到线程池已经停止
+        m_wake_seq_.fetch_add(1, std::memory_order_release);
+        FutexWake(m_wake_seq_, INT_MAX);
+    }
 
     // 析构时要等待所有线程都析构在退出
     std::unique_lock<std::mutex> locker(m_task_mtx_);
@@ -32,9 +70,18 @@ HncThreadPool::~HncThreadPool() {
  * @brief 启动线程池
  */
 void HncThreadPool::start() noexcept {
-    for (size_t i = 0; i < m_init_size_; ++i) {
-        auto cur_thread = std::make_unique<HncThread>([this](const int thread_id) -> void {
-            if (this->is_fixed()) this->m_fixed_func(thread_id);
+    const auto init_size = static_cast<size_t>(m_init_size_);
+    if (m_mode_ == TPoolMode::WORK_STEALING) {
+        // 本地队列在线程启动前全部创建好， 之后窃取时不需要加锁访问列表
+        for (size_t i = 0; i < init_size; ++i) {
+            m_workers_.push_back(std::make_unique<Worker>());
+        }
+    }
+    for (size_t i = 0; i < init_size; ++i) {
+        auto cur_thread = std::make_unique<HncThread>([this, i](const int thread_id) -> void {
+            if (this->m_mode_ == TPoolMode::WORK_STEALING) this->m_stealing_func(thread_id, i);
+            else if (this->m_ring_ != nullptr) this->m_lock_free_func(thread_id);
+            else if (this->is_fixed()) this->m_fixed_func(thread_id);
             else this->m_cached_func(thread_id);
         });
         auto cur_tid = cur_thread->get_thread_id();
@@ -66,12 +113,21 @@ bool HncThreadPool::is_fixed() const noexcept {
 void HncThreadPool::print_status() const noexcept {
     if (is_fixed()) {
         std::cout << " init_thead : " << m_init_size_
-        << "\n task_size : " << m_task_size_ << '/' << m_thresh_hold_task_size_ << '\n';
+        << "\n task_size : " << m_pending_size() << '/' << m_thresh_hold_task_size_ << '\n';
+    } else if (m_mode_ == TPoolMode::WORK_STEALING) {
+        size_t local_size = 0;
+        for (const auto& worker : m_workers_) {
+            local_size += worker->m_deque_.size();
+        }
+        std::cout << " init_thead : " << m_init_size_
+        << "\n task_size : " << m_pending_size() << '/' << m_thresh_hold_task_size_
+        << "\n local_task_size : " << local_size
+        << "\n steal_count : " << m_steal_count_ << '\n';
     } else {
         std::cout << " init_thead : " << m_init_size_ << '/' << m_thresh_hold_thread_size_
            << "\n cur_thread : " << m_cur_size_ << '/' << m_thresh_hold_thread_size_
            << "\n idle_thread : " << m_idle_size_ << '/' << m_thresh_hold_thread_size_
-           << "\n task_size : " << m_task_size_ << '/' << m_thresh_hold_task_size_ << '\n';
+           << "\n task_size : " << m_pending_size() << '/' << m_thresh_hold_task_size_ << '\n';
     }
 }
 
@@ -83,6 +139,18 @@ void HncThreadPool::print_status() const noexcept {
 bool HncThreadPool::set_task_thresh_hold(const size_t task_thresh_hold) noexcept {
     if (m_check_running()) return false;
     m_thresh_hold_task_size_ = task_thresh_hold;
+    if (m_ring_ != nullptr) {
+        set_lock_free_queue(true);
+    }
+    return true;
+}
+
+/**
+ * @brief 使用无锁环形队列代替 m_task_que_ + m_task_mtx_
+ */
+bool HncThreadPool::set_lock_free_queue(const bool enable) {
+    if (m_check_running()) return false;
+    m_ring_ = enable ? std::make_unique<LockFreeRingQueue>(std::bit_ceil(std::max<size_t>(m_thresh_hold_task_size_, 2))) : nullptr;
     return true;
 }
 
@@ -196,5 +264,254 @@ void HncThreadPool::m_get_task(std::function<void()>& task) noexcept
     }
 }
 
+/**
+ * @brief 工作窃取模式的线程函数
+ * 1. 先找任务: 本地队列(后进先出) -> 全局队列 -> 随机窃取其他线程的本地队列(先进先出)
+ * 2. 连续 STEAL_ROUNDS 轮都没有找到任务后， 在 m_task_mtx_ 内登记为睡眠线程， 确认没有任务后等待 m_cond_not_empty_
+ * 3. 外部提交的任务在 m_task_mtx_ 内放入全局队列并通知； 本地队列不加锁， 压入后有睡眠线程时才加锁通知
+ */
+void HncThreadPool::m_stealing_func(const int tid, const size_t index) noexcept {
+    tls_stealing_ = {this, index};
+    m_workers_[index]->m_rand_ = (index + 1) * 0x9E3779B97F4A7C15ull;
+    while (true) {
+        std::function<void()> task;
+        bool found = false;
+        for (size_t round = 0; round < constant::STEAL_ROUNDS && !found; ++round) {
+            found = m_find_task(index, task);
+            if (!found) std::this_thread::yield();
+        }
+        if (found) {
+            task();
+            continue;
+        }
+
+        if (m_ring_ != nullptr) {
+            if (!m_check_running() && !m_has_stealing_task()) {
+                std::unique_lock<std::mutex> locker(m_task_mtx_);
+                tls_stealing_ = {};
+                m_is_exit(tid);
+                return;
+            }
+            m_park(true, 0);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> locker(m_task_mtx_);
+        // 与 m_push_local 中的 压入 + 读取 m_sleeping_ 相对: 先登记再检查队列， 两边至少有一边能看到对方
+        m_sleeping_.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!m_has_stealing_task()) {
+            // 唤醒后查看是否需要退出线程池
+            if (!m_check_running()) {
+                m_sleeping_.fetch_sub(1, std::memory_order_relaxed);
+                tls_stealing_ = {};
+                m_is_exit(tid);
+                return;
+            }
+            m_cond_not_empty_.wait(locker);
+        }
+        m_sleeping_.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+bool HncThreadPool::m_is_worker() const noexcept {
+    return tls_stealing_.pool == this;
+}
+
+bool HncThreadPool::m_push_local(std::function<void()>&& task) {
+    if (!m_is_worker()) {
+        return false;
+    }
+    m_workers_[tls_stealing_.index]->m_deque_.push(new std::function<void()>(std::move(task)));
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping_.load(std::memory_order_acquire) > 0) {
+        if (m_ring_ != nullptr) {
+            m_wake_one();
+        } else {
+            // 睡眠线程从登记到等待一直持有锁， 加锁后通知不会丢失
+            std::lock_guard<std::mutex> locker(m_task_mtx_);
+            m_cond_not_empty_.notify_one();
+        }
+    }
+    return true;
+}
+
+bool HncThreadPool::m_find_task(const size_t index, std::function<void()>& task) noexcept {
+    Worker& self = *m_workers_[index];
+    if (const auto local = self.m_deque_.pop()) {
+        task = std::move(**local);
+        delete *local;
+        return true;
+    }
+
+    // 全局队列， 先不加锁地检查一次
+    if (m_ring_ != nullptr) {
+        if (auto global = m_ring_->pop()) {
+            task = std::move(*global);
+            return true;
+        }
+    } else if (m_task_size_.load(std::memory_order_acquire) > 0) {
+        std::unique_lock<std::mutex> locker(m_task_mtx_);
+        if (m_task_size_.load(std::memory_order_acquire) > 0) {
+            task = std::move(m_task_que_.front());
+            m_task_que_.pop();
+            m_task_size_.fetch_sub(1, std::memory_order_release);
+            m_cond_not_full_.notify_one();
+            return true;
+        }
+    }
+
+    // 从随机位置开始依次窃取其他线程的本地队列
+    const size_t count = m_workers_.size();
+    uint64_t x = self.m_rand_;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    self.m_rand_ = x;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t victim = (x + i) % count;
+        if (victim == index) continue;
+        if (const auto stolen = m_workers_[victim]->m_deque_.steal()) {
+            m_steal_count_.fetch_add(1, std::memory_order_relaxed);
+            task = std::move(**stolen);
+            delete *stolen;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HncThreadPool::m_has_stealing_task() const noexcept {
+    if (m_pending_size() > 0) {
+        return true;
+    }
+    return std::ranges::any_of(m_workers_, [](const auto& worker) { return !worker->m_deque_.empty(); });
+}
+
+/**
+ * @brief 工作窃取模式下在线程池中的线程上执行一个等待中的任务
+ */
+bool HncThreadPool::run_pending_task() noexcept {
+    if (!m_is_worker()) {
+        return false;
+    }
+    std::function<void()> task;
+    if (!m_find_task(tls_stealing_.index, task)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+
+/**
+ * @brief 无锁队列模式的固定/可变线程数函数
+ * 1. 先自旋 SPIN_ROUNDS 轮尝试出队， 仍然没有任务时在 m_wake_seq_ 上睡眠
+ * 2. 可变模式下每次最多睡眠1秒， 空闲超过 THREAD_IDLE_TIME 并且线程数多于初始线程数时回收自己
+ * 3. 只有线程的创建和退出需要 m_task_mtx_ 保护线程列表
+ */
+void HncThreadPool::m_lock_free_func(const int tid) noexcept {
+    const bool cached = m_mode_ == TPoolMode::CACHED;
+    auto last = std::chrono::high_resolution_clock::now();
+    while (true) {
+        std::optional<std::function<void()>> task = m_ring_->pop();
+        for (size_t round = 0; round < constant::SPIN_ROUNDS && !task; ++round) {
+            std::this_thread::yield();
+            task = m_ring_->pop();
+        }
+        if (task) {
+            if (cached) m_idle_size_.fetch_sub(1, std::memory_order_release);
+            (*task)();
+            if (cached) m_idle_size_.fetch_add(1, std::memory_order_release);
+            last = std::chrono::high_resolution_clock::now();
+            continue;
+        }
+
+        // 线程池停止并且任务全部执行完后退出
+        if (!m_check_running()) {
+            if (m_ring_->empty()) {
+                std::unique_lock<std::mutex> locker(m_task_mtx_);
+                m_is_exit(tid);
+                return;
+            }
+            continue;
+        }
+
+        if (m_park(false, cached ? 1000 : 0) || !cached) {
+            continue;
+        }
+        // 可变线程模式下， 当等待任务超时时，尝试回收线程
+        const auto dur = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::high_resolution_clock::now() - last);
+        if (static_cast<size_t>(dur.count()) >= constant::THREAD_IDLE_TIME) {
+            std::unique_lock<std::mutex> locker(m_task_mtx_);
+            if (m_cur_size_ > static_cast<unsigned>(m_init_size_)) {
+                m_threads_.erase(tid);
+                m_cur_size_.fetch_sub(1, std::memory_order_release);
+                m_idle_size_.fetch_sub(1, std::memory_order_release);
+                logger::log_debug("[cached]thread" + std::to_string(tid) + "-> timeout...exit!");
+                return;
+            }
+        }
+    }
+}
+
+bool HncThreadPool::m_push_ring(std::function<void()>&& task) {
+    // 队列满时最多等待1秒
+    if (!m_ring_->push(std::move(task))) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (!m_ring_->push(std::move(task))) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+    }
+    // 与 m_park 中的 登记 + 检查队列 相对， 两边至少有一边能看到对方
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping_.load(std::memory_order_acquire) > 0) {
+        m_wake_one();
+    }
+
+    // cached模式：等待的任务多于空闲线程时添加新线程， 只有这里需要加锁
+    const auto thresh_hold_thread_size = static_cast<unsigned>(m_thresh_hold_thread_size_);
+    if (m_mode_ == TPoolMode::CACHED && m_ring_->size() > m_idle_size_ && m_cur_size_ < thresh_hold_thread_size) {
+        std::lock_guard<std::mutex> locker(m_task_mtx_);
+        if (m_cur_size_ < thresh_hold_thread_size && m_check_running()) {
+            auto cur_thread = std::make_unique<HncThread>([this](const int thread_id) -> void {
+                this->m_lock_free_func(thread_id);
+            });
+            auto cur_tid = cur_thread->get_thread_id();
+            m_threads_.emplace(cur_tid, std::move(cur_thread));
+            m_threads_[cur_tid]->start();
+            m_cur_size_.fetch_add(1, std::memory_order_release);
+            m_idle_size_.fetch_add(1, std::memory_order_release);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 睡眠前先读取 m_wake_seq_， 之后的唤醒都会改变它的值， futex 比较失败直接返回， 唤醒不会丢失
+ */
+bool HncThreadPool::m_park(const bool stealing, const long timeout_ms) noexcept {
+    const uint32_t seq = m_wake_seq_.load(std::memory_order_acquire);
+    m_sleeping_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool woken = true;
+    if (m_check_running() && !(stealing ? m_has_stealing_task() : !m_ring_->empty())) {
+        woken = FutexWait(m_wake_seq_, seq, timeout_ms);
+    }
+    m_sleeping_.fetch_sub(1, std::memory_order_relaxed);
+    return woken;
+}
+
+void HncThreadPool::m_wake_one() noexcept {
+    m_wake_seq_.fetch_add(1, std::memory_order_release);
+    FutexWake(m_wake_seq_, 1);
+}
+
+size_t HncThreadPool::m_pending_size() const noexcept {
+    return m_ring_ != nullptr ? m_ring_->size() : m_task_size_.load(std::memory_order_acquire);
+}
 
 }
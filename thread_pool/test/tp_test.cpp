@@ -2,11 +2,14 @@
 #include <thread>
 #include <vector>
 #include <chrono>
+#include <atomic>
+#include <cassert>
 
 #include "hnc_thread_pool.h"
 
 using namespace hnc::core::logger;
 using namespace hnc::core::thread_pool;
+using hnc::core::thread_pool::details::HncThreadPool;
 
 /**
  * @brief 一个具体任务，继承 Task<MyTask>
@@ -103,6 +106,90 @@ void test_obj_task() {
 }
 
 
+// 递归拆分的求和， 子任务在任务内提交， 进入当前线程的本地队列
+long long fork_join_sum(const std::shared_ptr<HncThreadPool>& pool, const long long begin, const long long end) {
+    if (end - begin <= 1000) {
+        long long sum = 0;
+        for (long long i = begin; i < end; ++i) sum += i;
+        return sum;
+    }
+    const long long mid = begin + (end - begin) / 2;
+    auto left = pool->submit_task([&pool, begin, mid] { return fork_join_sum(pool, begin, mid); });
+    const long long right = fork_join_sum(pool, mid, end);
+    return pool->wait_task(left) + right;
+}
+
+void test_work_stealing_pool() {
+    std::cout << "======== [Test 6] work stealing 线程池 ========\n";
+    const auto pool = ThreadPoolManager::get_work_stealing_pool("Stealing_Pool(4)", 4);
+
+    // 外部提交进入全局队列
+    std::atomic<int> count{0};
+    std::vector<std::future<void>> futures;
+    for (int i = 0; i < 1000; ++i) {
+        futures.push_back(pool->submit_task([&count] { count.fetch_add(1); }));
+    }
+    for (auto& future : futures) {
+        future.get();
+    }
+    assert(count == 1000);
+
+    // fork/join: 子任务由线程池中的线程提交， 空闲线程从其他线程的本地队列窃取
+    const auto start = std::chrono::steady_clock::now();
+    auto result = pool->submit_task([&pool] { return fork_join_sum(pool, 0, 10000000); });
+    assert(result.get() == 10000000LL * 9999999 / 2);
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "fork/join sum " << ms << "ms\n";
+    pool->print_status();
+    std::cout << "======== [Test 6] over ========\n";
+}
+
+// 多个线程同时提交， 返回全部执行完的耗时
+long long submit_from_producers(const std::shared_ptr<HncThreadPool>& pool, const int producers, const int tasks_per_producer) {
+    std::atomic<int> count{0};
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&pool, &count, tasks_per_producer] {
+            std::vector<std::future<void>> futures;
+            futures.reserve(tasks_per_producer);
+            for (int i = 0; i < tasks_per_producer; ++i) {
+                futures.push_back(pool->submit_task([&count] { count.fetch_add(1, std::memory_order_relaxed); }));
+            }
+            for (auto& future : futures) {
+                future.get();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(count == producers * tasks_per_producer);
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void test_lock_free_pool() {
+    std::cout << "======== [Test 7] 无锁任务队列 ========\n";
+    constexpr int producers = 4;
+    constexpr int tasks = 10000;
+
+    const auto fixed = ThreadPoolManager::get_fixed_pool("LockFree_Fixed(4)", 4, true);
+    const auto us = submit_from_producers(fixed, producers, tasks);
+    std::cout << "fixed " << producers << " producers " << producers * tasks << " tasks: " << us << "us\n";
+
+    const auto cached = ThreadPoolManager::get_cached_pool("LockFree_Cached(2)", 2, true);
+    submit_from_producers(cached, producers, tasks);
+    cached->print_status();
+
+    // 工作窃取模式的全局队列同样可以换成无锁队列
+    const auto stealing = ThreadPoolManager::get_work_stealing_pool("LockFree_Stealing(4)", 4, true);
+    submit_from_producers(stealing, producers, tasks);
+    auto result = stealing->submit_task([&stealing] { return fork_join_sum(stealing, 0, 1000000); });
+    assert(result.get() == 1000000LL * 999999 / 2);
+    std::cout << "======== [Test 7] over ========\n";
+}
+
+
 int main() {
     change_log_file_name("thread_pool/benchmark");
 
@@ -111,6 +198,8 @@ int main() {
     test_fixed_performance();
     test_cached_performance();
     test_obj_task();
+    test_work_stealing_pool();
+    test_lock_free_pool();
     std::cout << "======== [Test Completed] ========\n";
     return 0;
 }